@@ -0,0 +1,637 @@
+/**
+ * cluster - starts a local RackKey cluster (a master and N storage nodes, as
+ * child processes) on ephemeral ports, with all state in a temp directory.
+ *
+ * Usage:
+ *
+ *      cluster [--name=value ...]
+ *
+ * See printUsage() for all options. e.g.
+ *
+ *      cluster --nodes=5 --replication-factor=3
+ *      cluster --nodes=3 --run='./loadgen --master=$RACKKEY_MASTER --duration-sec=30'
+ *
+ * NOTE:
+ *
+ * The launcher:
+ *
+ *      1. creates a work dir (`--work-dir`, or a fresh /tmp/rackkey_cluster_XXXXXX)
+ *      2. picks a free port for the master and for each storage node (and an
+ *         RPC port offset leaving each node's RPC port free too)
+ *      3. writes `config.json` to the work dir, i.e. the base config (`--config`) with
+ *         the picked ports, the work dir's store directories, and any overrides given
+ *      4. starts each storage node (with env. NODE_ID, PORT and CONFIG_PATH), then the
+ *         master (with CONFIG_PATH), waiting for each to accept connections
+ *      5. prints the cluster's layout as JSON (also written to `cluster.json`)
+ *
+ * It then runs the `--run` command (with env. RACKKEY_MASTER set to the master's URL)
+ * and exits with its status, or, without `--run`, waits for SIGINT/SIGTERM. Either
+ * way, all servers are then stopped and the temp work dir removed (unless `--keep`,
+ * or the cluster failed).
+ *
+ * Each server's output goes to `{work dir}/{master, node_N}.log`.
+ */
+
+#include <cpprest/json.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <filesystem>
+
+using namespace web;
+
+namespace fs = std::filesystem;
+
+////////////////////////////////////////////
+// Cluster config
+////////////////////////////////////////////
+
+struct ClusterConfig
+{
+    uint32_t nodes = 3;
+
+    std::string baseConfigPath = "../src/config.json";
+    std::string masterBin;
+    std::string storageBin;
+    std::string workDir;
+    bool keep = false;
+
+    std::string run;
+    uint32_t startupTimeoutMs = 10000;
+
+    /* config.json overrides, if set */
+    std::optional<uint32_t> replicationFactor;
+    std::optional<uint32_t> numVirtualNodes;
+    std::optional<uint32_t> healthCheckPeriodMs;
+    std::optional<std::string> frontEnd;
+    std::optional<std::string> storageTransport;
+    std::optional<std::string> storageEngine;
+    std::optional<uint32_t> maxDataSizePower;
+};
+
+static void printUsage()
+{
+    std::cerr <<
+        "usage: cluster [--name=value ...]\n"
+        "\n"
+        "  --nodes=N                   num. storage nodes (3)\n"
+        "  --config=PATH               base config.json (../src/config.json)\n"
+        "  --master-bin=PATH           master binary (master, next to this binary)\n"
+        "  --storage-bin=PATH          storage binary (storage, next to this binary)\n"
+        "  --work-dir=PATH             directory for config, stores and logs (fresh temp dir)\n"
+        "  --keep=0|1                  keep the work dir on exit (0)\n"
+        "  --run=CMD                   run CMD (via /bin/sh) against the cluster, then stop it\n"
+        "  --startup-timeout-ms=MS     max. time for each server to start listening (10000)\n"
+        "\n"
+        "config.json overrides:\n"
+        "  --replication-factor=N\n"
+        "  --virtual-nodes=N\n"
+        "  --health-check-period-ms=MS\n"
+        "  --front-end=cpprest|native\n"
+        "  --storage-transport=rpc|http\n"
+        "  --storage-engine=disk|memory\n"
+        "  --max-data-size-power=N\n";
+}
+
+/**
+ * Parses `--name=value` arguments into `config`.
+ *
+ * Throws:
+ *      runtime_error() - on unknown options or invalid values
+ */
+static ClusterConfig parseArgs(int argc, char *argv[])
+{
+    ClusterConfig config;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            exit(0);
+        }
+
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+            throw std::runtime_error("invalid argument: " + arg);
+
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+
+        if (name == "nodes") config.nodes = std::stoul(value);
+        else if (name == "config") config.baseConfigPath = value;
+        else if (name == "master-bin") config.masterBin = value;
+        else if (name == "storage-bin") config.storageBin = value;
+        else if (name == "work-dir") config.workDir = value;
+        else if (name == "keep") config.keep = std::stoul(value) != 0;
+        else if (name == "run") config.run = value;
+        else if (name == "startup-timeout-ms") config.startupTimeoutMs = std::stoul(value);
+        else if (name == "replication-factor") config.replicationFactor = std::stoul(value);
+        else if (name == "virtual-nodes") config.numVirtualNodes = std::stoul(value);
+        else if (name == "health-check-period-ms") config.healthCheckPeriodMs = std::stoul(value);
+        else if (name == "front-end") config.frontEnd = value;
+        else if (name == "storage-transport") config.storageTransport = value;
+        else if (name == "storage-engine") config.storageEngine = value;
+        else if (name == "max-data-size-power") config.maxDataSizePower = std::stoul(value);
+        else
+            throw std::runtime_error("unknown option: --" + name);
+    }
+
+    if (config.nodes == 0)
+        throw std::runtime_error("--nodes must be non-zero");
+    if (config.replicationFactor && (*config.replicationFactor == 0 || *config.replicationFactor > config.nodes))
+        throw std::runtime_error("--replication-factor must be within [1, --nodes]");
+
+    // default to the server binaries built alongside this one
+    fs::path binDir = fs::read_symlink("/proc/self/exe").parent_path();
+    if (config.masterBin.empty())
+        config.masterBin = binDir / "master";
+    if (config.storageBin.empty())
+        config.storageBin = binDir / "storage";
+
+    return config;
+}
+
+////////////////////////////////////////////
+// Processes
+////////////////////////////////////////////
+
+/**
+ * A server started by the launcher.
+ */
+struct Server
+{
+    std::string name;
+    std::string url;
+    uint16_t port;
+    pid_t pid = -1;
+    std::string logPath;
+};
+
+/**
+ * Returns `count` distinct ports that are currently free on the loopback interface.
+ *
+ * NOTE:
+ *
+ * Each port is found by binding to port 0. All sockets are held until every port
+ * is picked (so no port is picked twice), then closed for the servers to bind.
+ */
+static std::vector<uint16_t> pickFreePorts(uint32_t count)
+{
+    std::vector<int> sockets;
+    std::vector<uint16_t> ports;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+
+        socklen_t len = sizeof(addr);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+            || getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+        {
+            throw std::runtime_error("pickFreePorts() - failed to bind an ephemeral port");
+        }
+
+        sockets.push_back(fd);
+        ports.push_back(ntohs(addr.sin_port));
+    }
+
+    for (int fd : sockets)
+        close(fd);
+
+    return ports;
+}
+
+/**
+ * Returns an offset such that each of `storageNodes`' RPC ports (i.e. its port
+ * + offset) is currently free, and not one of `takenPorts`.
+ *
+ * Throws:
+ *      runtime_error() - if no such offset is found
+ */
+static uint32_t pickRpcPortOffset(const std::vector<Server> &storageNodes, const std::vector<uint16_t> &takenPorts)
+{
+    for (uint32_t offset = 1000; offset < 1100; offset++)
+    {
+        std::vector<int> sockets;
+        bool allFree = true;
+
+        for (const Server &node : storageNodes)
+        {
+            uint32_t port = node.port + offset;
+            if (port > 65535 || std::find(takenPorts.begin(), takenPorts.end(), port) != takenPorts.end())
+            {
+                allFree = false;
+                break;
+            }
+
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            addr.sin_port = htons(port);
+
+            if (fd >= 0)
+                sockets.push_back(fd);
+            if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+            {
+                allFree = false;
+                break;
+            }
+        }
+
+        for (int fd : sockets)
+            close(fd);
+
+        if (allFree)
+            return offset;
+    }
+
+    throw std::runtime_error("pickRpcPortOffset() - no free RPC ports found");
+}
+
+/**
+ * Returns true if something is accepting connections on loopback port `port`.
+ */
+static bool isListening(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    bool connected = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    close(fd);
+    return connected;
+}
+
+/**
+ * Starts `bin` as a child process with extra environment variables `env`,
+ * its stdout/stderr redirected to `server.logPath`.
+ *
+ * Throws:
+ *      runtime_error() - if the process can't be started
+ */
+static void spawnServer(Server &server, const std::string &bin,
+                        const std::vector<std::pair<std::string, std::string>> &env,
+                        const std::string &workDir)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("spawnServer() - fork failed for " + server.name);
+
+    if (pid == 0)
+    {
+        // child: own process group, so terminal signals only reach the launcher
+        setpgid(0, 0);
+
+        int logFd = open(server.logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (logFd >= 0)
+        {
+            dup2(logFd, STDOUT_FILENO);
+            dup2(logFd, STDERR_FILENO);
+            close(logFd);
+        }
+
+        for (auto &[name, value] : env)
+            setenv(name.c_str(), value.c_str(), 1);
+
+        if (chdir(workDir.c_str()) != 0)
+            _exit(127);
+
+        execl(bin.c_str(), bin.c_str(), static_cast<char*>(nullptr));
+        std::cerr << "exec failed: " << bin << std::endl;
+        _exit(127);
+    }
+
+    server.pid = pid;
+}
+
+/**
+ * Waits for `server` to accept connections.
+ *
+ * Throws:
+ *      runtime_error() - if it exits or doesn't listen within `timeoutMs`
+ */
+static void awaitServer(Server &server, uint32_t timeoutMs)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    while (!isListening(server.port))
+    {
+        int status;
+        if (waitpid(server.pid, &status, WNOHANG) == server.pid)
+        {
+            server.pid = -1;
+            throw std::runtime_error(server.name + " exited during startup (see " + server.logPath + ")");
+        }
+        if (std::chrono::steady_clock::now() >= deadline)
+            throw std::runtime_error(server.name + " didn't start listening in time (see " + server.logPath + ")");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
+
+/**
+ * Stops all running `servers`: SIGTERM, then SIGKILL after a grace period.
+ */
+static void stopServers(std::vector<Server> &servers)
+{
+    for (Server &server : servers)
+    {
+        if (server.pid > 0)
+            kill(server.pid, SIGTERM);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    for (Server &server : servers)
+    {
+        while (server.pid > 0)
+        {
+            if (waitpid(server.pid, nullptr, WNOHANG) == server.pid)
+            {
+                server.pid = -1;
+                break;
+            }
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                kill(server.pid, SIGKILL);
+                waitpid(server.pid, nullptr, 0);
+                server.pid = -1;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+}
+
+////////////////////////////////////////////
+// Cluster
+////////////////////////////////////////////
+
+/**
+ * Writes the cluster's config.json, i.e. the base config with
+ * the cluster's addresses, store directories and overrides.
+ */
+static void writeClusterConfig(const ClusterConfig &config, const std::string &path,
+                               const Server &master, const std::vector<Server> &storageNodes,
+                               uint32_t rpcPortOffset)
+{
+    std::ifstream baseFile(config.baseConfigPath);
+    if (!baseFile.is_open())
+        throw std::runtime_error("Unable to open configuration file: " + config.baseConfigPath);
+
+    std::string content((std::istreambuf_iterator<char>(baseFile)), std::istreambuf_iterator<char>());
+    json::value cfg = json::value::parse(content);
+
+    json::value &masterServer = cfg[U("masterServer")];
+    masterServer[U("masterServerIPPort")] = json::value::string(U(master.url));
+
+    json::value nodeIPs = json::value::array();
+    for (size_t i = 0; i < storageNodes.size(); i++)
+        nodeIPs[i] = json::value::string(U(storageNodes[i].url));
+    masterServer[U("storageNodeIPs")] = nodeIPs;
+
+    if (config.replicationFactor)
+        masterServer[U("replicationFactor")] = json::value::number(*config.replicationFactor);
+    if (config.numVirtualNodes)
+        masterServer[U("numVirtualNodes")] = json::value::number(*config.numVirtualNodes);
+    if (config.healthCheckPeriodMs)
+        masterServer[U("healthCheckPeriodMs")] = json::value::number(*config.healthCheckPeriodMs);
+    if (config.frontEnd)
+        masterServer[U("frontEnd")] = json::value::string(U(*config.frontEnd));
+    if (config.storageTransport)
+        masterServer[U("storageTransport")] = json::value::string(U(*config.storageTransport));
+
+    // every node stores into the work dir (store files are already suffixed by NODE_ID)
+    json::value &storageServer = cfg[U("storageServer")];
+    storageServer[U("storeDirPath")] = json::value::string(U(config.workDir + "/store"));
+    storageServer[U("removeExistingStoreFile")] = json::value::boolean(true);
+    if (storageServer.has_field(U("tiering")))
+        storageServer[U("tiering")][U("hotStoreDirPath")] = json::value::string(U(config.workDir + "/hot"));
+
+    if (config.storageEngine)
+        storageServer[U("storageEngine")] = json::value::string(U(*config.storageEngine));
+    if (config.maxDataSizePower)
+        storageServer[U("maxDataSizePower")] = json::value::number(*config.maxDataSizePower);
+
+    cfg[U("shared")][U("rpcPortOffset")] = json::value::number(rpcPortOffset);
+
+    std::ofstream out(path);
+    out << cfg.serialize() << std::endl;
+    if (!out)
+        throw std::runtime_error("writeClusterConfig() - failed to write " + path);
+}
+
+static std::string clusterJson(const ClusterConfig &config, const Server &master, const std::vector<Server> &storageNodes)
+{
+    std::ostringstream os;
+    os << "{\n"
+       << "  \"master\": {\"url\": \"" << master.url << "\", \"pid\": " << master.pid
+       << ", \"log\": \"" << master.logPath << "\"},\n"
+       << "  \"storageNodes\": [";
+    for (size_t i = 0; i < storageNodes.size(); i++)
+    {
+        const Server &node = storageNodes[i];
+        os << (i ? ",\n" : "\n")
+           << "    {\"id\": " << i << ", \"url\": \"" << node.url << "\", \"pid\": " << node.pid
+           << ", \"log\": \"" << node.logPath << "\"}";
+    }
+    os << "\n  ],\n"
+       << "  \"workDir\": \"" << config.workDir << "\"\n"
+       << "}\n";
+    return os.str();
+}
+
+static std::atomic<bool> stopRequested(false);
+
+static void onStopSignal(int)
+{
+    stopRequested = true;
+}
+
+/**
+ * Runs `command` via /bin/sh, returning its exit status.
+ */
+static int runCommand(const std::string &command)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    {
+        // forward interrupts, then keep waiting for the command to exit
+        if (stopRequested)
+            kill(pid, SIGTERM);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * Waits for SIGINT/SIGTERM, reporting any server that exits in the meantime.
+ */
+static void waitForStop(std::vector<Server> &servers)
+{
+    while (!stopRequested)
+    {
+        for (Server &server : servers)
+        {
+            if (server.pid > 0 && waitpid(server.pid, nullptr, WNOHANG) == server.pid)
+            {
+                std::cerr << "cluster: " << server.name << " exited (see " << server.logPath << ")" << std::endl;
+                server.pid = -1;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
+
+////////////////////////////////////////////
+// Main
+////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    ClusterConfig config;
+    try
+    {
+        config = parseArgs(argc, argv);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "cluster: " << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    // handlers (not SIG_IGN), so children still get default signal dispositions
+    struct sigaction action = {};
+    action.sa_handler = onStopSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    bool createdWorkDir = config.workDir.empty();
+    if (createdWorkDir)
+    {
+        char workDirTemplate[] = "/tmp/rackkey_cluster_XXXXXX";
+        if (mkdtemp(workDirTemplate) == nullptr)
+        {
+            std::cerr << "cluster: failed to create a work dir" << std::endl;
+            return 1;
+        }
+        config.workDir = workDirTemplate;
+    }
+    config.workDir = fs::absolute(config.workDir);
+    fs::create_directories(config.workDir + "/store");
+    fs::create_directories(config.workDir + "/hot");
+
+    std::vector<uint16_t> ports = pickFreePorts(config.nodes + 1);
+
+    Server master;
+    master.name = "master";
+    master.port = ports[0];
+    master.url = "http://127.0.0.1:" + std::to_string(master.port);
+    master.logPath = config.workDir + "/master.log";
+
+    std::vector<Server> storageNodes(config.nodes);
+    for (uint32_t i = 0; i < config.nodes; i++)
+    {
+        Server &node = storageNodes[i];
+        node.name = "node_" + std::to_string(i);
+        node.port = ports[i + 1];
+        node.url = "http://127.0.0.1:" + std::to_string(node.port);
+        node.logPath = config.workDir + "/" + node.name + ".log";
+    }
+
+    int exitCode = 0;
+    try
+    {
+        std::string configPath = config.workDir + "/config.json";
+        uint32_t rpcPortOffset = pickRpcPortOffset(storageNodes, ports);
+        writeClusterConfig(config, configPath, master, storageNodes, rpcPortOffset);
+
+        // storage nodes first, so the master's first health check finds them up
+        for (uint32_t i = 0; i < config.nodes; i++)
+        {
+            Server &node = storageNodes[i];
+            spawnServer(node, config.storageBin, {
+                {"NODE_ID", std::to_string(i)},
+                {"PORT", std::to_string(node.port)},
+                {"CONFIG_PATH", configPath}
+            }, config.workDir);
+        }
+        for (Server &node : storageNodes)
+            awaitServer(node, config.startupTimeoutMs);
+
+        spawnServer(master, config.masterBin, {{"CONFIG_PATH", configPath}}, config.workDir);
+        awaitServer(master, config.startupTimeoutMs);
+
+        std::string layout = clusterJson(config, master, storageNodes);
+        std::ofstream(config.workDir + "/cluster.json") << layout;
+        std::cout << layout << std::flush;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "cluster: " << e.what() << std::endl;
+        exitCode = 1;
+    }
+
+    std::vector<Server> servers = storageNodes;
+    servers.push_back(master);
+
+    if (exitCode == 0)
+    {
+        if (!config.run.empty())
+        {
+            setenv("RACKKEY_MASTER", master.url.c_str(), 1);
+            exitCode = runCommand(config.run);
+        }
+        else
+        {
+            std::cerr << "cluster: running, press Ctrl-C to stop" << std::endl;
+            waitForStop(servers);
+        }
+    }
+
+    stopServers(servers);
+
+    // only remove a work dir we created, and keep it to debug failures
+    if (createdWorkDir && !config.keep && exitCode == 0)
+        fs::remove_all(config.workDir);
+    else
+        std::cerr << "cluster: kept work dir " << config.workDir << std::endl;
+
+    return exitCode;
+}
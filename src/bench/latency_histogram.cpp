@@ -0,0 +1,207 @@
+#include <cmath>
+#include <limits>
+#include <iostream>
+#include <algorithm>
+
+#include "latency_histogram.hpp"
+
+#include "test_utils.hpp"
+
+namespace
+{
+    const uint32_t SUB_BUCKET_COUNT = 1u << LatencyHistogram::SUB_BUCKET_BITS;
+    const uint32_t SUB_BUCKET_HALF = SUB_BUCKET_COUNT / 2;
+
+    /* num. power of two ranges above the first (exact) sub-bucket range */
+    const uint32_t NUM_BUCKETS = 64 - LatencyHistogram::SUB_BUCKET_BITS + 1;
+}
+
+////////////////////////////////////////////
+// LatencyHistogram methods
+////////////////////////////////////////////
+
+/* Default constructor */
+LatencyHistogram::LatencyHistogram()
+    : counts((NUM_BUCKETS + 1) * SUB_BUCKET_HALF, 0),
+        totalCount(0),
+        minValue(std::numeric_limits<uint64_t>::max()),
+        maxValue(0),
+        sum(0)
+{
+}
+
+/**
+ * Returns the index of the bucket value `value` is recorded into.
+ *
+ * NOTE:
+ *
+ * Bucket `b` covers values [2^(b + SUB_BUCKET_BITS - 1), 2^(b + SUB_BUCKET_BITS))
+ * at a resolution of 2^b, so only the top half of its sub-buckets is used
+ * (the bottom half overlaps bucket `b - 1`). Bucket 0 uses all of them.
+ */
+uint32_t LatencyHistogram::indexOf(uint64_t value)
+{
+    uint32_t msb = 63 - __builtin_clzll(value | 1);
+    uint32_t bucket = msb < SUB_BUCKET_BITS ? 0 : msb - SUB_BUCKET_BITS + 1;
+    uint32_t subBucket = value >> bucket;
+    return bucket * SUB_BUCKET_HALF + subBucket;
+}
+
+/**
+ * Returns the highest value recorded into bucket `index`.
+ */
+uint64_t LatencyHistogram::highestValueAt(uint32_t index)
+{
+    uint32_t bucket = index < SUB_BUCKET_COUNT ? 0 : (index - SUB_BUCKET_HALF) / SUB_BUCKET_HALF;
+    uint64_t subBucket = index - bucket * SUB_BUCKET_HALF;
+    return ((subBucket + 1) << bucket) - 1;
+}
+
+/**
+ * Records a single value `value`.
+ */
+void LatencyHistogram::record(uint64_t value)
+{
+    this->counts[indexOf(value)]++;
+    this->totalCount++;
+    this->minValue = std::min(this->minValue, value);
+    this->maxValue = std::max(this->maxValue, value);
+    this->sum += value;
+}
+
+/**
+ * Adds all values recorded by `other` into this histogram.
+ */
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (size_t i = 0; i < this->counts.size(); i++)
+        this->counts[i] += other.counts[i];
+
+    this->totalCount += other.totalCount;
+    this->minValue = std::min(this->minValue, other.minValue);
+    this->maxValue = std::max(this->maxValue, other.maxValue);
+    this->sum += other.sum;
+}
+
+/**
+ * Returns the value at percentile `percentile` (within [0, 100]).
+ */
+uint64_t LatencyHistogram::valueAtPercentile(double percentile) const
+{
+    if (this->totalCount == 0)
+        return 0;
+
+    // rank of the requested value, in [1, totalCount]
+    double fraction = std::clamp(percentile, 0.0, 100.0) / 100.0;
+    uint64_t rank = std::max<uint64_t>(1, std::ceil(fraction * this->totalCount));
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < this->counts.size(); i++)
+    {
+        seen += this->counts[i];
+        if (seen >= rank)
+            return std::min(highestValueAt(i), this->maxValue);
+    }
+    return this->maxValue;
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return this->totalCount;
+}
+
+uint64_t LatencyHistogram::min() const
+{
+    return this->totalCount == 0 ? 0 : this->minValue;
+}
+
+uint64_t LatencyHistogram::max() const
+{
+    return this->maxValue;
+}
+
+double LatencyHistogram::mean() const
+{
+    return this->totalCount == 0 ? 0 : this->sum / this->totalCount;
+}
+
+////////////////////////////////////////////
+// LatencyHistogram tests
+////////////////////////////////////////////
+namespace LatencyHistogramTests
+{
+    void testPercentilesWithinPrecision()
+    {
+        LatencyHistogram histogram;
+        ASSERT_THAT(histogram.count() == 0);
+        ASSERT_THAT(histogram.valueAtPercentile(50) == 0);
+
+        // 1, 2, ..., 100000
+        for (uint64_t v = 1; v <= 100000; v++)
+            histogram.record(v);
+
+        ASSERT_THAT(histogram.count() == 100000);
+        ASSERT_THAT(histogram.min() == 1);
+        ASSERT_THAT(histogram.max() == 100000);
+        ASSERT_THAT(std::abs(histogram.mean() - 50000.5) < 1e-6);
+
+        // each percentile is within 1% of its exact value
+        for (double p : {50.0, 90.0, 99.0, 99.9})
+        {
+            double exact = p / 100.0 * 100000;
+            double value = histogram.valueAtPercentile(p);
+            ASSERT_THAT(value >= exact && value <= exact * 1.01);
+        }
+        ASSERT_THAT(histogram.valueAtPercentile(100) == 100000);
+
+        // small values are exact
+        LatencyHistogram small;
+        small.record(7);
+        small.record(200);
+        ASSERT_THAT(small.valueAtPercentile(50) == 7);
+        ASSERT_THAT(small.valueAtPercentile(100) == 200);
+
+        // and huge values still have a bucket
+        small.record(UINT64_MAX);
+        ASSERT_THAT(small.valueAtPercentile(100) == UINT64_MAX);
+    }
+
+    void testMergeCombinesCounts()
+    {
+        LatencyHistogram fast, slow;
+        for (int i = 0; i < 990; i++)
+            fast.record(100);
+        for (int i = 0; i < 10; i++)
+            slow.record(50000);
+
+        fast.merge(slow);
+
+        ASSERT_THAT(fast.count() == 1000);
+        ASSERT_THAT(fast.min() == 100 && fast.max() == 50000);
+        ASSERT_THAT(fast.valueAtPercentile(50) == 100);
+        ASSERT_THAT(fast.valueAtPercentile(99) == 100);
+
+        // the slow tail shows up above p99
+        uint64_t p999 = fast.valueAtPercentile(99.9);
+        ASSERT_THAT(p999 >= 50000 && p999 <= 50000 * 1.01);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "LatencyHistogramTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testPercentilesWithinPrecision),
+            TEST(testMergeCombinesCounts)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * HDR-style latency histogram, recording values (e.g. microseconds) with a
+ * bounded relative error over their whole range.
+ *
+ * NOTE:
+ *
+ * Values are bucketed log-linearly, as in HdrHistogram: each power of two
+ * range [2^k, 2^(k+1)) is split into `2^(SUB_BUCKET_BITS - 1)` equal
+ * sub-buckets, so a value is recorded to within 1 / 2^(SUB_BUCKET_BITS - 1)
+ * (< 1%) of itself. Values below 2^SUB_BUCKET_BITS are recorded exactly.
+ *
+ * Recording is O(1) and allocation-free, and histograms can be merged,
+ * so each thread can record into its own and merge at the end.
+ */
+class LatencyHistogram
+{
+public:
+    static const uint32_t SUB_BUCKET_BITS = 8;
+
+    /* Default constructor */
+    LatencyHistogram();
+
+    /**
+     * Records a single value `value`.
+     */
+    void record(uint64_t value);
+
+    /**
+     * Adds all values recorded by `other` into this histogram.
+     */
+    void merge(const LatencyHistogram &other);
+
+    /**
+     * Returns the value at percentile `percentile` (within [0, 100]).
+     *
+     * NOTE:
+     *
+     * As in HdrHistogram, this is the highest value equivalent to (i.e.
+     * recorded into the same bucket as) the percentile's actual value.
+     */
+    uint64_t valueAtPercentile(double percentile) const;
+
+    uint64_t count() const;
+    uint64_t min() const;
+    uint64_t max() const;
+    double mean() const;
+
+private:
+    std::vector<uint64_t> counts;
+    uint64_t totalCount;
+    uint64_t minValue;
+    uint64_t maxValue;
+    double sum;
+
+    /**
+     * Returns the index of the bucket value `value` is recorded into.
+     */
+    static uint32_t indexOf(uint64_t value);
+
+    /**
+     * Returns the highest value recorded into bucket `index`.
+     */
+    static uint64_t highestValueAt(uint32_t index);
+};
+
+namespace LatencyHistogramTests
+{
+    void testPercentilesWithinPrecision();
+    void testMergeCombinesCounts();
+    void runAll();
+}
@@ -0,0 +1,638 @@
+/**
+ * loadgen - drives a master server's /store API with a configurable workload,
+ * reporting throughput and latency histograms per operation as JSON.
+ *
+ * Usage:
+ *
+ *      loadgen [--name=value ...]
+ *
+ * See printUsage() for all options. e.g.
+ *
+ *      loadgen --master=http://localhost:9000 --workload=b --threads=32 \
+ *              --keys=10000 --key-dist=zipfian --size=65536 --duration-sec=60
+ *
+ * NOTE:
+ *
+ * By default the load is closed-loop: each of `--threads` clients sends its next
+ * request as soon as its previous one completes, so throughput is whatever the
+ * cluster sustains. With `--rate`, the load is open-loop: requests are scheduled
+ * at `--rate` ops/s in total (constant or Poisson arrivals), and latency is measured
+ * from each request's scheduled start, so queueing behind a slow request is counted
+ * (i.e. no coordinated omission). `--threads` then bounds the requests in flight.
+ *
+ * Workloads `a`, `b` and `c` set the YCSB core workloads' read/update mixes
+ * (50/50, 95/5 and 100/0); the individual `--*-pct` options override them.
+ */
+
+#include <cpprest/http_client.h>
+
+#include <cmath>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "zipfian.hpp"
+#include "latency_histogram.hpp"
+
+using namespace web;
+using namespace web::http;
+using namespace web::http::client;
+
+////////////////////////////////////////////
+// Load generator config
+////////////////////////////////////////////
+
+/**
+ * Distribution of object sizes written by the load generator.
+ */
+enum SizeDist : uint32_t
+{
+    /* every object is `size` bytes */
+    SIZE_FIXED = 0,
+
+    /* uniform over [sizeMin, sizeMax] */
+    SIZE_UNIFORM,
+
+    /* log-normal with mean `size`, clamped to [sizeMin, sizeMax] */
+    SIZE_LOGNORMAL
+};
+
+struct LoadgenConfig
+{
+    std::string master = "http://localhost:9000";
+    std::string out;
+
+    uint32_t threads = 16;
+    uint64_t ops = 10000;
+    double durationSec = 0;
+    uint32_t timeoutMs = 30000;
+
+    /* total ops/s to schedule (open-loop), or 0 for closed-loop */
+    double rate = 0;
+    bool poisson = true;
+
+    std::string workload = "a";
+    int readPct = -1;
+    int writePct = -1;
+    int deletePct = -1;
+
+    uint32_t keys = 1000;
+    std::string keyPrefix = "loadgen_";
+    bool zipfian = true;
+    double zipfTheta = 0.99;
+    bool preload = true;
+
+    SizeDist sizeDist = SIZE_FIXED;
+    uint32_t size = 4096;
+    uint32_t sizeMin = 1024;
+    uint32_t sizeMax = 1u << 20;
+    double sizeSigma = 1.0;
+
+    uint64_t seed = 42;
+};
+
+static const char *sizeDistName(SizeDist dist)
+{
+    switch (dist)
+    {
+        case SIZE_FIXED: return "fixed";
+        case SIZE_UNIFORM: return "uniform";
+        case SIZE_LOGNORMAL: return "lognormal";
+    }
+    return "unknown";
+}
+
+static void printUsage()
+{
+    std::cerr <<
+        "usage: loadgen [--name=value ...]\n"
+        "\n"
+        "  --master=URL                master server to load (http://localhost:9000)\n"
+        "  --out=PATH                  write the JSON report to PATH instead of stdout\n"
+        "  --threads=N                 concurrent clients (16)\n"
+        "  --ops=N                     total operations over all clients (10000)\n"
+        "  --duration-sec=S            run for S seconds instead of --ops\n"
+        "  --timeout-ms=MS             per-request timeout (30000)\n"
+        "  --rate=R                    open-loop: schedule R ops/s in total (0 = closed-loop)\n"
+        "  --arrival=poisson|constant  open-loop inter-arrival times (poisson)\n"
+        "  --workload=a|b|c            YCSB read/update mix: 50/50, 95/5, 100/0 (a)\n"
+        "  --read-pct=P --write-pct=P --delete-pct=P   explicit op mix, overrides --workload\n"
+        "  --keys=N                    key space size (1000)\n"
+        "  --key-prefix=S              prefix of generated keys (loadgen_)\n"
+        "  --key-dist=zipfian|uniform  key popularity (zipfian)\n"
+        "  --zipf-theta=T              zipfian skew, within [0, 1) (0.99)\n"
+        "  --preload=0|1               write every key before the run (1)\n"
+        "  --size-dist=fixed|uniform|lognormal   object size distribution (fixed)\n"
+        "  --size=B                    fixed size / lognormal mean, bytes (4096)\n"
+        "  --size-min=B --size-max=B   size bounds, bytes (1024, 1048576)\n"
+        "  --size-sigma=S              lognormal shape (1.0)\n"
+        "  --seed=N                    RNG seed (42)\n";
+}
+
+/**
+ * Parses `--name=value` arguments into `config`.
+ *
+ * Throws:
+ *      runtime_error() - on unknown options or invalid values
+ */
+static LoadgenConfig parseArgs(int argc, char *argv[])
+{
+    LoadgenConfig config;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            exit(0);
+        }
+
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+            throw std::runtime_error("invalid argument: " + arg);
+
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+
+        if (name == "master") config.master = value;
+        else if (name == "out") config.out = value;
+        else if (name == "threads") config.threads = std::stoul(value);
+        else if (name == "ops") config.ops = std::stoull(value);
+        else if (name == "duration-sec") config.durationSec = std::stod(value);
+        else if (name == "timeout-ms") config.timeoutMs = std::stoul(value);
+        else if (name == "rate") config.rate = std::stod(value);
+        else if (name == "workload") config.workload = value;
+        else if (name == "read-pct") config.readPct = std::stoi(value);
+        else if (name == "write-pct") config.writePct = std::stoi(value);
+        else if (name == "delete-pct") config.deletePct = std::stoi(value);
+        else if (name == "keys") config.keys = std::stoul(value);
+        else if (name == "key-prefix") config.keyPrefix = value;
+        else if (name == "zipf-theta") config.zipfTheta = std::stod(value);
+        else if (name == "preload") config.preload = std::stoul(value) != 0;
+        else if (name == "size") config.size = std::stoul(value);
+        else if (name == "size-min") config.sizeMin = std::stoul(value);
+        else if (name == "size-max") config.sizeMax = std::stoul(value);
+        else if (name == "size-sigma") config.sizeSigma = std::stod(value);
+        else if (name == "seed") config.seed = std::stoull(value);
+        else if (name == "arrival")
+        {
+            if (value == "poisson") config.poisson = true;
+            else if (value == "constant") config.poisson = false;
+            else throw std::runtime_error("invalid --arrival: " + value);
+        }
+        else if (name == "key-dist")
+        {
+            if (value == "zipfian") config.zipfian = true;
+            else if (value == "uniform") config.zipfian = false;
+            else throw std::runtime_error("invalid --key-dist: " + value);
+        }
+        else if (name == "size-dist")
+        {
+            if (value == "fixed") config.sizeDist = SIZE_FIXED;
+            else if (value == "uniform") config.sizeDist = SIZE_UNIFORM;
+            else if (value == "lognormal") config.sizeDist = SIZE_LOGNORMAL;
+            else throw std::runtime_error("invalid --size-dist: " + value);
+        }
+        else
+            throw std::runtime_error("unknown option: --" + name);
+    }
+
+    // fill in the op mix from the workload, unless given explicitly
+    std::array<int, 3> mix;
+    if (config.workload == "a") mix = {50, 50, 0};
+    else if (config.workload == "b") mix = {95, 5, 0};
+    else if (config.workload == "c") mix = {100, 0, 0};
+    else throw std::runtime_error("invalid --workload: " + config.workload);
+
+    bool explicitMix = config.readPct >= 0 || config.writePct >= 0 || config.deletePct >= 0;
+    if (explicitMix)
+    {
+        config.readPct = std::max(config.readPct, 0);
+        config.writePct = std::max(config.writePct, 0);
+        config.deletePct = std::max(config.deletePct, 0);
+    }
+    else
+    {
+        config.readPct = mix[0];
+        config.writePct = mix[1];
+        config.deletePct = mix[2];
+    }
+
+    if (config.readPct + config.writePct + config.deletePct != 100)
+        throw std::runtime_error("--read-pct, --write-pct and --delete-pct must sum to 100");
+    if (config.threads == 0 || config.keys == 0)
+        throw std::runtime_error("--threads and --keys must be non-zero");
+    if (config.sizeMin == 0 || config.sizeMin > config.sizeMax)
+        throw std::runtime_error("need 0 < --size-min <= --size-max");
+    if (config.rate < 0)
+        throw std::runtime_error("--rate must be non-negative");
+
+    return config;
+}
+
+////////////////////////////////////////////
+// Workload
+////////////////////////////////////////////
+
+enum OpType : uint32_t
+{
+    OP_READ = 0,
+    OP_WRITE,
+    OP_DELETE,
+    NUM_OP_TYPES
+};
+
+static const char *opName(uint32_t op)
+{
+    static const char *names[NUM_OP_TYPES] = {"read", "write", "delete"};
+    return names[op];
+}
+
+/**
+ * Measurements of a single op type, collected by one client (then merged).
+ */
+struct OpStats
+{
+    /* latencies, in microseconds */
+    LatencyHistogram latencyUs;
+
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+
+    /* reads/deletes skipped, as their key wasn't stored */
+    uint64_t misses = 0;
+
+    void merge(const OpStats &other)
+    {
+        latencyUs.merge(other.latencyUs);
+        bytes += other.bytes;
+        errors += other.errors;
+        misses += other.misses;
+    }
+};
+
+/**
+ * State shared by all clients.
+ *
+ * NOTE:
+ *
+ * `keyStored[i]` is true if key i was last written (rather than deleted) by us.
+ * The master replies to reads of unknown keys with an error, so reads and deletes
+ * of keys we haven't stored are skipped and counted as misses instead.
+ */
+struct Workload
+{
+    LoadgenConfig config;
+    std::unique_ptr<ZipfianGenerator> keyChooser;
+    std::unique_ptr<std::atomic<bool>[]> keyStored;
+
+    /* random bytes all written objects are sliced from */
+    std::vector<unsigned char> payload;
+};
+
+/**
+ * Draws an object size from the configured distribution.
+ */
+static uint32_t drawSize(const LoadgenConfig &config, std::mt19937_64 &rng)
+{
+    switch (config.sizeDist)
+    {
+        case SIZE_FIXED:
+            return config.size;
+
+        case SIZE_UNIFORM:
+            return std::uniform_int_distribution<uint32_t>(config.sizeMin, config.sizeMax)(rng);
+
+        case SIZE_LOGNORMAL:
+        {
+            // mean of a lognormal(m, s) is exp(m + s^2 / 2)
+            double s = config.sizeSigma;
+            double m = std::log(static_cast<double>(config.size)) - s * s / 2;
+            double size = std::lognormal_distribution<double>(m, s)(rng);
+            return static_cast<uint32_t>(std::clamp(size, double(config.sizeMin), double(config.sizeMax)));
+        }
+    }
+    return config.size;
+}
+
+static std::shared_ptr<http_client> makeClient(const LoadgenConfig &config)
+{
+    http_client_config clientConfig;
+    clientConfig.set_timeout(std::chrono::milliseconds(config.timeoutMs));
+    return std::make_shared<http_client>(U(config.master), clientConfig);
+}
+
+/**
+ * Sends a single `op` request for key index `keyIndex`, returning num. bytes
+ * transferred.
+ *
+ * Throws:
+ *      runtime_error() - if the master replies with an error status
+ *      http_exception() - on any connection error or timeout
+ */
+static uint64_t sendOp(Workload &workload, http_client &client, uint32_t op,
+                       uint32_t keyIndex, std::mt19937_64 &rng)
+{
+    std::string key = workload.config.keyPrefix + std::to_string(keyIndex);
+
+    http_request req;
+    req.set_request_uri(U("/store/" + key));
+    uint64_t numBytes = 0;
+
+    if (op == OP_READ)
+    {
+        req.set_method(methods::GET);
+    }
+    else if (op == OP_WRITE)
+    {
+        uint32_t size = drawSize(workload.config, rng);
+        req.set_method(methods::PUT);
+        req.set_body(std::vector<unsigned char>(workload.payload.begin(), workload.payload.begin() + size));
+        numBytes = size;
+    }
+    else
+    {
+        req.set_method(methods::DEL);
+    }
+
+    http_response response = client.request(req).get();
+
+    // always drain the body, so transfer time is counted
+    std::vector<unsigned char> body = response.extract_vector().get();
+    if (response.status_code() != status_codes::OK)
+        throw std::runtime_error("status " + std::to_string(response.status_code()));
+
+    if (op == OP_READ)
+        numBytes = body.size();
+    else
+        workload.keyStored[keyIndex].store(op == OP_WRITE, std::memory_order_relaxed);
+
+    return numBytes;
+}
+
+/**
+ * Writes every key once, over all clients.
+ */
+static void preload(Workload &workload)
+{
+    std::atomic<uint32_t> nextKey(0);
+    std::atomic<uint64_t> errors(0);
+    std::vector<std::thread> threads;
+
+    for (uint32_t t = 0; t < workload.config.threads; t++)
+    {
+        threads.emplace_back([&, t]() {
+            auto client = makeClient(workload.config);
+            std::mt19937_64 rng(workload.config.seed + 1000 + t);
+
+            for (uint32_t i = nextKey++; i < workload.config.keys; i = nextKey++)
+            {
+                try
+                {
+                    sendOp(workload, *client, OP_WRITE, i, rng);
+                }
+                catch (std::exception &e)
+                {
+                    errors++;
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    if (errors > 0)
+        std::cerr << "loadgen: " << errors << " preload writes failed" << std::endl;
+}
+
+/**
+ * Client thread function. Runs ops until the op budget or duration is used up.
+ */
+static void runClient(Workload &workload, uint32_t clientNum, std::atomic<uint64_t> &opsIssued,
+                      std::chrono::steady_clock::time_point start, std::array<OpStats, NUM_OP_TYPES> &stats)
+{
+    const LoadgenConfig &config = workload.config;
+    auto client = makeClient(config);
+
+    std::mt19937_64 rng(config.seed + 1 + clientNum);
+    std::uniform_int_distribution<int> pctDist(0, 99);
+    std::uniform_int_distribution<uint32_t> uniformKeys(0, config.keys - 1);
+
+    // open-loop: each client schedules an equal share of the total rate
+    double meanGapSec = config.rate > 0 ? config.threads / config.rate : 0;
+    std::exponential_distribution<double> poissonGap(meanGapSec > 0 ? 1.0 / meanGapSec : 1.0);
+    auto nextArrival = start;
+
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(config.durationSec));
+
+    while (true)
+    {
+        if (config.durationSec > 0)
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+                break;
+        }
+        else if (opsIssued.fetch_add(1, std::memory_order_relaxed) >= config.ops)
+            break;
+
+        // open-loop: wait for the next scheduled arrival (if not already late)
+        auto opStart = std::chrono::steady_clock::now();
+        if (meanGapSec > 0)
+        {
+            double gapSec = config.poisson ? poissonGap(rng) : meanGapSec;
+            nextArrival += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(gapSec));
+            if (config.durationSec > 0 && nextArrival >= deadline)
+                break;
+
+            std::this_thread::sleep_until(nextArrival);
+            opStart = nextArrival;
+        }
+
+        int pct = pctDist(rng);
+        uint32_t op = pct < config.readPct ? OP_READ
+                    : pct < config.readPct + config.writePct ? OP_WRITE
+                    : OP_DELETE;
+        uint32_t keyIndex = workload.keyChooser ? workload.keyChooser->next(rng) : uniformKeys(rng);
+
+        if (op != OP_WRITE && !workload.keyStored[keyIndex].load(std::memory_order_relaxed))
+        {
+            stats[op].misses++;
+            continue;
+        }
+
+        try
+        {
+            stats[op].bytes += sendOp(workload, *client, op, keyIndex, rng);
+        }
+        catch (std::exception &e)
+        {
+            stats[op].errors++;
+        }
+
+        auto latency = std::chrono::steady_clock::now() - opStart;
+        stats[op].latencyUs.record(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+    }
+}
+
+////////////////////////////////////////////
+// Report
+////////////////////////////////////////////
+
+static std::string histogramJson(const LatencyHistogram &histogram)
+{
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(1)
+       << "{\"count\": " << histogram.count()
+       << ", \"minUs\": " << histogram.min()
+       << ", \"meanUs\": " << histogram.mean()
+       << ", \"p50Us\": " << histogram.valueAtPercentile(50)
+       << ", \"p90Us\": " << histogram.valueAtPercentile(90)
+       << ", \"p99Us\": " << histogram.valueAtPercentile(99)
+       << ", \"p999Us\": " << histogram.valueAtPercentile(99.9)
+       << ", \"p9999Us\": " << histogram.valueAtPercentile(99.99)
+       << ", \"maxUs\": " << histogram.max()
+       << "}";
+    return os.str();
+}
+
+static std::string configJson(const LoadgenConfig &config)
+{
+    std::ostringstream os;
+    os << "{\"master\": \"" << config.master << "\""
+       << ", \"threads\": " << config.threads
+       << ", \"ops\": " << config.ops
+       << ", \"durationSec\": " << config.durationSec
+       << ", \"rate\": " << config.rate
+       << ", \"arrival\": \"" << (config.rate > 0 ? (config.poisson ? "poisson" : "constant") : "closed") << "\""
+       << ", \"workload\": \"" << config.workload << "\""
+       << ", \"readPct\": " << config.readPct
+       << ", \"writePct\": " << config.writePct
+       << ", \"deletePct\": " << config.deletePct
+       << ", \"keys\": " << config.keys
+       << ", \"keyDist\": \"" << (config.zipfian ? "zipfian" : "uniform") << "\""
+       << ", \"zipfTheta\": " << config.zipfTheta
+       << ", \"sizeDist\": \"" << sizeDistName(config.sizeDist) << "\""
+       << ", \"size\": " << config.size
+       << ", \"sizeMin\": " << config.sizeMin
+       << ", \"sizeMax\": " << config.sizeMax
+       << ", \"seed\": " << config.seed
+       << "}";
+    return os.str();
+}
+
+////////////////////////////////////////////
+// Main
+////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    LoadgenConfig config;
+    try
+    {
+        config = parseArgs(argc, argv);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "loadgen: " << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    Workload workload;
+    workload.config = config;
+    workload.keyStored.reset(new std::atomic<bool>[config.keys]());
+    if (config.zipfian)
+        workload.keyChooser = std::make_unique<ZipfianGenerator>(config.keys, config.zipfTheta, true);
+
+    std::mt19937_64 rng(config.seed);
+    workload.payload.resize(config.sizeDist == SIZE_FIXED ? config.size : config.sizeMax);
+    for (unsigned char &c : workload.payload)
+        c = static_cast<unsigned char>(rng());
+
+    if (config.preload)
+    {
+        std::cerr << "loadgen: preloading " << config.keys << " keys" << std::endl;
+        preload(workload);
+    }
+
+    // run workload
+    std::cerr << "loadgen: running" << std::endl;
+    std::vector<std::array<OpStats, NUM_OP_TYPES>> clientStats(config.threads);
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> opsIssued(0);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < config.threads; t++)
+        threads.emplace_back(runClient, std::ref(workload), t, std::ref(opsIssued), start, std::ref(clientStats[t]));
+    for (std::thread &thread : threads)
+        thread.join();
+
+    double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // merge per-client stats
+    std::array<OpStats, NUM_OP_TYPES> totals;
+    OpStats overall;
+    for (auto &stats : clientStats)
+    {
+        for (uint32_t op = 0; op < NUM_OP_TYPES; op++)
+        {
+            totals[op].merge(stats[op]);
+            overall.merge(stats[op]);
+        }
+    }
+
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2);
+    report << "{\n"
+           << "  \"config\": " << configJson(config) << ",\n"
+           << "  \"elapsedSec\": " << elapsedSec << ",\n"
+           << "  \"total\": {\"ops\": " << overall.latencyUs.count()
+           << ", \"opsPerSec\": " << overall.latencyUs.count() / elapsedSec
+           << ", \"mbPerSec\": " << overall.bytes / elapsedSec / (1 << 20)
+           << ", \"errors\": " << overall.errors
+           << ", \"misses\": " << overall.misses
+           << ", \"latency\": " << histogramJson(overall.latencyUs) << "}";
+
+    for (uint32_t op = 0; op < NUM_OP_TYPES; op++)
+    {
+        OpStats &stats = totals[op];
+        report << ",\n  \"" << opName(op) << "\": {\"ops\": " << stats.latencyUs.count()
+               << ", \"opsPerSec\": " << stats.latencyUs.count() / elapsedSec
+               << ", \"mbPerSec\": " << stats.bytes / elapsedSec / (1 << 20)
+               << ", \"errors\": " << stats.errors
+               << ", \"misses\": " << stats.misses
+               << ", \"latency\": " << histogramJson(stats.latencyUs) << "}";
+    }
+    report << "\n}\n";
+
+    if (config.out.empty())
+    {
+        std::cout << report.str();
+    }
+    else
+    {
+        std::ofstream outFile(config.out);
+        outFile << report.str();
+        if (!outFile)
+        {
+            std::cerr << "loadgen: failed to write " << config.out << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
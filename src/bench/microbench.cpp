@@ -0,0 +1,302 @@
+/**
+ * microbench - Google Benchmark microbenchmarks of the hot paths shared by
+ * the master and storage servers.
+ *
+ * Usage:
+ *
+ *      microbench [--benchmark_filter=REGEX] [--benchmark_out=PATH] [...]
+ *
+ * NOTE:
+ *
+ * Results are printed to the console AND written as JSON to `microbench.json`
+ * (unless `--benchmark_out` is given), so runs can be diffed by tools like
+ * Google Benchmark's compare.py to catch regressions.
+ *
+ * Fixtures are seeded, so each run measures identical inputs.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <memory>
+#include <cstring>
+#include <unordered_set>
+
+#include <benchmark/benchmark.h>
+
+#include "block.hpp"
+#include "crypto.hpp"
+#include "payloads.hpp"
+#include "hash_ring.hpp"
+#include "free_space.hpp"
+#include "disk_storage.hpp"
+
+////////////////////////////////////////////
+// FreeSpaceMap
+////////////////////////////////////////////
+
+static const uint32_t FSM_CAPACITY = 1u << 16;
+
+/**
+ * Returns a map with `fillPct`% of its blocks allocated, scattered at random
+ * (i.e. the worst case for finding contiguous runs).
+ */
+static FreeSpaceMap makeFilledMap(uint32_t fillPct)
+{
+    FreeSpaceMap fsm(FSM_CAPACITY);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uint32_t> pctDist(0, 99);
+
+    for (uint32_t i = 0; i < FSM_CAPACITY; i++)
+    {
+        if (pctDist(rng) < fillPct)
+            fsm.allocateNBlocks(i, 1);
+    }
+    return fsm;
+}
+
+/* args: {fill %, num. contiguous blocks} */
+static void BM_FreeSpaceMapFind(benchmark::State &state)
+{
+    FreeSpaceMap fsm = makeFilledMap(state.range(0));
+    uint32_t N = state.range(1);
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(fsm.findNFreeBlocks(N));
+}
+BENCHMARK(BM_FreeSpaceMapFind)
+    ->ArgsProduct({{0, 50, 90, 99}, {1, 16, 256}})
+    ->ArgNames({"fillPct", "blocks"});
+
+/* args: {fill %, num. contiguous blocks} */
+static void BM_FreeSpaceMapAllocateFree(benchmark::State &state)
+{
+    FreeSpaceMap fsm = makeFilledMap(state.range(0));
+    uint32_t N = state.range(1);
+
+    for (auto _ : state)
+    {
+        auto start = fsm.findNFreeBlocks(N);
+        if (!start)
+        {
+            state.SkipWithError("no free run of the requested size");
+            break;
+        }
+        fsm.allocateNBlocks(*start, N);
+        fsm.freeNBlocks(*start, N);
+    }
+}
+BENCHMARK(BM_FreeSpaceMapAllocateFree)
+    ->Args({0, 1})->Args({50, 1})->Args({90, 1})
+    ->Args({0, 16})->Args({50, 16})
+    ->ArgNames({"fillPct", "blocks"});
+
+////////////////////////////////////////////
+// HashRing
+////////////////////////////////////////////
+
+/* args: {num. virtual nodes} */
+static void BM_HashRingFindNextNode(benchmark::State &state)
+{
+    const int numPhysicalNodes = 5;
+    int numVirtualNodes = state.range(0);
+
+    HashRing ring;
+    for (int i = 0; i < numVirtualNodes; i++)
+    {
+        int physicalNodeId = i % numPhysicalNodes;
+        std::string id = "127.0.0.1:" + std::to_string(8080 + physicalNodeId) + ":" + std::to_string(i);
+        ring.addNode(std::make_shared<VirtualNode>(id, physicalNodeId));
+    }
+
+    std::mt19937 rng(42);
+    std::vector<uint32_t> hashes(4096);
+    for (uint32_t &hash : hashes)
+        hash = rng();
+
+    size_t i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(ring.findNextNode(hashes[i++ & (hashes.size() - 1)]));
+}
+BENCHMARK(BM_HashRingFindNextNode)
+    ->Arg(100)->Arg(1000)->Arg(10000)
+    ->ArgName("vnodes");
+
+////////////////////////////////////////////
+// Crypto
+////////////////////////////////////////////
+
+/* args: {input size (in bytes)} */
+static void BM_Sha256_32(benchmark::State &state)
+{
+    std::string input(state.range(0), 'k');
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Crypto::sha256_32(input));
+
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_Sha256_32)
+    ->Arg(16)->Arg(64)->Arg(1024)
+    ->ArgName("bytes");
+
+////////////////////////////////////////////
+// Block
+////////////////////////////////////////////
+
+/**
+ * Fixture of `numBlocks` blocks of key "archive.zip", each holding `dataBlockSize` bytes.
+ */
+struct BlockFixture
+{
+    std::vector<unsigned char> data;
+    std::vector<Block> blocks;
+
+    BlockFixture(uint32_t numBlocks, uint32_t dataBlockSize)
+        : data(numBlocks * dataBlockSize)
+    {
+        std::mt19937 rng(42);
+        for (unsigned char &c : data)
+            c = static_cast<unsigned char>(rng());
+
+        for (uint32_t i = 0; i < numBlocks; i++)
+        {
+            auto start = data.begin() + i * dataBlockSize;
+            blocks.emplace_back("archive.zip", i, dataBlockSize, start, start + dataBlockSize);
+        }
+    }
+};
+
+/* args: {num. blocks, data block size} */
+static void BM_BlockSerialize(benchmark::State &state)
+{
+    BlockFixture fixture(state.range(0), state.range(1));
+    std::vector<unsigned char> buffer;
+
+    for (auto _ : state)
+    {
+        buffer.clear();
+        for (Block &block : fixture.blocks)
+            block.serialize(buffer);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+
+    state.SetBytesProcessed(state.iterations() * fixture.data.size());
+}
+BENCHMARK(BM_BlockSerialize)
+    ->ArgsProduct({{1, 16}, {4096, 65536}})
+    ->ArgNames({"blocks", "blockSize"});
+
+/* args: {num. blocks, data block size} */
+static void BM_BlockDeserialize(benchmark::State &state)
+{
+    BlockFixture fixture(state.range(0), state.range(1));
+    std::vector<unsigned char> buffer;
+    for (Block &block : fixture.blocks)
+        block.serialize(buffer);
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Block::deserialize(buffer));
+
+    state.SetBytesProcessed(state.iterations() * fixture.data.size());
+}
+BENCHMARK(BM_BlockDeserialize)
+    ->ArgsProduct({{1, 16}, {4096, 65536}})
+    ->ArgNames({"blocks", "blockSize"});
+
+////////////////////////////////////////////
+// Payloads
+////////////////////////////////////////////
+
+/* args: {num. keys} */
+static void BM_SyncInfoRoundTrip(benchmark::State &state)
+{
+    std::map<std::string, std::vector<uint32_t>> keyBlockNumMap;
+    for (int i = 0; i < state.range(0); i++)
+    {
+        std::vector<uint32_t> blockNums(16);
+        for (uint32_t j = 0; j < blockNums.size(); j++)
+            blockNums[j] = j * 5 + i % 5;
+        keyBlockNumMap["archive_" + std::to_string(i) + ".zip"] = blockNums;
+    }
+    Payloads::SyncInfo syncInfo(keyBlockNumMap, Payloads::SizeInfo(1u << 20, 1u << 30));
+
+    std::vector<unsigned char> buffer;
+    for (auto _ : state)
+    {
+        buffer.clear();
+        syncInfo.serialize(buffer);
+        benchmark::DoNotOptimize(Payloads::SyncInfo::deserialize(buffer));
+    }
+
+    state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(BM_SyncInfoRoundTrip)
+    ->Arg(10)->Arg(1000)
+    ->ArgName("keys");
+
+////////////////////////////////////////////
+// BAT
+////////////////////////////////////////////
+
+/* args: {num. BAT entries} */
+static void BM_FindBATEntry(benchmark::State &state)
+{
+    uint32_t numEntries = state.range(0);
+
+    BAT bat;
+    std::vector<uint32_t> keyHashes;
+    for (uint32_t i = 0; i < numEntries; i++)
+    {
+        std::string key = "archive_" + std::to_string(i) + ".zip";
+        uint32_t keyHash = Crypto::sha256_32(key);
+        bat.table.emplace_back(bat.keys.add(key), keyHash, i, 4096);
+        bat.numEntries++;
+        keyHashes.push_back(keyHash);
+    }
+
+    // look up existing keys in random order
+    std::mt19937 rng(42);
+    std::shuffle(keyHashes.begin(), keyHashes.end(), rng);
+
+    size_t i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(bat.findBATEntry(keyHashes[i++ % keyHashes.size()]));
+}
+BENCHMARK(BM_FindBATEntry)
+    ->Arg(1000)->Arg(10000)->Arg(100000)
+    ->ArgName("entries");
+
+////////////////////////////////////////////
+// Main
+////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    // default to also writing JSON results, unless the caller chose an output
+    std::vector<char*> args(argv, argv + argc);
+    bool hasOut = false, hasFormat = false;
+    for (int i = 1; i < argc; i++)
+    {
+        hasOut |= std::strncmp(argv[i], "--benchmark_out=", 16) == 0;
+        hasFormat |= std::strncmp(argv[i], "--benchmark_out_format=", 23) == 0;
+    }
+
+    std::string outArg = "--benchmark_out=microbench.json";
+    std::string formatArg = "--benchmark_out_format=json";
+    if (!hasOut)
+        args.push_back(outArg.data());
+    if (!hasOut && !hasFormat)
+        args.push_back(formatArg.data());
+
+    int numArgs = args.size();
+    benchmark::Initialize(&numArgs, args.data());
+    if (benchmark::ReportUnrecognizedArguments(numArgs, args.data()))
+        return 1;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
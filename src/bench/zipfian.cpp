@@ -0,0 +1,156 @@
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "zipfian.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// ZipfianGenerator methods
+////////////////////////////////////////////
+
+/* Param constructor */
+ZipfianGenerator::ZipfianGenerator(
+    uint64_t numItems,
+    double theta,
+    bool scrambled
+)
+    : numItems(numItems),
+        theta(theta),
+        scrambled(scrambled)
+{
+    if (numItems == 0)
+        throw std::runtime_error("ZipfianGenerator() - numItems must be non-zero");
+    if (theta < 0 || theta >= 1)
+        throw std::runtime_error("ZipfianGenerator() - theta must be within [0, 1)");
+
+    this->zetaN = 0;
+    for (uint64_t i = 1; i <= numItems; i++)
+        this->zetaN += 1.0 / std::pow(static_cast<double>(i), theta);
+
+    double zeta2 = 1.0 + std::pow(0.5, theta);
+    this->alpha = 1.0 / (1.0 - theta);
+    this->eta = (1.0 - std::pow(2.0 / numItems, 1.0 - theta)) / (1.0 - zeta2 / this->zetaN);
+    this->halfPowTheta = std::pow(0.5, theta);
+
+    // eta is 0/0 for a single item
+    if (numItems < 2)
+        this->eta = 0;
+}
+
+/**
+ * Draws the next item, in [0, numItems).
+ */
+uint64_t ZipfianGenerator::next(std::mt19937_64 &rng) const
+{
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    double uz = u * this->zetaN;
+
+    uint64_t rank;
+    if (uz < 1.0)
+        rank = 0;
+    else if (uz < 1.0 + this->halfPowTheta)
+        rank = 1;
+    else
+        rank = static_cast<uint64_t>(this->numItems * std::pow(this->eta * u - this->eta + 1.0, this->alpha));
+
+    rank = std::min(rank, this->numItems - 1);
+    if (!this->scrambled)
+        return rank;
+
+    // FNV-1a over the rank's bytes
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 8; i++)
+    {
+        hash ^= (rank >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ull;
+    }
+    return hash % this->numItems;
+}
+
+////////////////////////////////////////////
+// ZipfianGenerator tests
+////////////////////////////////////////////
+namespace ZipfianTests
+{
+    void testSkewedTowardsLowRanks()
+    {
+        const uint64_t numItems = 1000;
+        const int numDraws = 200000;
+
+        ZipfianGenerator zipf(numItems, 0.99);
+        std::mt19937_64 rng(42);
+
+        std::vector<int> freqs(numItems, 0);
+        for (int i = 0; i < numDraws; i++)
+        {
+            uint64_t item = zipf.next(rng);
+            ASSERT_THAT(item < numItems);
+            freqs[item]++;
+        }
+
+        // P(rank 0) = 1 / zeta(1000, 0.99), roughly 13%
+        ASSERT_THAT(freqs[0] > numDraws / 10 && freqs[0] < numDraws / 6);
+        ASSERT_THAT(freqs[0] > freqs[1] && freqs[1] > freqs[10] && freqs[10] > freqs[500]);
+
+        // scrambling moves the hottest item, but keeps its popularity
+        ZipfianGenerator scrambled(numItems, 0.99, true);
+        std::vector<int> scrambledFreqs(numItems, 0);
+        for (int i = 0; i < numDraws; i++)
+            scrambledFreqs[scrambled.next(rng)]++;
+
+        int hottest = *std::max_element(scrambledFreqs.begin(), scrambledFreqs.end());
+        ASSERT_THAT(hottest > numDraws / 10);
+    }
+
+    void testZeroThetaIsUniform()
+    {
+        const uint64_t numItems = 10;
+        const int numDraws = 100000;
+
+        ZipfianGenerator uniform(numItems, 0.0);
+        std::mt19937_64 rng(42);
+
+        std::vector<int> freqs(numItems, 0);
+        for (int i = 0; i < numDraws; i++)
+            freqs[uniform.next(rng)]++;
+
+        for (int freq : freqs)
+            ASSERT_THAT(std::abs(freq - numDraws / 10) < numDraws / 100);
+
+        // a single item is always drawn
+        ZipfianGenerator single(1);
+        ASSERT_THAT(single.next(rng) == 0);
+
+        try
+        {
+            ZipfianGenerator invalid(10, 1.0);
+            FORCE_FAIL("theta of 1 should throw");
+        }
+        catch (std::runtime_error &e)
+        {
+        }
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "ZipfianTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testSkewedTowardsLowRanks),
+            TEST(testZeroThetaIsUniform)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
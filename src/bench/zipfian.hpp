@@ -0,0 +1,51 @@
+#pragma once
+
+#include <random>
+#include <cstdint>
+
+/**
+ * Generates item ranks in [0, numItems) with Zipfian popularity, i.e.
+ * rank `r` is drawn with probability proportional to 1 / (r + 1)^theta.
+ *
+ * NOTE:
+ *
+ * Uses the rejection-free method of Gray et al. ("Quickly Generating
+ * Billion-Record Synthetic Databases"), as YCSB does, so each draw is O(1)
+ * after an O(numItems) setup. theta = 0 gives a uniform distribution, and
+ * YCSB's default skew is theta = 0.99.
+ *
+ * With `scrambled`, ranks are hashed over the item space (as in YCSB's
+ * ScrambledZipfianGenerator), so the hottest items aren't all neighbours.
+ */
+class ZipfianGenerator
+{
+public:
+    /* Param constructor */
+    ZipfianGenerator(
+        uint64_t numItems,
+        double theta = 0.99,
+        bool scrambled = false
+    );
+
+    /**
+     * Draws the next item, in [0, numItems).
+     */
+    uint64_t next(std::mt19937_64 &rng) const;
+
+private:
+    uint64_t numItems;
+    double theta;
+    bool scrambled;
+
+    double zetaN;
+    double alpha;
+    double eta;
+    double halfPowTheta;
+};
+
+namespace ZipfianTests
+{
+    void testSkewedTowardsLowRanks();
+    void testZeroThetaIsUniform();
+    void runAll();
+}
@@ -0,0 +1,206 @@
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include "hedge_policy.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// HedgePolicy methods
+////////////////////////////////////////////
+
+/* Param constructor (a `percentile` of 0 disables hedging) */
+HedgePolicy::HedgePolicy(double percentile, double budgetPercent, std::chrono::microseconds minDelay)
+    : percentile(percentile),
+        earnedPerRequest(std::llround(budgetPercent / 100 * HEDGE_COST)),
+        minDelay(minDelay),
+        budget(0),
+        requests(0),
+        hedged(0),
+        hedgesWon(0)
+{
+}
+
+/**
+ * Records that a request to node `nodeId` got its response after `latency`.
+ */
+void HedgePolicy::recordLatency(uint32_t nodeId, std::chrono::microseconds latency)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    // the oldest latency is overwritten once the window is full
+    NodeLatencies &node = this->nodeLatencies[nodeId];
+    if (node.samples.size() < WINDOW_SIZE)
+        node.samples.push_back(latency);
+    else
+        node.samples[node.next] = latency;
+    node.next = (node.next + 1) % WINDOW_SIZE;
+}
+
+/**
+ * Returns how long a request to node `nodeId` may take before it's
+ * hedged, or nothing if it shouldn't be.
+ */
+std::optional<std::chrono::microseconds> HedgePolicy::hedgeDelay(uint32_t nodeId)
+{
+    if (this->percentile <= 0)
+        return std::nullopt;
+
+    std::vector<std::chrono::microseconds> samples;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->nodeLatencies.find(nodeId);
+        if (it == this->nodeLatencies.end() || it->second.samples.size() < MIN_SAMPLES)
+            return std::nullopt;
+        samples = it->second.samples;
+    }
+
+    size_t rank = std::min<size_t>(samples.size() - 1, std::ceil(this->percentile * samples.size() / 100) - 1);
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+
+    return std::max(samples[rank], this->minDelay);
+}
+
+/**
+ * Counts a request that could be hedged, earning its share of the budget.
+ */
+void HedgePolicy::recordRequest()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->requests++;
+    this->budget = std::min(MAX_BURST * HEDGE_COST, this->budget + this->earnedPerRequest);
+}
+
+/**
+ * Spends a hedge from the budget. Returns false (spending nothing) if
+ * there isn't one to spend.
+ */
+bool HedgePolicy::tryHedge()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->budget < HEDGE_COST)
+        return false;
+
+    this->budget -= HEDGE_COST;
+    this->hedged++;
+    return true;
+}
+
+/* Counts a hedge that got its response before the request it hedged */
+void HedgePolicy::recordHedgeWon()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->hedgesWon++;
+}
+
+uint64_t HedgePolicy::numRequests()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->requests;
+}
+
+uint64_t HedgePolicy::numHedged()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->hedged;
+}
+
+uint64_t HedgePolicy::numHedgesWon()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->hedgesWon;
+}
+
+////////////////////////////////////////////
+// HedgePolicy tests
+////////////////////////////////////////////
+namespace HedgePolicyTests
+{
+    using std::chrono::microseconds;
+
+    void testDelayFollowsPercentile()
+    {
+        HedgePolicy policy(90, 5, microseconds(0));
+
+        // latencies of 1..100us, so the 90th percentile is 90us
+        for (int i = 100; i >= 1; i--)
+            policy.recordLatency(1, microseconds(i));
+        ASSERT_THAT(policy.hedgeDelay(1) == microseconds(90));
+
+        // only the latest WINDOW_SIZE latencies count, so the node's delay adapts
+        for (size_t i = 0; i < HedgePolicy::WINDOW_SIZE; i++)
+            policy.recordLatency(1, microseconds(5000));
+        ASSERT_THAT(policy.hedgeDelay(1) == microseconds(5000));
+
+        // delays are at least `minDelay`
+        HedgePolicy floored(90, 5, microseconds(200));
+        for (int i = 1; i <= 100; i++)
+            floored.recordLatency(1, microseconds(i));
+        ASSERT_THAT(floored.hedgeDelay(1) == microseconds(200));
+    }
+
+    void testDelayNeedsSamples()
+    {
+        HedgePolicy policy(95, 5, microseconds(0));
+
+        for (size_t i = 0; i < HedgePolicy::MIN_SAMPLES - 1; i++)
+            policy.recordLatency(1, microseconds(100));
+        ASSERT_THAT(!policy.hedgeDelay(1).has_value());
+        ASSERT_THAT(!policy.hedgeDelay(2).has_value());
+
+        policy.recordLatency(1, microseconds(100));
+        ASSERT_THAT(policy.hedgeDelay(1).has_value());
+
+        // a percentile of 0 never hedges
+        HedgePolicy disabled(0, 5, microseconds(0));
+        for (size_t i = 0; i < HedgePolicy::MIN_SAMPLES; i++)
+            disabled.recordLatency(1, microseconds(100));
+        ASSERT_THAT(!disabled.hedgeDelay(1).has_value());
+    }
+
+    void testBudget()
+    {
+        HedgePolicy policy(95, 10, microseconds(0));
+
+        // 10% of a hedge per request
+        ASSERT_THAT(!policy.tryHedge());
+        for (int i = 0; i < 10; i++)
+            policy.recordRequest();
+        ASSERT_THAT(policy.tryHedge());
+        ASSERT_THAT(!policy.tryHedge());
+
+        // unspent hedges are saved up, to at most MAX_BURST
+        for (int i = 0; i < 1000; i++)
+            policy.recordRequest();
+
+        int numHedges = 0;
+        while (policy.tryHedge())
+            numHedges++;
+        ASSERT_THAT(numHedges == static_cast<int>(HedgePolicy::MAX_BURST));
+
+        ASSERT_THAT(policy.numRequests() == 1010);
+        ASSERT_THAT(policy.numHedged() == 11);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "HedgePolicyTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testDelayFollowsPercentile),
+            TEST(testDelayNeedsSamples),
+            TEST(testBudget)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <optional>
+
+/**
+ * Decides when a storage node request should be hedged, i.e. also sent to
+ * another replica, with whichever answers first being used.
+ *
+ * NOTE:
+ *
+ * A request is hedged once it has taken longer than the `percentile`th
+ * percentile of its node's recent request latencies (but at least
+ * `minDelay`), so the delay adapts to each node. Nodes with fewer than
+ * MIN_SAMPLES latencies recorded aren't hedged.
+ *
+ * Hedges are capped by a budget: each request earns `budgetPercent`% of
+ * a hedge, and each hedge spends one, so they add at most `budgetPercent`%
+ * to the load (with bursts of up to MAX_BURST hedges).
+ */
+class HedgePolicy
+{
+public:
+    // num. latencies kept per node, and num. needed before it's hedged
+    static constexpr size_t WINDOW_SIZE = 256;
+    static constexpr size_t MIN_SAMPLES = 16;
+
+    // max. num. hedges saved up while none are needed
+    static constexpr uint64_t MAX_BURST = 10;
+
+    /* Param constructor (a `percentile` of 0 disables hedging) */
+    HedgePolicy(double percentile, double budgetPercent, std::chrono::microseconds minDelay);
+
+    /**
+     * Records that a request to node `nodeId` got its response after `latency`.
+     */
+    void recordLatency(uint32_t nodeId, std::chrono::microseconds latency);
+
+    /**
+     * Returns how long a request to node `nodeId` may take before it's
+     * hedged, or nothing if it shouldn't be.
+     */
+    std::optional<std::chrono::microseconds> hedgeDelay(uint32_t nodeId);
+
+    /**
+     * Counts a request that could be hedged, earning its share of the budget.
+     */
+    void recordRequest();
+
+    /**
+     * Spends a hedge from the budget. Returns false (spending nothing) if
+     * there isn't one to spend.
+     */
+    bool tryHedge();
+
+    /* Counts a hedge that got its response before the request it hedged */
+    void recordHedgeWon();
+
+    /* Num. requests counted, hedges sent, and hedges that answered first */
+    uint64_t numRequests();
+    uint64_t numHedged();
+    uint64_t numHedgesWon();
+
+private:
+    struct NodeLatencies
+    {
+        std::vector<std::chrono::microseconds> samples;
+        size_t next = 0;
+    };
+
+    // budget is kept in millionths of a hedge, so it adds up exactly
+    static constexpr uint64_t HEDGE_COST = 1000000;
+
+    double percentile;
+    uint64_t earnedPerRequest;
+    std::chrono::microseconds minDelay;
+
+    std::mutex mutex;
+    std::map<uint32_t, NodeLatencies> nodeLatencies;
+    uint64_t budget;
+
+    uint64_t requests;
+    uint64_t hedged;
+    uint64_t hedgesWon;
+};
+
+namespace HedgePolicyTests
+{
+    void testDelayFollowsPercentile();
+    void testDelayNeedsSamples();
+    void testBudget();
+    void runAll();
+}
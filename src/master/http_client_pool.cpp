@@ -0,0 +1,201 @@
+#include <iostream>
+#include <stdexcept>
+#include <functional>
+
+#include "http_client_pool.hpp"
+
+#include "test_utils.hpp"
+
+using namespace web::http;
+
+////////////////////////////////////////////
+// HttpClientPool::Lease methods
+////////////////////////////////////////////
+
+HttpClientPool::Lease::Lease(std::shared_ptr<http_client> client, std::shared_ptr<std::atomic<uint32_t>> inFlight)
+    : leasedClient(client),
+        inFlight(inFlight)
+{
+    (*this->inFlight)++;
+}
+
+HttpClientPool::Lease::~Lease()
+{
+    (*this->inFlight)--;
+}
+
+http_client &HttpClientPool::Lease::client()
+{
+    return *this->leasedClient;
+}
+
+////////////////////////////////////////////
+// HttpClientPool methods
+////////////////////////////////////////////
+
+/* Param constructor, for `size` clients of `baseUri` */
+HttpClientPool::HttpClientPool(std::string baseUri, uint32_t size)
+    : baseUri(baseUri),
+        nextSlot(0)
+{
+    if (size == 0)
+        throw std::runtime_error("HttpClientPool() - size must be non-zero");
+
+    for (uint32_t i = 0; i < size; i++)
+        this->slots.push_back(this->newSlot());
+}
+
+HttpClientPool::Slot HttpClientPool::newSlot()
+{
+    return {std::make_shared<http_client>(U(this->baseUri)), std::make_shared<std::atomic<uint32_t>>(0)};
+}
+
+/**
+ * Returns a lease of the client with the fewest requests in flight.
+ */
+std::shared_ptr<HttpClientPool::Lease> HttpClientPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    // start from a different slot each time, so ties are spread round-robin
+    uint32_t best = this->nextSlot++ % this->slots.size();
+    for (uint32_t n = 1; n < this->slots.size(); n++)
+    {
+        uint32_t i = (best + n) % this->slots.size();
+        if (*this->slots[i].inFlight < *this->slots[best].inFlight)
+            best = i;
+    }
+
+    return std::make_shared<Lease>(this->slots[best].client, this->slots[best].inFlight);
+}
+
+/**
+ * Sends a GET of `path` on each client, so each has a connection open
+ * before it's needed. The returned task completes once all have had a
+ * response (or failed - failures are ignored).
+ */
+pplx::task<void> HttpClientPool::warmUp(std::string path)
+{
+    std::vector<Slot> slots;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        slots = this->slots;
+    }
+
+    std::vector<pplx::task<void>> tasks;
+    for (Slot &slot : slots)
+    {
+        auto lease = std::make_shared<Lease>(slot.client, slot.inFlight);
+        tasks.push_back(lease->client().request(methods::GET, U(path))
+        .then([lease](pplx::task<http_response> prevTask)
+        {
+            try
+            {
+                prevTask.get();
+            }
+            catch (const std::exception &e) {}
+        }));
+    }
+
+    return pplx::when_all(tasks.begin(), tasks.end());
+}
+
+/**
+ * Replaces every client with a new one.
+ */
+void HttpClientPool::evict()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (Slot &slot : this->slots)
+        slot = this->newSlot();
+}
+
+uint32_t HttpClientPool::size()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->slots.size();
+}
+
+/* Num. requests in flight over all clients */
+uint32_t HttpClientPool::numInFlight()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    uint32_t count = 0;
+    for (Slot &slot : this->slots)
+        count += *slot.inFlight;
+    return count;
+}
+
+////////////////////////////////////////////
+// HttpClientPool tests
+////////////////////////////////////////////
+namespace HttpClientPoolTests
+{
+    void testLeasesLeastBusyClient()
+    {
+        HttpClientPool pool("http://127.0.0.1:8081", 3);
+
+        // concurrent leases each get their own client...
+        auto a = pool.acquire();
+        auto b = pool.acquire();
+        auto c = pool.acquire();
+        ASSERT_THAT(&a->client() != &b->client());
+        ASSERT_THAT(&b->client() != &c->client());
+        ASSERT_THAT(&a->client() != &c->client());
+        ASSERT_THAT(pool.numInFlight() == 3);
+
+        // ...and a freed client is the next one leased
+        http_client *freed = &b->client();
+        b.reset();
+        ASSERT_THAT(pool.numInFlight() == 2);
+
+        auto d = pool.acquire();
+        ASSERT_THAT(&d->client() == freed);
+
+        // once all are busy, they're shared
+        auto e = pool.acquire();
+        ASSERT_THAT(pool.numInFlight() == 4);
+    }
+
+    void testEvictKeepsLeasedClients()
+    {
+        HttpClientPool pool("http://127.0.0.1:8081", 1);
+
+        auto before = pool.acquire();
+        http_client *evicted = &before->client();
+
+        pool.evict();
+
+        // the leased client stays usable, but isn't leased again
+        auto after = pool.acquire();
+        ASSERT_THAT(&after->client() != evicted);
+        ASSERT_THAT(&before->client() == evicted);
+
+        // the new client's count starts from zero
+        ASSERT_THAT(pool.numInFlight() == 1);
+        before.reset();
+        ASSERT_THAT(pool.numInFlight() == 1);
+        after.reset();
+        ASSERT_THAT(pool.numInFlight() == 0);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "HttpClientPoolTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testLeasesLeastBusyClient),
+            TEST(testEvictKeepsLeasedClients)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cpprest/http_client.h>
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace web::http::client;
+
+/**
+ * A fixed-size pool of http_clients of one storage node, so concurrent
+ * requests to it go over separate connections.
+ *
+ * NOTE:
+ *
+ * acquire() leases the client with the fewest requests in flight (ties go
+ * round-robin), and the lease counts as in flight until it's destroyed, so
+ * callers keep it until they've read the response's body.
+ *
+ * evict() replaces every client, e.g. once the node has gone down, so the
+ * next requests open fresh connections. Requests already in flight keep
+ * their (old) client alive through their lease.
+ */
+class HttpClientPool
+{
+public:
+    /* A client taken from the pool (see acquire()) */
+    class Lease
+    {
+    public:
+        Lease(std::shared_ptr<http_client> client, std::shared_ptr<std::atomic<uint32_t>> inFlight);
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        http_client &client();
+
+    private:
+        std::shared_ptr<http_client> leasedClient;
+        std::shared_ptr<std::atomic<uint32_t>> inFlight;
+    };
+
+    /* Param constructor, for `size` clients of `baseUri` */
+    HttpClientPool(std::string baseUri, uint32_t size);
+
+    /**
+     * Returns a lease of the client with the fewest requests in flight.
+     */
+    std::shared_ptr<Lease> acquire();
+
+    /**
+     * Sends a GET of `path` on each client, so each has a connection open
+     * before it's needed. The returned task completes once all have had a
+     * response (or failed - failures are ignored).
+     */
+    pplx::task<void> warmUp(std::string path);
+
+    /**
+     * Replaces every client with a new one.
+     */
+    void evict();
+
+    uint32_t size();
+
+    /* Num. requests in flight over all clients */
+    uint32_t numInFlight();
+
+private:
+    struct Slot
+    {
+        std::shared_ptr<http_client> client;
+        std::shared_ptr<std::atomic<uint32_t>> inFlight;
+    };
+
+    std::string baseUri;
+
+    std::mutex mutex;
+    std::vector<Slot> slots;
+    uint32_t nextSlot;
+
+    Slot newSlot();
+};
+
+namespace HttpClientPoolTests
+{
+    void testLeasesLeastBusyClient();
+    void testEvictKeepsLeasedClients();
+    void runAll();
+}
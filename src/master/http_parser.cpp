@@ -0,0 +1,298 @@
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include "http_parser.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// Helpers
+////////////////////////////////////////////
+
+static std::string toLower(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+static std::string trim(const std::string &s)
+{
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return "";
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+/* True if comma-separated header value `value` has token `token` (case-insensitive) */
+static bool hasToken(const std::string &value, const std::string &token)
+{
+    std::string lower = toLower(value);
+    size_t start = 0;
+    while (start <= lower.size())
+    {
+        size_t end = lower.find(',', start);
+        if (end == std::string::npos)
+            end = lower.size();
+        if (trim(lower.substr(start, end - start)) == token)
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+////////////////////////////////////////////
+// HttpRequestHead methods
+////////////////////////////////////////////
+
+/* Default constructor */
+HttpRequestHead::HttpRequestHead()
+    : minorVersion(1),
+        contentLength(0),
+        chunked(false),
+        keepAlive(true),
+        expectContinue(false),
+        headSize(0)
+{
+}
+
+/**
+ * Parses the request head at the start of `data` (`size` bytes) into `head`.
+ */
+HttpParseStatus HttpRequestHead::parse(const char *data, size_t size, HttpRequestHead &head)
+{
+    head = HttpRequestHead();
+
+    // tolerate blank lines between pipelined requests
+    size_t start = 0;
+    while (start < size && (data[start] == '\r' || data[start] == '\n'))
+        start++;
+
+    const char *headEnd = nullptr;
+    for (size_t i = start; i + 3 < size; i++)
+    {
+        if (data[i] == '\r' && data[i + 1] == '\n' && data[i + 2] == '\r' && data[i + 3] == '\n')
+        {
+            headEnd = data + i;
+            break;
+        }
+    }
+
+    if (headEnd == nullptr)
+        return (size - start > MAX_HEAD_SIZE) ? HTTP_PARSE_INVALID : HTTP_PARSE_INCOMPLETE;
+    if (headEnd - (data + start) > static_cast<long>(MAX_HEAD_SIZE))
+        return HTTP_PARSE_INVALID;
+
+    head.headSize = (headEnd - data) + 4;
+
+    std::string text(data + start, headEnd);
+    size_t lineEnd = text.find("\r\n");
+    std::string requestLine = text.substr(0, lineEnd);
+
+    /**
+     * Request line, i.e. METHOD TARGET HTTP/1.x
+     */
+    size_t sp1 = requestLine.find(' ');
+    size_t sp2 = (sp1 == std::string::npos) ? std::string::npos : requestLine.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos || sp1 == 0 || sp2 == sp1 + 1)
+        return HTTP_PARSE_INVALID;
+
+    head.method = requestLine.substr(0, sp1);
+    head.target = requestLine.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string version = requestLine.substr(sp2 + 1);
+
+    if (version == "HTTP/1.1")
+        head.minorVersion = 1;
+    else if (version == "HTTP/1.0")
+        head.minorVersion = 0;
+    else
+        return HTTP_PARSE_INVALID;
+
+    if (head.target.empty() || head.target[0] != '/')
+        return HTTP_PARSE_INVALID;
+
+    /**
+     * Headers, i.e. NAME: VALUE
+     */
+    bool hasContentLength = false;
+    head.keepAlive = (head.minorVersion == 1);
+
+    size_t pos = (lineEnd == std::string::npos) ? text.size() : lineEnd + 2;
+    while (pos < text.size())
+    {
+        size_t end = text.find("\r\n", pos);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(pos, end - pos);
+        pos = end + 2;
+
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon == 0 || line[0] == ' ' || line[0] == '\t')
+            return HTTP_PARSE_INVALID;
+
+        std::string name = line.substr(0, colon);
+        std::string value = trim(line.substr(colon + 1));
+        std::string lowerName = toLower(name);
+
+        if (lowerName == "content-length")
+        {
+            if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos || value.size() > 19)
+                return HTTP_PARSE_INVALID;
+
+            uint64_t length = std::stoull(value);
+            if (hasContentLength && length != head.contentLength)
+                return HTTP_PARSE_INVALID;
+
+            head.contentLength = length;
+            hasContentLength = true;
+        }
+        else if (lowerName == "transfer-encoding")
+            head.chunked = hasToken(value, "chunked");
+        else if (lowerName == "connection")
+        {
+            if (hasToken(value, "close"))
+                head.keepAlive = false;
+            else if (hasToken(value, "keep-alive"))
+                head.keepAlive = true;
+        }
+        else if (lowerName == "expect")
+            head.expectContinue = hasToken(value, "100-continue");
+
+        head.headers.emplace_back(std::move(name), std::move(value));
+    }
+
+    // the body's length would be ambiguous
+    if (head.chunked && hasContentLength)
+        return HTTP_PARSE_INVALID;
+
+    return HTTP_PARSE_COMPLETE;
+}
+
+/**
+ * Returns the value of header `name` (case-insensitive), or "" if absent.
+ */
+std::string HttpRequestHead::header(const std::string &name) const
+{
+    std::string lowerName = toLower(name);
+    for (auto &[headerName, value] : this->headers)
+    {
+        if (toLower(headerName) == lowerName)
+            return value;
+    }
+    return "";
+}
+
+////////////////////////////////////////////
+// HttpRequestHead tests
+////////////////////////////////////////////
+namespace HttpRequestHeadTests
+{
+    void testParsesRequest()
+    {
+        std::string request = 
+            "PUT /store/images.zip HTTP/1.1\r\n"
+            "Host: localhost:9000\r\n"
+            "Content-Length: 5\r\n"
+            "Content-Type:  application/octet-stream \r\n"
+            "Expect: 100-continue\r\n"
+            "\r\n"
+            "hello";
+
+        HttpRequestHead head;
+        ASSERT_THAT(HttpRequestHead::parse(request.data(), request.size(), head) == HTTP_PARSE_COMPLETE);
+        ASSERT_THAT(head.method == "PUT");
+        ASSERT_THAT(head.target == "/store/images.zip");
+        ASSERT_THAT(head.minorVersion == 1);
+        ASSERT_THAT(head.contentLength == 5);
+        ASSERT_THAT(head.keepAlive && head.expectContinue && !head.chunked);
+        ASSERT_THAT(head.headers.size() == 4);
+        ASSERT_THAT(head.header("content-type") == "application/octet-stream");
+        ASSERT_THAT(head.header("X-Missing") == "");
+        ASSERT_THAT(request.substr(head.headSize) == "hello");
+
+        // HTTP/1.0 closes by default, unless asked not to
+        std::string http10 = "GET /stats HTTP/1.0\r\n\r\n";
+        ASSERT_THAT(HttpRequestHead::parse(http10.data(), http10.size(), head) == HTTP_PARSE_COMPLETE);
+        ASSERT_THAT(head.minorVersion == 0 && !head.keepAlive && head.contentLength == 0);
+
+        std::string keepAlive10 = "GET /stats HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n";
+        ASSERT_THAT(HttpRequestHead::parse(keepAlive10.data(), keepAlive10.size(), head) == HTTP_PARSE_COMPLETE);
+        ASSERT_THAT(head.keepAlive);
+
+        std::string close11 = "DELETE /store/a HTTP/1.1\r\nConnection: upgrade, close\r\n\r\n";
+        ASSERT_THAT(HttpRequestHead::parse(close11.data(), close11.size(), head) == HTTP_PARSE_COMPLETE);
+        ASSERT_THAT(head.method == "DELETE" && !head.keepAlive);
+
+        std::string chunked = "PUT /store/a HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n";
+        ASSERT_THAT(HttpRequestHead::parse(chunked.data(), chunked.size(), head) == HTTP_PARSE_COMPLETE);
+        ASSERT_THAT(head.chunked);
+    }
+
+    void testIncompleteAndPipelined()
+    {
+        std::string first = "GET /store/a HTTP/1.1\r\nHost: x\r\n\r\n";
+        std::string second = "\r\nGET /store/b HTTP/1.1\r\n\r\n";
+        std::string pipelined = first + second;
+
+        // every strict prefix of the first head is incomplete
+        HttpRequestHead head;
+        for (size_t i = 0; i < first.size(); i++)
+            ASSERT_THAT(HttpRequestHead::parse(pipelined.data(), i, head) == HTTP_PARSE_INCOMPLETE);
+
+        ASSERT_THAT(HttpRequestHead::parse(pipelined.data(), pipelined.size(), head) == HTTP_PARSE_COMPLETE);
+        ASSERT_THAT(head.target == "/store/a" && head.headSize == first.size());
+
+        // the next request starts right after it (stray CRLFs are skipped)
+        const char *rest = pipelined.data() + head.headSize;
+        size_t restSize = pipelined.size() - head.headSize;
+        ASSERT_THAT(HttpRequestHead::parse(rest, restSize, head) == HTTP_PARSE_COMPLETE);
+        ASSERT_THAT(head.target == "/store/b" && head.headSize == restSize);
+    }
+
+    void testInvalidRequests()
+    {
+        std::vector<std::string> invalid = {
+            "GET\r\n\r\n",
+            "GET /a\r\n\r\n",
+            "GET /a HTTP/2.0\r\n\r\n",
+            "GET a HTTP/1.1\r\n\r\n",
+            "GET /a HTTP/1.1\r\nNoColon\r\n\r\n",
+            "GET /a HTTP/1.1\r\n folded: value\r\n\r\n",
+            "PUT /a HTTP/1.1\r\nContent-Length: -1\r\n\r\n",
+            "PUT /a HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n",
+            "PUT /a HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"
+        };
+
+        HttpRequestHead head;
+        for (std::string &request : invalid)
+        {
+            if (HttpRequestHead::parse(request.data(), request.size(), head) != HTTP_PARSE_INVALID)
+                FORCE_FAIL("request should be invalid: " + request);
+        }
+
+        // a head that never ends is rejected once it's too large
+        std::string huge = "GET /a HTTP/1.1\r\nX-Pad: " + std::string(HttpRequestHead::MAX_HEAD_SIZE, 'a');
+        ASSERT_THAT(HttpRequestHead::parse(huge.data(), huge.size(), head) == HTTP_PARSE_INVALID);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "HttpRequestHeadTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testParsesRequest),
+            TEST(testIncompleteAndPipelined),
+            TEST(testInvalidRequests)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
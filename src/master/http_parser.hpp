@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+/* Result of parsing a request head (see HttpRequestHead::parse()) */
+enum HttpParseStatus
+{
+    HTTP_PARSE_INCOMPLETE,
+    HTTP_PARSE_COMPLETE,
+    HTTP_PARSE_INVALID
+};
+
+/**
+ * The head (request line and headers) of an HTTP/1.x request, as
+ * parsed by the master's native front end (see native_front_end.hpp).
+ */
+class HttpRequestHead
+{
+public:
+    /* Max. size of a request head, in bytes */
+    static const size_t MAX_HEAD_SIZE = 64 * 1024;
+
+    std::string method;
+    std::string target;
+
+    /* Minor version, i.e. 1 for HTTP/1.1, 0 for HTTP/1.0 */
+    int minorVersion;
+
+    /* In order received, with names as given */
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    /* Body size, from Content-Length (0 if absent) */
+    uint64_t contentLength;
+
+    /* True if the body uses chunked transfer encoding */
+    bool chunked;
+
+    /* True if the connection may be reused after this request */
+    bool keepAlive;
+
+    /* True if the client waits for a '100 Continue' before sending the body */
+    bool expectContinue;
+
+    /* Num. bytes the head takes up, i.e. where the body (or next request) starts */
+    size_t headSize;
+
+    /* Default constructor */
+    HttpRequestHead();
+
+    /**
+     * Parses the request head at the start of `data` (`size` bytes) into `head`.
+     * 
+     * Returns HTTP_PARSE_INCOMPLETE if `data` doesn't hold the whole head yet,
+     * and HTTP_PARSE_INVALID if it's malformed (or over MAX_HEAD_SIZE).
+     */
+    static HttpParseStatus parse(const char *data, size_t size, HttpRequestHead &head);
+
+    /**
+     * Returns the value of header `name` (case-insensitive), or "" if absent.
+     */
+    std::string header(const std::string &name) const;
+};
+
+namespace HttpRequestHeadTests
+{
+    void testParsesRequest();
+    void testIncompleteAndPipelined();
+    void testInvalidRequests();
+    void runAll();
+}
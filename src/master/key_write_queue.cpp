@@ -0,0 +1,196 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <iostream>
+#include <stdexcept>
+#include <functional>
+
+#include "key_write_queue.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// KeyWriteQueue methods
+////////////////////////////////////////////
+
+/**
+ * Runs `write` once every write of `key` queued before it has finished
+ * (straight away if there are none). Completes once `write`'s task does.
+ */
+pplx::task<void> KeyWriteQueue::run(const std::string &key, const Write &write)
+{
+    pplx::task_completion_event<void> done;
+    std::optional<pplx::task<void>> previous;
+    uint64_t writeId;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        writeId = this->nextWriteId++;
+
+        auto it = this->lastWrites.find(key);
+        if (it != this->lastWrites.end())
+        {
+            previous = it->second.done;
+            this->queued++;
+        }
+        this->lastWrites[key] = {writeId, pplx::create_task(done)};
+    }
+
+    // started outside the lock, as starting a write may run a lot of it
+    pplx::task<void> written = previous
+        ? previous->then([write]() { return KeyWriteQueue::start(write); })
+        : KeyWriteQueue::start(write);
+
+    return written.then([this, key, writeId, done](pplx::task<void> finished)
+    {
+        // the key is forgotten once its last queued write finishes
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            auto it = this->lastWrites.find(key);
+            if (it != this->lastWrites.end() && it->second.id == writeId)
+                this->lastWrites.erase(it);
+        }
+        done.set();
+
+        finished.get();
+    });
+}
+
+uint64_t KeyWriteQueue::numQueued()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->queued;
+}
+
+/* Runs `write`, turning anything it throws into a failed task */
+pplx::task<void> KeyWriteQueue::start(const Write &write)
+{
+    try
+    {
+        return write();
+    }
+    catch (...)
+    {
+        return pplx::task_from_exception<void>(std::current_exception());
+    }
+}
+
+////////////////////////////////////////////
+// KeyWriteQueue tests
+////////////////////////////////////////////
+namespace KeyWriteQueueTests
+{
+    /* A write that records its start, and completes once `release` is set */
+    struct ControlledWrite
+    {
+        std::shared_ptr<std::atomic<bool>> started = std::make_shared<std::atomic<bool>>(false);
+        pplx::task_completion_event<void> release;
+
+        KeyWriteQueue::Write write()
+        {
+            auto started = this->started;
+            auto release = this->release;
+            return [started, release]()
+            {
+                *started = true;
+                return pplx::create_task(release);
+            };
+        }
+    };
+
+    void testSerialisesWritesToAKey()
+    {
+        KeyWriteQueue writes;
+        ControlledWrite first, second, third;
+
+        auto firstDone = writes.run("key", first.write());
+        auto secondDone = writes.run("key", second.write());
+        auto thirdDone = writes.run("key", third.write());
+
+        ASSERT_THAT(*first.started);
+        ASSERT_THAT(!*second.started);
+        ASSERT_THAT(writes.numQueued() == 2);
+
+        // each write starts only once the one before it has finished
+        first.release.set();
+        firstDone.wait();
+        while (!*second.started)
+            std::this_thread::yield();
+        ASSERT_THAT(!*third.started);
+
+        second.release.set();
+        third.release.set();
+        secondDone.wait();
+        thirdDone.wait();
+        ASSERT_THAT(*third.started);
+    }
+
+    void testDifferentKeysDontWait()
+    {
+        KeyWriteQueue writes;
+        ControlledWrite first, other;
+
+        auto firstDone = writes.run("key", first.write());
+        auto otherDone = writes.run("other key", other.write());
+
+        ASSERT_THAT(*first.started);
+        ASSERT_THAT(*other.started);
+        ASSERT_THAT(writes.numQueued() == 0);
+
+        first.release.set();
+        other.release.set();
+        firstDone.wait();
+        otherDone.wait();
+
+        // a write after the key's last one has finished doesn't wait either
+        ControlledWrite later;
+        later.release.set();
+        writes.run("key", later.write()).wait();
+        ASSERT_THAT(writes.numQueued() == 0);
+    }
+
+    void testFailedWriteDoesntBlockTheNext()
+    {
+        KeyWriteQueue writes;
+        ControlledWrite next;
+        next.release.set();
+
+        auto failed = writes.run("key", []() -> pplx::task<void>
+        {
+            throw std::runtime_error("write failed");
+        });
+        auto nextDone = writes.run("key", next.write());
+
+        try
+        {
+            failed.get();
+            FORCE_FAIL("failed write should have failed its task");
+        }
+        catch (const std::runtime_error &e)
+        {
+        }
+
+        nextDone.wait();
+        ASSERT_THAT(*next.started);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "KeyWriteQueueTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testSerialisesWritesToAKey),
+            TEST(testDifferentKeysDontWait),
+            TEST(testFailedWriteDoesntBlockTheNext)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <pplx/pplxtasks.h>
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+/**
+ * Serialises the writes to each key, so a write (e.g. an append, which
+ * reads the key's tail before extending it) never overlaps another of
+ * the same key. Writes to different keys run concurrently.
+ *
+ * NOTE:
+ *
+ * Writes are queued as continuations, so no thread waits on one. A write
+ * runs once the one queued before it has finished, failed or not.
+ */
+class KeyWriteQueue
+{
+public:
+    typedef std::function<pplx::task<void>()> Write;
+
+    /* Default constructor */
+    KeyWriteQueue() : nextWriteId(0), queued(0) {}
+
+    /**
+     * Runs `write` once every write of `key` queued before it has finished
+     * (straight away if there are none). Completes once `write`'s task does.
+     */
+    pplx::task<void> run(const std::string &key, const Write &write);
+
+    /* Num. writes that had to wait for an earlier write of their key */
+    uint64_t numQueued();
+
+private:
+    struct LastWrite
+    {
+        uint64_t id;
+        pplx::task<void> done;  // never fails
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, LastWrite> lastWrites;
+    uint64_t nextWriteId;
+    uint64_t queued;
+
+    static pplx::task<void> start(const Write &write);
+};
+
+namespace KeyWriteQueueTests
+{
+    void testSerialisesWritesToAKey();
+    void testDifferentKeysDontWait();
+    void testFailedWriteDoesntBlockTheNext();
+    void runAll();
+}
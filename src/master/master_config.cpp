@@ -30,6 +30,23 @@ void MasterConfig::loadVariables()
 
     this->replicationFactor = masterServer.at(U("replicationFactor")).as_integer();
 
+    this->streamWindowBytes = masterServer.at(U("streamWindowBytes")).as_number().to_uint64();
+    this->streamBatchBytes = masterServer.at(U("streamBatchBytes")).as_integer();
+
+    this->ioThreads = masterServer.at(U("ioThreads")).as_integer();
+
+    this->frontEnd = masterServer.at(U("frontEnd")).as_string();
+    this->frontEndThreads = masterServer.at(U("frontEndThreads")).as_integer();
+    this->maxBufferedBodyBytes = masterServer.at(U("maxBufferedBodyBytes")).as_number().to_uint64();
+    this->maxCpprestBodyBytes = masterServer.at(U("maxCpprestBodyBytes")).as_number().to_uint64();
+
+    this->storageTransport = masterServer.at(U("storageTransport")).as_string();
+    this->connectionsPerNode = masterServer.at(U("connectionsPerNode")).as_integer();
+    this->coalesceGets = masterServer.at(U("coalesceGets")).as_bool();
+    this->hedgePercentile = masterServer.at(U("hedgePercentile")).as_double();
+    this->hedgeBudgetPercent = masterServer.at(U("hedgeBudgetPercent")).as_double();
+    this->hedgeMinDelayMs = masterServer.at(U("hedgeMinDelayMs")).as_integer();
+
     /**
      * shared config
      */
@@ -37,4 +54,9 @@ void MasterConfig::loadVariables()
 
     this->dataBlockSize = shared.at(U("dataBlockSize")).as_integer();
     this->keyLengthMax = shared.at(U("keyLengthMax")).as_integer();
+    this->shutdownDrainMs = shared.at(U("shutdownDrainMs")).as_integer();
+    this->rpcPortOffset = shared.at(U("rpcPortOffset")).as_integer();
+    this->rpcSocketBufferBytes = shared.at(U("rpcSocketBufferBytes")).as_integer();
+    this->rpcLocalDir = shared.at(U("rpcLocalDir")).as_string();
+    this->rpcShmRingBytes = shared.at(U("rpcShmRingBytes")).as_number().to_uint64();
 }
\ No newline at end of file
@@ -33,6 +33,88 @@ public:
      */
     uint32_t replicationFactor;
 
+    /**
+     * Max. num. bytes of a single streamed upload held by the master at
+     * once, i.e. read from the client but not yet stored by its nodes
+     * (or of a streamed download, fetched but not yet read by the client).
+     * 
+     * NOTE:
+     * 
+     * Only the "native" front end stops reading an upload's socket while
+     * its window is full. cpprest's listener reads every body in full
+     * regardless, so with it this bounds only the bytes in flight to nodes
+     * (see `maxCpprestBodyBytes`).
+     */
+    uint64_t streamWindowBytes;
+
+    /**
+     * Num. bytes read from a streamed upload (or fetched for a streamed
+     * download) at a time, rounded down to a whole number of data blocks.
+     * Each batch is passed on as soon as it's ready.
+     */
+    uint32_t streamBatchBytes;
+
+    /**
+     * Num. threads in cpprest's thread pool, which accepts requests and runs
+     * all handlers and storage node requests (0 uses cpprest's default).
+     */
+    uint32_t ioThreads;
+
+    /**
+     * Which server accepts client requests: "cpprest" (cpprest's http_listener,
+     * which buffers whole request bodies) or "native" (see NativeFrontEnd).
+     */
+    std::string frontEnd;
+
+    /**
+     * Num. event loop threads used by the "native" front end.
+     */
+    uint32_t frontEndThreads;
+
+    /**
+     * Max. size (in bytes) of a request body the "native" front end receives in
+     * full before passing the request on. Larger bodies are passed on as they
+     * arrive, with at most `streamWindowBytes` of them unread at once.
+     */
+    uint64_t maxBufferedBodyBytes;
+
+    /**
+     * Max. size (in bytes) of a request body the "cpprest" front end accepts
+     * (0 for no limit). Its listener reads every body into memory in full, so
+     * larger bodies, or ones of unknown length, are turned away.
+     */
+    uint64_t maxCpprestBodyBytes;
+
+    /**
+     * How the master talks to storage nodes: "rpc" (see rpc.hpp) or "http".
+     */
+    std::string storageTransport;
+
+    /**
+     * Num. connections pooled per storage node (persistent RPC connections,
+     * or http_clients), opened at startup and reopened by the health checks
+     * (e.g. after the node has been down).
+     */
+    uint32_t connectionsPerNode;
+
+    /**
+     * Whether concurrent GETs of a key share their fetches from storage
+     * nodes (see SingleFlight).
+     */
+    bool coalesceGets;
+
+    /**
+     * A GET's request to a storage node is hedged (also sent to the blocks'
+     * other replicas) once it has taken longer than the `hedgePercentile`th
+     * percentile of the node's recent latencies, and at least `hedgeMinDelayMs`
+     * (see HedgePolicy). A percentile of 0 disables hedging.
+     */
+    double hedgePercentile;
+    uint32_t hedgeMinDelayMs;
+
+    /* Max. num. hedges, as a percentage of GETs' storage node requests */
+    double hedgeBudgetPercent;
+
     /**
      * Size of data (in bytes) each data block (i.e. Block object) stores.
      */
@@ -40,4 +122,30 @@ public:
 
     /* Maximum size of key in bytes/chars */
     uint32_t keyLengthMax;
+
+    /**
+     * Max. time (in milliseconds) spent on shutdown waiting for in-flight
+     * requests to finish.
+     */
+    uint32_t shutdownDrainMs;
+
+    /**
+     * Storage nodes serve RPCs on their PORT + `rpcPortOffset`.
+     */
+    uint32_t rpcPortOffset;
+
+    /* Send/receive buffer size (in bytes) of RPC sockets (0 keeps the OS default) */
+    uint32_t rpcSocketBufferBytes;
+
+    /**
+     * Directory shared with storage nodes on the same host, holding their
+     * local RPC sockets (and our shared memory rings). Empty uses TCP only.
+     */
+    std::string rpcLocalDir;
+
+    /**
+     * Size (in bytes) of each shared memory ring of a local RPC connection
+     * (0 sends payloads over the socket).
+     */
+    uint64_t rpcShmRingBytes;
 };
\ No newline at end of file
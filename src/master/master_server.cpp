@@ -1,9 +1,13 @@
 #include <cpprest/http_listener.h>
 #include <cpprest/json.h>
 #include <cpprest/http_client.h>
+#include <pplx/threadpool.h>
 
 #include <iostream>
+#include <sstream>
 #include <set>
+#include <deque>
+#include <optional>
 #include <map>
 #include <unordered_set>
 #include <chrono>
@@ -16,10 +20,20 @@
 #include "storage_node.hpp"
 #include "hash_ring.hpp"
 #include "master_config.hpp"
+#include "stream_window.hpp"
+#include "server_lifecycle.hpp"
+#include "native_front_end.hpp"
+#include "http_client_pool.hpp"
+#include "single_flight.hpp"
+#include "hedge_policy.hpp"
+#include "task_timer.hpp"
+#include "key_write_queue.hpp"
+#include "rpc.hpp"
 
 #include "utils.hpp"
 #include "config.hpp"
 #include "block.hpp"
+#include "crypto.hpp"
 #include "test_utils.hpp"
 #include "payloads.hpp"
 
@@ -52,6 +66,19 @@ public:
     std::map<std::string, std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>>> keyBlockNodeMap;
     std::mutex kbnMutex;
 
+    /**
+     * Stores a content hash of each block of each key, used to find 
+     * which blocks a delta PUT actually changes (see StoreEndpoint::deltaHandler()).
+     * 
+     * Mapping is of the form: { key -> [block 0 hash, block 1 hash, ...] }.
+     * 
+     * NOTE: 
+     * 
+     * Guarded by `kbnMutex`. Only keys written through this master 
+     * have hashes, i.e. they aren't recovered by syncWithStorageNodes().
+     */
+    std::map<std::string, std::shared_ptr<std::vector<uint32_t>>> keyBlockHashMap;
+
     /**
      * Stores our storage nodes, which are represented as StorageNode
      * objects (see storage_node.hpp).
@@ -61,21 +88,40 @@ public:
     std::map<uint32_t, std::shared_ptr<StorageNode>> storageNodes;
 
     /**
-     * Stores currently open connections to storage nodes.
+     * Pooled connections to each storage node, i.e. its RpcClient if
+     * config.storageTransport is "rpc", or its HttpClientPool otherwise.
+     * Both are thread-safe, and the maps are only modified on startup.
      * 
-     * Mapping is of the form: { storage node id -> http_client object }.
+     * Mappings are of the form: { storage node id -> RpcClient/HttpClientPool object }.
      */
-    std::map<uint32_t, std::shared_ptr<http_client>> openConnections;
-    std::mutex openConnectionsMutex;
+    std::map<uint32_t, std::shared_ptr<RpcClient>> rpcClients;
+    std::map<uint32_t, std::shared_ptr<HttpClientPool>> httpClientPools;
 
     /* Master-specific config parameters read from config.json */
     MasterConfig config;
 
+    /* Tracks in-flight requests, so shutdown can drain them (see startServer()) */
+    ServerLifecycle lifecycle;
+
+    /* Decides when GETs' storage node requests are hedged (see StoreEndpoint::getBlocksHedged()) */
+    HedgePolicy hedgePolicy;
+
+    /* Schedules delayed work, e.g. hedges and polls of slow readers, without blocking threads */
+    TaskTimer timer;
+
+    /* Serialises the writes (PUT, /append, /delta, DEL) of each key (see router()) */
+    KeyWriteQueue keyWrites;
+
     /* Default constructor */
     MasterServer(std::string configFilePath) 
-        : config(configFilePath)
+        : config(configFilePath),
+          hedgePolicy(
+              config.hedgePercentile,
+              config.hedgeBudgetPercent,
+              std::chrono::milliseconds(config.hedgeMinDelayMs))
     {
         initialiseStorageNodes();
+        warmUpConnections();
         syncWithStorageNodes();
     }
 
@@ -83,8 +129,18 @@ public:
 
     /**
      * Contains all handlers for our /store endpoint
+     * 
+     * NOTE:
+     * 
+     * Handlers never block on the storage nodes (or the client): each returns a 
+     * task that completes once it has replied, so pool threads are free to serve
+     * other requests in the meantime (see router()).
+     * 
+     * Continuations capture a shared_ptr to the endpoint (`self`) rather than `this`,
+     * and helpers' continuations capture `server` directly, as a handler's task can 
+     * outlive router()'s call (and a failed when_all can finish before its other tasks).
      */
-    class StoreEndpoint
+    class StoreEndpoint : public std::enable_shared_from_this<StoreEndpoint>
     {
     private:
         MasterServer *server;
@@ -92,402 +148,1725 @@ public:
     public:
         explicit StoreEndpoint(MasterServer *server) : server(server) {}
 
+        /**
+         * The blocks of a batch of a streamed GET, in order (along with the
+         * payloads they point into). Read-only once fetched, as concurrent
+         * GETs of the same batch share them (see fetchAhead()).
+         */
+        struct FetchedBatch
+        {
+            std::shared_ptr<std::map<uint32_t, Block>> blockMap;
+            std::vector<std::shared_ptr<std::vector<unsigned char>>> responsePayloads;
+        };
+
+        /* A batch of a streamed GET, fetched once `task` completes */
+        struct PendingBatch
+        {
+            uint64_t numBytes;
+            pplx::task<std::shared_ptr<FetchedBatch>> task;
+        };
+
+        /**
+         * State of a streamed GET, shared by its continuations (see getHandler()).
+         */
+        struct GetStream
+        {
+            std::string key;
+            uint32_t dataBlockSize;
+            uint64_t windowBytes;
+
+            // the key's blocks' nodes, of the form: {block num -> storage node id set}
+            std::shared_ptr<const std::map<uint32_t, std::set<uint32_t>>> blockNodeMap;
+
+            // each batch's node choices, of the form: {node id -> block num list}
+            std::vector<std::unordered_map<uint32_t, std::vector<uint32_t>>> batches;
+            size_t nextBatch = 0;
+
+            std::deque<PendingBatch> inFlight;
+            uint64_t inFlightBytes = 0;
+
+            concurrency::streams::producer_consumer_buffer<uint8_t> responseBuffer;
+        };
+
         /**
          * /store/{KEY}: GET
          * ---
          * Requests all of {KEY}'s blocks from the storage cluster
          * and returns them in order.
+         * 
+         * NOTE:
+         * 
+         * The response is streamed: blocks are fetched in batches of `streamBatchBytes`
+         * (each batch split across the nodes holding its blocks), and each batch is
+         * written to the response as soon as it and every batch before it have arrived.
+         * 
+         * At most `streamWindowBytes` are fetched ahead of what the client has read,
+         * so the master never holds the whole object, and the first byte goes out
+         * as soon as the first batch arrives (rather than the slowest node's last).
+         * 
+         * The status is only sent once the first batch has arrived, so a failing
+         * node still gets a 500 for small objects. A failure after that aborts the
+         * (chunked) response, so the client sees a truncated body rather than
+         * a short 200.
+         * 
+         * A node that is slow to send its part of a batch is hedged with the
+         * blocks' other replicas (see getBlocksHedged()).
          */
-        void getHandler(http_request request, std::string key) 
+        pplx::task<void> getHandler(http_request request, std::string key) 
         {
             std::cout << "GET req received: " << key << std::endl;
 
             // timing point: start
             auto start = std::chrono::high_resolution_clock::now();
 
-            // check key exists
-            if (server->keyBlockNodeMap.find(key) == server->keyBlockNodeMap.end())
+            // check key exists, and take a copy of its blocks' nodes
+            auto blockNodeMap = std::make_shared<std::map<uint32_t, std::set<uint32_t>>>();
+            {
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                auto it = server->keyBlockNodeMap.find(key);
+                if (it != server->keyBlockNodeMap.end())
+                    *blockNodeMap = *(it->second);
+            }
+
+            if (blockNodeMap->empty())
+            {
+                std::cout << "GET: failed - key doesn't exist" << std::endl;
+                request.reply(status_codes::InternalError);
+                return pplx::task_from_result();
+            }
+
+            auto stream = std::make_shared<GetStream>();
+            stream->key = key;
+            stream->dataBlockSize = server->config.dataBlockSize;
+            stream->windowBytes = server->config.streamWindowBytes;
+            stream->blockNodeMap = blockNodeMap;
+
+            uint32_t blocksPerBatch = std::max<uint32_t>(1, server->config.streamBatchBytes / stream->dataBlockSize);
+
+            /**
+             * For each block, we chose the first healthy storage node that
+             * stores it, and record our 'choice' in the block's batch.
+             */
+            uint32_t batchBlockCnt = blocksPerBatch;
+            for (auto &[blockNum, nodeIds] : *blockNodeMap)        
+            {
+                bool foundHealthy = false;
+                for (auto nodeId : nodeIds)
+                {
+                    std::shared_ptr<StorageNode> sn = server->storageNodes[nodeId];
+                    if (sn->isHealthy)
+                    {
+                        if (batchBlockCnt == blocksPerBatch)
+                        {
+                            stream->batches.emplace_back();
+                            batchBlockCnt = 0;
+                        }
+                        stream->batches.back()[nodeId].push_back(blockNum);
+                        batchBlockCnt++;
+                        foundHealthy = true;
+                        break;
+                    }
+                }
+
+                if (!foundHealthy)
+                    throw std::runtime_error("Error: no healthy nodes available for block " + std::to_string(blockNum));
+            }
+
+            fetchAhead(stream);
+
+            // wait for the first batch before committing to a status
+            auto self = shared_from_this();
+            return stream->inFlight.front().task
+            .then([self, stream, request](pplx::task<std::shared_ptr<FetchedBatch>> firstBatch) mutable
+            {
+                try
+                {
+                    firstBatch.get();
+                }
+                catch (const std::exception& e)
+                {
+                    std::cout << "GET: failed - " << e.what() << std::endl;
+                    request.reply(status_codes::InternalError);
+                    StoreEndpoint::abandonBatches(stream);
+                    return pplx::task_from_result();
+                }
+
+                http_response response(status_codes::OK);
+                response.set_body(stream->responseBuffer.create_istream());
+                request.reply(response);
+
+                return self->writeBatches(stream);
+            })
+            .then([stream, start](pplx::task<void> written)
+            {
+                try
+                {
+                    written.get();
+                }
+                catch (const std::exception& e)
+                {
+                    std::cout << "GET: failed mid-stream - " << e.what() << std::endl;
+                    StoreEndpoint::abandonBatches(stream);
+                    return stream->responseBuffer.close(std::ios_base::out, std::current_exception());
+                }
+
+                // timing point: end
+                auto end = std::chrono::high_resolution_clock::now();
+                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+                std::cout << "Total Time: " << duration.count() << " ms" << std::endl;
+
+                std::cout << "GET: successful" << std::endl;
+                return stream->responseBuffer.close(std::ios_base::out);
+            });
+        }
+
+        /**
+         * Helper for getHandler().
+         * 
+         * Starts fetching `stream`'s next batches, while they fit in its
+         * window (the next one is always let through if none are in flight).
+         * 
+         * NOTE:
+         * 
+         * If `coalesceGets` is set, a batch already being fetched by another GET
+         * of the key (from the same nodes) is joined rather than fetched again,
+         * so a burst of GETs of a hot key costs the storage nodes one read (see
+         * SingleFlight). Writes of the key stop it being joined (see router()).
+         */
+        void fetchAhead(std::shared_ptr<GetStream> stream)
+        {
+            while (stream->nextBatch < stream->batches.size())
+            {
+                auto &nodeBlockMap = stream->batches[stream->nextBatch];
+
+                uint64_t batchBytes = 0;
+                for (auto &[nodeId, blockNums] : nodeBlockMap)
+                    batchBytes += static_cast<uint64_t>(blockNums.size()) * stream->dataBlockSize;
+
+                if (!stream->inFlight.empty() && stream->inFlightBytes + batchBytes > stream->windowBytes)
+                    break;
+
+                auto self = shared_from_this();
+                auto fetch = [self, key = stream->key, nodeBlockMap, blockNodeMap = stream->blockNodeMap]()
+                {
+                    // call `getBlocksHedged` for each of the batch's nodes
+                    std::vector<pplx::task<std::shared_ptr<FetchedBatch>>> nodeTasks;
+                    for (auto &[nodeId, blockNums] : nodeBlockMap)
+                        nodeTasks.push_back(self->getBlocksHedged(nodeId, key, blockNums, blockNodeMap));
+
+                    return pplx::when_all(nodeTasks.begin(), nodeTasks.end())
+                    .then([](std::vector<std::shared_ptr<FetchedBatch>> nodeBatches)
+                    {
+                        return StoreEndpoint::mergeBatches(nodeBatches);
+                    });
+                };
+
+                PendingBatch pending;
+                pending.numBytes = batchBytes;
+                if (server->config.coalesceGets)
+                    pending.task = server->getFlights.run(stream->key, StoreEndpoint::batchFlightKey(nodeBlockMap), fetch);
+                else
+                    pending.task = fetch();
+
+                stream->inFlight.push_back(std::move(pending));
+                stream->inFlightBytes += batchBytes;
+                stream->nextBatch++;
+            }
+        }
+
+        /**
+         * Helper for fetchAhead().
+         * 
+         * Returns the key identifying a batch's fetch among its key's, i.e. its
+         * nodes' block num lists (in node order), of the form: "node:block,block;...".
+         */
+        static std::string batchFlightKey(const std::unordered_map<uint32_t, std::vector<uint32_t>> &nodeBlockMap)
+        {
+            std::map<uint32_t, const std::vector<uint32_t>*> ordered;
+            for (auto &[nodeId, blockNums] : nodeBlockMap)
+                ordered[nodeId] = &blockNums;
+
+            std::string flightKey;
+            for (auto &[nodeId, blockNums] : ordered)
+            {
+                flightKey += std::to_string(nodeId) + ":";
+                for (uint32_t blockNum : *blockNums)
+                    flightKey += std::to_string(blockNum) + ",";
+                flightKey += ";";
+            }
+            return flightKey;
+        }
+
+        /**
+         * Helper for getHandler().
+         * 
+         * Writes `stream`'s in-flight batches to its response buffer in order,
+         * each once it has arrived, fetching further batches as the window allows.
+         */
+        pplx::task<void> writeBatches(std::shared_ptr<GetStream> stream)
+        {
+            if (stream->inFlight.empty())
+                return pplx::task_from_result();
+
+            PendingBatch pending = stream->inFlight.front();
+            stream->inFlight.pop_front();
+
+            auto self = shared_from_this();
+            return pending.task
+            .then([server = this->server, stream, numBytes = pending.numBytes](std::shared_ptr<FetchedBatch> fetched)
+            {
+                // write the batch's blocks in order
+                auto payloadBuffer = std::make_shared<std::vector<unsigned char>>();
+                payloadBuffer->reserve(numBytes);
+                for (auto &[blockNum, block] : *(fetched->blockMap))
+                    payloadBuffer->insert(payloadBuffer->end(), block.dataStart, block.dataEnd);
+
+                return stream->responseBuffer.putn_nocopy(payloadBuffer->data(), payloadBuffer->size())
+                .then([server, stream, payloadBuffer](size_t numWritten)
+                {
+                    /**
+                     * The response buffer doesn't push back on us, so wait for the client to 
+                     * read enough of what we've written before fetching further ahead.
+                     */
+                    return StoreEndpoint::waitForReader(
+                        server, stream, stream->responseBuffer.in_avail(), std::chrono::steady_clock::now(), STREAM_POLL_MIN);
+                });
+            })
+            .then([self, stream, numBytes = pending.numBytes](bool readerKeptUp)
+            {
+                if (!readerKeptUp)
+                    throw std::runtime_error("client stopped reading");
+
+                stream->inFlightBytes -= numBytes;
+                self->fetchAhead(stream);
+                return self->writeBatches(stream);
+            });
+        }
+
+        /**
+         * Helper for getHandler().
+         * 
+         * Observes `stream`'s remaining in-flight batches, so their fetches
+         * can finish (or fail) after the response is abandoned.
+         */
+        static void abandonBatches(std::shared_ptr<GetStream> stream)
+        {
+            for (PendingBatch &pending : stream->inFlight)
+            {
+                pending.task.then([](pplx::task<std::shared_ptr<FetchedBatch>> fetched)
+                {
+                    try { fetched.get(); } catch (const std::exception &e) {}
+                });
+            }
+            stream->inFlight.clear();
+        }
+
+        // how long a streamed GET waits on a client that has stopped reading
+        static constexpr std::chrono::seconds STREAM_STALL_TIMEOUT{30};
+
+        // bounds of the interval a streamed GET polls a slow client at
+        static constexpr std::chrono::milliseconds STREAM_POLL_MIN{1};
+        static constexpr std::chrono::milliseconds STREAM_POLL_MAX{16};
+
+        /**
+         * Helper for getHandler().
+         * 
+         * Completes once at most `windowBytes` of `stream`'s response are waiting
+         * to be read by the client, with false if the client makes no progress
+         * for `STREAM_STALL_TIMEOUT`.
+         * 
+         * NOTE:
+         * 
+         * The response buffer has no read notification, so this polls. Polls are
+         * scheduled on the server's TaskTimer, so no thread waits between them,
+         * and their interval (from `pollInterval`) doubles up to STREAM_POLL_MAX
+         * while the client makes no progress.
+         */
+        static pplx::task<bool> waitForReader(
+            MasterServer *server,
+            std::shared_ptr<GetStream> stream,
+            size_t lastUnread,
+            std::chrono::steady_clock::time_point lastProgress,
+            std::chrono::milliseconds pollInterval
+        )
+        {
+            size_t unread = stream->responseBuffer.in_avail();
+            auto now = std::chrono::steady_clock::now();
+
+            if (unread <= stream->windowBytes)
+                return pplx::task_from_result(true);
+
+            if (unread < lastUnread)
+            {
+                lastProgress = now;
+                pollInterval = STREAM_POLL_MIN;
+            }
+            else if (now - lastProgress > STREAM_STALL_TIMEOUT)
+                return pplx::task_from_result(false);
+
+            return server->timer.after(pollInterval)
+            .then([server, stream, unread, lastProgress, pollInterval]()
+            {
+                auto nextInterval = std::min(pollInterval * 2, STREAM_POLL_MAX);
+                return StoreEndpoint::waitForReader(server, stream, unread, lastProgress, nextInterval);
+            });
+        }
+
+        /**
+         * State of a hedged request (see getBlocksHedged()), shared by its
+         * original request and its hedge.
+         */
+        struct HedgedRead
+        {
+            std::mutex mutex;
+            pplx::task_completion_event<std::shared_ptr<FetchedBatch>> result;
+            uint32_t numPending = 1;
+            bool done = false;
+        };
+
+        /**
+         * Helper for fetchAhead().
+         * 
+         * Retrieves blocks `blockNums` for key `key` from node `storageNodeId`,
+         * hedging the request if it's slow: once it has taken longer than the 
+         * node's hedge delay (see HedgePolicy), the blocks are also requested
+         * from their other healthy replicas (in `blockNodeMap`), and whichever
+         * answers first is used.
+         * 
+         * NOTE:
+         * 
+         * Hedges are only sent if every block has another healthy replica, and
+         * the hedge budget allows it. The returned task only fails once every 
+         * request sent has failed.
+         */
+        pplx::task<std::shared_ptr<FetchedBatch>> getBlocksHedged(
+            uint32_t storageNodeId,
+            std::string key,
+            const std::vector<uint32_t> &blockNums,
+            std::shared_ptr<const std::map<uint32_t, std::set<uint32_t>>> blockNodeMap
+        )
+        {
+            auto read = std::make_shared<HedgedRead>();
+            MasterServer *server = this->server;
+
+            fetchBlocks(storageNodeId, key, blockNums)
+            .then([server, read](pplx::task<std::shared_ptr<FetchedBatch>> fetched)
+            {
+                StoreEndpoint::settleHedgedRead(server, read, fetched, false);
+            });
+
+            server->hedgePolicy.recordRequest();
+
+            bool hasReplicas = true;
+            for (uint32_t blockNum : blockNums)
+                hasReplicas = hasReplicas && blockNodeMap->at(blockNum).size() > 1;
+
+            std::optional<std::chrono::microseconds> delay = server->hedgePolicy.hedgeDelay(storageNodeId);
+            if (!hasReplicas || !delay)
+                return pplx::create_task(read->result);
+
+            auto self = shared_from_this();
+            server->timer.after(*delay)
+            .then([self, server, read, storageNodeId, key, blockNums, blockNodeMap]()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(read->mutex);
+                    if (read->done)
+                        return;
+                }
+
+                // choose another healthy replica for each block
+                std::map<uint32_t, std::vector<uint32_t>> hedgeNodeBlockMap;
+                for (uint32_t blockNum : blockNums)
+                {
+                    bool foundReplica = false;
+                    for (uint32_t nodeId : blockNodeMap->at(blockNum))
+                    {
+                        if (nodeId != storageNodeId && server->storageNodes[nodeId]->isHealthy)
+                        {
+                            hedgeNodeBlockMap[nodeId].push_back(blockNum);
+                            foundReplica = true;
+                            break;
+                        }
+                    }
+
+                    if (!foundReplica)
+                        return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(read->mutex);
+                    if (read->done || !server->hedgePolicy.tryHedge())
+                        return;
+                    read->numPending++;
+                }
+
+                pplx::task<std::shared_ptr<FetchedBatch>> hedge;
+                try
+                {
+                    std::vector<pplx::task<std::shared_ptr<FetchedBatch>>> hedgeTasks;
+                    for (auto &[nodeId, hedgeBlockNums] : hedgeNodeBlockMap)
+                        hedgeTasks.push_back(self->fetchBlocks(nodeId, key, hedgeBlockNums));
+
+                    hedge = pplx::when_all(hedgeTasks.begin(), hedgeTasks.end())
+                    .then([](std::vector<std::shared_ptr<FetchedBatch>> nodeBatches)
+                    {
+                        return StoreEndpoint::mergeBatches(nodeBatches);
+                    });
+                }
+                catch (const std::exception &e)
+                {
+                    hedge = pplx::task_from_exception<std::shared_ptr<FetchedBatch>>(std::current_exception());
+                }
+
+                hedge.then([server, read](pplx::task<std::shared_ptr<FetchedBatch>> fetched)
+                {
+                    StoreEndpoint::settleHedgedRead(server, read, fetched, true);
+                });
+            });
+
+            return pplx::create_task(read->result);
+        }
+
+        /**
+         * Helper for getBlocksHedged().
+         * 
+         * Completes `read` with `fetched`'s blocks if it's the first request to
+         * succeed, or with its error if it's the last to fail.
+         */
+        static void settleHedgedRead(
+            MasterServer *server,
+            std::shared_ptr<HedgedRead> read,
+            pplx::task<std::shared_ptr<FetchedBatch>> fetched,
+            bool isHedge
+        )
+        {
+            std::shared_ptr<FetchedBatch> batch;
+            std::exception_ptr error;
+            try
+            {
+                batch = fetched.get();
+            }
+            catch (const std::exception &e)
+            {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(read->mutex);
+            read->numPending--;
+            if (read->done)
+                return;
+
+            if (batch)
+            {
+                read->done = true;
+                if (isHedge)
+                    server->hedgePolicy.recordHedgeWon();
+                read->result.set(batch);
+            }
+            else if (read->numPending == 0)
+            {
+                read->done = true;
+                read->result.set_exception(error);
+            }
+        }
+
+        /**
+         * Helper for getBlocksHedged().
+         * 
+         * Retrieves blocks `blockNums` for key `key` from node `storageNodeId`
+         * (see getBlocks()), recording how long the node took to answer.
+         */
+        pplx::task<std::shared_ptr<FetchedBatch>> fetchBlocks(
+            uint32_t storageNodeId,
+            std::string key,
+            const std::vector<uint32_t> &blockNums
+        )
+        {
+            auto fetched = std::make_shared<FetchedBatch>();
+            fetched->blockMap = std::make_shared<std::map<uint32_t, Block>>();
+            fetched->responsePayloads.push_back(std::make_shared<std::vector<unsigned char>>());
+
+            auto start = std::chrono::steady_clock::now();
+            return getBlocks(storageNodeId, key, blockNums, fetched->blockMap, fetched->responsePayloads.back())
+            .then([server = this->server, storageNodeId, start, fetched]()
+            {
+                auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                server->hedgePolicy.recordLatency(storageNodeId, latency);
+                return fetched;
+            });
+        }
+
+        /**
+         * Helper for fetchAhead() and getBlocksHedged().
+         * 
+         * Returns the blocks of `batches` (fetched from different nodes) as one batch.
+         */
+        static std::shared_ptr<FetchedBatch> mergeBatches(std::vector<std::shared_ptr<FetchedBatch>> batches)
+        {
+            auto merged = std::make_shared<FetchedBatch>();
+            merged->blockMap = std::make_shared<std::map<uint32_t, Block>>();
+            for (auto &batch : batches)
+            {
+                merged->blockMap->insert(batch->blockMap->begin(), batch->blockMap->end());
+                merged->responsePayloads.insert(
+                    merged->responsePayloads.end(), batch->responsePayloads.begin(), batch->responsePayloads.end());
+            }
+            return merged;
+        }
+
+        /**
+         * Helper for getHandler().
+         * 
+         * Retreives blocks `blockNums` for key `key` from node `storageNodeId`.
+         * 
+         * NOTE:
+         * 
+         * `blockMap` is populated by this function (see getHandler() below).
+         */
+        pplx::task<void> getBlocks(
+            uint32_t storageNodeId,
+            std::string key,
+            const std::vector<uint32_t> &blockNums,
+            std::shared_ptr<std::map<uint32_t, Block>> blockMap,
+            std::shared_ptr<std::vector<unsigned char>> responsePayload
+        )
+        {
+            std::shared_ptr<StorageNode> sn = server->storageNodes[storageNodeId];
+
+            // request payload is the list of block numbers
+            RpcMessage message(RPC_GET_BLOCKS, key);
+            message.appendRef(reinterpret_cast<const unsigned char*>(blockNums.data()), blockNums.size() * sizeof(uint32_t));
+
+            return server->callStorageNode(sn, message, "getBlocks")
+
+            // deserialize payload and populate block map
+            .then([blockMap, responsePayload](std::vector<unsigned char> payload)
+            {
+                *responsePayload = std::move(payload);
+                std::vector<Block> blocks = Block::deserialize(*(responsePayload));
+                for (auto &block : blocks)
+                {
+                    blockMap->insert({block.blockNum, std::move(block)});
+                }
+            });
+        }
+
+        /**
+         * /store/{KEY}: PUT
+         * ---
+         * Given {KEY} and a data payload, breaks payload into blocks and 
+         * distributes them across the storage cluster.
+         * 
+         * NOTE:
+         * 
+         * The payload is streamed (see streamBlocks()), so with the native
+         * front end the master never holds more than `streamWindowBytes` of
+         * it at once (cpprest's listener has already read it all in, which
+         * is why it caps bodies at `maxCpprestBodyBytes`).
+         */
+        pplx::task<void> putHandler(http_request request, std::string key) 
+        {
+            std::cout << "PUT req received: " << key << std::endl;
+
+            return streamBlocks(request, key);
+        }
+
+        /**
+         * State of a streamed PUT, shared by its continuations (see streamBlocks()).
+         */
+        struct PutStream
+        {
+            http_request request;
+            std::string key;
+            std::string stagedKey;
+            std::chrono::high_resolution_clock::time_point start;
+
+            uint32_t dataBlockSize;
+            uint32_t batchBytes;
+            uint32_t blockCnt = 0;
+
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap;
+            std::shared_ptr<std::vector<uint32_t>> blockHashes;
+            std::shared_ptr<StreamWindow> window;
+
+            // the key's kbn entry before the upload (if any), still read until it's committed
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> replacedBlockNodeMap;
+
+            // last send to each node, which its next batch is chained after
+            std::map<uint32_t, pplx::task<void>> nodeTasks;
+
+            // completes once each sent batch's bytes are back in the window, oldest first
+            std::deque<pplx::task<void>> batchTasks;
+        };
+
+        /**
+         * Helper for putHandler().
+         * 
+         * Reads `request`'s body in batches of `streamBatchBytes`, breaking each into
+         * blocks and sending them to their storage nodes as soon as it's read, then
+         * replies to `request` once every block is stored.
+         * 
+         * NOTE:
+         * 
+         * Blocks are stored under the key's staged key (see ApiUtils::stagedKey()), so
+         * the key's existing blocks and kbn entry are left as they are, and GETs keep
+         * reading its old value until the upload is complete. Each node's first batch
+         * is sent as a /store PUT (replacing any blocks staged by an interrupted PUT),
+         * and its later batches as /append PUTs, chained after the previous one so
+         * they arrive in order. Different nodes are sent to in parallel.
+         * 
+         * The upload is then committed, or its staged blocks deleted if it failed
+         * (see finishStream()).
+         * 
+         * A batch's bytes are held in the upload's StreamWindow until all its nodes have
+         * stored it, so reading stalls whenever `streamWindowBytes` are in flight. The
+         * stall is a continuation on the oldest batch, so no thread waits on it. Only
+         * the native front end passes the stall on to the client, by no longer reading
+         * its socket (see NativeFrontEnd).
+         */
+        pplx::task<void> streamBlocks(http_request request, std::string key)
+        {
+            auto stream = std::make_shared<PutStream>();
+            stream->request = request;
+            stream->key = key;
+            stream->stagedKey = ApiUtils::stagedKey(key);
+
+            // timing point: start
+            stream->start = std::chrono::high_resolution_clock::now();
+
+            stream->dataBlockSize = server->config.dataBlockSize;
+            stream->batchBytes = std::max(stream->dataBlockSize, server->config.streamBatchBytes / stream->dataBlockSize * stream->dataBlockSize);
+
+            stream->blockNodeMap = std::make_shared<std::map<uint32_t, std::set<uint32_t>>>();
+            stream->blockHashes = std::make_shared<std::vector<uint32_t>>();
+            stream->window = std::make_shared<StreamWindow>(server->config.streamWindowBytes);
+
+            {
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                auto it = server->keyBlockNodeMap.find(key);
+                if (it != server->keyBlockNodeMap.end())
+                    stream->replacedBlockNodeMap = it->second;
+            }
+
+            auto self = shared_from_this();
+            return streamNextBatch(stream)
+            .then([self, stream](pplx::task<void> streamed)
+            {
+                try
+                {
+                    streamed.get();
+                }
+                catch (const std::exception &e)
+                {
+                    stream->window->fail(e.what());
+                }
+
+                // wait for every batch, so none outlives the request
+                return pplx::when_all(stream->batchTasks.begin(), stream->batchTasks.end());
+            })
+            .then([self, stream]()
+            {
+                return self->finishStream(stream);
+            });
+        }
+
+        /**
+         * Helper for streamBlocks().
+         * 
+         * Reads and sends `stream`'s next batch once it fits in the window, 
+         * then the batches after it. Completes once the body is read (or 
+         * the stream has failed).
+         */
+        pplx::task<void> streamNextBatch(std::shared_ptr<PutStream> stream)
+        {
+            auto self = shared_from_this();
+
+            if (!stream->window->tryAcquire(stream->batchBytes))
+            {
+                if (stream->window->failed() || stream->batchTasks.empty())
+                    return pplx::task_from_result();
+
+                // retry once the oldest batch is stored
+                pplx::task<void> oldest = stream->batchTasks.front();
+                stream->batchTasks.pop_front();
+                return oldest.then([self, stream]()
+                {
+                    return self->streamNextBatch(stream);
+                });
+            }
+
+            // read the next batch (short only at the end of the body)
+            auto batch = std::make_shared<std::vector<unsigned char>>(stream->batchBytes);
+            return readBatch(stream->request.body(), batch, 0)
+            .then([self, stream, batch](pplx::task<size_t> read)
+            {
+                size_t batchSize = 0;
+                try
+                {
+                    batchSize = read.get();
+                }
+                catch (const std::exception &e)
+                {
+                    stream->window->release(stream->batchBytes);
+                    stream->window->fail(std::string("reading request body - ") + e.what());
+                    return pplx::task_from_result();
+                }
+
+                if (batchSize == 0)
+                {
+                    stream->window->release(stream->batchBytes);
+                    return pplx::task_from_result();
+                }
+                batch->resize(batchSize);
+
+                self->sendBatch(stream, batch);
+
+                if (batchSize < stream->batchBytes)
+                    return pplx::task_from_result();
+                return self->streamNextBatch(stream);
+            });
+        }
+
+        /**
+         * Helper for streamBlocks().
+         * 
+         * Reads from `body` into `batch` (from offset `batchSize`) until it's
+         * full or the body ends. Completes with the num. bytes read in total.
+         */
+        static pplx::task<size_t> readBatch(
+            concurrency::streams::istream body,
+            std::shared_ptr<std::vector<unsigned char>> batch,
+            size_t batchSize
+        )
+        {
+            if (batchSize == batch->size())
+                return pplx::task_from_result(batchSize);
+
+            return body.streambuf().getn(batch->data() + batchSize, batch->size() - batchSize)
+            .then([body, batch, batchSize](size_t numRead)
+            {
+                if (numRead == 0)
+                    return pplx::task_from_result(batchSize);
+                return StoreEndpoint::readBatch(body, batch, batchSize + numRead);
+            });
+        }
+
+        /**
+         * Helper for streamBlocks().
+         * 
+         * Breaks `batch` into blocks and sends each to its storage nodes,
+         * handing the batch's bytes back to the window once all have stored it.
+         */
+        void sendBatch(std::shared_ptr<PutStream> stream, std::shared_ptr<std::vector<unsigned char>> batch)
+        {
+            std::vector<uint32_t> hashes = MasterServer::blockHashes(*batch, stream->dataBlockSize);
+            stream->blockHashes->insert(stream->blockHashes->end(), hashes.begin(), hashes.end());
+
+            /**
+             * Break up the batch into blocks and assign each block 
+             * to R storage nodes, where R is our replication factor.
+             */
+            uint32_t batchSize = batch->size();
+            std::unordered_map<uint32_t, std::shared_ptr<std::vector<Block>>> nodeBlockMap;
+            for (uint32_t i = 0; i < batchSize; i += stream->dataBlockSize)
+            {
+                uint32_t blockNum = stream->blockCnt++;
+                auto blockStart = batch->begin() + i;
+                auto blockEnd = batch->begin() + std::min(i + stream->dataBlockSize, batchSize);
+                Block block(stream->key, blockNum, blockEnd - blockStart, blockStart, blockEnd);
+
+                for (uint32_t nodeId : server->findBlockNodes(stream->key, blockNum))
+                {
+                    auto &blocks = nodeBlockMap[nodeId];
+                    if (!blocks)
+                        blocks = std::make_shared<std::vector<Block>>();
+                    blocks->push_back(block);
+                }
+            }
+
+            /**
+             * Send each storage node its blocks of the batch
+             */
+            auto self = shared_from_this();
+            std::vector<pplx::task<void>> sendTasks;
+            for (auto &[nodeId, blocks] : nodeBlockMap)
+            {
+                uint32_t storageNodeId = nodeId;
+                std::shared_ptr<std::vector<Block>> nodeBlocks = blocks;
+
+                auto it = stream->nodeTasks.find(storageNodeId);
+                pplx::task<void> task = (it == stream->nodeTasks.end())
+                    ? sendBlocks(storageNodeId, stream->stagedKey, *nodeBlocks, stream->blockNodeMap, nullptr)
+                    : it->second.then([self, stream, storageNodeId, nodeBlocks, batch]()
+                    {
+                        return self->appendBlocks(storageNodeId, stream->stagedKey, *nodeBlocks, stream->blockNodeMap, UINT32_MAX);
+                    });
+
+                stream->nodeTasks[storageNodeId] = task;
+                sendTasks.push_back(task);
+            }
+
+            // hand the batch's bytes back once all its nodes have stored it
+            stream->batchTasks.push_back(
+                pplx::when_all(sendTasks.begin(), sendTasks.end())
+                .then([window = stream->window, batch, batchBytes = stream->batchBytes](pplx::task<void> allTasks)
+                {
+                    try
+                    {
+                        allTasks.get();
+                    }
+                    catch (const std::exception &e)
+                    {
+                        window->fail(e.what());
+                    }
+                    window->release(batchBytes);
+                })
+            );
+        }
+
+        /**
+         * Helper for streamBlocks().
+         *
+         * Once all `stream`'s batches are done, commits the upload if they were
+         * all stored (see commitStream()), or else deletes its staged blocks,
+         * leaving the key's old value as it was. Then replies to its request.
+         */
+        pplx::task<void> finishStream(std::shared_ptr<PutStream> stream)
+        {
+            if (!stream->window->failed())
+                return commitStream(stream);
+
+            // a failed send may still have stored blocks that weren't recorded
+            std::vector<pplx::task<void>> delBlockTasks;
+            for (auto &[nodeId, task] : stream->nodeTasks)
+                delBlockTasks.push_back(deleteBlocks(nodeId, stream->stagedKey, stream->blockNodeMap));
+
+            return pplx::when_all(delBlockTasks.begin(), delBlockTasks.end())
+            .then([stream](pplx::task<void> allTasks)
+            {
+                try
+                {
+                    allTasks.get();
+                }
+                catch (const std::exception &e)
+                {
+                    std::cout << "PUT: failed to delete staged blocks - " << e.what() << std::endl;
+                }
+
+                std::cout << "PUT: failed - " << stream->window->error() << std::endl;
+                stream->request.reply(status_codes::InternalError);
+            });
+        }
+
+        /**
+         * Helper for finishStream().
+         *
+         * Renames `stream`'s staged key to its key on every node it stored to,
+         * swaps the key's kbn entry for the upload's, deletes the key's old
+         * blocks on nodes the upload didn't store to, then replies to its request.
+         *
+         * NOTE:
+         *
+         * Nodes are renamed in parallel, so a GET during the renames may read
+         * either value's blocks from each node. If a rename fails, the key is
+         * left part old and part new, so it's deleted everywhere instead.
+         */
+        pplx::task<void> commitStream(std::shared_ptr<PutStream> stream)
+        {
+            std::vector<uint32_t> storedNodeIds;
+            std::vector<pplx::task<bool>> renameTasks;
+            for (auto &[nodeId, task] : stream->nodeTasks)
+            {
+                storedNodeIds.push_back(nodeId);
+                renameTasks.push_back(
+                    renameBlocks(nodeId, stream->stagedKey, stream->key, stream->replacedBlockNodeMap)
+                    .then([](pplx::task<void> renamed)
+                    {
+                        try
+                        {
+                            renamed.get();
+                            return true;
+                        }
+                        catch (const std::exception &e)
+                        {
+                            std::cout << "PUT: failed to commit staged blocks - " << e.what() << std::endl;
+                            return false;
+                        }
+                    })
+                );
+            }
+
+            auto self = shared_from_this();
+            return pplx::when_all(renameTasks.begin(), renameTasks.end())
+            .then([self, stream, storedNodeIds](std::vector<bool> renamed)
+            {
+                bool committed = std::find(renamed.begin(), renamed.end(), false) == renamed.end();
+                std::set<uint32_t> stored(storedNodeIds.begin(), storedNodeIds.end());
+
+                // update kbn
+                {
+                    std::lock_guard<std::mutex> lock(self->server->kbnMutex);
+                    if (committed)
+                    {
+                        self->server->keyBlockNodeMap[stream->key] = stream->blockNodeMap;
+                        self->server->keyBlockHashMap[stream->key] = stream->blockHashes;
+                    }
+                    else
+                    {
+                        self->server->keyBlockNodeMap.erase(stream->key);
+                        self->server->keyBlockHashMap.erase(stream->key);
+                    }
+                }
+
+                /**
+                 * Delete the key's blocks the kbn no longer points to
+                 */
+                std::set<uint32_t> replacedNodeIds;
+                if (stream->replacedBlockNodeMap)
+                {
+                    std::lock_guard<std::mutex> lock(self->server->kbnMutex);
+                    for (auto &[blockNum, nodeIds] : *(stream->replacedBlockNodeMap))
+                        replacedNodeIds.insert(nodeIds.begin(), nodeIds.end());
+                }
+
+                std::vector<pplx::task<void>> delBlockTasks;
+                for (uint32_t nodeId : replacedNodeIds)
+                {
+                    if (stored.find(nodeId) == stored.end())
+                        delBlockTasks.push_back(self->deleteBlocks(nodeId, stream->key, stream->replacedBlockNodeMap));
+                }
+
+                if (!committed)
+                {
+                    for (size_t i = 0; i < storedNodeIds.size(); i++)
+                    {
+                        uint32_t nodeId = storedNodeIds[i];
+                        if (renamed[i])
+                        {
+                            delBlockTasks.push_back(self->deleteBlocks(nodeId, stream->key, stream->blockNodeMap));
+                            continue;
+                        }
+
+                        delBlockTasks.push_back(self->deleteBlocks(nodeId, stream->stagedKey, stream->blockNodeMap));
+                        if (replacedNodeIds.find(nodeId) != replacedNodeIds.end())
+                            delBlockTasks.push_back(self->deleteBlocks(nodeId, stream->key, stream->replacedBlockNodeMap));
+                    }
+                }
+
+                return pplx::when_all(delBlockTasks.begin(), delBlockTasks.end())
+                .then([stream, committed](pplx::task<void> allTasks)
+                {
+                    try
+                    {
+                        allTasks.get();
+                    }
+                    catch (const std::exception &e)
+                    {
+                        std::cout << "PUT: failed to delete stale blocks - " << e.what() << std::endl;
+                    }
+
+                    if (!committed)
+                    {
+                        std::cout << "PUT: failed - couldn't commit staged blocks" << std::endl;
+                        stream->request.reply(status_codes::InternalError);
+                        return;
+                    }
+
+                    // timing point: end
+                    auto end = std::chrono::high_resolution_clock::now();
+                    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - stream->start);
+                    std::cout << "Total Time: " << duration.count() << " ms (" << stream->blockCnt << " blocks streamed)" << std::endl;
+
+                    std::cout << "PUT: successful" << std::endl;
+
+                    // send success response
+                    http_response response(status_codes::OK);
+                    stream->request.reply(response);
+                });
+            });
+        }
+
+        /**
+         * Helper for commitStream().
+         *
+         * Moves key `fromKey`'s blocks on storage node `storageNodeId` to key
+         * `key`, replacing the node's blocks of `key`, where `replacedBlockNodeMap`
+         * maps those (if any) to the nodes storing them.
+         */
+        pplx::task<void> renameBlocks(
+            uint32_t storageNodeId,
+            std::string fromKey,
+            std::string key,
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> replacedBlockNodeMap
+        )
+        {
+            std::shared_ptr<StorageNode> sn = server->storageNodes[storageNodeId];
+
+            RpcMessage message(RPC_RENAME_KEY, key);
+            message.append(std::vector<unsigned char>(fromKey.begin(), fromKey.end()));
+
+            return server->callStorageNode(sn, message, "renameBlocks")
+
+            // update node's stats
+            .then([server = this->server, sn, replacedBlockNodeMap](std::vector<unsigned char> payload)
+            {
+                Payloads::SizeInfo sizeInfo = Payloads::SizeInfo::deserialize(payload);
+
+                // the node's old blocks of the key are replaced
+                if (replacedBlockNodeMap)
+                {
+                    std::lock_guard<std::mutex> lock(server->kbnMutex);
+                    uint32_t existingBlocks = 0;
+                    for (auto &[blockNum, nodeIds] : *(replacedBlockNodeMap))
+                    {
+                        if (nodeIds.find(sn->id) != nodeIds.end())
+                            existingBlocks++;
+                    }
+                    sn->stats.blocksStored -= existingBlocks;
+                }
+
+                server->updateNodeDataSizes(sn, sizeInfo);
+            });
+        }
+
+        /**
+         * Helper for deltaHandler().
+         * 
+         * Breaks `requestPayload` into blocks and distributes them across 
+         * the storage cluster as {KEY}'s new data, then replies to `request`.
+         */
+        pplx::task<void> storeBlocks(http_request request, std::string key, std::shared_ptr<std::vector<unsigned char>> requestPayload)
+        {
+            // timing point: start
+            auto start = std::chrono::high_resolution_clock::now();
+
+            /**
+             * blockNodeMap maps each block num. to a list of nodes that store it.
+             * 
+             * i.e. {block num -> [nodeA, nodeB, ...]}
+             */
+            auto blockNodeMap = std::make_shared<std::map<uint32_t, std::set<uint32_t>>>();
+            auto blockHashes = std::make_shared<std::vector<uint32_t>>(
+                MasterServer::blockHashes(*requestPayload, server->config.dataBlockSize)
+            );
+
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> replacedBlockNodeMap;
+            {
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                auto it = server->keyBlockNodeMap.find(key);
+                if (it != server->keyBlockNodeMap.end())
+                    replacedBlockNodeMap = it->second;
+            }
+
+            std::vector<pplx::task<void>> sendBlockTasks;
+
+            /**
+             * Break up payload data into blocks and assign each block 
+             * to R storage nodes, where R is our replication factor.
+             */
+            uint32_t payloadSize = requestPayload->size();
+            uint32_t blockCnt = 0;
+
+            std::unordered_map<uint32_t, std::vector<Block>> nodeBlockMap;
+
+            for (uint32_t i = 0; i < payloadSize; i += server->config.dataBlockSize) 
+            {
+                // construct the block
+                uint32_t blockNum = blockCnt++;
+                auto blockStart = requestPayload->begin() + i;
+                auto blockEnd = requestPayload->begin() + std::min(i + server->config.dataBlockSize, payloadSize);
+                auto dataSize = blockEnd - blockStart;
+
+                Block block(key, blockNum, dataSize, blockStart, blockEnd);
+
+                // add the block to its storage nodes' block lists
+                for (uint32_t nodeId : server->findBlockNodes(key, blockNum))
+                    nodeBlockMap[nodeId].push_back(block);
+            }
+
+            /**
+             * Send each storage node its block list
+             */
+            for (auto &p : nodeBlockMap)
+            {
+                uint32_t storageNodeId = p.first;
+                std::vector<Block> &blocks = p.second;
+
+                auto task = sendBlocks(storageNodeId, key, blocks, blockNodeMap, replacedBlockNodeMap);
+                sendBlockTasks.push_back(task);
+            }
+
+            // reply once all `sendBlocks` tasks have finished
+            return pplx::when_all(sendBlockTasks.begin(), sendBlockTasks.end())
+            .then([server = this->server, request, key, requestPayload, blockNodeMap, blockHashes, start](pplx::task<void> allTasks)
+            {
+                try
+                {
+                    allTasks.get();
+
+                    // update kbn
+                    std::lock_guard<std::mutex> lock(server->kbnMutex);
+                    server->keyBlockNodeMap[key] = blockNodeMap;
+                    server->keyBlockHashMap[key] = blockHashes;
+                }
+                catch (const std::exception& e)
+                {
+                    std::cout << "PUT: failed - " << e.what() << std::endl;
+                    request.reply(status_codes::InternalError);
+                    return;
+                }
+
+                // timing point: end
+                auto end = std::chrono::high_resolution_clock::now();
+                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+                std::cout << "Total Time: " << duration.count() << " ms" << std::endl;
+
+                std::cout << "PUT: successful" << std::endl;
+
+                // send success response
+                http_response response(status_codes::OK);
+                request.reply(response);
+            });
+        }
+
+        /**
+         * Helper for putHandler().
+         * 
+         * Sends the given list of blocks `blocks` for key `key` to storage
+         * node `storageNodeId`.
+         * 
+         * NOTE:
+         * 
+         * `blockNodeMap` is populated in this function (see putHandler() below).
+         * `replacedBlockNodeMap` is the key's kbn entry being replaced (if any),
+         * whose blocks on the node are overwritten.
+         */
+        pplx::task<void> sendBlocks(
+            uint32_t storageNodeId,
+            std::string key,
+            std::vector<Block> &blocks,
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap,
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> replacedBlockNodeMap
+        )
+        {
+            std::shared_ptr<StorageNode> sn = server->storageNodes[storageNodeId];
+
+            // populate request payload (blocks' data is sent without copying)
+            RpcMessage message(RPC_STORE_BLOCKS, key);
+            message.appendBlocks(blocks);
+
+            std::vector<uint32_t> blockNums;
+            for (auto &block : blocks)
+                blockNums.push_back(block.blockNum);
+
+            pplx::task<void> task = server->callStorageNode(sn, message, "sendBlocks")
+                .then([server = this->server, storageNodeId, blockNodeMap, blockNums](std::vector<unsigned char> payload) 
+                {
+                    // assign each block to node `storageNodeId`
+                    {
+                        std::lock_guard<std::mutex> lock(server->kbnMutex);
+                        for (uint32_t bn : blockNums)
+                            (*blockNodeMap)[bn].insert(storageNodeId);
+                    }
+                    
+                    return payload;
+                })
+
+                // update node's stats
+                .then([server = this->server, sn, replacedBlockNodeMap, blocksAdded = blockNums.size()](std::vector<unsigned char> payload)
+                {
+                    Payloads::SizeInfo sizeInfo = Payloads::SizeInfo::deserialize(payload);
+
+                    // if removing existing blocks, subtract their stats contribution
+                    if (replacedBlockNodeMap)
+                    {
+                        std::lock_guard<std::mutex> lock(server->kbnMutex);
+                        uint32_t existingBlocks = 0;
+                        for (auto &[blockNum, nodeIds] : *(replacedBlockNodeMap))
+                        {
+                            if (nodeIds.find(sn->id) != nodeIds.end())
+                                existingBlocks++;
+                        }
+                        sn->stats.blocksStored -= existingBlocks;
+                    }
+
+                    sn->stats.blocksStored += blocksAdded;
+
+                    server->updateNodeDataSizes(sn, sizeInfo);
+                });
+
+            return task;
+        }
+
+        /**
+         * /delta/{KEY}: PUT
+         * ---
+         * Given {KEY} and a data payload, stores the payload as {KEY}'s new
+         * data, like /store/{KEY}: PUT, but only sends the blocks that changed.
+         * 
+         * NOTE:
+         * 
+         * Changed blocks are found by comparing per-block content hashes with
+         * those of {KEY}'s stored data, and are written over the existing blocks
+         * on the nodes that store them (/update/{KEY}: PUT).
+         * 
+         * Falls back to a full PUT if {KEY} has no known hashes, its number
+         * of blocks changes, or a node storing a changed block is unhealthy.
+         */
+        pplx::task<void> deltaHandler(http_request request, std::string key)
+        {
+            std::cout << "DELTA req received: " << key << std::endl;
+
+            auto self = shared_from_this();
+            return request.extract_vector()
+            .then([self, request, key](std::vector<unsigned char> payload)
+            {
+                auto requestPayload = std::make_shared<std::vector<unsigned char>>(std::move(payload));
+                return self->storeDelta(request, key, requestPayload);
+            });
+        }
+
+        /**
+         * Helper for deltaHandler().
+         * 
+         * Sends the blocks of `requestPayload` that differ from {KEY}'s 
+         * stored data, then replies to `request`.
+         */
+        pplx::task<void> storeDelta(http_request request, std::string key, std::shared_ptr<std::vector<unsigned char>> requestPayload)
+        {
+            uint32_t dataBlockSize = server->config.dataBlockSize;
+            auto newHashes = std::make_shared<std::vector<uint32_t>>(MasterServer::blockHashes(*requestPayload, dataBlockSize));
+
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap;
+            std::shared_ptr<std::vector<uint32_t>> oldHashes;
+            {
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                auto kbnIt = server->keyBlockNodeMap.find(key);
+                auto hashIt = server->keyBlockHashMap.find(key);
+                if (kbnIt != server->keyBlockNodeMap.end() && hashIt != server->keyBlockHashMap.end())
+                {
+                    blockNodeMap = kbnIt->second;
+                    oldHashes = hashIt->second;
+                }
+            }
+
+            if (!oldHashes || oldHashes->size() != newHashes->size() || blockNodeMap->size() != newHashes->size())
             {
-                std::cout << "GET: failed - key doesn't exist" << std::endl;
-                request.reply(status_codes::InternalError);
-                return;
+                std::cout << "DELTA: block layout unknown or changed, falling back to PUT" << std::endl;
+                return storeBlocks(request, key, requestPayload);
             }
 
-            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap = server->keyBlockNodeMap[key];
-            
             /**
-             * For each block, we chose the first healthy storage node that
-             * stores it.
-             * 
-             * We store our 'choices' in nodeBlockMap, which is a mapping
-             * of the form: {node id -> block num list}.
+             * Assign each changed block to the nodes already storing it
              */
-            std::unordered_map<uint32_t, std::vector<uint32_t>> nodeBlockMap;
-            for (auto p : *(blockNodeMap))        
+            uint32_t payloadSize = requestPayload->size();
+            uint32_t numChanged = 0;
+            bool replicasHealthy = true;
+            std::unordered_map<uint32_t, std::vector<Block>> nodeBlockMap;
+
+            for (uint32_t blockNum = 0; blockNum < newHashes->size(); blockNum++)
             {
-                uint32_t blockNum = p.first;
-                std::set<uint32_t> nodeIds = p.second;
+                if ((*newHashes)[blockNum] == (*oldHashes)[blockNum])
+                    continue;
+                numChanged++;
 
-                bool foundHealthy = false;
-                for (auto nodeId : nodeIds)
+                uint32_t i = blockNum * dataBlockSize;
+                auto blockStart = requestPayload->begin() + i;
+                auto blockEnd = requestPayload->begin() + std::min(i + dataBlockSize, payloadSize);
+                Block block(key, blockNum, blockEnd - blockStart, blockStart, blockEnd);
+
+                for (uint32_t nodeId : blockNodeMap->at(blockNum))
                 {
-                    std::shared_ptr<StorageNode> sn = server->storageNodes[nodeId];
-                    if (sn->isHealthy)
-                    {
-                        nodeBlockMap[nodeId].push_back(blockNum);
-                        foundHealthy = true;
-                        break;
-                    }
+                    replicasHealthy = replicasHealthy && server->storageNodes[nodeId]->isHealthy;
+                    nodeBlockMap[nodeId].push_back(block);
                 }
-
-                if (!foundHealthy)
-                    throw std::runtime_error("Error: no healthy nodes available for block " + std::to_string(blockNum));
             }
 
-            // mapping of the form: {block num. -> block object}
-            auto blockMap = std::make_shared<std::map<uint32_t, Block>>();
+            if (!replicasHealthy)
+            {
+                std::cout << "DELTA: not all nodes storing changed blocks are healthy, falling back to PUT" << std::endl;
+                return storeBlocks(request, key, requestPayload);
+            }
 
-            std::vector<std::shared_ptr<std::vector<unsigned char>>> responsePayloads;
-            
             /**
-             * Call `getBlocks` for each node and wait on all tasks 
-             * to finish.
+             * Send each storage node its changed blocks
              */
-            std::vector<pplx::task<void>> getBlockTasks;
-            for (auto p : nodeBlockMap)
-            {
-                uint32_t nodeId = p.first;
-                std::vector<uint32_t> blockNums = p.second;
+            std::vector<pplx::task<void>> updateTasks;
+            for (auto &[nodeId, blocks] : nodeBlockMap)
+                updateTasks.push_back(updateBlocks(nodeId, key, blocks));
 
-                auto responsePayload = std::make_shared<std::vector<unsigned char>>();
-                responsePayloads.push_back(responsePayload);
-
-                auto task = getBlocks(nodeId, key, blockNums, blockMap, responsePayload);
-                getBlockTasks.push_back(task);
-            }
-
-            bool success = true;
-            auto task = pplx::when_all(getBlockTasks.begin(), getBlockTasks.end())
-            .then([&request, &success](pplx::task<void> allTasks)
+            size_t numBlocks = blockNodeMap->size();
+            return pplx::when_all(updateTasks.begin(), updateTasks.end())
+            .then([server = this->server, request, key, requestPayload, newHashes, numChanged, numBlocks](pplx::task<void> allTasks)
             {
-                try 
+                bool success = true;
+                try
                 {
                     allTasks.get();
                 }
                 catch (const std::exception& e)
                 {
-                    std::cout << "GET: failed - " << e.what() << std::endl;
+                    std::cout << "DELTA: failed - " << e.what() << std::endl;
                     success = false;
-
-                    request.reply(status_codes::InternalError);
                 }
-            });
-
-            task.wait();
-
-            if (!success)
-                return;
 
-            // recombine blocks in order
-            std::vector<unsigned char> payloadBuffer;
-            for (auto p : *(blockMap))
-            {
-                Block block = p.second;
-                payloadBuffer.insert(payloadBuffer.end(), block.dataStart, block.dataEnd);
-            }
+                {
+                    std::lock_guard<std::mutex> lock(server->kbnMutex);
 
-            // timing point: end
-            auto end = std::chrono::high_resolution_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-            std::cout << "Total Time: " << duration.count() << " ms" << std::endl;
+                    // replicas may now differ, so the next delta must be a full PUT
+                    if (!success)
+                        server->keyBlockHashMap.erase(key);
+                    else
+                        server->keyBlockHashMap[key] = newHashes;
+                }
 
-            std::cout << "GET: successful" << std::endl;
+                if (!success)
+                {
+                    request.reply(status_codes::InternalError);
+                    return;
+                }
 
-            // send success response
-            http_response response(status_codes::OK);
-            response.set_body(payloadBuffer);
-            request.reply(response);
-            return;
+                std::cout << "DELTA: successful - " << numChanged << "/" << numBlocks << " blocks changed" << std::endl;
+                request.reply(status_codes::OK);
+            });
         }
 
         /**
-         * Helper for getHandler().
-         * 
-         * Retreives blocks `blockNums` for key `key` from node `storageNodeId`.
-         * 
-         * NOTE:
+         * Helper for deltaHandler().
          * 
-         * `blockMap` is populated by this function (see getHandler() below).
+         * Sends the given list of blocks `blocks` for key `key` to storage
+         * node `storageNodeId`, to replace the blocks it already stores.
          */
-        pplx::task<void> getBlocks(
+        pplx::task<void> updateBlocks(
             uint32_t storageNodeId,
             std::string key,
-            std::vector<uint32_t> blockNums,
-            std::shared_ptr<std::map<uint32_t, Block>> blockMap,
-            std::shared_ptr<std::vector<unsigned char>> responsePayload
+            std::vector<Block> &blocks
         )
         {
             std::shared_ptr<StorageNode> sn = server->storageNodes[storageNodeId];
 
-            auto client = server->getHttpClient(sn);
+            // populate request payload
+            RpcMessage message(RPC_UPDATE_BLOCKS, key);
+            message.appendBlocks(blocks);
 
-            /**
-             * Serialize block numbers to send as payload.
-             */
-            std::vector<unsigned char> requestPayload;
-            for (uint32_t bn : blockNums)
+            return server->callStorageNode(sn, message, "updateBlocks")
+
+            // update node's stats
+            .then([server = this->server, sn](std::vector<unsigned char> payload)
             {
-                requestPayload.insert(
-                    requestPayload.end(),
-                    reinterpret_cast<unsigned char*>(&bn),
-                    reinterpret_cast<unsigned char*>(&bn) + sizeof(bn)
-                );
-            }
+                Payloads::SizeInfo sizeInfo = Payloads::SizeInfo::deserialize(payload);
+                server->updateNodeDataSizes(sn, sizeInfo);
+            });
+        }
 
-            // build and send request
-            http_request req = http_request();
-            req.set_method(methods::GET);
-            req.set_request_uri(U("/store/" + key));
-            req.set_body(requestPayload);
+        /**
+         * /append/{KEY}: PUT
+         * ---
+         * Given {KEY} and a data payload, appends the payload to {KEY}'s
+         * existing data (or stores it, if {KEY} doesn't exist).
+         * 
+         * NOTE:
+         * 
+         * Only the new blocks are placed and sent, along with {KEY}'s tail
+         * block if it was partial (as it's filled with the start of the payload).
+         * Storage nodes append them to their extents without rewriting existing data.
+         * 
+         * Writes to the same key are serialised by router(), so the tail can't
+         * change between being fetched and appended to. If the append fails, the
+         * re-sent tail block is restored (see appendPayload()).
+         */
+        pplx::task<void> appendHandler(http_request request, std::string key)
+        {
+            std::cout << "APPEND req received: " << key << std::endl;
 
-            return client->request(req)
-            .then([=](http_response response)
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap;
             {
-                if (response.status_code() != status_codes::OK)
-                {
-                    throw std::runtime_error(
-                        "getBlocks() failed with status: " + std::to_string(response.status_code()));
-                }
-                return response.extract_vector();
-            })
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                auto it = server->keyBlockNodeMap.find(key);
+                if (it != server->keyBlockNodeMap.end())
+                    blockNodeMap = it->second;
+            }
 
-            // deserialize payload and populate block map
-            .then([=](std::vector<unsigned char> payload)
+            // nothing to append to
+            if (!blockNodeMap || blockNodeMap->empty())
+                return putHandler(request, key);
+
+            auto self = shared_from_this();
+            return request.extract_vector()
+            .then([self, request, key, blockNodeMap](std::vector<unsigned char> payload)
             {
-                *responsePayload = payload;
-                std::vector<Block> blocks = Block::deserialize(*(responsePayload));
-                for (auto block : blocks)
+                if (payload.empty())
                 {
-                    blockMap->insert({block.blockNum, std::move(block)});
+                    request.reply(status_codes::OK);
+                    return pplx::task_from_result();
                 }
+
+                return self->appendPayload(
+                    request, key, blockNodeMap, std::make_shared<std::vector<unsigned char>>(std::move(payload)));
             });
         }
 
         /**
-         * /store/{KEY}: PUT
-         * ---
-         * Given {KEY} and a data payload, breaks payload into blocks and 
-         * distributes them across the storage cluster.
+         * Helper for appendHandler().
+         * 
+         * Fetches {KEY}'s tail block, then sends it (if partial) and `payload`'s 
+         * new blocks to their nodes, and replies to `request` (once the tail is
+         * restored, if the append failed).
          */
-        void putHandler(http_request request, std::string key) 
+        pplx::task<void> appendPayload(
+            http_request request,
+            std::string key,
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap,
+            std::shared_ptr<std::vector<unsigned char>> payload
+        )
         {
-            std::cout << "PUT req received: " << key << std::endl;
-
-            // timing point: start
-            auto start = std::chrono::high_resolution_clock::now();
-
-            /**
-             * blockNodeMap maps each block num. to a list of nodes that store it.
-             * 
-             * i.e. {block num -> [nodeA, nodeB, ...]}
-             */
-            auto blockNodeMap = std::make_shared<std::map<uint32_t, std::set<uint32_t>>>();
-
-            auto requestPayload = std::make_shared<std::vector<unsigned char>>();
-
-            std::vector<pplx::task<void>> sendBlockTasks;
-            bool success = true;
+            uint32_t tailBlockNum;
+            std::set<uint32_t> tailNodeIds;
+            {
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                tailBlockNum = blockNodeMap->rbegin()->first;
+                tailNodeIds = blockNodeMap->rbegin()->second;
+            }
 
             /**
-             * Break up payload data into blocks and assign each block 
-             * to R storage nodes, where R is our replication factor.
+             * Fetch the tail block from any healthy node storing it.
              */
-            pplx::task<void> task = request.extract_vector()
-            .then([&](std::vector<unsigned char> payload)
+            auto tailBlockMap = std::make_shared<std::map<uint32_t, Block>>();
+            auto tailPayload = std::make_shared<std::vector<unsigned char>>();
+            bool tailReplicasHealthy = true;
+            std::optional<uint32_t> tailNodeId;
+            for (uint32_t nodeId : tailNodeIds)
             {
-                *requestPayload = std::move(payload);
-                    
-                uint32_t payloadSize = requestPayload->size();
-                uint32_t blockCnt = 0;
+                if (server->storageNodes[nodeId]->isHealthy)
+                    tailNodeId = tailNodeId.value_or(nodeId);
+                else
+                    tailReplicasHealthy = false;
+            }
 
-                std::unordered_map<uint32_t, std::vector<Block>> nodeBlockMap;
+            if (tailNodeId == std::nullopt)
+            {
+                std::cout << "APPEND: failed - no healthy nodes available for block " << tailBlockNum << std::endl;
+                request.reply(status_codes::InternalError);
+                return pplx::task_from_result();
+            }
 
-                for (uint32_t i = 0; i < payloadSize; i += server->config.dataBlockSize) 
+            auto self = shared_from_this();
+            return getBlocks(*tailNodeId, key, {tailBlockNum}, tailBlockMap, tailPayload)
+            .then([self, request, key, blockNodeMap, payload, tailBlockNum, tailNodeIds, tailBlockMap, tailPayload, tailReplicasHealthy](pplx::task<void> fetched)
+            {
+                try
+                {
+                    fetched.get();
+                }
+                catch (const std::exception &e)
                 {
-                    // construct the block
-                    uint32_t blockNum = blockCnt++;
-                    auto blockStart = requestPayload->begin() + i;
-                    auto blockEnd = requestPayload->begin() + std::min(i + server->config.dataBlockSize, payloadSize);
-                    auto dataSize = blockEnd - blockStart;
+                    std::cout << "APPEND: failed - " << e.what() << std::endl;
+                    request.reply(status_codes::InternalError);
+                    return pplx::task_from_result();
+                }
 
-                    Block block(key, blockNum, dataSize, blockStart, blockEnd);
+                MasterServer *server = self->server;
+                uint32_t dataBlockSize = server->config.dataBlockSize;
+                Block &tailBlock = tailBlockMap->at(tailBlockNum);
+
+                /**
+                 * If the tail block is partial, fill it with the start of the payload
+                 * and re-send it to every node storing it (so none are left partial).
+                 */
+                std::vector<unsigned char> data;
+                uint32_t firstBlockNum = tailBlockNum + 1;
+                if (tailBlock.dataSize < dataBlockSize)
+                {
+                    if (!tailReplicasHealthy)
+                    {
+                        std::cout << "APPEND: failed - not all nodes storing tail block are healthy" << std::endl;
+                        request.reply(status_codes::InternalError);
+                        return pplx::task_from_result();
+                    }
 
-                    // replication factor
-                    uint32_t R = std::min(server->config.replicationFactor, server->config.numStorageNodes);
+                    data.assign(tailBlock.dataStart, tailBlock.dataEnd);
+                    firstBlockNum = tailBlockNum;
+                }
+                data.insert(data.end(), payload->begin(), payload->end());
 
-                    /**
-                     * Find next R (replication factor) distinct storage nodes and 
-                     * add the block to the nodes' block list.
-                     */
-                    std::string hashInput = key + std::to_string(blockNum);
-                    uint32_t hash = Crypto::sha256_32(hashInput);
-                    std::unordered_set<uint32_t> usedStorageNodes;
-                    int cnt = 0;
+                /**
+                 * Break up data into blocks, placing new blocks with the hash ring
+                 */
+                std::unordered_map<uint32_t, std::vector<Block>> nodeBlockMap;
+                auto appendedHashes = std::make_shared<std::vector<uint32_t>>(MasterServer::blockHashes(data, dataBlockSize));
+                uint32_t dataSize = data.size();
+                uint32_t blockNum = firstBlockNum;
+                for (uint32_t i = 0; i < dataSize; i += dataBlockSize, blockNum++)
+                {
+                    auto blockStart = data.begin() + i;
+                    auto blockEnd = data.begin() + std::min(i + dataBlockSize, dataSize);
+                    Block block(key, blockNum, blockEnd - blockStart, blockStart, blockEnd);
 
-                    while (cnt < R)
+                    if (blockNum == tailBlockNum)
                     {
-                        std::shared_ptr<VirtualNode> vn = server->hashRing.findNextNode(hash);
-                        uint32_t nodeId = vn->physicalNodeId;
-                        std::shared_ptr<StorageNode> sn = server->storageNodes[nodeId];
-
-                        bool nodeUnusedByBlock = usedStorageNodes.find(nodeId) == usedStorageNodes.end();
-                        bool nodeHealthy = sn->isHealthy;
-
-                        if (nodeUnusedByBlock && nodeHealthy)
-                        {
+                        for (uint32_t nodeId : tailNodeIds)
+                            nodeBlockMap[nodeId].push_back(block);
+                    }
+                    else
+                    {
+                        for (uint32_t nodeId : server->findBlockNodes(key, blockNum))
                             nodeBlockMap[nodeId].push_back(block);
-                            usedStorageNodes.insert(nodeId);
-                            cnt++;
-                        }
-
-                        hash = vn->hash();
                     }
                 }
 
-                return nodeBlockMap;
-            })
-
-            /**
-             * Send each storage node its block list
-             */
-            .then([&](std::unordered_map<uint32_t, std::vector<Block>> nodeBlockMap)
-            {
-                auto sendStart = std::chrono::high_resolution_clock::now();
-
-                for (auto p : nodeBlockMap)
-                {
-                    uint32_t storageNodeId = p.first;
-                    std::vector<Block> blocks = p.second;
+                /**
+                 * Send each storage node its blocks to append
+                 */
+                auto appendedBlockNodeMap = std::make_shared<std::map<uint32_t, std::set<uint32_t>>>();
+                std::vector<pplx::task<void>> appendTasks;
+                for (auto &[nodeId, blocks] : nodeBlockMap)
+                    appendTasks.push_back(self->appendBlocks(nodeId, key, blocks, appendedBlockNodeMap, tailBlockNum));
 
-                    auto task = sendBlocks(storageNodeId, key, blocks, blockNodeMap);
-                    sendBlockTasks.push_back(task);
-                }
-
-                // wait for all `sendBlocks` tasks to finish
-                return pplx::when_all(sendBlockTasks.begin(), sendBlockTasks.end())
-                .then([&](pplx::task<void> allTasks)
+                return pplx::when_all(appendTasks.begin(), appendTasks.end())
+                .then([self, server, request, key, blockNodeMap, appendedBlockNodeMap, appendedHashes, tailBlockNum, firstBlockNum, tailNodeIds, tailBlockMap, tailPayload](pplx::task<void> allTasks)
                 {
                     try
                     {
                         allTasks.get();
-
-                        // update kbn
-                        server->keyBlockNodeMap[key] = blockNodeMap;
                     }
                     catch (const std::exception& e)
                     {
-                        std::cout << "PUT: failed - " << e.what() << std::endl;
-                        success = false;
-                        request.reply(status_codes::InternalError);
+                        std::cout << "APPEND: failed - " << e.what() << std::endl;
+
+                        if (firstBlockNum != tailBlockNum)
+                        {
+                            request.reply(status_codes::InternalError);
+                            return pplx::task_from_result();
+                        }
+
+                        return self->restoreTail(key, blockNodeMap, tailBlockMap->at(tailBlockNum), tailNodeIds)
+                        .then([request, tailPayload]()
+                        {
+                            request.reply(status_codes::InternalError);
+                        });
                     }
-                });
-            });
-            
-            task.wait();
 
-            if (!success)
-                return;
+                    // add new blocks to kbn, and their hashes (if the key's are known)
+                    {
+                        std::lock_guard<std::mutex> lock(server->kbnMutex);
+                        for (auto &[bn, nodeIds] : *appendedBlockNodeMap)
+                            (*blockNodeMap)[bn].insert(nodeIds.begin(), nodeIds.end());
+
+                        auto hashIt = server->keyBlockHashMap.find(key);
+                        if (hashIt != server->keyBlockHashMap.end() && hashIt->second->size() == tailBlockNum + 1)
+                        {
+                            hashIt->second->resize(firstBlockNum);
+                            hashIt->second->insert(hashIt->second->end(), appendedHashes->begin(), appendedHashes->end());
+                        }
+                        else
+                            server->keyBlockHashMap.erase(key);
+                    }
 
-            server->calculateAndShowBlockDistribution(key);
+                    std::cout << "APPEND: successful" << std::endl;
+                    request.reply(status_codes::OK);
+                    return pplx::task_from_result();
+                });
+            });
+        }
 
-            // timing point: end
-            auto end = std::chrono::high_resolution_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-            std::cout << "Total Time: " << duration.count() << " ms" << std::endl;
+        /**
+         * Helper for appendPayload().
+         * 
+         * Re-sends {KEY}'s (partial) tail block `tailBlock` to the nodes storing
+         * it, after a failed append re-sent it filled, so none keep the filled
+         * block or anything appended after it. `tailBlock`'s data must outlive
+         * the returned task.
+         * 
+         * NOTE:
+         * 
+         * Nodes it can't be restored on are dropped from the block's entry in the
+         * kbn, so it's never read from them. Blocks the failed append stored on 
+         * other nodes are left, to be replaced by the next append that re-sends
+         * them (see StorageEngine::appendBlocks()).
+         */
+        pplx::task<void> restoreTail(
+            std::string key,
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap,
+            Block tailBlock,
+            std::set<uint32_t> tailNodeIds
+        )
+        {
+            uint32_t tailBlockNum = tailBlock.blockNum;
+            auto restoredBlockNodeMap = std::make_shared<std::map<uint32_t, std::set<uint32_t>>>();
 
-            std::cout << "PUT: successful" << std::endl;
+            std::vector<pplx::task<void>> restoreTasks;
+            for (uint32_t nodeId : tailNodeIds)
+            {
+                std::vector<Block> blocks = {tailBlock};
+                restoreTasks.push_back(
+                    appendBlocks(nodeId, key, blocks, restoredBlockNodeMap, tailBlockNum)
+                    .then([server = this->server, key, blockNodeMap, tailBlockNum, nodeId](pplx::task<void> restored)
+                    {
+                        try
+                        {
+                            restored.get();
+                        }
+                        catch (const std::exception &e)
+                        {
+                            std::cout << "APPEND: failed to restore tail block on node " << nodeId << " - " << e.what() << std::endl;
 
-            server->showKbn();
+                            std::lock_guard<std::mutex> lock(server->kbnMutex);
+                            (*blockNodeMap)[tailBlockNum].erase(nodeId);
+                            server->keyBlockHashMap.erase(key);
+                        }
+                    })
+                );
+            }
 
-            // send success response
-            http_response response(status_codes::OK);
-            request.reply(response);
-            return;
+            return pplx::when_all(restoreTasks.begin(), restoreTasks.end());
         }
 
         /**
-         * Helper for putHandler().
+         * Helper for appendHandler().
          * 
          * Sends the given list of blocks `blocks` for key `key` to storage
-         * node `storageNodeId`.
+         * node `storageNodeId`, to append to its existing blocks.
          * 
          * NOTE:
          * 
-         * `blockNodeMap` is populated in this function (see putHandler() below).
+         * `blockNodeMap` is populated with the sent blocks. Any re-sent
+         * tail block (i.e. block `tailBlockNum`) isn't counted as a new block.
          */
-        pplx::task<void> sendBlocks(
+        pplx::task<void> appendBlocks(
             uint32_t storageNodeId,
             std::string key,
             std::vector<Block> &blocks,
-            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap,
+            uint32_t tailBlockNum
         )
         {
             std::shared_ptr<StorageNode> sn = server->storageNodes[storageNodeId];
 
-            auto client = server->getHttpClient(sn);
-
             // populate request payload
-            std::vector<unsigned char> payloadBuffer;
-            for (auto &block : blocks)
-                block.serialize(payloadBuffer);
+            RpcMessage message(RPC_APPEND_BLOCKS, key);
+            message.appendBlocks(blocks);
 
-            // build and send request
-            http_request req = http_request();
-            req.set_method(methods::PUT);
-            req.set_request_uri(U("/store/" + key));
-            req.set_body(payloadBuffer);
+            std::vector<uint32_t> blockNums;
+            for (auto &block : blocks)
+                blockNums.push_back(block.blockNum);
 
-            pplx::task<void> task = client->request(req)
-                .then([=](http_response response) 
-                {
-                    if (response.status_code() != status_codes::OK) 
-                    {
-                        throw std::runtime_error(
-                            "sendBlocks() failed with status: " + std::to_string(response.status_code()));
-                    }
+            return server->callStorageNode(sn, message, "appendBlocks")
 
-                    // assign each block to node `storageNodeId`
-                    for (auto &block : blocks)
-                        (*blockNodeMap)[block.blockNum].insert(storageNodeId);
-                    
-                    return response.extract_vector();
-                })
+            // update node's stats
+            .then([server = this->server, sn, storageNodeId, blockNodeMap, blockNums, tailBlockNum](std::vector<unsigned char> payload)
+            {
+                Payloads::SizeInfo sizeInfo = Payloads::SizeInfo::deserialize(payload);
+                server->updateNodeDataSizes(sn, sizeInfo);
 
-                // update node's stats
-                .then([=](std::vector<unsigned char> payload)
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                for (uint32_t bn : blockNums)
                 {
-                    Payloads::SizeInfo sizeInfo = Payloads::SizeInfo::deserialize(payload);
-
-                    // if removing existing blocks, subtract their stats contribution
-                    if (server->keyBlockNodeMap.find(key) != server->keyBlockNodeMap.end())
-                    {
-                        uint32_t existingBlocks = 0;
-                        for (auto &blockNodesPair : *(server->keyBlockNodeMap[key]))
-                        {
-                            std::set<uint32_t> &nodeIds = blockNodesPair.second;
-                            if (nodeIds.find(sn->id) != nodeIds.end())
-                                existingBlocks++;
-                        }
-                        sn->stats.blocksStored -= existingBlocks;
-                    }
-
-                    uint32_t blocksAdded = blocks.size();
-                    sn->stats.blocksStored += blocksAdded;
-
-                    server->updateNodeDataSizes(sn, sizeInfo);
-                });
-
-            return task;
+                    (*blockNodeMap)[bn].insert(storageNodeId);
+                    if (bn != tailBlockNum)
+                        sn->stats.blocksStored++;
+                }
+            });
         }
 
         /**
@@ -506,27 +1885,29 @@ public:
          * 
          * Rebalancing will likely require block-level deletion capability.
          */
-        void deleteHandler(http_request request, std::string key) 
+        pplx::task<void> deleteHandler(http_request request, std::string key) 
         {
             std::cout << "DEL req received: " << key << std::endl;
 
-            // check key exists
-            if (server->keyBlockNodeMap.find(key) == server->keyBlockNodeMap.end())
+            // check key exists, and find all nodes that store at least 1 of its blocks
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap;
+            std::unordered_set<uint32_t> allNodeIds;
             {
-                std::cout << "DEL: failed - key doesn't exist" << std::endl;
-                request.reply(status_codes::InternalError);
-                return;
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                auto it = server->keyBlockNodeMap.find(key);
+                if (it != server->keyBlockNodeMap.end())
+                {
+                    blockNodeMap = it->second;
+                    for (auto &[blockNum, nodeIds] : *(blockNodeMap))
+                        allNodeIds.insert(nodeIds.begin(), nodeIds.end());
+                }
             }
 
-            // find all nodes that store at least 1 block for `key`
-            std::unordered_set<uint32_t> allNodeIds;
-            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap = server->keyBlockNodeMap[key];
-
-            for (auto p : *(blockNodeMap))
+            if (!blockNodeMap)
             {
-                std::set<uint32_t> nodeIds = p.second;
-                for (auto nodeId : nodeIds)
-                    allNodeIds.insert(nodeId);
+                std::cout << "DEL: failed - key doesn't exist" << std::endl;
+                request.reply(status_codes::InternalError);
+                return pplx::task_from_result();
             }
 
             std::vector<pplx::task<void>> delBlockTasks;
@@ -534,13 +1915,12 @@ public:
             // call `deleteBlocks()` for each node
             for (uint32_t nodeId : allNodeIds)
             {
-                auto task = deleteBlocks(nodeId, key);
+                auto task = deleteBlocks(nodeId, key, blockNodeMap);
                 delBlockTasks.push_back(task);
             }
 
-            bool success = true;
-            auto task = pplx::when_all(delBlockTasks.begin(), delBlockTasks.end())
-            .then([&](pplx::task<void> allTasks)
+            return pplx::when_all(delBlockTasks.begin(), delBlockTasks.end())
+            .then([server = this->server, request, key](pplx::task<void> allTasks)
             {
                 try
                 {
@@ -549,58 +1929,41 @@ public:
                 catch (const std::exception& e)
                 {
                     std::cout << "DEL: failed - " << e.what() << std::endl;
-                    success = false;
                     request.reply(status_codes::InternalError);
+                    return;
                 }
-            });
-
-            task.wait();
-
-            if (!success)
-                return;
-            
-            // remove key's entry from KBN entirely
-            server->keyBlockNodeMap.erase(key);
 
-            server->showKbn();
+                // remove key's entry from KBN entirely
+                {
+                    std::lock_guard<std::mutex> lock(server->kbnMutex);
+                    server->keyBlockNodeMap.erase(key);
+                    server->keyBlockHashMap.erase(key);
+                }
 
-            // send success response
-            std::cout << "DEL: successful" << std::endl;
-            request.reply(status_codes::OK);
-            return;
+                // send success response
+                std::cout << "DEL: successful" << std::endl;
+                request.reply(status_codes::OK);
+            });
         }
 
         /**
-         * Helper for deleteHandler().
+         * Helper for deleteHandler(), finishStream() and commitStream().
          * 
-         * Deletes all blocks correpsonding to key `key` from node `storageNodeId`.
+         * Deletes all blocks correpsonding to key `key` from node `storageNodeId`,
+         * where `blockNodeMap` maps the key's blocks to the nodes storing them.
          */
-        pplx::task<void> deleteBlocks(uint32_t storageNodeId, std::string key)
+        pplx::task<void> deleteBlocks(
+            uint32_t storageNodeId,
+            std::string key,
+            std::shared_ptr<std::map<uint32_t, std::set<uint32_t>>> blockNodeMap
+        )
         {
             std::shared_ptr<StorageNode> sn = server->storageNodes[storageNodeId];
 
-            auto client = server->getHttpClient(sn);
-
-            // build and send request
-            http_request request = http_request();
-            request.set_method(methods::DEL);
-            request.set_request_uri(U("/store/" + key));
-
-            auto task = client->request(request)
-            .then([=](http_response response)
-            {
-                if (response.status_code() != status_codes::OK)
-                {
-                    throw std::runtime_error(
-                        "deleteBlocks() failed with status: " + std::to_string(response.status_code())
-                    );
-                }
-
-                return response.extract_vector();
-            })
+            auto task = server->callStorageNode(sn, RpcMessage(RPC_DELETE_KEY, key), "deleteBlocks")
 
             // update node's stats
-            .then([=](std::vector<unsigned char> payload)
+            .then([server = this->server, sn, blockNodeMap](std::vector<unsigned char> payload)
             {
                 // update data sizes
                 Payloads::SizeInfo sizeInfo = Payloads::SizeInfo::deserialize(payload);
@@ -608,11 +1971,13 @@ public:
 
                 // update num blocks
                 uint32_t blocksRemoved = 0;
-                for (auto &blockNodesPair : *(server->keyBlockNodeMap[key]))
                 {
-                    std::set<uint32_t> &nodeIds = blockNodesPair.second;
-                    if (nodeIds.find(sn->id) != nodeIds.end())
-                        blocksRemoved++;
+                    std::lock_guard<std::mutex> lock(server->kbnMutex);
+                    for (auto &[blockNum, nodeIds] : *(blockNodeMap))
+                    {
+                        if (nodeIds.find(sn->id) != nodeIds.end())
+                            blocksRemoved++;
+                    }
                 }
                 sn->stats.blocksStored -= blocksRemoved;
             });
@@ -621,10 +1986,16 @@ public:
         }
     };
 
+    /**
+     * Batch fetches of in-flight GETs, so concurrent GETs of the same key
+     * share them (see StoreEndpoint::fetchAhead()).
+     */
+    SingleFlight<StoreEndpoint::FetchedBatch> getFlights;
+
     /**
      * Contains all handlers for our /keys endpoint.
      */
-    class KeysEndpoint
+    class KeysEndpoint : public std::enable_shared_from_this<KeysEndpoint>
     {
     private:
         MasterServer *server;
@@ -642,17 +2013,152 @@ public:
             std::cout << "GET /keys req received" << std::endl;
 
             std::ostringstream oss;
-            for (const auto &p : server->keyBlockNodeMap)
             {
-                std::string key = p.first;
-                key = StringUtils::removeNullChars(key);
-                oss << key << "\n";
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                for (const auto &p : server->keyBlockNodeMap)
+                {
+                    oss << p.first << "\n";
+                }
             }
 
             std::cout << "GET: successful" << std::endl;
             
             request.reply(status_codes::OK, oss.str());
         }
+
+        /**
+         * /keys:DEL
+         * ---
+         * Deletes all keys in the request body, a newline-separated
+         * list of keys. Unknown keys are skipped.
+         * 
+         * NOTE:
+         * 
+         * Each storage node is sent a single bulk delete for all its keys,
+         * which it acknowledges once the keys are durably tombstoned 
+         * (space is reclaimed in the background).
+         */
+        pplx::task<void> deleteHandler(http_request request)
+        {
+            std::cout << "DEL /keys req received" << std::endl;
+
+            auto self = shared_from_this();
+            return request.extract_string()
+            .then([self, request](std::string body)
+            {
+                return self->deleteKeyList(request, body);
+            });
+        }
+
+        /**
+         * Helper for deleteHandler().
+         * 
+         * Deletes all keys in `body` (a newline-separated list of keys),
+         * then replies to `request`.
+         */
+        pplx::task<void> deleteKeyList(http_request request, const std::string &body)
+        {
+            std::vector<std::string> keys;
+            std::istringstream iss(body);
+            std::string line;
+            while (std::getline(iss, line))
+            {
+                if (!line.empty())
+                    keys.push_back(line);
+            }
+
+            /**
+             * Group keys by the nodes that store at least 1 of their blocks,
+             * counting the blocks each node will drop.
+             */
+            std::vector<std::string> foundKeys;
+            std::map<uint32_t, std::vector<std::string>> nodeKeys;
+            std::map<uint32_t, uint32_t> nodeBlocksRemoved;
+            {
+                std::lock_guard<std::mutex> lock(server->kbnMutex);
+                for (std::string &key : keys)
+                {
+                    auto it = server->keyBlockNodeMap.find(key);
+                    if (it == server->keyBlockNodeMap.end())
+                        continue;
+                    foundKeys.push_back(key);
+
+                    std::unordered_set<uint32_t> keyNodeIds;
+                    for (auto &[blockNum, nodeIds] : *(it->second))
+                    {
+                        for (uint32_t nodeId : nodeIds)
+                        {
+                            keyNodeIds.insert(nodeId);
+                            nodeBlocksRemoved[nodeId]++;
+                        }
+                    }
+
+                    for (uint32_t nodeId : keyNodeIds)
+                        nodeKeys[nodeId].push_back(key);
+                }
+            }
+
+            std::vector<pplx::task<void>> delKeysTasks;
+            for (auto &[nodeId, keysOnNode] : nodeKeys)
+                delKeysTasks.push_back(deleteKeys(nodeId, keysOnNode, nodeBlocksRemoved[nodeId]));
+
+            return pplx::when_all(delKeysTasks.begin(), delKeysTasks.end())
+            .then([server = this->server, request, foundKeys = std::move(foundKeys)](pplx::task<void> allTasks)
+            {
+                try
+                {
+                    allTasks.get();
+                }
+                catch (const std::exception& e)
+                {
+                    std::cout << "DEL: failed - " << e.what() << std::endl;
+                    request.reply(status_codes::InternalError);
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(server->kbnMutex);
+                    for (const std::string &key : foundKeys)
+                    {
+                        server->keyBlockNodeMap.erase(key);
+                        server->keyBlockHashMap.erase(key);
+                    }
+                }
+
+                std::cout << "DEL: successful - deleted " << foundKeys.size() << " keys" << std::endl;
+                request.reply(status_codes::OK, std::to_string(foundKeys.size()) + "\n");
+            });
+        }
+
+        /**
+         * Helper for deleteHandler().
+         * 
+         * Deletes all blocks of keys `keys` from node `storageNodeId`,
+         * which stores `blocksRemoved` of their blocks.
+         */
+        pplx::task<void> deleteKeys(uint32_t storageNodeId, const std::vector<std::string> &keys, uint32_t blocksRemoved)
+        {
+            std::shared_ptr<StorageNode> sn = server->storageNodes[storageNodeId];
+
+            std::string body;
+            for (const std::string &key : keys)
+                body += key + "\n";
+
+            RpcMessage message(RPC_DELETE_KEYS);
+            message.append(std::vector<unsigned char>(body.begin(), body.end()));
+
+            auto task = server->callStorageNode(sn, message, "deleteKeys")
+
+            // update node's stats
+            .then([server = this->server, sn, blocksRemoved](std::vector<unsigned char> payload)
+            {
+                Payloads::SizeInfo sizeInfo = Payloads::SizeInfo::deserialize(payload);
+                server->updateNodeDataSizes(sn, sizeInfo);
+                sn->stats.blocksStored -= blocksRemoved;
+            });
+
+            return task;
+        }
     };
 
     /**
@@ -759,6 +2265,18 @@ public:
 
             oss << "\n";
 
+            uint64_t numJoined = server->getFlights.numJoined();
+            uint64_t numFetched = server->getFlights.numFetched();
+            oss << "GET batches: " << numFetched << " fetched, " << numJoined << " joined (in-flight fetches shared)\n";
+
+            uint64_t numRequests = server->hedgePolicy.numRequests();
+            uint64_t numHedged = server->hedgePolicy.numHedged();
+            uint64_t numHedgesWon = server->hedgePolicy.numHedgesWon();
+            oss << "GET node requests: " << numRequests << " sent, " << numHedged << " hedged, " 
+                << numHedgesWon << " answered first by the hedge\n";
+
+            oss << "Key writes: " << server->keyWrites.numQueued() << " queued behind another of their key\n";
+
             return oss;
         }
     };
@@ -784,25 +2302,7 @@ public:
     {
         std::shared_ptr<StorageNode> sn = this->storageNodes[storageNodeId];
 
-        auto client = this->getHttpClient(sn);
-
-        http_request request;
-        request.set_method(methods::GET);
-        request.set_request_uri(U("/sync"));
-
-        auto task = client->request(request)
-        .then([=](http_response response)
-        {
-            if (response.status_code() != status_codes::OK)
-            {
-                throw std::runtime_error(
-                    "syncWithStorageNode() failed with status: " + std::to_string(response.status_code())
-                );
-            }
-
-            return response.extract_vector();
-        })
-
+        auto task = this->callStorageNode(sn, RpcMessage(RPC_SYNC), "syncWithStorageNode")
         .then([=](std::vector<unsigned char> payload)
         {
             Payloads::SyncInfo syncInfo = Payloads::SyncInfo::deserialize(payload);
@@ -816,6 +2316,10 @@ public:
                 std::string key = p.first;
                 std::vector<uint32_t> blockNums = p.second;
 
+                // left by an interrupted PUT, and replaced by the key's next one
+                if (ApiUtils::isStagedKey(key))
+                    continue;
+
                 auto blockNodeMap = std::make_shared<std::map<uint32_t, std::set<uint32_t>>>();
 
                 {
@@ -852,17 +2356,85 @@ public:
      * to the hash ring.
      */
     void initialiseStorageNodes() {
+        if (this->config.storageTransport != "rpc" && this->config.storageTransport != "http")
+            throw std::runtime_error("Unknown storageTransport: " + this->config.storageTransport);
+
         for (std::string ipPort : this->config.storageNodeIPs) 
         {
             auto storageNode = std::make_shared<StorageNode>(ipPort, this->config.numVirtualNodes);
             this->storageNodes[storageNode->id] = storageNode;
 
+            if (this->config.storageTransport == "rpc")
+            {
+                web::uri uri(U(ipPort));
+                this->rpcClients[storageNode->id] = std::make_shared<RpcClient>(
+                    uri.host(),
+                    uri.port() + this->config.rpcPortOffset,
+                    this->config.connectionsPerNode,
+                    this->config.rpcSocketBufferBytes,
+                    this->config.rpcLocalDir,
+                    this->config.rpcShmRingBytes
+                );
+            }
+            else
+            {
+                this->httpClientPools[storageNode->id] = std::make_shared<HttpClientPool>(
+                    ipPort,
+                    this->config.connectionsPerNode
+                );
+            }
+
             // add all virtual nodes to the hash ring
             for (auto &vn : storageNode->virtualNodes)
                 hashRing.addNode(vn);
         }
     }
 
+    /**
+     * Opens the pooled connections to each storage node, so the first
+     * requests don't wait on them.
+     */
+    void warmUpConnections()
+    {
+        std::vector<pplx::task<void>> tasks;
+        for (auto &[nodeId, sn] : this->storageNodes)
+            tasks.push_back(this->warmUpConnections(sn));
+
+        pplx::when_all(tasks.begin(), tasks.end()).wait();
+    }
+
+    /**
+     * Opens the pooled connections to storage node `sn` that aren't open. The
+     * returned task completes once they've been tried (failures are ignored).
+     * 
+     * NOTE:
+     * 
+     * RPC connections are opened on the calling thread (see RpcClient::warmUp()),
+     * so this is only called on startup and by the health thread.
+     */
+    pplx::task<void> warmUpConnections(std::shared_ptr<StorageNode> sn)
+    {
+        if (this->config.storageTransport == "rpc")
+        {
+            this->rpcClients[sn->id]->warmUp();
+            return pplx::task_from_result();
+        }
+        return this->httpClientPools[sn->id]->warmUp("/health/");
+    }
+
+    /**
+     * Drops the pooled connections to storage node `sn`, e.g. once it's gone
+     * down, so requests reconnect rather than reuse connections that may be
+     * dead.
+     */
+    void evictConnections(std::shared_ptr<StorageNode> sn)
+    {
+        if (this->config.storageTransport == "rpc")
+            this->rpcClients[sn->id]->closeConnections();
+        else
+            this->httpClientPools[sn->id]->evict();
+    }
+
     /**
      * Thread function used to periodically check health of all storage nodes.
      * 
@@ -873,15 +2445,22 @@ public:
      */
     void checkNodeHealth()
     {
-        while (1) 
+        while (!this->lifecycle.isDraining()) 
         {
             uint32_t period = this->config.healthCheckPeriodMs;
 
             /**
-             * Every `period` milliseconds, send a GET to the /health/ endpoint
-             * of each storage node.
+             * Every `period` milliseconds, send a health check (RPC_HEALTH, or
+             * a GET to the /health/ endpoint) to each storage node.
+             * 
+             * Update the health status of each StorageNode object accordingly,
+             * dropping the connections to nodes that go down, and reopening
+             * them once they're back.
              * 
-             * Update the health status of each StorageNode object accordingly.
+             * RPC connections are reopened here rather than by requests (which
+             * never block on connecting), including any that broke while their
+             * node stayed healthy. They're checked before each health check, so
+             * a node that's back is seen as healthy once it can be reached.
              */
 
             std::vector<pplx::task<void>> healthCheckTasks;
@@ -890,28 +2469,35 @@ public:
                 uint32_t nodeId = p.first;
                 std::shared_ptr<StorageNode> sn = p.second;
 
-                auto client = getHttpClient(sn);
+                /**
+                 * Health responses carry a 'size response', so space the node
+                 * reclaims in the background (e.g. after deletes) shows up here.
+                 */
+                if (this->config.storageTransport == "rpc")
+                    this->rpcClients[nodeId]->warmUp();
 
-                // build and send request
-                http_request req = http_request();
-                req.set_method(methods::GET);
-                req.set_request_uri(U("/health/"));
-
-                auto task = client->request(req)
-                .then([=](pplx::task<http_response> prevTask){
+                bool wasHealthy = sn->isHealthy;
+                auto task = callStorageNode(sn, RpcMessage(RPC_HEALTH), "checkNodeHealth")
+                .then([=](pplx::task<std::vector<unsigned char>> prevTask){
                     try
                     {
-                        // can throw an http_exception if connection isn't established
-                        http_response resp = prevTask.get();
-
-                        bool isHealthy = (resp.status_code() == status_codes::OK);
-                        sn->isHealthy = isHealthy;
+                        // throws if the node can't be reached, or isn't OK
+                        std::vector<unsigned char> payload = prevTask.get();
+                        sn->isHealthy = true;
 
+                        if (payload.size() == sizeof(Payloads::SizeInfo))
+                            this->updateNodeDataSizes(sn, Payloads::SizeInfo::deserialize(payload));
                     }
-                    catch (const http_exception &e)
+                    catch (const std::exception &e)
                     {
                         sn->isHealthy = false;
                     }
+
+                    if (wasHealthy && !sn->isHealthy)
+                        this->evictConnections(sn);
+                    else if (!wasHealthy && sn->isHealthy && this->config.storageTransport != "rpc")
+                        return this->warmUpConnections(sn);
+                    return pplx::task_from_result();
                 });
 
                 healthCheckTasks.push_back(task);
@@ -921,97 +2507,163 @@ public:
             auto task = pplx::when_all(healthCheckTasks.begin(), healthCheckTasks.end());
             task.wait();
 
-            // wait for `period` ms
-            std::this_thread::sleep_for(
+            // wait for `period` ms (or until we start shutting down)
+            this->lifecycle.waitForDraining(
                 std::chrono::milliseconds(period)
             );
         }
     }
 
     /**
-     * Retreive the http_client associated with the given storage
-     * node, or create one if it doesn't exist.
+     * Returns the ids of the R (replication factor) distinct, healthy storage
+     * nodes block `blockNum` of key `key` is placed on, i.e. the first R found
+     * walking clockwise round the hash ring from the block's hash.
      */
-    std::shared_ptr<http_client> getHttpClient(std::shared_ptr<StorageNode> sn)
+    std::vector<uint32_t> findBlockNodes(const std::string &key, uint32_t blockNum)
     {
-        if (this->openConnections.find(sn->id) == this->openConnections.end())
-            this->openConnections[sn->id] = std::make_shared<http_client>(U(sn->ipPort));
-        return this->openConnections[sn->id];
-    }
+        uint32_t R = std::min(this->config.replicationFactor, this->config.numStorageNodes);
 
-    void showKbn() 
-    {
-        std::ostringstream oss;
-
-        oss << "{\n";
-        for (const auto& [key, blockMapPtr] : keyBlockNodeMap) {
-            oss << "  \"" << key << "\": {\n";
-
-            if (blockMapPtr) {
-                for (const auto& [blockNum, nodeSet] : *blockMapPtr) {
-                    oss << "    Block " << blockNum << ": { ";
-                    for (auto it = nodeSet.begin(); it != nodeSet.end(); ++it) {
-                        oss << *it;
-                        if (std::next(it) != nodeSet.end()) {
-                            oss << ", ";
-                        }
-                    }
-                    oss << " }\n";
-                }
-            } else {
-                oss << "    (null pointer)\n";
+        std::string hashInput = key + std::to_string(blockNum);
+        uint32_t hash = Crypto::sha256_32(hashInput);
+
+        std::vector<uint32_t> nodeIds;
+        std::unordered_set<uint32_t> usedStorageNodes;
+
+        while (nodeIds.size() < R)
+        {
+            std::shared_ptr<VirtualNode> vn = this->hashRing.findNextNode(hash);
+            uint32_t nodeId = vn->physicalNodeId;
+            std::shared_ptr<StorageNode> sn = this->storageNodes[nodeId];
+
+            bool nodeUnusedByBlock = usedStorageNodes.find(nodeId) == usedStorageNodes.end();
+            bool nodeHealthy = sn->isHealthy;
+
+            if (nodeUnusedByBlock && nodeHealthy)
+            {
+                nodeIds.push_back(nodeId);
+                usedStorageNodes.insert(nodeId);
             }
 
-            oss << "  }\n";
+            hash = vn->hash();
         }
-        oss << "}\n";
 
-        std::cout << oss.str() << std::endl;
+        return nodeIds;
     }
 
     /**
-     * Calculates and displays the distribution of the given `key`s blocks
-     * across the storage nodes.
+     * Returns the content hash of each `dataBlockSize` byte block of `data`.
      */
-    void calculateAndShowBlockDistribution(std::string key) 
+    static std::vector<uint32_t> blockHashes(std::vector<unsigned char> &data, uint32_t dataBlockSize)
     {
-        std::map<uint32_t, uint32_t> nodeBlockCounts; // node id -> block count
-        
-        std::map<uint32_t, std::set<uint32_t>> blockNodeMap = *(this->keyBlockNodeMap[key]);
-        uint32_t totalNumBlocks = blockNodeMap.size();
-        uint32_t totalNumReplicatedBlocks = 0;
-
-        for (auto p: blockNodeMap)
+        std::vector<uint32_t> hashes;
+        uint32_t dataSize = data.size();
+        for (uint32_t i = 0; i < dataSize; i += dataBlockSize)
         {
-            uint32_t blockNum = p.first; 
-            std::set<uint32_t> nodeIds = p.second;
+            auto blockEnd = data.begin() + std::min(i + dataBlockSize, dataSize);
+            hashes.push_back(Crypto::sha256_32(std::string(data.begin() + i, blockEnd)));
+        }
 
-            for (auto nodeId : nodeIds)
+        return hashes;
+    }
+
+    /**
+     * Sends `message` to storage node `sn` (over RPC, or its HTTP equivalent,
+     * depending on config.storageTransport), returning a task completing with
+     * the response's payload.
+     * 
+     * NOTE:
+     * 
+     * The task fails (with "`caller`() failed with status: ...") unless the
+     * node responds OK. Data referenced by `message` need only stay valid
+     * until this returns.
+     */
+    pplx::task<std::vector<unsigned char>> callStorageNode(
+        std::shared_ptr<StorageNode> sn,
+        const RpcMessage &message,
+        std::string caller
+    )
+    {
+        if (this->config.storageTransport == "rpc")
+        {
+            return this->rpcClients[sn->id]->call(message)
+            .then([caller](RpcResponse response)
             {
-                if (nodeBlockCounts.find(nodeId) == nodeBlockCounts.end())
-                    nodeBlockCounts[nodeId] = 0;
-                nodeBlockCounts[nodeId]++;
-                totalNumReplicatedBlocks++;
-            }
+                if (response.status != RPC_OK)
+                {
+                    throw std::runtime_error(
+                        caller + "() failed with RPC status: " + std::to_string(response.status));
+                }
+                return std::move(response.payload);
+            });
+        }
+
+        http_request req = http_request();
+        switch (message.code)
+        {
+        case RPC_GET_BLOCKS:
+            req.set_method(methods::GET);
+            req.set_request_uri(U("/store/" + message.key));
+            break;
+        case RPC_STORE_BLOCKS:
+            req.set_method(methods::PUT);
+            req.set_request_uri(U("/store/" + message.key));
+            break;
+        case RPC_APPEND_BLOCKS:
+            req.set_method(methods::PUT);
+            req.set_request_uri(U("/append/" + message.key));
+            break;
+        case RPC_UPDATE_BLOCKS:
+            req.set_method(methods::PUT);
+            req.set_request_uri(U("/update/" + message.key));
+            break;
+        case RPC_DELETE_KEY:
+            req.set_method(methods::DEL);
+            req.set_request_uri(U("/store/" + message.key));
+            break;
+        case RPC_DELETE_KEYS:
+            req.set_method(methods::DEL);
+            req.set_request_uri(U("/keys"));
+            break;
+        case RPC_HEALTH:
+            req.set_method(methods::GET);
+            req.set_request_uri(U("/health/"));
+            break;
+        case RPC_SYNC:
+            req.set_method(methods::GET);
+            req.set_request_uri(U("/sync"));
+            break;
+        case RPC_RENAME_KEY:
+            req.set_method(methods::PUT);
+            req.set_request_uri(U("/rename/" + message.key));
+            break;
+        default:
+            throw std::runtime_error(caller + "(): no HTTP endpoint for " + rpcOpName(message.code));
         }
 
-        std::ostringstream oss;
-
-        oss << "\n";
-        oss << "-------------------\n";
-        oss << "key: " << key << "\n";
-        oss << "unique blocks: " << totalNumBlocks << "\n";
-        oss << "total blocks (including replicas): " << totalNumReplicatedBlocks << "\n";
-        oss << "block distribution:\n";
-        oss << "{\n";
-        for (const auto& [nodeId, blockCount] : nodeBlockCounts) {
-            oss << "  " << nodeId << ": " << blockCount << "\n";
+        if (message.payloadSize > 0)
+        {
+            std::vector<unsigned char> body = message.flatten();
+
+            // /keys reads its body as text
+            if (message.code == RPC_DELETE_KEYS)
+                req.set_body(std::string(body.begin(), body.end()));
+            else
+                req.set_body(body);
         }
-        oss << "}\n";
-        oss << "-------------------\n";
-        oss << "\n";
 
-        std::cout << oss.str();
+        // held until the body's read, so the client counts as busy until then
+        auto lease = this->httpClientPools[sn->id]->acquire();
+        return lease->client().request(req)
+        .then([caller, lease](http_response response)
+        {
+            if (response.status_code() != status_codes::OK)
+            {
+                throw std::runtime_error(
+                    caller + "() failed with status: " + std::to_string(response.status_code()));
+            }
+            return response.extract_vector()
+            .then([lease](std::vector<unsigned char> body) { return body; });
+        });
     }
 
     /**
@@ -1036,69 +2688,224 @@ public:
 
     /**
      * Routes the given `request` to the appropriate endpoint / handler.
+     * 
+     * NOTE:
+     * 
+     * Handlers that talk to storage nodes return a task instead of waiting on 
+     * it, so this returns as soon as their requests are sent. Each task is observed 
+     * here, so a handler that throws replies 500 (rather than its unobserved
+     * exception taking the process down).
+     * 
+     * Requests arriving once shutdown has started get a 503, and the rest
+     * count as in flight until their task completes.
+     * 
+     * Writes count as writes of their key (of every key for /keys DEL) until
+     * their task completes, so no GET shares a fetch started before them
+     * (see SingleFlight). Writes of a single key also wait for any earlier 
+     * write of it to complete before they're handled (see KeyWriteQueue).
      */
     void router(http_request request) {
         auto p = ApiUtils::parsePath(request.relative_uri().to_string());
         std::string endpoint = p.first;
         std::string key = p.second;
 
-        key = StringUtils::fixedSize(key, 50);
+        // keys are variable length, up to a configured max.
+        if (key.size() > this->config.keyLengthMax)
+        {
+            request.reply(status_codes::BadRequest, "Key exceeds max. key length of " + std::to_string(this->config.keyLengthMax));
+            return;
+        }
+
+        // the staged key suffix is reserved for PUTs in progress (see StoreEndpoint::streamBlocks())
+        if (ApiUtils::isStagedKey(key))
+        {
+            request.reply(status_codes::BadRequest, "Key ends with reserved suffix " + ApiUtils::STAGED_KEY_SUFFIX);
+            return;
+        }
+
+        if (!this->lifecycle.tryBeginRequest())
+        {
+            request.reply(status_codes::ServiceUnavailable);
+            return;
+        }
+
+        bool writesAll = endpoint == U("/keys") && request.method() == methods::DEL;
+        bool writesKey = request.method() != methods::GET 
+            && (endpoint == U("/store") || endpoint == U("/append") || endpoint == U("/delta"));
+
+        if (writesAll)
+            this->getFlights.beginWriteAll();
+        if (writesKey)
+            this->getFlights.beginWrite(key);
 
-        StoreEndpoint storeEndpoint(this);
-        KeysEndpoint keysEndpoint(this);
+        auto storeEndpoint = std::make_shared<StoreEndpoint>(this);
+        auto keysEndpoint = std::make_shared<KeysEndpoint>(this);
         StatsEndpoint statsEndpoint(this);
 
-        if (endpoint == U("/store"))
+        pplx::task<void> handled = pplx::task_from_result();
+        try
         {
-            if (request.method() == methods::GET)
-                storeEndpoint.getHandler(request, key);
-            if (request.method() == methods::PUT)
-                storeEndpoint.putHandler(request, key);
-            if (request.method() == methods::DEL)
-                storeEndpoint.deleteHandler(request, key);
+            if (endpoint == U("/store"))
+            {
+                if (request.method() == methods::GET)
+                    handled = storeEndpoint->getHandler(request, key);
+                if (request.method() == methods::PUT)
+                    handled = this->keyWrites.run(key, [storeEndpoint, request, key]() { return storeEndpoint->putHandler(request, key); });
+                if (request.method() == methods::DEL)
+                    handled = this->keyWrites.run(key, [storeEndpoint, request, key]() { return storeEndpoint->deleteHandler(request, key); });
+            }
+            else if (endpoint == U("/append"))
+            {
+                if (request.method() == methods::PUT)
+                    handled = this->keyWrites.run(key, [storeEndpoint, request, key]() { return storeEndpoint->appendHandler(request, key); });
+            }
+            else if (endpoint == U("/delta"))
+            {
+                if (request.method() == methods::PUT)
+                    handled = this->keyWrites.run(key, [storeEndpoint, request, key]() { return storeEndpoint->deltaHandler(request, key); });
+            }
+            else if (endpoint == U("/keys"))
+            {
+                if (request.method() == methods::GET)
+                    keysEndpoint->getHandler(request);
+                if (request.method() == methods::DEL)
+                    handled = keysEndpoint->deleteHandler(request);
+            }
+            else if (endpoint == U("/stats"))
+            {
+                if (request.method() == methods::GET)
+                    statsEndpoint.getHandler(request);
+            }
+            else 
+            {
+                std::cout << "Endpoint not implemented: " << endpoint << std::endl;
+            }
         }
-        else if (endpoint == U("/keys"))
+        catch (const std::exception &e)
         {
-            if (request.method() == methods::GET)
-                keysEndpoint.getHandler(request);
+            handled = pplx::task_from_exception<void>(std::current_exception());
         }
-        else if (endpoint == U("/stats"))
+
+        handled.then([this, request, endpoint, key, writesAll, writesKey](pplx::task<void> t) mutable
+        {
+            try
+            {
+                t.get();
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << endpoint << ": failed - " << e.what() << std::endl;
+
+                // the handler may have replied before failing
+                try { request.reply(status_codes::InternalError); } catch (const std::exception &e) {}
+            }
+
+            if (writesAll)
+                this->getFlights.endWriteAll();
+            if (writesKey)
+                this->getFlights.endWrite(key);
+
+            this->lifecycle.endRequest();
+        });
+    }
+
+    /**
+     * Helper for startServer().
+     * 
+     * Returns whether the cpprest front end should handle `request`, replying
+     * 413 if its body is larger than `maxCpprestBodyBytes`, or 411 if its length
+     * isn't given up front.
+     * 
+     * NOTE:
+     * 
+     * cpprest's listener reads every body into memory in full, whatever the
+     * handler's StreamWindow, so this is what bounds an upload on that path.
+     */
+    bool acceptsCpprestBody(http_request request)
+    {
+        uint64_t maxBodyBytes = this->config.maxCpprestBodyBytes;
+        if (maxBodyBytes == 0)
+            return true;
+
+        if (request.headers().has(U("Transfer-Encoding")))
         {
-            if (request.method() == methods::GET)
-                statsEndpoint.getHandler(request);
+            request.reply(status_codes::LengthRequired);
+            return false;
         }
-        else 
+
+        if (request.headers().content_length() > maxBodyBytes)
         {
-            std::cout << "Endpoint not implemented: " << endpoint << std::endl;
-            return;
+            request.reply(status_codes::RequestEntityTooLarge);
+            return false;
         }
+
+        return true;
     }
 
     /**
-     * Starts the master server and starts the node health thread (see checkNodeHealth()).
+     * Starts the master server and starts the node health thread (see checkNodeHealth()),
+     * then serves requests until SIGINT/SIGTERM.
+     * 
+     * NOTE:
+     * 
+     * Requests are accepted by cpprest's http_listener, or by NativeFrontEnd if
+     * `frontEnd` is "native". Either way they're all passed to router().
+     * 
+     * On shutdown, new requests are turned away while those in flight are given
+     * up to `shutdownDrainMs` to finish, before the listener is closed.
      */
     void startServer() 
     {
         uri_builder uri(this->config.masterServerIPPort);
         auto addr = uri.to_uri().to_string();
-        http_listener listener(addr);
 
-        listener.support([this](http_request request) {
-            this->router(request);
-        });
+        std::unique_ptr<http_listener> listener;
+        std::unique_ptr<NativeFrontEnd> nativeFrontEnd;
 
         try 
         {
             // start request listener
-            listener
-                .open()
-                .then([&addr](){ std::cout << "Master server is listening at: " << addr << std::endl; });
+            if (this->config.frontEnd == "native")
+            {
+                web::uri parsed = uri.to_uri();
+                nativeFrontEnd = std::make_unique<NativeFrontEnd>(
+                    parsed.host(),
+                    parsed.port(),
+                    this->config.frontEndThreads,
+                    this->config.maxBufferedBodyBytes,
+                    this->config.streamWindowBytes,
+                    [this](http_request request) { this->router(request); }
+                );
+                nativeFrontEnd->start();
+            }
+            else if (this->config.frontEnd == "cpprest")
+            {
+                listener = std::make_unique<http_listener>(addr);
+                listener->support([this](http_request request) {
+                    if (this->acceptsCpprestBody(request))
+                        this->router(request);
+                });
+                listener->open().wait();
+            }
+            else
+                throw std::runtime_error("unknown frontEnd '" + this->config.frontEnd + "'");
+
+            std::cout << "Master server (" << this->config.frontEnd << " front end) is listening at: " << addr << std::endl;
             
             // start a thread to periodically check storage node health
             std::thread nodeHealthThread(&MasterServer::checkNodeHealth, this);
-            nodeHealthThread.detach();
 
-            while (1);
+            int signal = ServerLifecycle::waitForShutdownSignal();
+            std::cout << "Received signal " << signal << ", shutting down" << std::endl;
+
+            if (!this->lifecycle.drain(std::chrono::milliseconds(this->config.shutdownDrainMs)))
+                std::cout << this->lifecycle.requestsInFlight() << " requests still in flight, closing anyway" << std::endl;
+
+            if (listener)
+                listener->close().wait();
+            if (nativeFrontEnd)
+                nativeFrontEnd->stop();
+            nodeHealthThread.join();
         } 
         catch (const std::exception& e) 
         {
@@ -1113,11 +2920,22 @@ public:
 
 void run()
 {    
-    std::string configFilePath = "../src/config.json";
+    // may be overridden via the environment variable `CONFIG_PATH` (e.g. by bench/cluster.cpp)
+    const char* envConfigPath = std::getenv("CONFIG_PATH");
+    std::string configFilePath = envConfigPath ? envConfigPath : "../src/config.json";
+
+    // before any thread is started, so shutdown signals reach startServer() alone
+    ServerLifecycle::blockShutdownSignals();
+
+    // the thread pool must be sized before cpprest first uses it
+    uint32_t ioThreads = MasterConfig(configFilePath).ioThreads;
+    if (ioThreads > 0)
+        crossplat::threadpool::initialize_with_threads(ioThreads);
+
     MasterServer masterServer = MasterServer(configFilePath);
     masterServer.startServer();
 
-    PayloadsTests::runAll();
+    std::cout << "Master server stopped" << std::endl;
 }
 
 int main() 
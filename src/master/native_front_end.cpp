@@ -0,0 +1,1016 @@
+#include <cpprest/http_msg.h>
+#include <cpprest/containerstream.h>
+#include <cpprest/producerconsumerstream.h>
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "native_front_end.hpp"
+#include "http_parser.hpp"
+
+using namespace web;
+using namespace web::http;
+
+// num. bytes of a response body read from the handler at a time
+static const size_t RESPONSE_CHUNK_SIZE = 64 * 1024;
+
+// num. unsent response bytes at which a connection stops taking more from its handler
+static const size_t OUTPUT_HIGH_WATER = 256 * 1024;
+
+// num. bytes read from a socket at a time (outside of buffered bodies)
+static const size_t READ_SIZE = 16 * 1024;
+
+/**
+ * The buffer a streamed request body is passed to the handler through, which
+ * can call back once the handler has read it down to `windowBytes` unread.
+ *
+ * NOTE:
+ *
+ * Every way the handler reads from it goes through one of the overrides
+ * below, which check for the drain after the base buffer has done the read.
+ */
+class BodyBuffer : public concurrency::streams::details::basic_producer_consumer_buffer<uint8_t>
+{
+public:
+    typedef concurrency::streams::details::basic_producer_consumer_buffer<uint8_t> Base;
+
+    explicit BodyBuffer(size_t windowBytes) : Base(512), windowBytes(windowBytes) {}
+
+    /**
+     * Calls `fn` (once, from whichever thread reads the buffer) when no more
+     * than `windowBytes` are unread, straight away if that's already so.
+     */
+    void notifyWhenDrained(std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->drainMutex);
+            if (this->in_avail() > this->windowBytes)
+            {
+                this->onDrained = std::move(fn);
+                return;
+            }
+        }
+        fn();
+    }
+
+    virtual void release(uint8_t *ptr, size_t count) override
+    {
+        Base::release(ptr, count);
+        this->consumed();
+    }
+
+protected:
+    virtual pplx::task<size_t> _getn(uint8_t *ptr, size_t count) override
+    {
+        auto self = std::static_pointer_cast<BodyBuffer>(this->shared_from_this());
+        return Base::_getn(ptr, count).then([self](size_t numRead)
+        {
+            self->consumed();
+            return numRead;
+        });
+    }
+
+    virtual size_t _sgetn(uint8_t *ptr, size_t count) override
+    {
+        size_t numRead = Base::_sgetn(ptr, count);
+        this->consumed();
+        return numRead;
+    }
+
+    virtual pplx::task<int_type> _bumpc() override
+    {
+        auto self = std::static_pointer_cast<BodyBuffer>(this->shared_from_this());
+        return Base::_bumpc().then([self](int_type c)
+        {
+            self->consumed();
+            return c;
+        });
+    }
+
+    virtual int_type _sbumpc() override
+    {
+        int_type c = Base::_sbumpc();
+        this->consumed();
+        return c;
+    }
+
+private:
+    size_t windowBytes;
+
+    std::mutex drainMutex;
+    std::function<void()> onDrained;
+
+    void consumed()
+    {
+        std::function<void()> fn;
+        {
+            std::lock_guard<std::mutex> lock(this->drainMutex);
+            if (!this->onDrained || this->in_avail() > this->windowBytes)
+                return;
+            fn.swap(this->onDrained);
+        }
+        fn();
+    }
+};
+
+/**
+ * A client connection, only ever touched by its event loop's thread.
+ */
+struct Connection
+{
+    enum State
+    {
+        READING_HEAD,
+        READING_BODY,       // buffering a body of up to `maxBufferedBodyBytes`
+        STREAMING_BODY,     // handler is running, and reading the body as it arrives
+        AWAITING_RESPONSE,  // whole request received, handler hasn't finished replying
+        CLOSING             // no more requests, closing once output is sent
+    };
+
+    int fd;
+    bool closed = false;
+    State state = READING_HEAD;
+
+    // received, but not yet parsed (or passed on) bytes: in[inStart, inEnd)
+    std::vector<char> in;
+    size_t inStart = 0;
+    size_t inEnd = 0;
+
+    // unsent output, with `outOffset` bytes of the first segment sent
+    std::deque<std::shared_ptr<std::vector<unsigned char>>> out;
+    size_t outOffset = 0;
+    size_t outBytes = 0;
+
+    // current request
+    HttpRequestHead head;
+    http_request request;
+    bool responseStarted = false;
+    bool responseDone = false;
+
+    // body being buffered (READING_BODY)
+    std::shared_ptr<std::vector<unsigned char>> body;
+    uint64_t bodyReceived = 0;
+
+    // body being streamed to the handler (STREAMING_BODY)
+    std::shared_ptr<BodyBuffer> bodyBuffer;
+    bool readPaused = false;
+
+    // response pump waiting for `out` to drain below OUTPUT_HIGH_WATER
+    std::shared_ptr<pplx::task_completion_event<void>> outputWaiter;
+
+    // events currently registered with epoll
+    uint32_t events = 0;
+
+    explicit Connection(int fd) : fd(fd), in(READ_SIZE) {}
+
+    size_t inAvail() const { return this->inEnd - this->inStart; }
+};
+
+/**
+ * Runs one thread's accept/read/write loop (see NativeFrontEnd).
+ */
+class NativeFrontEnd::EventLoop : public std::enable_shared_from_this<NativeFrontEnd::EventLoop>
+{
+public:
+    EventLoop(
+        int listenFd,
+        uint64_t maxBufferedBodyBytes,
+        uint64_t bodyWindowBytes,
+        NativeFrontEnd::Handler handler
+    )
+        : listenFd(listenFd),
+            maxBufferedBodyBytes(maxBufferedBodyBytes),
+            bodyWindowBytes(bodyWindowBytes),
+            handler(handler),
+            stopped(false)
+    {
+        this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        this->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (this->epollFd < 0 || this->wakeFd < 0)
+            throw std::runtime_error("NativeFrontEnd: failed to create epoll/eventfd - " + std::string(strerror(errno)));
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = this->listenFd;
+        epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->listenFd, &ev);
+
+        ev.data.fd = this->wakeFd;
+        epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->wakeFd, &ev);
+    }
+
+    ~EventLoop()
+    {
+        close(this->epollFd);
+        close(this->wakeFd);
+    }
+
+    void start()
+    {
+        this->thread = std::thread(&EventLoop::run, this);
+    }
+
+    /**
+     * Stops the loop and joins its thread.
+     */
+    void stop()
+    {
+        this->post([this]() { this->running = false; });
+        if (this->thread.joinable())
+            this->thread.join();
+    }
+
+    /**
+     * Runs `fn` on the loop's thread. Returns false (without running it)
+     * if the loop has stopped.
+     */
+    bool post(std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->postedMutex);
+            if (this->stopped)
+                return false;
+            this->posted.push_back(std::move(fn));
+        }
+
+        uint64_t one = 1;
+        ssize_t n = write(this->wakeFd, &one, sizeof(one));
+        (void)n;
+        return true;
+    }
+
+private:
+    int listenFd;
+    int epollFd;
+    int wakeFd;
+
+    uint64_t maxBufferedBodyBytes;
+    uint64_t bodyWindowBytes;
+    NativeFrontEnd::Handler handler;
+
+    std::thread thread;
+    bool running = true;
+
+    std::map<int, std::shared_ptr<Connection>> connections;
+
+    std::mutex postedMutex;
+    std::vector<std::function<void()>> posted;
+    bool stopped;
+
+    ////////////////////////////////////////////
+    // Loop
+    ////////////////////////////////////////////
+
+    void run()
+    {
+        std::vector<epoll_event> events(256);
+
+        while (this->running)
+        {
+            int numEvents = epoll_wait(this->epollFd, events.data(), events.size(), -1);
+            if (numEvents < 0 && errno != EINTR)
+            {
+                std::cout << "NativeFrontEnd: epoll_wait failed - " << strerror(errno) << std::endl;
+                break;
+            }
+
+            for (int i = 0; i < numEvents; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == this->listenFd)
+                    this->acceptConnections();
+                else if (fd == this->wakeFd)
+                    this->runPosted();
+                else
+                {
+                    auto it = this->connections.find(fd);
+                    if (it == this->connections.end())
+                        continue;
+
+                    std::shared_ptr<Connection> conn = it->second;
+                    if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    {
+                        this->closeConnection(conn);
+                        continue;
+                    }
+                    if (events[i].events & EPOLLOUT)
+                        this->flush(conn);
+                    if (!conn->closed && (events[i].events & EPOLLIN))
+                        this->readInput(conn);
+                }
+            }
+        }
+
+        // stop taking posts, then close everything
+        {
+            std::lock_guard<std::mutex> lock(this->postedMutex);
+            this->stopped = true;
+        }
+        this->runPosted();
+
+        auto connections = this->connections;
+        for (auto &[fd, conn] : connections)
+            this->closeConnection(conn);
+        close(this->listenFd);
+    }
+
+    void runPosted()
+    {
+        uint64_t count;
+        ssize_t n = read(this->wakeFd, &count, sizeof(count));
+        (void)n;
+
+        std::vector<std::function<void()>> fns;
+        {
+            std::lock_guard<std::mutex> lock(this->postedMutex);
+            fns.swap(this->posted);
+        }
+        for (auto &fn : fns)
+            fn();
+    }
+
+    void acceptConnections()
+    {
+        while (true)
+        {
+            int fd = accept4(this->listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;
+
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            auto conn = std::make_shared<Connection>(fd);
+            this->connections[fd] = conn;
+
+            conn->events = EPOLLIN;
+            epoll_event ev = {};
+            ev.events = conn->events;
+            ev.data.fd = fd;
+            epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+
+    /**
+     * Re-registers `conn` for the events it currently wants, i.e. input unless its
+     * upload is paused (or a pipelined request is waiting), and output while any is unsent.
+     */
+    void updateEvents(std::shared_ptr<Connection> conn)
+    {
+        if (conn->closed)
+            return;
+
+        bool wantInput = !conn->readPaused
+            && conn->state != Connection::CLOSING
+            && !(conn->state == Connection::AWAITING_RESPONSE && conn->inAvail() > 0);
+
+        uint32_t events = (wantInput ? EPOLLIN : 0) | (conn->outBytes > 0 ? EPOLLOUT : 0);
+        if (events == conn->events)
+            return;
+
+        conn->events = events;
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = conn->fd;
+        epoll_ctl(this->epollFd, EPOLL_CTL_MOD, conn->fd, &ev);
+    }
+
+    void closeConnection(std::shared_ptr<Connection> conn)
+    {
+        if (conn->closed)
+            return;
+        conn->closed = true;
+
+        epoll_ctl(this->epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        this->connections.erase(conn->fd);
+
+        // fail the handler's reads of a body that'll never arrive
+        if (conn->bodyBuffer)
+            conn->bodyBuffer->close(std::ios_base::out, std::make_exception_ptr(std::runtime_error("client disconnected")));
+
+        if (conn->outputWaiter)
+        {
+            conn->outputWaiter->set_exception(std::make_exception_ptr(std::runtime_error("client disconnected")));
+            conn->outputWaiter.reset();
+        }
+    }
+
+    ////////////////////////////////////////////
+    // Input
+    ////////////////////////////////////////////
+
+    void readInput(std::shared_ptr<Connection> conn)
+    {
+        while (!conn->closed && !conn->readPaused && conn->state != Connection::CLOSING)
+        {
+            ssize_t n;
+            if (conn->state == Connection::READING_BODY && conn->inAvail() == 0)
+            {
+                // receive the body straight into the handler's buffer
+                n = recv(conn->fd, conn->body->data() + conn->bodyReceived, conn->body->size() - conn->bodyReceived, 0);
+                if (n > 0)
+                    conn->bodyReceived += n;
+            }
+            else
+            {
+                // waiting pipelined requests are parsed once the current one is answered
+                if (conn->state == Connection::AWAITING_RESPONSE && conn->inAvail() > 0)
+                    break;
+
+                if (conn->in.size() - conn->inEnd < READ_SIZE)
+                {
+                    // compact, or grow if mostly unparsed
+                    std::memmove(conn->in.data(), conn->in.data() + conn->inStart, conn->inAvail());
+                    conn->inEnd -= conn->inStart;
+                    conn->inStart = 0;
+                    if (conn->in.size() - conn->inEnd < READ_SIZE)
+                        conn->in.resize(conn->in.size() * 2);
+                }
+
+                n = recv(conn->fd, conn->in.data() + conn->inEnd, conn->in.size() - conn->inEnd, 0);
+                if (n > 0)
+                    conn->inEnd += n;
+            }
+
+            if (n == 0)
+            {
+                this->closeConnection(conn);
+                return;
+            }
+            if (n < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                if (errno == EINTR)
+                    continue;
+                this->closeConnection(conn);
+                return;
+            }
+
+            this->processInput(conn);
+        }
+
+        this->updateEvents(conn);
+    }
+
+    /**
+     * Moves `conn` through as many request states as its received input allows.
+     */
+    void processInput(std::shared_ptr<Connection> conn)
+    {
+        while (!conn->closed)
+        {
+            if (conn->state == Connection::READING_HEAD)
+            {
+                if (conn->inAvail() == 0)
+                    return;
+
+                HttpParseStatus status = HttpRequestHead::parse(conn->in.data() + conn->inStart, conn->inAvail(), conn->head);
+                if (status == HTTP_PARSE_INCOMPLETE)
+                    return;
+                if (status == HTTP_PARSE_INVALID)
+                {
+                    this->sendError(conn, status_codes::BadRequest);
+                    return;
+                }
+
+                conn->inStart += conn->head.headSize;
+                this->beginRequest(conn);
+            }
+            else if (conn->state == Connection::READING_BODY)
+            {
+                size_t n = std::min<uint64_t>(conn->inAvail(), conn->body->size() - conn->bodyReceived);
+                std::memcpy(conn->body->data() + conn->bodyReceived, conn->in.data() + conn->inStart, n);
+                conn->inStart += n;
+                conn->bodyReceived += n;
+
+                if (conn->bodyReceived < conn->body->size())
+                    return;
+
+                auto data = std::move(*(conn->body));
+                conn->body.reset();
+                conn->request.set_body(
+                    concurrency::streams::bytestream::open_istream(std::move(data)),
+                    conn->head.contentLength,
+                    this->contentType(conn->head)
+                );
+
+                conn->state = Connection::AWAITING_RESPONSE;
+                this->dispatch(conn);
+            }
+            else if (conn->state == Connection::STREAMING_BODY)
+            {
+                size_t n = std::min<uint64_t>(conn->inAvail(), conn->head.contentLength - conn->bodyReceived);
+                if (n > 0)
+                {
+                    conn->bodyBuffer->putn_nocopy(reinterpret_cast<uint8_t*>(conn->in.data() + conn->inStart), n).wait();
+                    conn->inStart += n;
+                    conn->bodyReceived += n;
+                }
+
+                if (conn->bodyReceived == conn->head.contentLength)
+                {
+                    conn->bodyBuffer->close(std::ios_base::out);
+                    conn->bodyBuffer.reset();
+                    conn->readPaused = false;
+                    conn->state = Connection::AWAITING_RESPONSE;
+                    return;
+                }
+
+                if (conn->bodyBuffer->in_avail() > this->bodyWindowBytes)
+                    this->pauseUpload(conn);
+                return;
+            }
+            else
+                return;
+        }
+    }
+
+    /**
+     * Stops reading `conn`'s upload until its handler has read the body down
+     * to `bodyWindowBytes` unread, when the handler's read posts the resume.
+     */
+    void pauseUpload(std::shared_ptr<Connection> conn)
+    {
+        conn->readPaused = true;
+
+        // weak, as the body buffer may outlive both (the request holds it too)
+        std::weak_ptr<EventLoop> weakSelf = shared_from_this();
+        std::weak_ptr<Connection> weakConn = conn;
+        conn->bodyBuffer->notifyWhenDrained([weakSelf, weakConn]()
+        {
+            std::shared_ptr<EventLoop> self = weakSelf.lock();
+            if (!self)
+                return;
+
+            self->post([self, weakConn]()
+            {
+                std::shared_ptr<Connection> conn = weakConn.lock();
+                if (!conn || conn->closed || !conn->readPaused)
+                    return;
+
+                conn->readPaused = false;
+                self->processInput(conn);
+                self->updateEvents(conn);
+            });
+        });
+    }
+
+    /**
+     * Builds `conn`'s http_request from its parsed head, then either buffers its
+     * body or hands it to the handler straight away (with the body to follow).
+     */
+    void beginRequest(std::shared_ptr<Connection> conn)
+    {
+        HttpRequestHead &head = conn->head;
+
+        if (head.chunked)
+        {
+            this->sendError(conn, status_codes::LengthRequired);
+            return;
+        }
+
+        conn->request = http_request(head.method);
+        conn->responseStarted = false;
+        conn->responseDone = false;
+        conn->bodyReceived = 0;
+
+        try
+        {
+            conn->request.set_request_uri(uri(head.target));
+        }
+        catch (const std::exception &e)
+        {
+            this->sendError(conn, status_codes::BadRequest);
+            return;
+        }
+
+        for (auto &[name, value] : head.headers)
+            conn->request.headers().add(name, value);
+
+        if (head.expectContinue && head.contentLength > 0)
+            this->queueOutput(conn, "HTTP/1.1 100 Continue\r\n\r\n");
+
+        if (head.contentLength <= this->maxBufferedBodyBytes)
+        {
+            conn->body = std::make_shared<std::vector<unsigned char>>(head.contentLength);
+            conn->state = Connection::READING_BODY;
+            return;
+        }
+
+        conn->bodyBuffer = std::make_shared<BodyBuffer>(this->bodyWindowBytes);
+        conn->request.set_body(
+            concurrency::streams::streambuf<uint8_t>(conn->bodyBuffer).create_istream(),
+            head.contentLength,
+            this->contentType(head)
+        );
+        conn->state = Connection::STREAMING_BODY;
+        this->dispatch(conn);
+    }
+
+    std::string contentType(const HttpRequestHead &head)
+    {
+        std::string type = head.header("Content-Type");
+        return type.empty() ? "application/octet-stream" : type;
+    }
+
+    /**
+     * Hands `conn`'s request to the handler, and sends its response once it replies.
+     */
+    void dispatch(std::shared_ptr<Connection> conn)
+    {
+        http_request request = conn->request;
+        try
+        {
+            this->handler(request);
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "NativeFrontEnd: handler failed - " << e.what() << std::endl;
+            try { request.reply(status_codes::InternalError); } catch (const std::exception &e) {}
+        }
+
+        auto self = shared_from_this();
+        std::weak_ptr<Connection> weakConn = conn;
+        bool http10 = (conn->head.minorVersion == 0);
+        request.get_response()
+        .then([self, weakConn, http10](pplx::task<http_response> responseTask)
+        {
+            http_response response;
+            try
+            {
+                response = responseTask.get();
+            }
+            catch (const std::exception &e)
+            {
+                response = http_response(status_codes::InternalError);
+            }
+
+            return self->sendResponse(weakConn, response, http10);
+        })
+        .then([](pplx::task<void> sent)
+        {
+            // the client may have gone away mid-response
+            try { sent.get(); } catch (const std::exception &e) {}
+        });
+    }
+
+    ////////////////////////////////////////////
+    // Output
+    ////////////////////////////////////////////
+
+    /**
+     * Sends `response` on `conn` (run on one of cpprest's threads): its head, then
+     * its body as the handler produces it, a chunk at a time, waiting for the
+     * connection to drain whenever OUTPUT_HIGH_WATER bytes are unsent.
+     *
+     * NOTE:
+     *
+     * HTTP/1.0 clients (`http10`) don't understand chunking, so a body of
+     * unknown length is sent as is to them, and ended by closing the connection.
+     */
+    pplx::task<void> sendResponse(std::weak_ptr<Connection> weakConn, http_response response, bool http10)
+    {
+        concurrency::streams::istream body = response.body();
+        bool hasBody = body.is_valid();
+        bool hasLength = response.headers().has(U("Content-Length"));
+        bool chunked = hasBody && !hasLength && !http10;
+        bool closeDelimited = hasBody && !hasLength && http10;
+
+        std::string head = "HTTP/1.1 " + std::to_string(response.status_code()) + " " + response.reason_phrase() + "\r\n";
+        for (auto &[name, value] : response.headers())
+        {
+            if (name == U("Connection") || name == U("Transfer-Encoding"))
+                continue;
+            head += name + ": " + value + "\r\n";
+        }
+
+        if (!hasBody && !hasLength)
+            head += "Content-Length: 0\r\n";
+        else if (chunked)
+            head += "Transfer-Encoding: chunked\r\n";
+
+        auto headBytes = std::make_shared<std::vector<unsigned char>>(head.begin(), head.end());
+        pplx::task<void> headSent = this->writeResponse(weakConn, headBytes, true, !hasBody, closeDelimited);
+        if (!hasBody)
+            return headSent;
+
+        auto self = shared_from_this();
+        return headSent.then([self, weakConn, body, chunked]()
+        {
+            return self->pumpBody(weakConn, body, chunked);
+        });
+    }
+
+    pplx::task<void> pumpBody(std::weak_ptr<Connection> weakConn, concurrency::streams::istream body, bool chunked)
+    {
+        auto chunk = std::make_shared<std::vector<unsigned char>>(RESPONSE_CHUNK_SIZE);
+
+        auto self = shared_from_this();
+        return body.streambuf().getn(chunk->data(), chunk->size())
+        .then([self, weakConn, body, chunked, chunk](size_t numRead)
+        {
+            chunk->resize(numRead);
+            bool last = (numRead == 0);
+
+            if (chunked && !last)
+            {
+                char size[32];
+                snprintf(size, sizeof(size), "%zx\r\n", numRead);
+                chunk->insert(chunk->begin(), size, size + strlen(size));
+                chunk->push_back('\r');
+                chunk->push_back('\n');
+            }
+            else if (chunked)
+            {
+                const char *lastChunk = "0\r\n\r\n";
+                chunk->assign(lastChunk, lastChunk + strlen(lastChunk));
+            }
+
+            return self->writeResponse(weakConn, chunk, false, last)
+            .then([self, weakConn, body, chunked, last]()
+            {
+                if (last)
+                    return pplx::task_from_result();
+                return self->pumpBody(weakConn, body, chunked);
+            });
+        });
+    }
+
+    /**
+     * Queues `data` (part of a response) on `conn`, from any thread. Completes once
+     * the connection has room for more, or fails if it has gone away.
+     *
+     * NOTE:
+     *
+     * The response head is passed with `isHead`, so the connection's headers
+     * can be added (`closeAfter` if the connection must close after the
+     * response), and the last part with `isLast`, which finishes the request.
+     */
+    pplx::task<void> writeResponse(
+        std::weak_ptr<Connection> weakConn,
+        std::shared_ptr<std::vector<unsigned char>> data,
+        bool isHead,
+        bool isLast,
+        bool closeAfter = false
+    )
+    {
+        auto ready = std::make_shared<pplx::task_completion_event<void>>();
+
+        bool posted = this->post([this, weakConn, data, isHead, isLast, closeAfter, ready]()
+        {
+            std::shared_ptr<Connection> conn = weakConn.lock();
+            if (!conn || conn->closed)
+            {
+                ready->set_exception(std::make_exception_ptr(std::runtime_error("client disconnected")));
+                return;
+            }
+
+            if (isHead)
+            {
+                conn->responseStarted = true;
+
+                // close if asked to, or if the rest of the body would have to be skipped
+                bool bodyUnread = (conn->state == Connection::STREAMING_BODY);
+                if (!conn->head.keepAlive || bodyUnread || closeAfter)
+                {
+                    std::string connClose = "Connection: close\r\n";
+                    data->insert(data->end(), connClose.begin(), connClose.end());
+                    conn->head.keepAlive = false;
+                }
+                data->push_back('\r');
+                data->push_back('\n');
+            }
+
+            if (!data->empty())
+                this->queueOutput(conn, data);
+
+            if (isLast)
+            {
+                conn->responseDone = true;
+                if (conn->state != Connection::STREAMING_BODY)
+                    this->finishRequest(conn);
+                else
+                    conn->state = Connection::CLOSING;
+            }
+
+            this->flush(conn);
+
+            if (conn->closed)
+                ready->set_exception(std::make_exception_ptr(std::runtime_error("client disconnected")));
+            else if (conn->outBytes <= OUTPUT_HIGH_WATER)
+                ready->set();
+            else
+                conn->outputWaiter = ready;
+        });
+
+        if (!posted)
+            ready->set_exception(std::make_exception_ptr(std::runtime_error("front end stopped")));
+
+        return pplx::create_task(*ready);
+    }
+
+    /**
+     * Finishes `conn`'s current request, then moves on to any pipelined
+     * request (or closes, if not keep-alive).
+     */
+    void finishRequest(std::shared_ptr<Connection> conn)
+    {
+        conn->request = http_request();
+
+        if (!conn->head.keepAlive)
+        {
+            conn->state = Connection::CLOSING;
+            this->updateEvents(conn);
+            return;
+        }
+
+        conn->state = Connection::READING_HEAD;
+        this->processInput(conn);
+        this->updateEvents(conn);
+    }
+
+    /**
+     * Replies `code` to a request we can't hand over, and stops reading `conn`.
+     */
+    void sendError(std::shared_ptr<Connection> conn, status_code code)
+    {
+        this->queueOutput(conn, "HTTP/1.1 " + std::to_string(code) + " \r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        conn->state = Connection::CLOSING;
+        this->flush(conn);
+    }
+
+    void queueOutput(std::shared_ptr<Connection> conn, const std::string &text)
+    {
+        this->queueOutput(conn, std::make_shared<std::vector<unsigned char>>(text.begin(), text.end()));
+    }
+
+    void queueOutput(std::shared_ptr<Connection> conn, std::shared_ptr<std::vector<unsigned char>> data)
+    {
+        conn->outBytes += data->size();
+        conn->out.push_back(std::move(data));
+    }
+
+    /**
+     * Writes as much of `conn`'s queued output as the socket takes.
+     */
+    void flush(std::shared_ptr<Connection> conn)
+    {
+        while (!conn->closed && conn->outBytes > 0)
+        {
+            iovec iov[16];
+            int numIov = 0;
+            size_t offset = conn->outOffset;
+            for (auto it = conn->out.begin(); it != conn->out.end() && numIov < 16; it++, offset = 0)
+            {
+                iov[numIov].iov_base = (*it)->data() + offset;
+                iov[numIov].iov_len = (*it)->size() - offset;
+                numIov++;
+            }
+
+            msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = numIov;
+            ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                if (errno == EINTR)
+                    continue;
+                this->closeConnection(conn);
+                return;
+            }
+
+            // drop fully sent segments
+            conn->outBytes -= n;
+            size_t sent = n;
+            while (sent > 0)
+            {
+                size_t remaining = conn->out.front()->size() - conn->outOffset;
+                if (sent < remaining)
+                {
+                    conn->outOffset += sent;
+                    break;
+                }
+                sent -= remaining;
+                conn->out.pop_front();
+                conn->outOffset = 0;
+            }
+        }
+
+        if (conn->outputWaiter && conn->outBytes <= OUTPUT_HIGH_WATER)
+        {
+            conn->outputWaiter->set();
+            conn->outputWaiter.reset();
+        }
+
+        if (conn->state == Connection::CLOSING && conn->outBytes == 0 && (conn->responseDone || !conn->responseStarted))
+        {
+            this->closeConnection(conn);
+            return;
+        }
+
+        this->updateEvents(conn);
+    }
+};
+
+////////////////////////////////////////////
+// NativeFrontEnd methods
+////////////////////////////////////////////
+
+/* Param constructor */
+NativeFrontEnd::NativeFrontEnd(
+    std::string host,
+    uint16_t port,
+    uint32_t numThreads,
+    uint64_t maxBufferedBodyBytes,
+    uint64_t bodyWindowBytes,
+    Handler handler
+)
+    : host(host),
+        port(port),
+        numThreads(std::max<uint32_t>(1, numThreads)),
+        maxBufferedBodyBytes(maxBufferedBodyBytes),
+        bodyWindowBytes(bodyWindowBytes),
+        handler(handler)
+{
+}
+
+NativeFrontEnd::~NativeFrontEnd()
+{
+    this->stop();
+}
+
+/**
+ * Binds the listening sockets and starts the event loops. Throws
+ * if the address can't be bound.
+ */
+void NativeFrontEnd::start()
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo *addrs = nullptr;
+    std::string service = std::to_string(this->port);
+    int err = getaddrinfo(this->host.empty() ? nullptr : this->host.c_str(), service.c_str(), &hints, &addrs);
+    if (err != 0)
+        throw std::runtime_error("NativeFrontEnd: can't resolve " + this->host + " - " + gai_strerror(err));
+
+    // one socket per loop, so the kernel spreads connections between them
+    for (uint32_t i = 0; i < this->numThreads; i++)
+    {
+        int fd = socket(addrs->ai_family, addrs->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addrs->ai_protocol);
+        if (fd >= 0)
+        {
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        }
+
+        if (fd < 0 || bind(fd, addrs->ai_addr, addrs->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0)
+        {
+            std::string error = strerror(errno);
+            if (fd >= 0)
+                close(fd);
+            freeaddrinfo(addrs);
+            this->stop();
+            throw std::runtime_error("NativeFrontEnd: can't listen on " + this->host + ":" + service + " - " + error);
+        }
+
+        auto loop = std::make_shared<EventLoop>(fd, this->maxBufferedBodyBytes, this->bodyWindowBytes, this->handler);
+        loop->start();
+        this->loops.push_back(loop);
+    }
+
+    freeaddrinfo(addrs);
+}
+
+/**
+ * Stops the event loops, closing all connections (including any
+ * mid-request), and joins their threads.
+ */
+void NativeFrontEnd::stop()
+{
+    for (auto &loop : this->loops)
+        loop->stop();
+    this->loops.clear();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cpprest/http_msg.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <functional>
+
+/**
+ * An epoll-based HTTP/1.1 server for the master's client API, used in
+ * place of cpprest's http_listener when `frontEnd` is "native".
+ *
+ * NOTE:
+ *
+ * Each request is handed to `handler` (i.e. MasterServer::router()) as an
+ * ordinary http_request, and its reply is picked up via get_response(), so
+ * handlers can't tell which front end they're behind.
+ *
+ * Each of the `numThreads` event loops accepts on its own SO_REUSEPORT socket
+ * and owns its connections outright, so connections are never locked. Handlers
+ * run on the loop thread (they don't block, see StoreEndpoint), and responses
+ * are passed back to it from cpprest's threads.
+ *
+ * Connections are kept alive, and pipelined requests are buffered and
+ * answered in order, one at a time.
+ *
+ * Request bodies of up to `maxBufferedBodyBytes` are received straight into
+ * the buffer the handler reads, before it's called. Larger bodies are handed
+ * over as they arrive, with reading paused while more than `bodyWindowBytes`
+ * are unread by the handler, until its reads drain them. Response bodies are
+ * written from the handler's own buffers with writev(), chunked if their
+ * length isn't known up front (or, for HTTP/1.0, ended by closing).
+ */
+class NativeFrontEnd
+{
+public:
+    typedef std::function<void(web::http::http_request)> Handler;
+
+    /* Param constructor */
+    NativeFrontEnd(
+        std::string host,
+        uint16_t port,
+        uint32_t numThreads,
+        uint64_t maxBufferedBodyBytes,
+        uint64_t bodyWindowBytes,
+        Handler handler
+    );
+    ~NativeFrontEnd();
+
+    /**
+     * Binds the listening sockets and starts the event loops. Throws
+     * if the address can't be bound.
+     */
+    void start();
+
+    /**
+     * Stops the event loops, closing all connections (including any
+     * mid-request), and joins their threads.
+     */
+    void stop();
+
+private:
+    class EventLoop;
+
+    std::string host;
+    uint16_t port;
+    uint32_t numThreads;
+    uint64_t maxBufferedBodyBytes;
+    uint64_t bodyWindowBytes;
+    Handler handler;
+
+    std::vector<std::shared_ptr<EventLoop>> loops;
+};
@@ -0,0 +1,158 @@
+#include <iostream>
+#include <stdexcept>
+
+#include "single_flight.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// SingleFlight tests
+////////////////////////////////////////////
+namespace SingleFlightTests
+{
+    /* A fetch that completes (with its num.) once `release` is set */
+    struct ControlledFetch
+    {
+        std::shared_ptr<int> numStarted = std::make_shared<int>(0);
+        pplx::task_completion_event<void> release;
+
+        SingleFlight<int>::Fetch fetch()
+        {
+            auto numStarted = this->numStarted;
+            auto release = this->release;
+            return [numStarted, release]()
+            {
+                int n = ++(*numStarted);
+                return pplx::create_task(release).then([n]() { return std::make_shared<int>(n); });
+            };
+        }
+    };
+
+    void testJoinsInFlightFetch()
+    {
+        SingleFlight<int> flights;
+        ControlledFetch controlled;
+
+        auto first = flights.run("key", "batch 0", controlled.fetch());
+        auto second = flights.run("key", "batch 0", controlled.fetch());
+
+        // different batches (or keys) aren't coalesced
+        auto otherBatch = flights.run("key", "batch 1", controlled.fetch());
+        auto otherKey = flights.run("other key", "batch 0", controlled.fetch());
+
+        ASSERT_THAT(*controlled.numStarted == 3);
+        ASSERT_THAT(flights.numFetched() == 3);
+        ASSERT_THAT(flights.numJoined() == 1);
+
+        controlled.release.set();
+        ASSERT_THAT(*first.get() == 1);
+        ASSERT_THAT(first.get() == second.get());
+        ASSERT_THAT(*otherBatch.get() == 2);
+        ASSERT_THAT(*otherKey.get() == 3);
+    }
+
+    void testCompletedFetchIsNotReused()
+    {
+        SingleFlight<int> flights;
+        ControlledFetch controlled;
+        controlled.release.set();
+
+        auto first = flights.run("key", "batch 0", controlled.fetch());
+        first.wait();
+
+        auto second = flights.run("key", "batch 0", controlled.fetch());
+        ASSERT_THAT(*second.get() == 2);
+        ASSERT_THAT(flights.numJoined() == 0);
+    }
+
+    void testWritesPreventJoining()
+    {
+        SingleFlight<int> flights;
+        ControlledFetch controlled;
+
+        // a write drops the fetch started before it...
+        auto beforeWrite = flights.run("key", "batch 0", controlled.fetch());
+        flights.beginWrite("key");
+
+        // ...and fetches during it are neither joined nor joinable
+        auto duringWrite1 = flights.run("key", "batch 0", controlled.fetch());
+        auto duringWrite2 = flights.run("key", "batch 0", controlled.fetch());
+        flights.endWrite("key");
+
+        auto afterWrite1 = flights.run("key", "batch 0", controlled.fetch());
+        auto afterWrite2 = flights.run("key", "batch 0", controlled.fetch());
+
+        ASSERT_THAT(*controlled.numStarted == 4);
+        ASSERT_THAT(flights.numJoined() == 1);
+
+        // writes to any key act on every key
+        flights.beginWriteAll();
+        auto duringWriteAll = flights.run("key", "batch 0", controlled.fetch());
+        flights.endWriteAll();
+        ASSERT_THAT(*controlled.numStarted == 5);
+
+        controlled.release.set();
+        ASSERT_THAT(*beforeWrite.get() == 1);
+        ASSERT_THAT(*duringWrite1.get() == 2);
+        ASSERT_THAT(*duringWrite2.get() == 3);
+        ASSERT_THAT(*afterWrite1.get() == 4);
+        ASSERT_THAT(afterWrite2.get() == afterWrite1.get());
+        ASSERT_THAT(*duringWriteAll.get() == 5);
+    }
+
+    void testFailureReachesAllWaiters()
+    {
+        SingleFlight<int> flights;
+        pplx::task_completion_event<std::shared_ptr<int>> result;
+
+        auto fetch = [result]() { return pplx::create_task(result); };
+        auto first = flights.run("key", "batch 0", fetch);
+        auto second = flights.run("key", "batch 0", fetch);
+
+        result.set_exception(std::runtime_error("node down"));
+        for (auto &waiter : {first, second})
+        {
+            try
+            {
+                waiter.get();
+                FORCE_FAIL("every waiter should see the fetch fail");
+            }
+            catch (const std::runtime_error &e) {}
+        }
+
+        // a fetch that throws fails its task, and isn't left joinable
+        auto throwing = flights.run("key", "batch 0", []() -> pplx::task<std::shared_ptr<int>> {
+            throw std::runtime_error("can't connect");
+        });
+        try
+        {
+            throwing.get();
+            FORCE_FAIL("a throwing fetch should fail its task");
+        }
+        catch (const std::runtime_error &e) {}
+
+        auto retried = flights.run("key", "batch 0", []() { return pplx::task_from_result(std::make_shared<int>(7)); });
+        ASSERT_THAT(*retried.get() == 7);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "SingleFlightTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testJoinsInFlightFetch),
+            TEST(testCompletedFetchIsNotReused),
+            TEST(testWritesPreventJoining),
+            TEST(testFailureReachesAllWaiters)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
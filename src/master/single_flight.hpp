@@ -0,0 +1,216 @@
+#pragma once
+
+#include <pplx/pplxtasks.h>
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+/**
+ * Coalesces identical concurrent fetches, so a fetch of `flightKey` (one of
+ * key `key`'s) started while an identical one is in flight joins it instead
+ * of fetching again.
+ *
+ * NOTE:
+ *
+ * A fetch can only be joined while it's in flight - results aren't cached,
+ * so once it completes, the next one fetches again.
+ *
+ * Writes to a key must be bracketed by beginWrite() and endWrite() (or
+ * beginWriteAll() and endWriteAll(), if they may touch any key). A write
+ * drops the key's in-flight fetches from the table, and no fetch of the key
+ * joins or can be joined until it ends. A fetch started after a write has
+ * completed therefore never joins one that started before the write.
+ *
+ * The result (shared by everyone who joined) must not be modified.
+ */
+template <typename T>
+class SingleFlight
+{
+public:
+    typedef std::function<pplx::task<std::shared_ptr<T>>()> Fetch;
+
+    /* Default constructor */
+    SingleFlight() : numWritesAll(0), nextFlightId(0), fetched(0), joined(0) {}
+
+    /**
+     * Returns the task of the in-flight fetch of `flightKey` of key `key`, or
+     * starts a new fetch with `fetch` (joinable until it completes).
+     */
+    pplx::task<std::shared_ptr<T>> run(const std::string &key, const std::string &flightKey, const Fetch &fetch)
+    {
+        pplx::task_completion_event<std::shared_ptr<T>> tce;
+        uint64_t flightId;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->fetched++;
+
+            auto keyIt = this->keys.find(key);
+            if (this->numWritesAll > 0 || (keyIt != this->keys.end() && keyIt->second.numWrites > 0))
+                return SingleFlight::start(fetch);
+
+            if (keyIt != this->keys.end())
+            {
+                auto flightIt = keyIt->second.flights.find(flightKey);
+                if (flightIt != keyIt->second.flights.end())
+                {
+                    this->fetched--;
+                    this->joined++;
+                    return flightIt->second.task;
+                }
+            }
+
+            flightId = this->nextFlightId++;
+            this->keys[key].flights[flightKey] = {flightId, pplx::create_task(tce)};
+        }
+
+        // fetched outside the lock, as starting a fetch may block (e.g. to connect)
+        SingleFlight::start(fetch).then([this, tce, key, flightKey, flightId](pplx::task<std::shared_ptr<T>> done)
+        {
+            this->land(key, flightKey, flightId);
+            try
+            {
+                tce.set(done.get());
+            }
+            catch (...)
+            {
+                tce.set_exception(std::current_exception());
+            }
+        });
+
+        return pplx::create_task(tce);
+    }
+
+    /**
+     * Marks a write of `key` as started, dropping its in-flight fetches.
+     */
+    void beginWrite(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        KeyFlights &keyFlights = this->keys[key];
+        keyFlights.numWrites++;
+        keyFlights.flights.clear();
+    }
+
+    /**
+     * Marks a write of `key` (started by beginWrite()) as ended.
+     */
+    void endWrite(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->keys.find(key);
+        if (it == this->keys.end())
+            return;
+
+        it->second.numWrites--;
+        if (it->second.numWrites == 0 && it->second.flights.empty())
+            this->keys.erase(it);
+    }
+
+    /**
+     * Marks a write of any number of keys as started, dropping all
+     * in-flight fetches.
+     */
+    void beginWriteAll()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->numWritesAll++;
+
+        for (auto it = this->keys.begin(); it != this->keys.end();)
+        {
+            it->second.flights.clear();
+            if (it->second.numWrites == 0)
+                it = this->keys.erase(it);
+            else
+                it++;
+        }
+    }
+
+    /**
+     * Marks a write started by beginWriteAll() as ended.
+     */
+    void endWriteAll()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->numWritesAll--;
+    }
+
+    /* Num. fetches started, and num. of times one was joined instead */
+    uint64_t numFetched()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->fetched;
+    }
+
+    uint64_t numJoined()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->joined;
+    }
+
+private:
+    struct Flight
+    {
+        uint64_t id;
+        pplx::task<std::shared_ptr<T>> task;
+    };
+
+    struct KeyFlights
+    {
+        uint32_t numWrites = 0;
+        std::map<std::string, Flight> flights;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, KeyFlights> keys;
+    uint32_t numWritesAll;
+    uint64_t nextFlightId;
+
+    uint64_t fetched;
+    uint64_t joined;
+
+    /* Runs `fetch`, turning anything it throws into a failed task */
+    static pplx::task<std::shared_ptr<T>> start(const Fetch &fetch)
+    {
+        try
+        {
+            return fetch();
+        }
+        catch (...)
+        {
+            return pplx::task_from_exception<std::shared_ptr<T>>(std::current_exception());
+        }
+    }
+
+    /**
+     * Removes flight `flightId` (if it's still in the table), as it's no
+     * longer joinable once complete.
+     */
+    void land(const std::string &key, const std::string &flightKey, uint64_t flightId)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto keyIt = this->keys.find(key);
+        if (keyIt == this->keys.end())
+            return;
+
+        auto flightIt = keyIt->second.flights.find(flightKey);
+        if (flightIt != keyIt->second.flights.end() && flightIt->second.id == flightId)
+            keyIt->second.flights.erase(flightIt);
+
+        if (keyIt->second.numWrites == 0 && keyIt->second.flights.empty())
+            this->keys.erase(keyIt);
+    }
+};
+
+namespace SingleFlightTests
+{
+    void testJoinsInFlightFetch();
+    void testCompletedFetchIsNotReused();
+    void testWritesPreventJoining();
+    void testFailureReachesAllWaiters();
+    void runAll();
+}
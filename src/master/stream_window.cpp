@@ -0,0 +1,209 @@
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+#include <algorithm>
+
+#include "stream_window.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// StreamWindow methods
+////////////////////////////////////////////
+
+/* Param constructor */
+StreamWindow::StreamWindow(uint64_t capacityBytes)
+    : capacityBytes(capacityBytes),
+        inFlight(0),
+        hasFailed(false)
+{
+}
+
+/**
+ * Blocks until `numBytes` more bytes fit in the window (or the stream
+ * has failed), then takes them. Returns false if the stream has failed.
+ */
+bool StreamWindow::acquire(uint64_t numBytes)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [&]() {
+        return this->hasFailed || this->inFlight == 0 || this->inFlight + numBytes <= this->capacityBytes;
+    });
+
+    if (this->hasFailed)
+        return false;
+
+    this->inFlight += numBytes;
+    return true;
+}
+
+/**
+ * Takes `numBytes` if they fit in the window right now, without blocking.
+ * Returns false if they don't (or if the stream has failed).
+ */
+bool StreamWindow::tryAcquire(uint64_t numBytes)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->hasFailed)
+        return false;
+    if (this->inFlight != 0 && this->inFlight + numBytes > this->capacityBytes)
+        return false;
+
+    this->inFlight += numBytes;
+    return true;
+}
+
+/**
+ * Returns `numBytes` bytes to the window.
+ */
+void StreamWindow::release(uint64_t numBytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->inFlight -= std::min(numBytes, this->inFlight);
+    }
+    this->cv.notify_all();
+}
+
+/**
+ * Marks the stream as failed with error `error` (if not failed already).
+ */
+void StreamWindow::fail(const std::string &error)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->hasFailed)
+        {
+            this->hasFailed = true;
+            this->firstError = error;
+        }
+    }
+    this->cv.notify_all();
+}
+
+/**
+ * Blocks until all acquired bytes have been released.
+ */
+void StreamWindow::drain()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [&]() { return this->inFlight == 0; });
+}
+
+bool StreamWindow::failed()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->hasFailed;
+}
+
+std::string StreamWindow::error()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->firstError;
+}
+
+uint64_t StreamWindow::bytesInFlight()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->inFlight;
+}
+
+////////////////////////////////////////////
+// StreamWindow tests
+////////////////////////////////////////////
+namespace StreamWindowTests
+{
+    void testAcquireBlocksUntilReleased()
+    {
+        StreamWindow window(100);
+
+        ASSERT_THAT(window.acquire(60));
+        ASSERT_THAT(window.bytesInFlight() == 60);
+
+        // 60 + 60 > 100, so the producer waits for a release
+        std::atomic<bool> acquired(false);
+        std::thread producer([&]() {
+            window.acquire(60);
+            acquired = true;
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ASSERT_THAT(!acquired);
+
+        window.release(60);
+        producer.join();
+        ASSERT_THAT(acquired);
+        ASSERT_THAT(window.bytesInFlight() == 60);
+
+        // a chunk larger than the window still goes through once it's empty
+        window.release(60);
+        ASSERT_THAT(window.acquire(500));
+        window.release(500);
+
+        window.drain();
+        ASSERT_THAT(window.bytesInFlight() == 0);
+    }
+
+    void testFailWakesProducer()
+    {
+        StreamWindow window(100);
+        ASSERT_THAT(window.acquire(100));
+
+        std::atomic<bool> result(true);
+        std::thread producer([&]() {
+            result = window.acquire(10);
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        window.fail("node 2 unreachable");
+        window.fail("node 3 unreachable");
+        producer.join();
+
+        // the blocked producer gives up, and the first error is kept
+        ASSERT_THAT(!result);
+        ASSERT_THAT(window.failed());
+        ASSERT_THAT(window.error() == "node 2 unreachable");
+        ASSERT_THAT(!window.acquire(1));
+    }
+
+    void testTryAcquireDoesntBlock()
+    {
+        StreamWindow window(100);
+
+        // a chunk larger than the window fits when it's empty
+        ASSERT_THAT(window.tryAcquire(150));
+        ASSERT_THAT(!window.tryAcquire(1));
+
+        window.release(150);
+        ASSERT_THAT(window.tryAcquire(60));
+        ASSERT_THAT(window.tryAcquire(40));
+        ASSERT_THAT(!window.tryAcquire(1));
+        ASSERT_THAT(window.bytesInFlight() == 100);
+
+        window.release(100);
+        window.fail("client disconnected");
+        ASSERT_THAT(!window.tryAcquire(1));
+        ASSERT_THAT(window.bytesInFlight() == 0);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "StreamWindowTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testAcquireBlocksUntilReleased),
+            TEST(testFailWakesProducer),
+            TEST(testTryAcquireDoesntBlock)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <condition_variable>
+
+/**
+ * Bounds the number of bytes of a single streamed request held in memory
+ * at once (e.g. read from the client, but not yet stored).
+ *
+ * NOTE:
+ *
+ * The producer acquire()s a chunk's bytes before reading it, and whoever
+ * finishes with the chunk release()s them. A producer that can't block
+ * (e.g. one running as a task continuation) uses tryAcquire() instead, and
+ * retries once an earlier chunk is done. A chunk larger than the whole
+ * window is still let through once nothing else is in flight, so progress
+ * is always possible.
+ *
+ * The first fail() is recorded, and wakes any blocked producer so it can
+ * stop streaming.
+ */
+class StreamWindow
+{
+public:
+    /* Param constructor */
+    StreamWindow(uint64_t capacityBytes);
+
+    /**
+     * Blocks until `numBytes` more bytes fit in the window (or the stream
+     * has failed), then takes them. Returns false if the stream has failed.
+     */
+    bool acquire(uint64_t numBytes);
+
+    /**
+     * Takes `numBytes` if they fit in the window right now, without blocking.
+     * Returns false if they don't (or if the stream has failed).
+     */
+    bool tryAcquire(uint64_t numBytes);
+
+    /**
+     * Returns `numBytes` bytes to the window.
+     */
+    void release(uint64_t numBytes);
+
+    /**
+     * Marks the stream as failed with error `error` (if not failed already).
+     */
+    void fail(const std::string &error);
+
+    /**
+     * Blocks until all acquired bytes have been released.
+     */
+    void drain();
+
+    bool failed();
+    std::string error();
+    uint64_t bytesInFlight();
+
+private:
+    uint64_t capacityBytes;
+    uint64_t inFlight;
+    bool hasFailed;
+    std::string firstError;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+namespace StreamWindowTests
+{
+    void testAcquireBlocksUntilReleased();
+    void testFailWakesProducer();
+    void testTryAcquireDoesntBlock();
+    void runAll();
+}
@@ -0,0 +1,149 @@
+#include <vector>
+#include <iostream>
+#include <functional>
+
+#include "task_timer.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// TaskTimer methods
+////////////////////////////////////////////
+
+/* Default constructor, starting the timer's thread */
+TaskTimer::TaskTimer()
+    : stopping(false)
+{
+    this->thread = std::thread(&TaskTimer::run, this);
+}
+
+TaskTimer::~TaskTimer()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->changed.notify_one();
+    this->thread.join();
+}
+
+/**
+ * Returns a task that completes once `delay` has passed.
+ */
+pplx::task<void> TaskTimer::after(std::chrono::microseconds delay)
+{
+    pplx::task_completion_event<void> tce;
+    auto deadline = std::chrono::steady_clock::now() + delay;
+
+    bool isNext;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->deadlines.insert({deadline, tce});
+        isNext = it == this->deadlines.begin();
+    }
+
+    // the thread only needs waking if it's waiting on a later deadline
+    if (isNext)
+        this->changed.notify_one();
+
+    return pplx::create_task(tce);
+}
+
+void TaskTimer::run()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (!this->stopping)
+    {
+        if (this->deadlines.empty())
+        {
+            this->changed.wait(lock);
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto next = this->deadlines.begin()->first;
+        if (next > now)
+        {
+            this->changed.wait_until(lock, next);
+            continue;
+        }
+
+        // complete every expired deadline's task, outside the lock
+        std::vector<pplx::task_completion_event<void>> expired;
+        auto end = this->deadlines.upper_bound(now);
+        for (auto it = this->deadlines.begin(); it != end; it++)
+            expired.push_back(it->second);
+        this->deadlines.erase(this->deadlines.begin(), end);
+
+        lock.unlock();
+        for (auto &tce : expired)
+            tce.set();
+        lock.lock();
+    }
+}
+
+////////////////////////////////////////////
+// TaskTimer tests
+////////////////////////////////////////////
+namespace TaskTimerTests
+{
+    void testFiresInDeadlineOrder()
+    {
+        TaskTimer timer;
+
+        std::mutex mutex;
+        std::vector<int> order;
+        auto record = [&mutex, &order](int n)
+        {
+            return [&mutex, &order, n]()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                order.push_back(n);
+            };
+        };
+
+        auto start = std::chrono::steady_clock::now();
+
+        // a later deadline is added first, so the earlier must wake the thread
+        auto late = timer.after(std::chrono::milliseconds(60)).then(record(2));
+        auto early = timer.after(std::chrono::milliseconds(20)).then(record(1));
+
+        early.wait();
+        ASSERT_THAT(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+        ASSERT_THAT(!late.is_done());
+
+        late.wait();
+        ASSERT_THAT(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(60));
+        ASSERT_THAT((order == std::vector<int>{1, 2}));
+    }
+
+    void testZeroDelay()
+    {
+        TaskTimer timer;
+
+        std::vector<pplx::task<void>> tasks;
+        for (int i = 0; i < 100; i++)
+            tasks.push_back(timer.after(std::chrono::microseconds(0)));
+
+        pplx::when_all(tasks.begin(), tasks.end()).wait();
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "TaskTimerTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testFiresInDeadlineOrder),
+            TEST(testZeroDelay)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <pplx/pplxtasks.h>
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+
+/**
+ * Hands out tasks that complete after a given delay, all served by one
+ * thread, so waiting on a delay never parks a pool thread.
+ *
+ * NOTE:
+ *
+ * Tasks of delays that haven't expired when the timer is destroyed
+ * never complete.
+ */
+class TaskTimer
+{
+public:
+    /* Default constructor, starting the timer's thread */
+    TaskTimer();
+    ~TaskTimer();
+
+    TaskTimer(const TaskTimer&) = delete;
+    TaskTimer& operator=(const TaskTimer&) = delete;
+
+    /**
+     * Returns a task that completes once `delay` has passed.
+     */
+    pplx::task<void> after(std::chrono::microseconds delay);
+
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::multimap<std::chrono::steady_clock::time_point, pplx::task_completion_event<void>> deadlines;
+    bool stopping;
+
+    std::thread thread;
+
+    void run();
+};
+
+namespace TaskTimerTests
+{
+    void testFiresInDeadlineOrder();
+    void testZeroDelay();
+    void runAll();
+}
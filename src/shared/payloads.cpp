@@ -164,8 +164,11 @@ namespace Payloads
             std::vector<uint32_t> blockNums = p.second;
 
             uint32_t numBlocks = blockNums.size();
+            uint32_t keySize = key.size();
 
-            // key
+            // key size, followed by the key
+            auto keySizeStart = reinterpret_cast<unsigned char*>(&keySize);
+            buffer.insert(buffer.end(), keySizeStart, keySizeStart + sizeof(keySize));
             buffer.insert(buffer.end(), key.begin(), key.end());
 
             // num. blocks
@@ -195,9 +198,13 @@ namespace Payloads
         // deserialize { key -> block num } map
         while (it < (buffer.end() - sizeof(SizeInfo)))
         {
-            // key
-            std::string key(it, it + 50);
-            it += key.size();
+            // key size, followed by the key
+            uint32_t keySize;
+            std::memcpy(&keySize, &(*it), sizeof(keySize));
+            it += sizeof(keySize);
+
+            std::string key(it, it + keySize);
+            it += keySize;
 
             // num. blocks
             uint32_t numBlocks;
@@ -309,8 +316,8 @@ namespace PayloadsTests
     void testSyncResponse()
     {
         std::map<std::string, std::vector<uint32_t>> keyBlockNumMap;
-        keyBlockNumMap[StringUtils::fixedSize("file1", 50)] = {1, 2, 3};
-        keyBlockNumMap[StringUtils::fixedSize("file2", 50)] = {4, 5, 6};
+        keyBlockNumMap["file1"] = {1, 2, 3};
+        keyBlockNumMap[std::string(200, 'k')] = {4, 5, 6};
         Payloads::SizeInfo sizeInfo(10, 10);
 
         Payloads::SyncInfo original(keyBlockNumMap, sizeInfo);
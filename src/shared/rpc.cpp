@@ -0,0 +1,1659 @@
+#include <deque>
+#include <random>
+#include <cstring>
+#include <climits>
+#include <sstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <filesystem>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "rpc.hpp"
+
+#include "test_utils.hpp"
+
+// max. time to establish a connection
+static const std::chrono::milliseconds RPC_CONNECT_TIMEOUT(2000);
+
+// max. time to wait for a response (as http_client's default)
+static const std::chrono::seconds RPC_REQUEST_TIMEOUT(30);
+
+// how often (in ms) client connections check for timed out calls
+static const int RPC_POLL_MS = 100;
+
+// size of RpcFrameReader's buffer (must fit a header and the longest key)
+static const size_t RPC_READ_BUFFER_SIZE = 128 * 1024;
+
+// num. bytes of a payload still to come at which it's received directly, not via the buffer
+static const size_t RPC_DIRECT_READ_MIN = 16 * 1024;
+
+// min. size of a payload passed through a ShmTransport (smaller ones are sent inline)
+static const uint64_t RPC_SHM_MIN_PAYLOAD = 16 * 1024;
+
+namespace fs = std::filesystem;
+
+////////////////////////////////////////////
+// Socket helpers
+////////////////////////////////////////////
+
+/**
+ * Disables Nagle's algorithm on `fd` (frames are always sent whole) and,
+ * if `bufferBytes` is non-zero, sets its send and receive buffer sizes.
+ */
+static void setSocketOptions(int fd, uint32_t bufferBytes)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (bufferBytes > 0)
+    {
+        int size = bufferBytes;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+}
+
+/**
+ * Returns a non-blocking socket connected to `host`:`port`. Throws if it
+ * can't connect within RPC_CONNECT_TIMEOUT.
+ */
+static int connectTo(const std::string &host, uint16_t port, uint32_t bufferBytes)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *addrs = nullptr;
+    std::string service = std::to_string(port);
+    int err = getaddrinfo(host.c_str(), service.c_str(), &hints, &addrs);
+    if (err != 0)
+        throw std::runtime_error("RPC: can't resolve " + host + " - " + gai_strerror(err));
+
+    int fd = socket(addrs->ai_family, addrs->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addrs->ai_protocol);
+    if (fd < 0)
+    {
+        freeaddrinfo(addrs);
+        throw std::runtime_error("RPC: socket() failed - " + std::string(strerror(errno)));
+    }
+
+    // buffer sizes must be set before connecting, for the window scale to match
+    setSocketOptions(fd, bufferBytes);
+
+    int result = connect(fd, addrs->ai_addr, addrs->ai_addrlen);
+    freeaddrinfo(addrs);
+
+    if (result != 0 && errno == EINPROGRESS)
+    {
+        pollfd pfd = {fd, POLLOUT, 0};
+        if (poll(&pfd, 1, RPC_CONNECT_TIMEOUT.count()) == 1)
+        {
+            socklen_t len = sizeof(result);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &result, &len);
+            errno = result;
+        }
+        else
+        {
+            result = -1;
+            errno = ETIMEDOUT;
+        }
+    }
+
+    if (result != 0)
+    {
+        std::string error = strerror(errno);
+        close(fd);
+        throw std::runtime_error("RPC: can't connect to " + host + ":" + service + " - " + error);
+    }
+
+    return fd;
+}
+
+/**
+ * Returns a non-blocking socket connected to the Unix socket at `path`.
+ * Throws if it can't connect.
+ */
+static int connectToLocal(const std::string &path, uint32_t bufferBytes)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("RPC: socket path too long - " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw std::runtime_error("RPC: socket() failed - " + std::string(strerror(errno)));
+
+    setSocketOptions(fd, bufferBytes);
+
+    // unlike TCP, this completes (or fails) straight away
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        std::string error = strerror(errno);
+        close(fd);
+        throw std::runtime_error("RPC: can't connect to " + path + " - " + error);
+    }
+
+    return fd;
+}
+
+/**
+ * Returns true if `host` resolves to an address of this host (i.e. a
+ * loopback address, or one of its interfaces').
+ */
+static bool isLocalAddress(const std::string &host)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *addrs = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &addrs) != 0)
+        return false;
+
+    ifaddrs *interfaces = nullptr;
+    if (getifaddrs(&interfaces) != 0)
+        interfaces = nullptr;
+
+    bool local = false;
+    for (addrinfo *addr = addrs; addr && !local; addr = addr->ai_next)
+    {
+        if (addr->ai_family == AF_INET)
+        {
+            in_addr ip = reinterpret_cast<sockaddr_in*>(addr->ai_addr)->sin_addr;
+            local = (ntohl(ip.s_addr) >> 24) == 127;
+
+            for (ifaddrs *i = interfaces; i && !local; i = i->ifa_next)
+            {
+                if (i->ifa_addr && i->ifa_addr->sa_family == AF_INET)
+                    local = reinterpret_cast<sockaddr_in*>(i->ifa_addr)->sin_addr.s_addr == ip.s_addr;
+            }
+        }
+        else if (addr->ai_family == AF_INET6)
+        {
+            in6_addr ip = reinterpret_cast<sockaddr_in6*>(addr->ai_addr)->sin6_addr;
+            local = IN6_IS_ADDR_LOOPBACK(&ip);
+
+            for (ifaddrs *i = interfaces; i && !local; i = i->ifa_next)
+            {
+                if (i->ifa_addr && i->ifa_addr->sa_family == AF_INET6)
+                    local = std::memcmp(&reinterpret_cast<sockaddr_in6*>(i->ifa_addr)->sin6_addr, &ip, sizeof(ip)) == 0;
+            }
+        }
+    }
+
+    if (interfaces)
+        freeifaddrs(interfaces);
+    freeaddrinfo(addrs);
+    return local;
+}
+
+/**
+ * Sends `iovs[index...]` on `fd`, advancing `index` (and trimming the first
+ * unsent iovec) as they're sent. On a non-blocking socket, stops early once
+ * the socket is full. Returns false if the connection is broken.
+ */
+static bool sendIovecs(int fd, std::vector<iovec> &iovs, size_t &index)
+{
+    while (index < iovs.size())
+    {
+        msghdr msg = {};
+        msg.msg_iov = iovs.data() + index;
+        msg.msg_iovlen = std::min<size_t>(iovs.size() - index, IOV_MAX);
+
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        // skip past what was sent
+        size_t sent = n;
+        while (index < iovs.size() && sent >= iovs[index].iov_len)
+        {
+            sent -= iovs[index].iov_len;
+            index++;
+        }
+        if (sent > 0)
+        {
+            iovs[index].iov_base = static_cast<char*>(iovs[index].iov_base) + sent;
+            iovs[index].iov_len -= sent;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Moves the payload of the frame given by `header` and `iovs` (as from
+ * RpcMessage::iovecs()) into `ring`, if it's large enough and fits, and
+ * sends `ref` (flagged RPC_FLAG_SHM) in its place.
+ */
+static void moveToRing(ShmRing &ring, RpcHeader &header, std::vector<iovec> &iovs, RpcShmRef &ref)
+{
+    if (header.payloadSize < RPC_SHM_MIN_PAYLOAD)
+        return;
+    if (!ring.tryWrite(iovs.data() + 2, iovs.size() - 2, header.payloadSize, ref.position))
+        return;
+
+    ref.size = header.payloadSize;
+    header.payloadSize = sizeof(ref);
+    header.flags |= RPC_FLAG_SHM;
+
+    iovs.resize(2);
+    iovs.push_back({&ref, sizeof(ref)});
+}
+
+/**
+ * If the frame given by `header` is flagged RPC_FLAG_SHM, replaces its
+ * `payload` (an RpcShmRef) with the payload it refers to in `ring`. Returns
+ * false if that isn't `ring`'s next payload (or there's no `ring`).
+ */
+static bool takeFromRing(ShmRing *ring, RpcHeader &header, std::vector<unsigned char> &payload)
+{
+    if (!(header.flags & RPC_FLAG_SHM))
+        return true;
+    if (!ring || payload.size() != sizeof(RpcShmRef))
+        return false;
+
+    RpcShmRef ref;
+    std::memcpy(&ref, payload.data(), sizeof(ref));
+    if (ref.size > RPC_MAX_PAYLOAD_SIZE)
+        return false;
+
+    std::vector<unsigned char> data(ref.size);
+    if (!ring->read(ref.position, ref.size, data.data()))
+        return false;
+
+    payload = std::move(data);
+    return true;
+}
+
+/* Returns `op`'s name, e.g. "GET_BLOCKS" */
+std::string rpcOpName(uint8_t op)
+{
+    switch (op)
+    {
+        case RPC_GET_BLOCKS: return "GET_BLOCKS";
+        case RPC_STORE_BLOCKS: return "STORE_BLOCKS";
+        case RPC_APPEND_BLOCKS: return "APPEND_BLOCKS";
+        case RPC_UPDATE_BLOCKS: return "UPDATE_BLOCKS";
+        case RPC_DELETE_KEY: return "DELETE_KEY";
+        case RPC_DELETE_KEYS: return "DELETE_KEYS";
+        case RPC_HEALTH: return "HEALTH";
+        case RPC_SYNC: return "SYNC";
+        case RPC_RENAME_KEY: return "RENAME_KEY";
+        case RPC_HELLO: return "HELLO";
+        case RPC_ATTACH_SHM: return "ATTACH_SHM";
+        default: return "UNKNOWN(" + std::to_string(op) + ")";
+    }
+}
+
+////////////////////////////////////////////
+// RpcMessage methods
+////////////////////////////////////////////
+
+/* Param constructor */
+RpcMessage::RpcMessage(uint8_t code, std::string key)
+    : code(code),
+        key(key),
+        payloadSize(0)
+{
+}
+
+/* Appends `bytes`, which the message keeps */
+void RpcMessage::append(std::vector<unsigned char> bytes)
+{
+    this->payloadSize += bytes.size();
+    this->segments.push_back({nullptr, bytes.size(), this->owned.size()});
+    this->owned.push_back(std::move(bytes));
+}
+
+/* Appends `size` bytes at `data`, without copying them */
+void RpcMessage::appendRef(const unsigned char *data, size_t size)
+{
+    // (an empty vector's data() may be null, which marks owned segments)
+    if (size == 0)
+        return;
+
+    this->payloadSize += size;
+    this->segments.push_back({data, size, 0});
+}
+
+/**
+ * Appends `blocks`, serialized as by Block::serialize(), without copying
+ * their data.
+ */
+void RpcMessage::appendBlocks(std::vector<Block> &blocks)
+{
+    for (Block &block : blocks)
+    {
+        // everything but the data, as Block::serialize() writes it
+        std::vector<unsigned char> meta;
+        int keySize = block.key.size();
+        meta.insert(meta.end(), reinterpret_cast<const unsigned char*>(&keySize),
+                    reinterpret_cast<const unsigned char*>(&keySize) + sizeof(keySize));
+        meta.insert(meta.end(), block.key.begin(), block.key.end());
+        meta.insert(meta.end(), reinterpret_cast<const unsigned char*>(&block.blockNum),
+                    reinterpret_cast<const unsigned char*>(&block.blockNum) + sizeof(block.blockNum));
+        meta.insert(meta.end(), reinterpret_cast<const unsigned char*>(&block.dataSize),
+                    reinterpret_cast<const unsigned char*>(&block.dataSize) + sizeof(block.dataSize));
+        this->append(std::move(meta));
+
+        size_t dataSize = std::distance(block.dataStart, block.dataEnd);
+        if (dataSize > 0)
+            this->appendRef(&(*block.dataStart), dataSize);
+    }
+}
+
+/* Returns a copy of the payload, e.g. to send as an HTTP body */
+std::vector<unsigned char> RpcMessage::flatten() const
+{
+    std::vector<unsigned char> payload;
+    payload.reserve(this->payloadSize);
+    for (const Segment &segment : this->segments)
+    {
+        const unsigned char *data = segment.data ? segment.data : this->owned[segment.ownedIndex].data();
+        payload.insert(payload.end(), data, data + segment.size);
+    }
+    return payload;
+}
+
+/**
+ * Returns the frame's iovecs, i.e. `header`, the key, then the
+ * payload's segments.
+ */
+std::vector<iovec> RpcMessage::iovecs(RpcHeader &header) const
+{
+    if (this->key.size() > UINT16_MAX)
+        throw std::runtime_error("RpcMessage::iovecs() - key too long");
+    if (this->payloadSize > RPC_MAX_PAYLOAD_SIZE)
+        throw std::runtime_error("RpcMessage::iovecs() - payload too large");
+
+    header.payloadSize = this->payloadSize;
+    header.code = this->code;
+    header.flags = 0;
+    header.keySize = this->key.size();
+
+    std::vector<iovec> iovs;
+    iovs.reserve(this->segments.size() + 2);
+    iovs.push_back({&header, sizeof(header)});
+    iovs.push_back({const_cast<char*>(this->key.data()), this->key.size()});
+    for (const Segment &segment : this->segments)
+    {
+        const unsigned char *data = segment.data ? segment.data : this->owned[segment.ownedIndex].data();
+        iovs.push_back({const_cast<unsigned char*>(data), segment.size});
+    }
+    return iovs;
+}
+
+////////////////////////////////////////////
+// RpcFrameReader methods
+////////////////////////////////////////////
+
+/* Default constructor */
+RpcFrameReader::RpcFrameReader()
+    : buffer(RPC_READ_BUFFER_SIZE),
+        start(0),
+        end(0),
+        inPayload(false),
+        payloadReceived(0)
+{
+}
+
+/**
+ * Does a single recv() from `fd`, passing each frame it completes to
+ * `onFrame`. Returns false once the connection is closed (or broken, or
+ * sends an invalid frame), true otherwise (including on EAGAIN).
+ */
+bool RpcFrameReader::readFrom(int fd, const FrameHandler &onFrame)
+{
+    // all buffered bytes are consumed before a payload is received directly
+    bool direct = this->inPayload && this->payload.size() - this->payloadReceived >= RPC_DIRECT_READ_MIN;
+
+    ssize_t n;
+    if (direct)
+        n = recv(fd, this->payload.data() + this->payloadReceived, this->payload.size() - this->payloadReceived, 0);
+    else
+    {
+        if (this->start > 0 && this->buffer.size() - this->end < RPC_DIRECT_READ_MIN)
+        {
+            std::memmove(this->buffer.data(), this->buffer.data() + this->start, this->end - this->start);
+            this->end -= this->start;
+            this->start = 0;
+        }
+        n = recv(fd, this->buffer.data() + this->end, this->buffer.size() - this->end, 0);
+    }
+
+    if (n == 0)
+        return false;
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    if (direct)
+        this->payloadReceived += n;
+    else
+        this->end += n;
+
+    while (true)
+    {
+        if (!this->inPayload)
+        {
+            size_t avail = this->end - this->start;
+            if (avail < sizeof(RpcHeader))
+                break;
+
+            std::memcpy(&this->header, this->buffer.data() + this->start, sizeof(RpcHeader));
+            if (this->header.payloadSize > RPC_MAX_PAYLOAD_SIZE)
+                return false;
+            if (avail < sizeof(RpcHeader) + this->header.keySize)
+                break;
+
+            auto keyStart = this->buffer.begin() + this->start + sizeof(RpcHeader);
+            this->key.assign(keyStart, keyStart + this->header.keySize);
+            this->start += sizeof(RpcHeader) + this->header.keySize;
+
+            this->payload.resize(this->header.payloadSize);
+            this->payloadReceived = 0;
+            this->inPayload = true;
+        }
+
+        size_t numCopied = std::min(this->end - this->start, this->payload.size() - this->payloadReceived);
+        std::memcpy(this->payload.data() + this->payloadReceived, this->buffer.data() + this->start, numCopied);
+        this->start += numCopied;
+        this->payloadReceived += numCopied;
+
+        if (this->payloadReceived < this->payload.size())
+            break;
+
+        this->inPayload = false;
+        onFrame(this->header, std::move(this->key), std::move(this->payload));
+        this->key.clear();
+        this->payload = std::vector<unsigned char>();
+    }
+
+    if (this->start == this->end)
+        this->start = this->end = 0;
+
+    return true;
+}
+
+////////////////////////////////////////////
+// RpcClient::Connection
+////////////////////////////////////////////
+
+/**
+ * A single connection of an RpcClient (see RpcClient).
+ */
+class RpcClient::Connection
+{
+public:
+    /**
+     * Param constructor, taking ownership of connected socket `fd` (a Unix
+     * socket if `isLocal`), which passes large payloads through `shm` (if set).
+     */
+    Connection(int fd, bool isLocal, std::shared_ptr<ShmTransport> shm)
+        : isLocal(isLocal),
+            fd(fd),
+            shm(shm),
+            closed(false),
+            stopping(false),
+            nextRequestId(0),
+            queuedOffset(0)
+    {
+        this->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        this->thread = std::thread(&Connection::run, this);
+    }
+
+    ~Connection()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->wake();
+        this->thread.join();
+
+        this->fail("RPC client closed");
+        close(this->fd);
+        close(this->wakeFd);
+    }
+
+    pplx::task<RpcResponse> call(const RpcMessage &message)
+    {
+        RpcHeader header;
+        std::vector<iovec> iovs = message.iovecs(header);
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->closed)
+            return pplx::task_from_exception<RpcResponse>(std::runtime_error("RPC connection closed"));
+
+        header.requestId = this->nextRequestId++;
+        PendingCall &pendingCall = this->pending[header.requestId];
+        pendingCall.deadline = std::chrono::steady_clock::now() + RPC_REQUEST_TIMEOUT;
+        pplx::task<RpcResponse> response = pplx::create_task(pendingCall.tce);
+
+        // written under `mutex`, so the server reads the ring in frame order
+        RpcShmRef ref;
+        if (this->shm)
+            moveToRing(this->shm->toServer(), header, iovs, ref);
+
+        // send what fits now, unless earlier frames are still queued
+        size_t index = 0;
+        if (this->queued.empty() && !sendIovecs(this->fd, iovs, index))
+        {
+            // wakes run(), which fails every pending call
+            shutdown(this->fd, SHUT_RDWR);
+            return response;
+        }
+
+        if (index < iovs.size())
+        {
+            std::vector<unsigned char> unsent;
+            for (; index < iovs.size(); index++)
+            {
+                auto data = static_cast<unsigned char*>(iovs[index].iov_base);
+                unsent.insert(unsent.end(), data, data + iovs[index].iov_len);
+            }
+
+            this->queued.push_back(std::move(unsent));
+            if (this->queued.size() == 1)
+                this->wake();
+        }
+
+        return response;
+    }
+
+    bool isClosed()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->closed;
+    }
+
+    const bool isLocal;
+
+private:
+    struct PendingCall
+    {
+        pplx::task_completion_event<RpcResponse> tce;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    int fd;
+    int wakeFd;
+    std::shared_ptr<ShmTransport> shm;
+    std::thread thread;
+    RpcFrameReader reader;
+
+    std::mutex mutex;
+    bool closed;
+    bool stopping;
+    uint32_t nextRequestId;
+    std::map<uint32_t, PendingCall> pending;
+
+    // unsent output, with `queuedOffset` bytes of the first frame sent
+    std::deque<std::vector<unsigned char>> queued;
+    size_t queuedOffset;
+
+    void wake()
+    {
+        uint64_t one = 1;
+        ssize_t n = write(this->wakeFd, &one, sizeof(one));
+        (void)n;
+    }
+
+    /**
+     * Thread function: receives responses, sends queued frames and times out
+     * calls, until the connection breaks or is destroyed.
+     */
+    void run()
+    {
+        pollfd fds[2] = {{this->fd, POLLIN, 0}, {this->wakeFd, POLLIN, 0}};
+
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (this->stopping)
+                    return;
+                fds[0].events = POLLIN | (this->queued.empty() ? 0 : POLLOUT);
+            }
+
+            if (poll(fds, 2, RPC_POLL_MS) < 0 && errno != EINTR)
+            {
+                this->fail("RPC poll() failed - " + std::string(strerror(errno)));
+                return;
+            }
+
+            if (fds[1].revents & POLLIN)
+            {
+                uint64_t count;
+                ssize_t n = read(this->wakeFd, &count, sizeof(count));
+                (void)n;
+            }
+
+            if ((fds[0].revents & POLLOUT) && !this->sendQueued())
+            {
+                this->fail("RPC connection broken");
+                return;
+            }
+
+            if (fds[0].revents & (POLLIN | POLLERR | POLLHUP))
+            {
+                bool invalid = false;
+                bool open = this->reader.readFrom(this->fd, [&](RpcHeader &header, std::string, std::vector<unsigned char> payload)
+                {
+                    if (invalid || !takeFromRing(this->shm ? &this->shm->toClient() : nullptr, header, payload))
+                    {
+                        invalid = true;
+                        return;
+                    }
+                    this->complete(header, std::move(payload));
+                });
+
+                if (invalid)
+                {
+                    this->fail("RPC response's shared memory payload is invalid");
+                    return;
+                }
+                if (!open)
+                {
+                    this->fail("RPC connection closed by storage node");
+                    return;
+                }
+            }
+
+            this->expireCalls();
+        }
+    }
+
+    /**
+     * Sends as much queued output as the socket takes. Returns false if
+     * the connection is broken.
+     */
+    bool sendQueued()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        while (!this->queued.empty())
+        {
+            std::vector<unsigned char> &frame = this->queued.front();
+            ssize_t n = send(this->fd, frame.data() + this->queuedOffset, frame.size() - this->queuedOffset, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+
+            this->queuedOffset += n;
+            if (this->queuedOffset < frame.size())
+                return true;
+
+            this->queued.pop_front();
+            this->queuedOffset = 0;
+        }
+        return true;
+    }
+
+    void complete(RpcHeader &header, std::vector<unsigned char> payload)
+    {
+        pplx::task_completion_event<RpcResponse> tce;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            auto it = this->pending.find(header.requestId);
+
+            // the call has already timed out
+            if (it == this->pending.end())
+                return;
+
+            tce = it->second.tce;
+            this->pending.erase(it);
+        }
+
+        RpcResponse response;
+        response.status = header.code;
+        response.payload = std::move(payload);
+        tce.set(std::move(response));
+    }
+
+    void expireCalls()
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        std::vector<pplx::task_completion_event<RpcResponse>> expired;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (auto it = this->pending.begin(); it != this->pending.end();)
+            {
+                if (it->second.deadline > now)
+                {
+                    it++;
+                    continue;
+                }
+                expired.push_back(it->second.tce);
+                it = this->pending.erase(it);
+            }
+        }
+
+        for (auto &tce : expired)
+            tce.set_exception(std::runtime_error("RPC timed out"));
+    }
+
+    /**
+     * Closes the connection to new calls, and fails all pending ones
+     * with `error`.
+     */
+    void fail(const std::string &error)
+    {
+        std::map<uint32_t, PendingCall> failed;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->closed = true;
+            failed.swap(this->pending);
+            this->queued.clear();
+        }
+
+        for (auto &[requestId, pendingCall] : failed)
+            pendingCall.tce.set_exception(std::runtime_error(error));
+    }
+};
+
+////////////////////////////////////////////
+// RpcClient methods
+////////////////////////////////////////////
+
+/* Param constructor */
+RpcClient::RpcClient(std::string host, uint16_t port, uint32_t numConnections, uint32_t socketBufferBytes,
+                     std::string localDir, uint64_t shmRingBytes)
+    : host(host),
+        port(port),
+        socketBufferBytes(socketBufferBytes),
+        localDir(localDir),
+        shmRingBytes(shmRingBytes),
+        isLocalHost(!localDir.empty() && isLocalAddress(host)),
+        connections(std::max<uint32_t>(1, numConnections)),
+        nextConnection(0)
+{
+}
+
+RpcClient::~RpcClient()
+{
+}
+
+/**
+ * Sends `message`, returning a task completing with its response. The task
+ * fails if the node can't be reached, the connection breaks, or there's no
+ * response within RPC_REQUEST_TIMEOUT.
+ */
+pplx::task<RpcResponse> RpcClient::call(const RpcMessage &message)
+{
+    uint32_t first = this->nextConnection++ % this->connections.size();
+
+    // the next open connection, round-robin
+    std::shared_ptr<Connection> connection;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (uint32_t n = 0; n < this->connections.size() && !connection; n++)
+        {
+            auto &candidate = this->connections[(first + n) % this->connections.size()];
+            if (candidate && !candidate->isClosed())
+                connection = candidate;
+        }
+    }
+
+    if (!connection)
+    {
+        return pplx::task_from_exception<RpcResponse>(std::runtime_error(
+            "RpcClient::call() - not connected to " + this->host + ":" + std::to_string(this->port)));
+    }
+
+    return connection->call(message);
+}
+
+/**
+ * Opens any connections that aren't open (e.g. have broken), returning the
+ * num. of connections open. Blocks while connecting.
+ */
+uint32_t RpcClient::warmUp()
+{
+    std::lock_guard<std::mutex> connectLock(this->connectMutex);
+
+    std::vector<uint32_t> closed;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (uint32_t i = 0; i < this->connections.size(); i++)
+        {
+            if (!this->connections[i] || this->connections[i]->isClosed())
+                closed.push_back(i);
+        }
+    }
+
+    uint32_t numOpen = this->connections.size() - closed.size();
+    for (uint32_t i : closed)
+    {
+        // connected without holding `mutex`, so calls aren't held up meanwhile
+        std::shared_ptr<Connection> connection;
+        try
+        {
+            connection = this->connect();
+        }
+        catch (const std::exception &e)
+        {
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->connections[i].swap(connection);
+        }
+        numOpen++;
+
+        // the replaced connection (if any) is destroyed here, joining its thread
+    }
+    return numOpen;
+}
+
+/**
+ * Closes every connection (failing their outstanding calls), e.g. once
+ * the server has gone down, so warmUp() opens fresh ones.
+ */
+void RpcClient::closeConnections()
+{
+    std::vector<std::shared_ptr<Connection>> closed(this->connections.size());
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        closed.swap(this->connections);
+    }
+
+    // destroyed (joining their threads) once any call() using them returns
+    closed.clear();
+}
+
+/**
+ * Returns a new connection to the server (over its Unix socket if it can
+ * be reached that way). Throws if it can't connect.
+ */
+std::shared_ptr<RpcClient::Connection> RpcClient::connect()
+{
+    std::shared_ptr<Connection> connection = this->isLocalHost ? this->connectLocal() : nullptr;
+    if (!connection)
+    {
+        int fd = connectTo(this->host, this->port, this->socketBufferBytes);
+        connection = std::make_shared<Connection>(fd, false, nullptr);
+    }
+    return connection;
+}
+
+/**
+ * Sends `message` on connected socket `fd` and waits for its response, to
+ * set up a connection before it's handed to a Connection. Throws if the
+ * connection breaks, or there's no response within RPC_CONNECT_TIMEOUT.
+ */
+RpcResponse RpcClient::callBlocking(int fd, const RpcMessage &message)
+{
+    auto deadline = std::chrono::steady_clock::now() + RPC_CONNECT_TIMEOUT;
+    auto waitFor = [&](short events)
+    {
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd pfd = {fd, events, 0};
+        if (timeout.count() <= 0 || poll(&pfd, 1, timeout.count()) != 1)
+            throw std::runtime_error("RPC: no response to " + rpcOpName(message.code));
+    };
+
+    RpcHeader header;
+    std::vector<iovec> iovs = message.iovecs(header);
+    header.requestId = 0;
+
+    size_t index = 0;
+    while (true)
+    {
+        if (!sendIovecs(fd, iovs, index))
+            throw std::runtime_error("RPC: connection broken sending " + rpcOpName(message.code));
+        if (index == iovs.size())
+            break;
+        waitFor(POLLOUT);
+    }
+
+    RpcFrameReader reader;
+    std::optional<RpcResponse> response;
+    while (!response)
+    {
+        waitFor(POLLIN);
+        bool open = reader.readFrom(fd, [&](RpcHeader &header, std::string, std::vector<unsigned char> payload)
+        {
+            response = RpcResponse{header.code, std::move(payload)};
+        });
+
+        if (!open)
+            throw std::runtime_error("RPC: connection closed awaiting " + rpcOpName(message.code));
+    }
+
+    return *response;
+}
+
+/* Num. connections currently open over a Unix socket */
+uint32_t RpcClient::numLocalConnections()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    uint32_t count = 0;
+    for (auto &connection : this->connections)
+    {
+        if (connection && connection->isLocal && !connection->isClosed())
+            count++;
+    }
+    return count;
+}
+
+/**
+ * Returns a new Connection over the server's Unix socket, or nullptr if
+ * it can't be reached that way.
+ *
+ * NOTE:
+ *
+ * The server's RPC_HELLO response (over TCP) names its socket, and the
+ * socket of that name in `localDir` must give the same response - otherwise
+ * it belongs to some other server (e.g. `localDir` isn't shared with ours).
+ *
+ * If the ShmTransport can't be set up, the connection goes without it.
+ */
+std::shared_ptr<RpcClient::Connection> RpcClient::connectLocal()
+{
+    static std::atomic<uint32_t> numShmFiles(0);
+
+    int fd = -1;
+    try
+    {
+        fd = connectTo(this->host, this->port, 0);
+        RpcResponse hello = callBlocking(fd, RpcMessage(RPC_HELLO));
+        close(fd);
+        fd = -1;
+
+        std::string helloString(hello.payload.begin(), hello.payload.end());
+        size_t newline = helloString.find('\n');
+        if (hello.status != RPC_OK || newline == std::string::npos || newline == 0)
+            return nullptr;
+
+        fd = connectToLocal(this->localDir + "/" + helloString.substr(0, newline), this->socketBufferBytes);
+        if (callBlocking(fd, RpcMessage(RPC_HELLO)).payload != hello.payload)
+        {
+            close(fd);
+            return nullptr;
+        }
+
+        std::shared_ptr<ShmTransport> shm;
+        if (this->shmRingBytes > 0)
+        {
+            std::string shmName = "rpc_" + std::to_string(getpid()) + "_" + std::to_string(numShmFiles++) + ".shm";
+            std::string shmPath = this->localDir + "/" + shmName;
+
+            try
+            {
+                shm = ShmTransport::create(shmPath, this->shmRingBytes);
+                RpcResponse attached = callBlocking(fd, RpcMessage(RPC_ATTACH_SHM, shmName));
+                if (attached.status != RPC_OK)
+                    shm.reset();
+            }
+            catch (const std::exception &e)
+            {
+                // the connection's state is unknown if ATTACH_SHM got no response
+                if (shm)
+                {
+                    unlink(shmPath.c_str());
+                    throw;
+                }
+            }
+
+            // the file is mapped by both sides now (or neither)
+            if (shm)
+                unlink(shmPath.c_str());
+        }
+
+        return std::make_shared<Connection>(fd, true, shm);
+    }
+    catch (const std::exception &e)
+    {
+        if (fd >= 0)
+            close(fd);
+        return nullptr;
+    }
+}
+
+////////////////////////////////////////////
+// RpcServer
+////////////////////////////////////////////
+
+/**
+ * A connection accepted by an RpcServer, shared by the requests
+ * received on it so they can reply.
+ */
+class RpcServerConnection
+{
+public:
+    int fd;
+    bool isLocal;
+    std::mutex writeMutex;
+
+    // set (under `writeMutex`) by RPC_ATTACH_SHM
+    std::shared_ptr<ShmTransport> shm;
+
+    /* Param constructor, taking ownership of socket `fd` (a Unix socket if `isLocal`) */
+    RpcServerConnection(int fd, bool isLocal) : fd(fd), isLocal(isLocal) {}
+    ~RpcServerConnection() { close(this->fd); }
+};
+
+/**
+ * Sends `response` (whose code is its RpcStatus) to the client. Safe to
+ * call from any thread; does nothing if the client has disconnected.
+ */
+void RpcRequest::reply(const RpcMessage &response) const
+{
+    RpcHeader header;
+    std::vector<iovec> iovs = response.iovecs(header);
+    header.requestId = this->requestId;
+
+    // a broken connection is noticed (and closed) by its reading thread
+    std::lock_guard<std::mutex> lock(this->connection->writeMutex);
+
+    // written under `writeMutex`, so the client reads the ring in frame order
+    RpcShmRef ref;
+    if (this->connection->shm)
+        moveToRing(this->connection->shm->toClient(), header, iovs, ref);
+
+    size_t index = 0;
+    sendIovecs(this->connection->fd, iovs, index);
+}
+
+void RpcRequest::reply(uint8_t status) const
+{
+    this->reply(RpcMessage(status));
+}
+
+/* Param constructor */
+RpcServer::RpcServer(std::string host, uint16_t port, uint32_t socketBufferBytes, Handler handler,
+                     std::string localSocketPath)
+    : host(host),
+        port(port),
+        socketBufferBytes(socketBufferBytes),
+        handler(handler),
+        localSocketPath(localSocketPath),
+        listenFd(-1),
+        localListenFd(-1),
+        wakeFd(-1),
+        stopping(false),
+        numConnectionThreads(0)
+{
+    std::random_device random;
+    std::ostringstream id;
+    id << std::hex << ((static_cast<uint64_t>(random()) << 32) | random());
+    this->instanceId = id.str();
+}
+
+RpcServer::~RpcServer()
+{
+    this->stop();
+}
+
+/**
+ * Binds the listening socket (throwing if it can't) and starts accepting
+ * connections.
+ *
+ * NOTE:
+ *
+ * If the local socket can't be bound (e.g. another live server has it),
+ * that's logged, and clients are served over TCP only.
+ */
+void RpcServer::start()
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo *addrs = nullptr;
+    std::string service = std::to_string(this->port);
+    int err = getaddrinfo(this->host.empty() ? nullptr : this->host.c_str(), service.c_str(), &hints, &addrs);
+    if (err != 0)
+        throw std::runtime_error("RpcServer: can't resolve " + this->host + " - " + gai_strerror(err));
+
+    int fd = socket(addrs->ai_family, addrs->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addrs->ai_protocol);
+    if (fd >= 0)
+    {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        // inherited by accepted sockets
+        setSocketOptions(fd, this->socketBufferBytes);
+    }
+
+    if (fd < 0 || bind(fd, addrs->ai_addr, addrs->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        std::string error = strerror(errno);
+        if (fd >= 0)
+            close(fd);
+        freeaddrinfo(addrs);
+        throw std::runtime_error("RpcServer: can't listen on " + this->host + ":" + service + " - " + error);
+    }
+    freeaddrinfo(addrs);
+
+    this->listenFd = fd;
+    this->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!this->localSocketPath.empty())
+        this->listenLocal();
+
+    this->acceptThread = std::thread(&RpcServer::acceptConnections, this);
+}
+
+/* Binds and listens on the Unix socket at `localSocketPath` */
+void RpcServer::listenLocal()
+{
+    const std::string &path = this->localSocketPath;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        std::cout << "RpcServer: local socket path too long, serving over TCP only: " << path << std::endl;
+        return;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    // a socket left behind by a server that's gone is replaced, but a live one (or any other file) isn't
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0)
+    {
+        bool inUse = !S_ISSOCK(st.st_mode);
+        if (!inUse)
+        {
+            try
+            {
+                close(connectToLocal(path, 0));
+                inUse = true;
+            }
+            catch (const std::runtime_error &e) {}
+        }
+
+        if (inUse)
+        {
+            std::cout << "RpcServer: " << path << " is in use, serving over TCP only" << std::endl;
+            return;
+        }
+        unlink(path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        std::cout << "RpcServer: can't listen on " << path << " (" << strerror(errno) << "), serving over TCP only" << std::endl;
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    // no less open than the TCP port (e.g. to a master running as another user than a container's)
+    chmod(path.c_str(), 0666);
+
+    this->localListenFd = fd;
+}
+
+/**
+ * Stops accepting connections, closes the open ones and waits for
+ * their threads to exit.
+ */
+void RpcServer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->stopping || this->listenFd < 0)
+            return;
+        this->stopping = true;
+    }
+
+    // wakes acceptConnections()
+    uint64_t one = 1;
+    ssize_t n = write(this->wakeFd, &one, sizeof(one));
+    (void)n;
+    this->acceptThread.join();
+    close(this->listenFd);
+    close(this->wakeFd);
+
+    if (this->localListenFd >= 0)
+    {
+        close(this->localListenFd);
+        unlink(this->localSocketPath.c_str());
+    }
+
+    // wakes each connection's recv()
+    std::unique_lock<std::mutex> lock(this->mutex);
+    for (auto &[fd, connection] : this->connections)
+        shutdown(fd, SHUT_RDWR);
+
+    this->cv.wait(lock, [&]() { return this->numConnectionThreads == 0; });
+}
+
+/* Port the server is listening on (e.g. if constructed with port 0) */
+uint16_t RpcServer::boundPort()
+{
+    sockaddr_storage addr = {};
+    socklen_t len = sizeof(addr);
+    getsockname(this->listenFd, reinterpret_cast<sockaddr*>(&addr), &len);
+
+    if (addr.ss_family == AF_INET6)
+        return ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+    return ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+}
+
+/**
+ * Thread function: accepts connections (over TCP, and the local socket if
+ * any), starting a thread to serve each, until the server is stopped.
+ */
+void RpcServer::acceptConnections()
+{
+    // poll() skips the local socket's entry if it's -1
+    pollfd fds[3] = {{this->wakeFd, POLLIN, 0}, {this->listenFd, POLLIN, 0}, {this->localListenFd, POLLIN, 0}};
+
+    while (true)
+    {
+        int ready = poll(fds, 3, -1);
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->stopping)
+                return;
+        }
+        if (ready < 0)
+            continue;
+
+        for (int i = 1; i < 3; i++)
+        {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+
+            bool isLocal = (i == 2);
+            int fd = accept4(fds[i].fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                // e.g. out of fds, so back off rather than spin
+                if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+
+            if (!isLocal)
+            {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            auto connection = std::make_shared<RpcServerConnection>(fd, isLocal);
+            this->connections[fd] = connection;
+            this->numConnectionThreads++;
+            std::thread(&RpcServer::serveConnection, this, connection).detach();
+        }
+    }
+}
+
+/**
+ * Thread function: receives requests on `connection`, passing each to
+ * `handler`, until the client disconnects or the server is stopped.
+ */
+void RpcServer::serveConnection(std::shared_ptr<RpcServerConnection> connection)
+{
+    RpcFrameReader reader;
+    bool invalid = false;
+    auto onFrame = [&](RpcHeader &header, std::string key, std::vector<unsigned char> payload)
+    {
+        // only this thread sets `shm`, so it needn't lock to read it
+        if (invalid || !takeFromRing(connection->shm ? &connection->shm->toServer() : nullptr, header, payload))
+        {
+            invalid = true;
+            return;
+        }
+
+        RpcRequest request;
+        request.op = header.code;
+        request.key = std::move(key);
+        request.payload = std::move(payload);
+        request.connection = connection;
+        request.requestId = header.requestId;
+
+        if (this->handleTransportRequest(request))
+            return;
+
+        try
+        {
+            this->handler(request);
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "RPC handler failed: " << e.what() << std::endl;
+            request.reply(RPC_ERROR);
+        }
+    };
+
+    while (reader.readFrom(connection->fd, onFrame) && !invalid);
+
+    shutdown(connection->fd, SHUT_RDWR);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->connections.erase(connection->fd);
+    this->numConnectionThreads--;
+    this->cv.notify_all();
+}
+
+/**
+ * Replies to `request` if it's one the server handles itself (e.g.
+ * RPC_HELLO), returning false otherwise.
+ */
+bool RpcServer::handleTransportRequest(RpcRequest &request)
+{
+    if (request.op == RPC_HELLO)
+    {
+        std::string socketName = this->localListenFd >= 0 ? fs::path(this->localSocketPath).filename().string() : "";
+        std::string hello = socketName + "\n" + this->instanceId;
+
+        RpcMessage response(RPC_OK);
+        response.append(std::vector<unsigned char>(hello.begin(), hello.end()));
+        request.reply(response);
+        return true;
+    }
+
+    if (request.op == RPC_ATTACH_SHM)
+    {
+        // only local clients share memory, and only via files beside our socket
+        const std::string &name = request.key;
+        if (!request.connection->isLocal || name.empty() || name[0] == '.' || name.find('/') != std::string::npos)
+        {
+            request.reply(RPC_BAD_REQUEST);
+            return true;
+        }
+
+        try
+        {
+            auto shm = ShmTransport::attach(fs::path(this->localSocketPath).parent_path() / name);
+            {
+                std::lock_guard<std::mutex> lock(request.connection->writeMutex);
+                request.connection->shm = shm;
+            }
+            request.reply(RPC_OK);
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "RPC: can't attach shared memory - " << e.what() << std::endl;
+            request.reply(RPC_ERROR);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+////////////////////////////////////////////
+// Rpc tests
+////////////////////////////////////////////
+namespace RpcTests
+{
+    void testRoundTrip()
+    {
+        // echoes the key, then the payload
+        RpcServer server("127.0.0.1", 0, 0, [](RpcRequest request) {
+            RpcMessage response(RPC_OK);
+            response.append(std::vector<unsigned char>(request.key.begin(), request.key.end()));
+            response.appendRef(request.payload.data(), request.payload.size());
+            request.reply(response);
+        });
+        server.start();
+
+        RpcClient client("127.0.0.1", server.boundPort(), 2, 0);
+        ASSERT_THAT(client.warmUp() == 2);
+
+        std::vector<std::vector<unsigned char>> dataBuffers;
+        auto [blocks, blockNums] = Block::generateRandom("some/key", 4096, 3 * 4096 + 100, dataBuffers);
+
+        // large enough to be sent partly from the client's queue
+        std::vector<unsigned char> bulk(8 * 1024 * 1024);
+        for (size_t i = 0; i < bulk.size(); i++)
+            bulk[i] = i % 251;
+
+        RpcMessage message(RPC_STORE_BLOCKS, "some/key");
+        message.appendBlocks(blocks);
+        message.append({1, 2, 3});
+        message.appendRef(bulk.data(), bulk.size());
+
+        std::vector<unsigned char> expected(message.key.begin(), message.key.end());
+        std::vector<unsigned char> payload = message.flatten();
+        expected.insert(expected.end(), payload.begin(), payload.end());
+
+        std::vector<pplx::task<RpcResponse>> calls;
+        for (int i = 0; i < 4; i++)
+            calls.push_back(client.call(message));
+
+        for (auto &call : calls)
+        {
+            RpcResponse response = call.get();
+            ASSERT_THAT(response.status == RPC_OK);
+            ASSERT_THAT(response.payload == expected);
+        }
+
+        // blocks are serialized as by Block::serialize()
+        std::vector<unsigned char> serialized;
+        for (auto &block : blocks)
+            block.serialize(serialized);
+        ASSERT_THAT(std::equal(serialized.begin(), serialized.end(), payload.begin()));
+
+        server.stop();
+    }
+
+    void testOutOfOrderResponses()
+    {
+        // replies to "slow" requests after a delay, and to the rest straight away
+        std::vector<std::thread> repliers;
+        std::mutex repliersMutex;
+        RpcServer server("127.0.0.1", 0, 0, [&](RpcRequest request) {
+            if (request.key != "slow")
+            {
+                request.reply(RPC_OK);
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(repliersMutex);
+            repliers.emplace_back([request]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                request.reply(RPC_NOT_IMPLEMENTED);
+            });
+        });
+        server.start();
+
+        // one connection, so both calls share it
+        RpcClient client("127.0.0.1", server.boundPort(), 1, 0);
+        ASSERT_THAT(client.warmUp() == 1);
+
+        auto slowCall = client.call(RpcMessage(RPC_HEALTH, "slow"));
+        auto fastCall = client.call(RpcMessage(RPC_HEALTH, "fast"));
+
+        ASSERT_THAT(fastCall.get().status == RPC_OK);
+        ASSERT_THAT(!slowCall.is_done());
+        ASSERT_THAT(slowCall.get().status == RPC_NOT_IMPLEMENTED);
+
+        for (auto &replier : repliers)
+            replier.join();
+        server.stop();
+    }
+
+    void testServerFailure()
+    {
+        // never replies
+        RpcServer server("127.0.0.1", 0, 0, [](RpcRequest) {});
+        server.start();
+        uint16_t port = server.boundPort();
+
+        RpcClient client("127.0.0.1", port, 1, 0);
+        ASSERT_THAT(client.warmUp() == 1);
+        auto call = client.call(RpcMessage(RPC_SYNC));
+
+        // the pending call fails once the server goes away...
+        server.stop();
+        try
+        {
+            call.get();
+            FORCE_FAIL("call should fail once its connection closes");
+        }
+        catch (const std::runtime_error &e) {}
+
+        // ...as do calls while it's down (without trying to reconnect)...
+        ASSERT_THAT(client.warmUp() == 0);
+        try
+        {
+            client.call(RpcMessage(RPC_SYNC)).get();
+            FORCE_FAIL("call should fail while the server is down");
+        }
+        catch (const std::runtime_error &e) {}
+
+        // ...and the client is reconnected by warmUp() once it's back
+        RpcServer restarted("127.0.0.1", port, 0, [](RpcRequest request) {
+            request.reply(RPC_OK);
+        });
+        restarted.start();
+        try
+        {
+            client.call(RpcMessage(RPC_SYNC)).get();
+            FORCE_FAIL("call() should never connect");
+        }
+        catch (const std::runtime_error &e) {}
+
+        ASSERT_THAT(client.warmUp() == 1);
+        ASSERT_THAT(client.call(RpcMessage(RPC_SYNC)).get().status == RPC_OK);
+        restarted.stop();
+    }
+
+    void testLocalTransport()
+    {
+        std::string socketPath = "rpc_test_" + std::to_string(getpid()) + ".sock";
+
+        // echoes the payload
+        RpcServer server("127.0.0.1", 0, 0, [](RpcRequest request) {
+            RpcMessage response(RPC_OK);
+            response.appendRef(request.payload.data(), request.payload.size());
+            request.reply(response);
+        }, socketPath);
+        server.start();
+
+        RpcClient client("127.0.0.1", server.boundPort(), 2, 0, ".", 1024 * 1024);
+        ASSERT_THAT(client.warmUp() == 2);
+
+        // small payloads are sent inline, mid-sized ones through the rings, and
+        // those that don't fit the rings inline again
+        for (size_t size : {100, 300 * 1024, 4 * 1024 * 1024})
+        {
+            std::vector<unsigned char> payload(size);
+            for (size_t i = 0; i < payload.size(); i++)
+                payload[i] = (i + size) % 251;
+
+            RpcMessage message(RPC_STORE_BLOCKS, "some/key");
+            message.appendRef(payload.data(), payload.size());
+
+            std::vector<pplx::task<RpcResponse>> calls;
+            for (int i = 0; i < 8; i++)
+                calls.push_back(client.call(message));
+
+            for (auto &call : calls)
+            {
+                RpcResponse response = call.get();
+                ASSERT_THAT(response.status == RPC_OK);
+                ASSERT_THAT(response.payload == payload);
+            }
+        }
+        ASSERT_THAT(client.numLocalConnections() == 2);
+
+        // a client that doesn't share the server's directory uses TCP
+        RpcClient remoteClient("127.0.0.1", server.boundPort(), 1, 0, "/nonexistent", 1024 * 1024);
+        ASSERT_THAT(remoteClient.warmUp() == 1);
+        ASSERT_THAT(remoteClient.call(RpcMessage(RPC_HEALTH)).get().status == RPC_OK);
+        ASSERT_THAT(remoteClient.numLocalConnections() == 0);
+
+        // TCP clients can't attach shared memory
+        RpcClient tcpClient("127.0.0.1", server.boundPort(), 1, 0);
+        ASSERT_THAT(tcpClient.warmUp() == 1);
+        ASSERT_THAT(tcpClient.call(RpcMessage(RPC_ATTACH_SHM, "rpc_x.shm")).get().status == RPC_BAD_REQUEST);
+
+        server.stop();
+        ASSERT_THAT(!fs::exists(socketPath));
+    }
+
+    void testWarmUpAndClose()
+    {
+        // replies to everything but RPC_SYNC
+        RpcServer server("127.0.0.1", 0, 0, [](RpcRequest request) {
+            if (request.op != RPC_SYNC)
+                request.reply(RPC_OK);
+        });
+
+        // nothing to connect to yet
+        RpcClient client("127.0.0.1", 0, 3, 0);
+        ASSERT_THAT(client.warmUp() == 0);
+
+        server.start();
+        RpcClient warmClient("127.0.0.1", server.boundPort(), 3, 0);
+        ASSERT_THAT(warmClient.warmUp() == 3);
+
+        // closing fails outstanding calls...
+        auto call = warmClient.call(RpcMessage(RPC_SYNC));
+        warmClient.closeConnections();
+        try
+        {
+            call.get();
+            FORCE_FAIL("call should fail once its connection is closed");
+        }
+        catch (const std::runtime_error &e) {}
+
+        // ...and later calls fail until it's warmed up again
+        try
+        {
+            warmClient.call(RpcMessage(RPC_HEALTH)).get();
+            FORCE_FAIL("call should fail once its client's connections are closed");
+        }
+        catch (const std::runtime_error &e) {}
+
+        ASSERT_THAT(warmClient.warmUp() == 3);
+        ASSERT_THAT(warmClient.call(RpcMessage(RPC_HEALTH)).get().status == RPC_OK);
+
+        server.stop();
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "RpcTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testRoundTrip),
+            TEST(testOutOfOrderResponses),
+            TEST(testServerFailure),
+            TEST(testLocalTransport),
+            TEST(testWarmUpAndClose)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
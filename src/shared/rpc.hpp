@@ -0,0 +1,396 @@
+#pragma once
+
+#include <pplx/pplxtasks.h>
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+#include <sys/uio.h>
+
+#include "block.hpp"
+#include "shm_ring.hpp"
+
+/**
+ * Binary RPC protocol spoken between the master and storage nodes, as an
+ * alternative to their HTTP API.
+ *
+ * Each RPC is a request frame from the master and a response frame from the
+ * storage node, both of the form:
+ *
+ *      RpcHeader - 12 bytes
+ *      key       - `keySize` bytes (empty in responses)
+ *      payload   - `payloadSize` bytes
+ *
+ * A response carries its request's `requestId`, so many requests can be in
+ * flight on one connection at once, and answered in any order.
+ *
+ * NOTE:
+ *
+ * Each operation takes and returns the same payloads as its HTTP endpoint
+ * (e.g. serialized Blocks, or a Payloads::SizeInfo).
+ *
+ * Clients on the same host as the server connect over a Unix socket instead
+ * of TCP, if they share its local directory. Large payloads on such a
+ * connection are then passed through a ShmTransport's rings, and the frame
+ * (flagged RPC_FLAG_SHM) carries an RpcShmRef in their place.
+ */
+
+/* Operations storage nodes serve over RPC, with their HTTP equivalents */
+enum RpcOp : uint8_t
+{
+    RPC_GET_BLOCKS = 1,     // GET /store/{KEY}
+    RPC_STORE_BLOCKS,       // PUT /store/{KEY}
+    RPC_APPEND_BLOCKS,      // PUT /append/{KEY}
+    RPC_UPDATE_BLOCKS,      // PUT /update/{KEY}
+    RPC_DELETE_KEY,         // DEL /store/{KEY}
+    RPC_DELETE_KEYS,        // DEL /keys
+    RPC_HEALTH,             // GET /health
+    RPC_SYNC,               // GET /sync
+    RPC_RENAME_KEY,         // PUT /rename/{KEY}, moving the key named by the payload to {KEY}
+
+    // handled by RpcServer itself, to set up local connections
+    RPC_HELLO,              // returns "{local socket name}\n{server instance id}"
+    RPC_ATTACH_SHM          // maps the ShmTransport file named by the key
+};
+
+enum RpcStatus : uint8_t
+{
+    RPC_OK = 0,
+    RPC_BAD_REQUEST,
+    RPC_ERROR,
+    RPC_UNAVAILABLE,        // server is shutting down
+    RPC_NOT_IMPLEMENTED
+};
+
+/* Returns `op`'s name, e.g. "GET_BLOCKS" */
+std::string rpcOpName(uint8_t op);
+
+struct __attribute__((packed)) RpcHeader
+{
+    uint32_t payloadSize;
+    uint32_t requestId;
+    uint8_t code;           // RpcOp (requests) or RpcStatus (responses)
+    uint8_t flags;
+    uint16_t keySize;
+};
+
+/* RpcHeader flag: the payload is an RpcShmRef to the real payload */
+const uint8_t RPC_FLAG_SHM = 1;
+
+/* Locates a payload in a ShmRing (see ShmRing::read()) */
+struct RpcShmRef
+{
+    uint64_t position;
+    uint64_t size;
+};
+
+/* Max. payload size accepted, so a corrupt header can't exhaust memory */
+const uint32_t RPC_MAX_PAYLOAD_SIZE = 1u << 30;
+
+/**
+ * An outgoing frame (request or response), whose payload is built from
+ * segments that are sent with a single (scatter-gather) sendmsg().
+ *
+ * NOTE:
+ *
+ * Segments added by appendRef() and appendBlocks() reference the caller's
+ * data rather than copying it, so it must stay valid until the frame has
+ * been sent, i.e. until RpcClient::call() or RpcRequest::reply() returns.
+ */
+class RpcMessage
+{
+public:
+    /* Param constructor */
+    RpcMessage(uint8_t code, std::string key = "");
+
+    /* Appends `bytes`, which the message keeps */
+    void append(std::vector<unsigned char> bytes);
+
+    /* Appends `size` bytes at `data`, without copying them */
+    void appendRef(const unsigned char *data, size_t size);
+
+    /**
+     * Appends `blocks`, serialized as by Block::serialize(), without copying
+     * their data.
+     */
+    void appendBlocks(std::vector<Block> &blocks);
+
+    /* Returns a copy of the payload, e.g. to send as an HTTP body */
+    std::vector<unsigned char> flatten() const;
+
+    uint8_t code;
+    std::string key;
+    uint64_t payloadSize;
+
+private:
+    friend class RpcClient;
+    friend class RpcRequest;
+
+    struct Segment
+    {
+        const unsigned char *data;  // or nullptr, if in `owned`
+        size_t size;
+        size_t ownedIndex;
+    };
+
+    std::vector<std::vector<unsigned char>> owned;
+    std::vector<Segment> segments;
+
+    /**
+     * Returns the frame's iovecs, i.e. `header`, the key, then the
+     * payload's segments.
+     */
+    std::vector<iovec> iovecs(RpcHeader &header) const;
+};
+
+struct RpcResponse
+{
+    uint8_t status;
+    std::vector<unsigned char> payload;
+};
+
+/**
+ * Reassembles the frames received on a socket.
+ *
+ * NOTE:
+ *
+ * Small frames are parsed out of a fixed buffer, but a large payload is
+ * received straight into the vector it's handed over in.
+ */
+class RpcFrameReader
+{
+public:
+    typedef std::function<void(RpcHeader&, std::string, std::vector<unsigned char>)> FrameHandler;
+
+    /* Default constructor */
+    RpcFrameReader();
+
+    /**
+     * Does a single recv() from `fd`, passing each frame it completes to
+     * `onFrame`. Returns false once the connection is closed (or broken, or
+     * sends an invalid frame), true otherwise (including on EAGAIN).
+     */
+    bool readFrom(int fd, const FrameHandler &onFrame);
+
+private:
+    std::vector<unsigned char> buffer;
+    size_t start;
+    size_t end;
+
+    // frame whose payload is being received
+    bool inPayload;
+    RpcHeader header;
+    std::string key;
+    std::vector<unsigned char> payload;
+    size_t payloadReceived;
+};
+
+/**
+ * Client for one storage node's RPC server, multiplexing calls over a small
+ * set of persistent TCP connections.
+ *
+ * NOTE:
+ *
+ * Calls are spread round-robin over the open ones of `numConnections`
+ * connections. A connection that breaks fails all of its outstanding calls.
+ *
+ * Connections are only (re)opened by warmUp(), which blocks while it connects,
+ * so it's called off the request path (e.g. by the master's health checks).
+ * call() never connects: with no connection open, it fails straight away.
+ *
+ * call() sends its frame straight away if the connection's socket has room
+ * (so payload segments are never copied), and queues a copy of whatever
+ * remains otherwise. Each connection's thread receives its responses (and
+ * sends queued frames), completing calls in whatever order they're answered.
+ *
+ * If `localDir` is set and `host` is local, each connection first tries the
+ * server's Unix socket in `localDir` (as named by its RPC_HELLO response),
+ * with a ShmTransport of `shmRingBytes` rings (if non-zero), falling back
+ * to TCP if the server isn't reachable that way.
+ */
+class RpcClient
+{
+public:
+    /* Param constructor */
+    RpcClient(std::string host, uint16_t port, uint32_t numConnections, uint32_t socketBufferBytes,
+              std::string localDir = "", uint64_t shmRingBytes = 0);
+    ~RpcClient();
+
+    RpcClient(const RpcClient&) = delete;
+    RpcClient& operator=(const RpcClient&) = delete;
+
+    /**
+     * Sends `message`, returning a task completing with its response. The task
+     * fails if the node can't be reached, the connection breaks, or there's no
+     * response within RPC_REQUEST_TIMEOUT.
+     */
+    pplx::task<RpcResponse> call(const RpcMessage &message);
+
+    /**
+     * Opens any connections that aren't open (e.g. have broken), returning the
+     * num. of connections open. Blocks while connecting.
+     */
+    uint32_t warmUp();
+
+    /**
+     * Closes every connection (failing their outstanding calls), e.g. once
+     * the server has gone down, so warmUp() opens fresh ones.
+     */
+    void closeConnections();
+
+    /* Num. connections currently open over a Unix socket */
+    uint32_t numLocalConnections();
+
+private:
+    class Connection;
+
+    std::string host;
+    uint16_t port;
+    uint32_t socketBufferBytes;
+    std::string localDir;
+    uint64_t shmRingBytes;
+    bool isLocalHost;
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::atomic<uint32_t> nextConnection;
+
+    // serializes warmUp()s, which connect without holding `mutex`
+    std::mutex connectMutex;
+
+    /**
+     * Returns a new connection to the server (over its Unix socket if it can
+     * be reached that way). Throws if it can't connect.
+     */
+    std::shared_ptr<Connection> connect();
+
+    /**
+     * Returns a new Connection over the server's Unix socket, or nullptr if
+     * it can't be reached that way.
+     */
+    std::shared_ptr<Connection> connectLocal();
+
+    /**
+     * Sends `message` on connected socket `fd` and waits for its response, to
+     * set up a connection before it's handed to a Connection. Throws if the
+     * connection breaks, or there's no response within RPC_CONNECT_TIMEOUT.
+     */
+    static RpcResponse callBlocking(int fd, const RpcMessage &message);
+};
+
+class RpcServerConnection;
+
+/**
+ * A request received by an RpcServer.
+ */
+class RpcRequest
+{
+public:
+    uint8_t op;
+    std::string key;
+    std::vector<unsigned char> payload;
+
+    /**
+     * Sends `response` (whose code is its RpcStatus) to the client. Safe to
+     * call from any thread; does nothing if the client has disconnected.
+     */
+    void reply(const RpcMessage &response) const;
+    void reply(uint8_t status) const;
+
+private:
+    friend class RpcServer;
+
+    std::shared_ptr<RpcServerConnection> connection;
+    uint32_t requestId;
+};
+
+/**
+ * Accepts RpcClient connections, passing each request received to `handler`.
+ *
+ * NOTE:
+ *
+ * Each connection has a thread receiving its requests, and `handler` is run
+ * on it, so it should hand off anything slow (e.g. to a WorkerPool). Replies
+ * are sent (blocking) by whichever thread makes them.
+ *
+ * If `localSocketPath` is set, clients on the same host can also connect
+ * to the Unix socket at that path (see RpcClient), and attach ShmTransport
+ * files in its directory.
+ */
+class RpcServer
+{
+public:
+    typedef std::function<void(RpcRequest)> Handler;
+
+    /* Param constructor */
+    RpcServer(std::string host, uint16_t port, uint32_t socketBufferBytes, Handler handler,
+              std::string localSocketPath = "");
+    ~RpcServer();
+
+    /**
+     * Binds the listening socket (throwing if it can't) and starts accepting
+     * connections.
+     */
+    void start();
+
+    /**
+     * Stops accepting connections, closes the open ones and waits for
+     * their threads to exit.
+     */
+    void stop();
+
+    /* Port the server is listening on (e.g. if constructed with port 0) */
+    uint16_t boundPort();
+
+private:
+    std::string host;
+    uint16_t port;
+    uint32_t socketBufferBytes;
+    Handler handler;
+    std::string localSocketPath;
+
+    // random id, so clients can tell the server behind a local socket is us
+    std::string instanceId;
+
+    int listenFd;
+    int localListenFd;
+    int wakeFd;
+    std::thread acceptThread;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping;
+    std::map<int, std::shared_ptr<RpcServerConnection>> connections;
+    uint32_t numConnectionThreads;
+
+    void acceptConnections();
+    void serveConnection(std::shared_ptr<RpcServerConnection> connection);
+
+    /**
+     * Replies to `request` if it's one the server handles itself (e.g.
+     * RPC_HELLO), returning false otherwise.
+     */
+    bool handleTransportRequest(RpcRequest &request);
+
+    /* Binds and listens on the Unix socket at `localSocketPath` */
+    void listenLocal();
+};
+
+namespace RpcTests
+{
+    void testRoundTrip();
+    void testOutOfOrderResponses();
+    void testServerFailure();
+    void testLocalTransport();
+    void testWarmUpAndClose();
+    void runAll();
+}
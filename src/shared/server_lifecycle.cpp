@@ -0,0 +1,187 @@
+#include <thread>
+#include <atomic>
+#include <csignal>
+#include <iostream>
+#include <stdexcept>
+#include <pthread.h>
+
+#include "server_lifecycle.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// ServerLifecycle methods
+////////////////////////////////////////////
+
+/* Default constructor */
+ServerLifecycle::ServerLifecycle()
+    : draining(false),
+        inFlight(0)
+{
+}
+
+/**
+ * Blocks SIGINT and SIGTERM in the calling thread (and threads
+ * it later starts).
+ */
+void ServerLifecycle::blockShutdownSignals()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+
+    if (pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0)
+        throw std::runtime_error("ServerLifecycle::blockShutdownSignals() - pthread_sigmask failed");
+}
+
+/**
+ * Sleeps until SIGINT or SIGTERM is received, returning the signal.
+ */
+int ServerLifecycle::waitForShutdownSignal()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+
+    int signal = 0;
+    if (sigwait(&signals, &signal) != 0)
+        throw std::runtime_error("ServerLifecycle::waitForShutdownSignal() - sigwait failed");
+    return signal;
+}
+
+/**
+ * Admits a request, returning false if the server is draining.
+ */
+bool ServerLifecycle::tryBeginRequest()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->draining)
+        return false;
+
+    this->inFlight++;
+    return true;
+}
+
+/**
+ * Marks an admitted request as finished.
+ */
+void ServerLifecycle::endRequest()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->inFlight--;
+    }
+    this->cv.notify_all();
+}
+
+/**
+ * Stops admitting requests, then waits up to `timeout` for those in flight
+ * to finish. Returns true if they all did.
+ */
+bool ServerLifecycle::drain(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->draining = true;
+    this->cv.notify_all();
+
+    return this->cv.wait_for(lock, timeout, [&]() { return this->inFlight == 0; });
+}
+
+/**
+ * Sleeps for `timeout`, or until draining starts. Returns true if
+ * draining.
+ */
+bool ServerLifecycle::waitForDraining(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->cv.wait_for(lock, timeout, [&]() { return this->draining; });
+}
+
+bool ServerLifecycle::isDraining()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->draining;
+}
+
+uint32_t ServerLifecycle::requestsInFlight()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->inFlight;
+}
+
+////////////////////////////////////////////
+// ServerLifecycle tests
+////////////////////////////////////////////
+namespace ServerLifecycleTests
+{
+    void testDrainWaitsForRequests()
+    {
+        ServerLifecycle lifecycle;
+
+        ASSERT_THAT(lifecycle.tryBeginRequest());
+        ASSERT_THAT(lifecycle.tryBeginRequest());
+        ASSERT_THAT(lifecycle.requestsInFlight() == 2);
+
+        // finish both requests while drain() waits on them
+        std::thread handler([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            lifecycle.endRequest();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            lifecycle.endRequest();
+        });
+
+        ASSERT_THAT(lifecycle.drain(std::chrono::seconds(5)));
+        handler.join();
+
+        // nothing is admitted once draining
+        ASSERT_THAT(lifecycle.isDraining());
+        ASSERT_THAT(!lifecycle.tryBeginRequest());
+        ASSERT_THAT(lifecycle.requestsInFlight() == 0);
+    }
+
+    void testDrainTimesOut()
+    {
+        ServerLifecycle lifecycle;
+        ASSERT_THAT(!lifecycle.waitForDraining(std::chrono::milliseconds(10)));
+        ASSERT_THAT(lifecycle.tryBeginRequest());
+
+        // a background loop waiting on the lifecycle is woken by drain()
+        std::atomic<bool> loopExited(false);
+        std::thread loop([&]() {
+            while (!lifecycle.waitForDraining(std::chrono::seconds(60)));
+            loopExited = true;
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_THAT(!lifecycle.drain(std::chrono::milliseconds(50)));
+        ASSERT_THAT(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+
+        loop.join();
+        ASSERT_THAT(loopExited);
+
+        // the straggler can still finish afterwards
+        lifecycle.endRequest();
+        ASSERT_THAT(lifecycle.drain(std::chrono::milliseconds(0)));
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "ServerLifecycleTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testDrainWaitsForRequests),
+            TEST(testDrainTimesOut)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+
+/**
+ * Tracks a server's in-flight requests, so it can shut down gracefully: 
+ * stop admitting new requests, then wait for those in flight to finish.
+ * 
+ * NOTE:
+ * 
+ * Shutdown is triggered by SIGINT/SIGTERM. blockShutdownSignals() must be
+ * called before any other thread is started (e.g. cpprest's thread pool),
+ * so every thread inherits the blocked mask and the signal is only ever
+ * received by waitForShutdownSignal(), i.e. the main thread sleeps on it
+ * rather than spinning.
+ */
+class ServerLifecycle
+{
+public:
+    ServerLifecycle();
+
+    /**
+     * Blocks SIGINT and SIGTERM in the calling thread (and threads
+     * it later starts).
+     */
+    static void blockShutdownSignals();
+
+    /**
+     * Sleeps until SIGINT or SIGTERM is received, returning the signal.
+     */
+    static int waitForShutdownSignal();
+
+    /**
+     * Admits a request, returning false if the server is draining (in
+     * which case it shouldn't be handled). Each admitted request must 
+     * be matched by an endRequest().
+     */
+    bool tryBeginRequest();
+
+    /**
+     * Marks an admitted request as finished.
+     */
+    void endRequest();
+
+    /**
+     * Stops admitting requests, then waits up to `timeout` for those in flight
+     * to finish. Returns true if they all did.
+     */
+    bool drain(std::chrono::milliseconds timeout);
+
+    /**
+     * Sleeps for `timeout`, or until draining starts. Returns true if
+     * draining (e.g. so a background loop can exit promptly).
+     */
+    bool waitForDraining(std::chrono::milliseconds timeout);
+
+    bool isDraining();
+    uint32_t requestsInFlight();
+
+private:
+    bool draining;
+    uint32_t inFlight;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+namespace ServerLifecycleTests
+{
+    void testDrainWaitsForRequests();
+    void testDrainTimesOut();
+    void runAll();
+}
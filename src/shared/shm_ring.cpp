@@ -0,0 +1,346 @@
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <functional>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_ring.hpp"
+
+#include "test_utils.hpp"
+
+// identifies ShmTransport files ("RKSHMRNG")
+static const uint64_t SHM_MAGIC = 0x474e524d48534b52;
+
+// offset of the first ring's data, i.e. the header's (page-aligned) size
+static const size_t SHM_DATA_OFFSET = 4096;
+
+struct ShmFileHeader
+{
+    uint64_t magic;
+    uint64_t ringBytes;
+    ShmRingControl rings[2];
+};
+
+static_assert(sizeof(ShmFileHeader) <= SHM_DATA_OFFSET, "ShmFileHeader must fit its page");
+
+////////////////////////////////////////////
+// ShmRing methods
+////////////////////////////////////////////
+
+/* Param constructor, over `capacity` bytes at `data` */
+ShmRing::ShmRing(ShmRingControl *control, unsigned char *data, uint64_t capacity)
+    : control(control),
+        data(data),
+        ringCapacity(capacity)
+{
+}
+
+/**
+ * Copies the `count` buffers at `iovs` (`size` bytes in all) into the ring
+ * as one payload, setting `position` to its position. Returns false (and
+ * writes nothing) if there isn't room.
+ */
+bool ShmRing::tryWrite(const iovec *iovs, size_t count, uint64_t size, uint64_t &position)
+{
+    uint64_t head = this->control->head.load(std::memory_order_relaxed);
+    uint64_t tail = this->control->tail.load(std::memory_order_acquire);
+    if (size > this->ringCapacity - (head - tail))
+        return false;
+
+    uint64_t written = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        auto src = static_cast<const unsigned char*>(iovs[i].iov_base);
+        size_t remaining = iovs[i].iov_len;
+        while (remaining > 0)
+        {
+            uint64_t offset = (head + written) % this->ringCapacity;
+            size_t chunk = std::min<uint64_t>(remaining, this->ringCapacity - offset);
+            std::memcpy(this->data + offset, src, chunk);
+            src += chunk;
+            remaining -= chunk;
+            written += chunk;
+        }
+    }
+
+    position = head;
+    this->control->head.store(head + size, std::memory_order_release);
+    return true;
+}
+
+/**
+ * Copies the `size`-byte payload at `position` to `out`, and frees its
+ * space. Returns false (and reads nothing) unless it's the next payload.
+ */
+bool ShmRing::read(uint64_t position, uint64_t size, unsigned char *out)
+{
+    uint64_t tail = this->control->tail.load(std::memory_order_relaxed);
+    uint64_t head = this->control->head.load(std::memory_order_acquire);
+    if (position != tail || size > head - tail)
+        return false;
+
+    uint64_t offset = tail % this->ringCapacity;
+    size_t first = std::min<uint64_t>(size, this->ringCapacity - offset);
+    std::memcpy(out, this->data + offset, first);
+    std::memcpy(out + first, this->data, size - first);
+
+    this->control->tail.store(tail + size, std::memory_order_release);
+    return true;
+}
+
+uint64_t ShmRing::capacity()
+{
+    return this->ringCapacity;
+}
+
+////////////////////////////////////////////
+// ShmTransport methods
+////////////////////////////////////////////
+
+/* Param constructor, taking ownership of `mappingSize` bytes mapped at `mapping` */
+ShmTransport::ShmTransport(void *mapping, size_t mappingSize)
+    : mapping(mapping),
+        mappingSize(mappingSize)
+{
+    auto header = static_cast<ShmFileHeader*>(mapping);
+    auto data = static_cast<unsigned char*>(mapping) + SHM_DATA_OFFSET;
+
+    for (int i = 0; i < 2; i++)
+        this->rings[i] = std::make_unique<ShmRing>(&header->rings[i], data + i * header->ringBytes, header->ringBytes);
+}
+
+ShmTransport::~ShmTransport()
+{
+    munmap(this->mapping, this->mappingSize);
+}
+
+/**
+ * Creates file `path` (which mustn't exist) with rings of `ringBytes` bytes
+ * each, and maps it. Throws on failure.
+ */
+std::shared_ptr<ShmTransport> ShmTransport::create(const std::string &path, uint64_t ringBytes)
+{
+    if (ringBytes == 0)
+        throw std::runtime_error("ShmTransport::create() - ringBytes must be non-zero");
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+        throw std::runtime_error("ShmTransport::create() - can't create " + path + ": " + strerror(errno));
+
+    size_t size = SHM_DATA_OFFSET + 2 * ringBytes;
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    std::string error = strerror(errno);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        unlink(path.c_str());
+        throw std::runtime_error("ShmTransport::create() - can't map " + path + ": " + error);
+    }
+
+    // the file starts zeroed, so only the header's constants need writing
+    auto header = new (mapping) ShmFileHeader();
+    header->ringBytes = ringBytes;
+    header->magic = SHM_MAGIC;
+
+    return std::shared_ptr<ShmTransport>(new ShmTransport(mapping, size));
+}
+
+/**
+ * Maps existing file `path`, as created by create(). Throws if it can't
+ * be mapped, or isn't a valid ShmTransport file.
+ */
+std::shared_ptr<ShmTransport> ShmTransport::attach(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("ShmTransport::attach() - can't open " + path + ": " + strerror(errno));
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > SHM_DATA_OFFSET)
+        mapping = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("ShmTransport::attach() - can't map " + path);
+
+    auto header = static_cast<ShmFileHeader*>(mapping);
+    if (header->magic != SHM_MAGIC || SHM_DATA_OFFSET + 2 * header->ringBytes != static_cast<uint64_t>(st.st_size))
+    {
+        munmap(mapping, st.st_size);
+        throw std::runtime_error("ShmTransport::attach() - " + path + " isn't a ShmTransport file");
+    }
+
+    return std::shared_ptr<ShmTransport>(new ShmTransport(mapping, st.st_size));
+}
+
+/* Ring written by the client and read by the server */
+ShmRing &ShmTransport::toServer()
+{
+    return *this->rings[0];
+}
+
+/* Ring written by the server and read by the client */
+ShmRing &ShmTransport::toClient()
+{
+    return *this->rings[1];
+}
+
+////////////////////////////////////////////
+// ShmRing tests
+////////////////////////////////////////////
+namespace ShmRingTests
+{
+    void testWriteRead()
+    {
+        ShmRingControl control = {};
+        std::vector<unsigned char> data(64);
+        ShmRing ring(&control, data.data(), data.size());
+
+        // a payload gathered from several buffers
+        std::string a = "hello, ", b = "world";
+        iovec iovs[2] = {{a.data(), a.size()}, {b.data(), b.size()}};
+
+        uint64_t position;
+        ASSERT_THAT(ring.tryWrite(iovs, 2, a.size() + b.size(), position));
+        ASSERT_THAT(position == 0);
+
+        std::vector<unsigned char> out(a.size() + b.size());
+        ASSERT_THAT(ring.read(position, out.size(), out.data()));
+        ASSERT_THAT(std::string(out.begin(), out.end()) == "hello, world");
+
+        // payloads can't be read twice
+        ASSERT_THAT(!ring.read(position, out.size(), out.data()));
+    }
+
+    void testWrapAround()
+    {
+        ShmRingControl control = {};
+        std::vector<unsigned char> data(10);
+        ShmRing ring(&control, data.data(), data.size());
+
+        // each payload starts where the last ended, so they soon wrap around
+        for (int i = 0; i < 20; i++)
+        {
+            std::vector<unsigned char> payload(7);
+            for (size_t j = 0; j < payload.size(); j++)
+                payload[j] = i * 7 + j;
+            iovec iov = {payload.data(), payload.size()};
+
+            uint64_t position;
+            ASSERT_THAT(ring.tryWrite(&iov, 1, payload.size(), position));
+            ASSERT_THAT(position == static_cast<uint64_t>(i * 7));
+
+            std::vector<unsigned char> out(payload.size());
+            ASSERT_THAT(ring.read(position, out.size(), out.data()));
+            ASSERT_THAT(out == payload);
+        }
+    }
+
+    void testFullAndOutOfOrder()
+    {
+        ShmRingControl control = {};
+        std::vector<unsigned char> data(16);
+        ShmRing ring(&control, data.data(), data.size());
+
+        std::vector<unsigned char> payload(6, 'x');
+        iovec iov = {payload.data(), payload.size()};
+
+        uint64_t first, second, third;
+        ASSERT_THAT(ring.tryWrite(&iov, 1, payload.size(), first));
+        ASSERT_THAT(ring.tryWrite(&iov, 1, payload.size(), second));
+
+        // only 4 bytes left
+        ASSERT_THAT(!ring.tryWrite(&iov, 1, payload.size(), third));
+
+        // payloads must be read in order...
+        std::vector<unsigned char> out(payload.size());
+        ASSERT_THAT(!ring.read(second, out.size(), out.data()));
+        ASSERT_THAT(ring.read(first, out.size(), out.data()));
+
+        // ...and reading one frees its space
+        ASSERT_THAT(ring.tryWrite(&iov, 1, payload.size(), third));
+        ASSERT_THAT(ring.read(second, out.size(), out.data()));
+        ASSERT_THAT(ring.read(third, out.size(), out.data()));
+    }
+
+    void testTransportFile()
+    {
+        std::string path = "shm_ring_test_" + std::to_string(getpid());
+        unlink(path.c_str());
+
+        auto client = ShmTransport::create(path, 1024);
+
+        // the file must not already exist
+        try
+        {
+            ShmTransport::create(path, 1024);
+            FORCE_FAIL("create() should fail if the file exists");
+        }
+        catch (const std::runtime_error &e) {}
+
+        // both sides see the same rings, even once the file is unlinked
+        auto server = ShmTransport::attach(path);
+        unlink(path.c_str());
+
+        ASSERT_THAT(server->toServer().capacity() == 1024);
+
+        std::string request = "request", response = "response";
+        iovec requestIov = {request.data(), request.size()};
+        iovec responseIov = {response.data(), response.size()};
+
+        uint64_t position;
+        std::vector<unsigned char> out(64);
+
+        ASSERT_THAT(client->toServer().tryWrite(&requestIov, 1, request.size(), position));
+        ASSERT_THAT(server->toServer().read(position, request.size(), out.data()));
+        ASSERT_THAT(std::string(out.begin(), out.begin() + request.size()) == request);
+
+        ASSERT_THAT(server->toClient().tryWrite(&responseIov, 1, response.size(), position));
+        ASSERT_THAT(client->toClient().read(position, response.size(), out.data()));
+        ASSERT_THAT(std::string(out.begin(), out.begin() + response.size()) == response);
+
+        // files that aren't ShmTransport files are rejected
+        {
+            int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+            ASSERT_THAT(ftruncate(fd, 2 * 4096 + 10) == 0);
+            close(fd);
+        }
+        try
+        {
+            ShmTransport::attach(path);
+            FORCE_FAIL("attach() should reject an invalid file");
+        }
+        catch (const std::runtime_error &e) {}
+        unlink(path.c_str());
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "ShmRingTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testWriteRead),
+            TEST(testWrapAround),
+            TEST(testFullAndOutOfOrder),
+            TEST(testTransportFile)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <sys/uio.h>
+
+/**
+ * Control words of one ShmRing, shared by its writer and reader.
+ *
+ * `head` and `tail` are byte positions that only ever grow (the ring offset
+ * is the position modulo the ring's size). Each is on its own cache line, as
+ * each has a single writer.
+ */
+struct ShmRingControl
+{
+    alignas(64) std::atomic<uint64_t> head;     // end of the data written
+    alignas(64) std::atomic<uint64_t> tail;     // end of the data read
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ShmRing needs lock-free 64-bit atomics");
+
+/**
+ * A single-producer, single-consumer byte ring in memory shared by two
+ * processes (see ShmTransport).
+ *
+ * NOTE:
+ *
+ * The writer copies a payload in with tryWrite(), then tells the reader the
+ * returned position out of band (e.g. in an RPC frame). The reader must read
+ * payloads in the order they were written, as read() frees each one's space.
+ *
+ * Neither side blocks - tryWrite() returns false if the ring is too full,
+ * and read() returns false if the position isn't the next one to read.
+ */
+class ShmRing
+{
+public:
+    /* Param constructor, over `capacity` bytes at `data` */
+    ShmRing(ShmRingControl *control, unsigned char *data, uint64_t capacity);
+
+    /**
+     * Copies the `count` buffers at `iovs` (`size` bytes in all) into the ring
+     * as one payload, setting `position` to its position. Returns false (and
+     * writes nothing) if there isn't room.
+     */
+    bool tryWrite(const iovec *iovs, size_t count, uint64_t size, uint64_t &position);
+
+    /**
+     * Copies the `size`-byte payload at `position` to `out`, and frees its
+     * space. Returns false (and reads nothing) unless it's the next payload.
+     */
+    bool read(uint64_t position, uint64_t size, unsigned char *out);
+
+    uint64_t capacity();
+
+private:
+    ShmRingControl *control;
+    unsigned char *data;
+    uint64_t ringCapacity;
+};
+
+/**
+ * A pair of ShmRings (one each way) in a file mapped by an RPC client and
+ * server on the same host.
+ *
+ * NOTE:
+ *
+ * The file is laid out as a page holding a header (magic, ring size and both
+ * rings' ShmRingControl), then the client-to-server ring's data, then the
+ * server-to-client ring's. It's sparse until written, and is best kept on
+ * a tmpfs (e.g. /dev/shm) so the rings are never written back to disk.
+ *
+ * The client create()s the file, the server attach()es to it, after which
+ * either may unlink it - the mapping lasts until both are destroyed.
+ */
+class ShmTransport
+{
+public:
+    /**
+     * Creates file `path` (which mustn't exist) with rings of `ringBytes` bytes
+     * each, and maps it. Throws on failure.
+     */
+    static std::shared_ptr<ShmTransport> create(const std::string &path, uint64_t ringBytes);
+
+    /**
+     * Maps existing file `path`, as created by create(). Throws if it can't
+     * be mapped, or isn't a valid ShmTransport file.
+     */
+    static std::shared_ptr<ShmTransport> attach(const std::string &path);
+
+    ~ShmTransport();
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    /* Ring written by the client and read by the server */
+    ShmRing &toServer();
+
+    /* Ring written by the server and read by the client */
+    ShmRing &toClient();
+
+private:
+    void *mapping;
+    size_t mappingSize;
+    std::unique_ptr<ShmRing> rings[2];
+
+    /* Param constructor, taking ownership of `mappingSize` bytes mapped at `mapping` */
+    ShmTransport(void *mapping, size_t mappingSize);
+};
+
+namespace ShmRingTests
+{
+    void testWriteRead();
+    void testWrapAround();
+    void testFullAndOutOfOrder();
+    void testTransportFile();
+    void runAll();
+}
@@ -57,6 +57,17 @@ namespace ApiUtils {
 
         return {prefix.empty() ? cleanUri : prefix, key};
     } 
+
+    std::string stagedKey(const std::string &key)
+    {
+        return key + STAGED_KEY_SUFFIX;
+    }
+
+    bool isStagedKey(const std::string &key)
+    {
+        return key.size() >= STAGED_KEY_SUFFIX.size()
+            && key.compare(key.size() - STAGED_KEY_SUFFIX.size(), STAGED_KEY_SUFFIX.size(), STAGED_KEY_SUFFIX) == 0;
+    }
 };
 
 namespace PrintUtils {
@@ -198,7 +209,8 @@ namespace UtilsTests
         std::cerr << "###################################" << std::endl;
 
         std::vector<std::pair<std::string, std::function<void()>>> tests = {
-            TEST(testParsePath)
+            TEST(testParsePath),
+            TEST(testStagedKey)
         };
 
         for (auto &[name, func] : tests)
@@ -231,4 +243,14 @@ namespace UtilsTests
             ASSERT_THAT(p == expectedParsedPaths[i]);
         }
     }
+
+    void testStagedKey()
+    {
+        ASSERT_THAT(ApiUtils::isStagedKey(ApiUtils::stagedKey("archive.zip")));
+        ASSERT_THAT(ApiUtils::isStagedKey(ApiUtils::stagedKey("")));
+
+        ASSERT_THAT(!ApiUtils::isStagedKey("archive.zip"));
+        ASSERT_THAT(!ApiUtils::isStagedKey(ApiUtils::stagedKey("archive.zip") + "1"));
+        ASSERT_THAT(!ApiUtils::isStagedKey("~staged"));
+    }
 };
\ No newline at end of file
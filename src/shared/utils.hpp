@@ -34,6 +34,26 @@ namespace ApiUtils {
      * "/keys" OR "/keys/" -> {"/keys", ""}
      */
     std::pair<std::string, std::string> parsePath(const std::string &uri);
+
+    /**
+     * Suffix of the key a streamed PUT stores its blocks under on the
+     * storage nodes, until it's complete (see stagedKey()).
+     */
+    inline const std::string STAGED_KEY_SUFFIX = ".~staged";
+
+    /**
+     * Returns the key a streamed PUT of `key` stages its blocks under.
+     * 
+     * NOTE:
+     * 
+     * Staged keys are reserved, i.e. clients can't read or write them.
+     */
+    std::string stagedKey(const std::string &key);
+
+    /**
+     * Returns whether `key` is a staged key (see stagedKey()).
+     */
+    bool isStagedKey(const std::string &key);
 };
     
 namespace PrintUtils {
@@ -163,5 +183,6 @@ namespace FileSystemUtils
 namespace UtilsTests
 {
     void testParsePath();
+    void testStagedKey();
     void runAll();
 }
\ No newline at end of file
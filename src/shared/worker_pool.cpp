@@ -0,0 +1,178 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+#include "worker_pool.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// WorkerPool methods
+////////////////////////////////////////////
+
+/* Param constructor */
+WorkerPool::WorkerPool(uint32_t numThreads)
+    : stopping(false)
+{
+    if (numThreads == 0)
+        throw std::runtime_error("WorkerPool() - numThreads must be non-zero");
+
+    for (uint32_t i = 0; i < numThreads; i++)
+        this->threads.emplace_back(&WorkerPool::work, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+    this->stop();
+}
+
+/**
+ * Queues `job` to be run by a worker thread. Throws if the
+ * pool has been stopped.
+ */
+void WorkerPool::submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->stopping)
+            throw std::runtime_error("WorkerPool::submit() - pool is stopped");
+        this->jobs.push_back(std::move(job));
+    }
+    this->cv.notify_one();
+}
+
+/**
+ * Stops accepting jobs, waits for the queued ones to run, and joins
+ * the worker threads.
+ */
+void WorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+
+    for (std::thread &thread : this->threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+}
+
+uint32_t WorkerPool::numThreads()
+{
+    return this->threads.size();
+}
+
+/**
+ * Worker thread function: runs jobs until the pool is stopped
+ * and its queue is empty.
+ */
+void WorkerPool::work()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cv.wait(lock, [&]() { return this->stopping || !this->jobs.empty(); });
+
+            if (this->jobs.empty())
+                return;
+
+            job = std::move(this->jobs.front());
+            this->jobs.pop_front();
+        }
+
+        try
+        {
+            job();
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "WorkerPool: job failed - " << e.what() << std::endl;
+        }
+    }
+}
+
+////////////////////////////////////////////
+// WorkerPool tests
+////////////////////////////////////////////
+namespace WorkerPoolTests
+{
+    void testRunsAllJobs()
+    {
+        WorkerPool pool(4);
+        ASSERT_THAT(pool.numThreads() == 4);
+
+        std::atomic<int> numRun(0);
+        std::atomic<int> maxConcurrent(0);
+        std::atomic<int> concurrent(0);
+        for (int i = 0; i < 16; i++)
+        {
+            pool.submit([&]() {
+                int now = ++concurrent;
+                int prevMax = maxConcurrent;
+                while (now > prevMax && !maxConcurrent.compare_exchange_weak(prevMax, now));
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                concurrent--;
+                numRun++;
+            });
+        }
+
+        // a failing job doesn't take its worker down
+        pool.submit([]() { throw std::runtime_error("job failed"); });
+
+        pool.stop();
+        ASSERT_THAT(numRun == 16);
+        ASSERT_THAT(maxConcurrent > 1 && maxConcurrent <= 4);
+    }
+
+    void testStopRunsQueuedJobs()
+    {
+        WorkerPool pool(1);
+
+        std::atomic<int> numRun(0);
+        for (int i = 0; i < 5; i++)
+        {
+            pool.submit([&]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                numRun++;
+            });
+        }
+
+        pool.stop();
+        ASSERT_THAT(numRun == 5);
+
+        try
+        {
+            pool.submit([]() {});
+            FORCE_FAIL("submit() after stop() should throw");
+        }
+        catch (std::runtime_error &e)
+        {
+        }
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "WorkerPoolTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testRunsAllJobs),
+            TEST(testStopRunsQueuedJobs)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
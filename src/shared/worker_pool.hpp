@@ -0,0 +1,65 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+/**
+ * A fixed-size pool of threads running submitted jobs in FIFO order.
+ * 
+ * NOTE:
+ * 
+ * Used to run handlers that block (e.g. on disk I/O) off cpprest's own
+ * thread pool, so its threads stay free to accept and read requests.
+ * 
+ * stop() runs every job already submitted before joining the threads.
+ */
+class WorkerPool
+{
+public:
+    /* Param constructor */
+    WorkerPool(uint32_t numThreads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * Queues `job` to be run by a worker thread. Throws if the
+     * pool has been stopped.
+     */
+    void submit(std::function<void()> job);
+
+    /**
+     * Stops accepting jobs, waits for the queued ones to run, and joins
+     * the worker threads.
+     */
+    void stop();
+
+    uint32_t numThreads();
+
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    bool stopping;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    /**
+     * Worker thread function: runs jobs until the pool is stopped
+     * and its queue is empty.
+     */
+    void work();
+};
+
+namespace WorkerPoolTests
+{
+    void testRunsAllJobs();
+    void testStopRunsQueuedJobs();
+    void runAll();
+}
@@ -0,0 +1,223 @@
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include "access_tracker.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// AccessStats methods
+////////////////////////////////////////////
+
+/**
+ * Returns the fraction of prefetched bytes that were later read.
+ */
+double AccessStats::prefetchHitRate() const
+{
+    if (prefetchedBytes == 0)
+        return 0.0;
+    return static_cast<double>(prefetchHitBytes) / prefetchedBytes;
+}
+
+std::string AccessStats::toString() const
+{
+    std::ostringstream oss;
+
+    oss << "reads: " << reads << "\n"
+        << "sequentialReads: " << sequentialReads << "\n"
+        << "prefetchedBytes: " << prefetchedBytes << "\n"
+        << "prefetchHitBytes: " << prefetchHitBytes << "\n"
+        << "prefetchHitRate: " << prefetchHitRate() << "\n";
+    return oss.str();
+}
+
+////////////////////////////////////////////
+// AccessTracker methods
+////////////////////////////////////////////
+
+/* Param constructor */
+AccessTracker::AccessTracker(
+    uint32_t minWindow,
+    uint32_t maxWindow,
+    size_t maxTrackedKeys
+)
+    : minWindow(minWindow),
+      maxWindow(std::max(minWindow, maxWindow)),
+      maxTrackedKeys(maxTrackedKeys)
+{
+}
+
+/**
+ * Records a read of `range` of the extent of key hash `keyHash`,
+ * returning the range of the extent to prefetch, if any.
+ */
+std::optional<ExtentRange> AccessTracker::recordRead(
+    uint32_t keyHash,
+    uint32_t startingDiskBlockNum,
+    ExtentRange range,
+    uint32_t extentNumBytes)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    this->accessStats.reads++;
+    uint32_t readEnd = range.offset + range.numBytes;
+
+    // first read of the key (or of a new extent of it) starts a new stream
+    auto it = this->streams.find(keyHash);
+    if (it == this->streams.end() || it->second.startingDiskBlockNum != startingDiskBlockNum)
+    {
+        if (it == this->streams.end() && this->streams.size() >= this->maxTrackedKeys)
+            this->streams.erase(this->streams.begin());
+
+        this->streams[keyHash] = {startingDiskBlockNum, readEnd, this->minWindow, 0, 0};
+        return std::nullopt;
+    }
+
+    Stream &stream = it->second;
+
+    // count any of the read's bytes we prefetched
+    uint32_t hitStart = std::max(range.offset, stream.prefetchStart);
+    uint32_t hitEnd = std::min(readEnd, stream.prefetchEnd);
+    if (hitStart < hitEnd)
+        this->accessStats.prefetchHitBytes += hitEnd - hitStart;
+
+    bool sequential = (
+        range.offset >= stream.nextOffset &&
+        range.offset - stream.nextOffset <= stream.window
+    );
+    stream.nextOffset = readEnd;
+
+    if (!sequential)
+    {
+        stream.window = this->minWindow;
+        stream.prefetchStart = stream.prefetchEnd = 0;
+        return std::nullopt;
+    }
+
+    this->accessStats.sequentialReads++;
+    stream.window = std::min(stream.window * 2, this->maxWindow);
+
+    // prefetch up to a window ahead of the read, skipping what's already prefetched
+    uint32_t prefetchStart = std::max(readEnd, stream.prefetchEnd);
+    uint32_t prefetchEnd = std::min(readEnd + stream.window, extentNumBytes);
+    if (prefetchStart >= prefetchEnd)
+        return std::nullopt;
+
+    if (stream.prefetchEnd < readEnd)
+        stream.prefetchStart = prefetchStart;
+    stream.prefetchEnd = prefetchEnd;
+
+    this->accessStats.prefetchedBytes += prefetchEnd - prefetchStart;
+    return ExtentRange{prefetchStart, prefetchEnd - prefetchStart};
+}
+
+/**
+ * Stops tracking reads of key hash `keyHash`.
+ */
+void AccessTracker::forget(uint32_t keyHash)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->streams.erase(keyHash);
+}
+
+/**
+ * Returns a snapshot of the tracker's counters.
+ */
+AccessStats AccessTracker::stats()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->accessStats;
+}
+
+////////////////////////////////////////////
+// AccessTracker tests
+////////////////////////////////////////////
+namespace AccessTrackerTests
+{
+    void testSequentialReadsPrefetch()
+    {
+        AccessTracker tracker(100, 400);
+        uint32_t extentNumBytes = 10000;
+
+        // first read only starts the stream
+        ASSERT_THAT(tracker.recordRead(1, 0, {0, 50}, extentNumBytes) == std::nullopt);
+
+        // each following read prefetches a (doubling) window ahead of itself
+        auto prefetch = tracker.recordRead(1, 0, {50, 50}, extentNumBytes);
+        ASSERT_THAT(prefetch != std::nullopt);
+        ASSERT_THAT(prefetch->offset == 100 && prefetch->numBytes == 200);
+
+        prefetch = tracker.recordRead(1, 0, {100, 50}, extentNumBytes);
+        ASSERT_THAT(prefetch != std::nullopt);
+        ASSERT_THAT(prefetch->offset == 300 && prefetch->numBytes == 250);
+
+        // window is capped, and never prefetches past the extent's end
+        prefetch = tracker.recordRead(1, 0, {150, 50}, extentNumBytes);
+        ASSERT_THAT(prefetch->offset == 550 && prefetch->numBytes == 50);
+
+        prefetch = tracker.recordRead(1, 0, {9800, 150}, extentNumBytes);
+        ASSERT_THAT(prefetch == std::nullopt);
+        prefetch = tracker.recordRead(1, 0, {9950, 10}, extentNumBytes);
+        ASSERT_THAT(prefetch->offset == 9960 && prefetch->numBytes == 40);
+
+        ASSERT_THAT(tracker.stats().reads == 6);
+        ASSERT_THAT(tracker.stats().sequentialReads == 4);
+    }
+
+    void testRandomReadsDontPrefetch()
+    {
+        AccessTracker tracker(100, 400);
+        uint32_t extentNumBytes = 10000;
+
+        ASSERT_THAT(tracker.recordRead(1, 0, {5000, 50}, extentNumBytes) == std::nullopt);
+        ASSERT_THAT(tracker.recordRead(1, 0, {0, 50}, extentNumBytes) == std::nullopt);
+        ASSERT_THAT(tracker.recordRead(1, 0, {8000, 50}, extentNumBytes) == std::nullopt);
+
+        // a new extent of the key (i.e. it was rewritten) restarts the stream
+        ASSERT_THAT(tracker.recordRead(1, 0, {8050, 50}, extentNumBytes) != std::nullopt);
+        ASSERT_THAT(tracker.recordRead(1, 7, {8100, 50}, extentNumBytes) == std::nullopt);
+
+        ASSERT_THAT(tracker.stats().sequentialReads == 1);
+    }
+
+    void testPrefetchHitRate()
+    {
+        AccessTracker tracker(100, 100);
+        uint32_t extentNumBytes = 10000;
+
+        tracker.recordRead(1, 0, {0, 100}, extentNumBytes);
+        tracker.recordRead(1, 0, {100, 100}, extentNumBytes); // prefetches [200, 300)
+        tracker.recordRead(1, 0, {200, 50}, extentNumBytes);  // hits 50, prefetches [300, 350)
+
+        AccessStats stats = tracker.stats();
+        ASSERT_THAT(stats.prefetchedBytes == 150);
+        ASSERT_THAT(stats.prefetchHitBytes == 50);
+        ASSERT_THAT(stats.prefetchHitRate() > 0.33 && stats.prefetchHitRate() < 0.34);
+
+        // forgotten keys start afresh
+        tracker.forget(1);
+        ASSERT_THAT(tracker.recordRead(1, 0, {250, 50}, extentNumBytes) == std::nullopt);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "AccessTrackerTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testSequentialReadsPrefetch),
+            TEST(testRandomReadsDontPrefetch),
+            TEST(testPrefetchHitRate)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
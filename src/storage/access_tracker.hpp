@@ -0,0 +1,120 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+
+/**
+ * Counters describing a storage engine's read access patterns.
+ */
+struct AccessStats
+{
+    /* num. reads recorded */
+    uint64_t reads = 0;
+
+    /* num. reads that continued on from the previous read of their extent */
+    uint64_t sequentialReads = 0;
+
+    /* num. bytes hinted to the kernel for prefetching */
+    uint64_t prefetchedBytes = 0;
+
+    /* num. prefetched bytes that were later read */
+    uint64_t prefetchHitBytes = 0;
+
+    /**
+     * Returns the fraction of prefetched bytes that were later read.
+     */
+    double prefetchHitRate() const;
+
+    std::string toString() const;
+};
+
+/**
+ * A byte range within an extent.
+ */
+struct ExtentRange
+{
+    uint32_t offset;
+    uint32_t numBytes;
+};
+
+/**
+ * Tracks reads of each key's extent, detecting sequential streams
+ * and deciding how far ahead of them to prefetch.
+ *
+ * NOTE:
+ *
+ * A read is sequential if it starts at, or within the current readahead
+ * window of, the end of the previous read of the same extent. Each
+ * sequential read doubles the stream's window (up to `maxWindow`), and
+ * any non-sequential read resets it to `minWindow`, so random access
+ * never triggers prefetching.
+ */
+class AccessTracker
+{
+public:
+    /* Param constructor */
+    AccessTracker(
+        uint32_t minWindow = 64 * 1024,
+        uint32_t maxWindow = 1u << 20,
+        size_t maxTrackedKeys = 1024
+    );
+
+    /**
+     * Records a read of `range` of the extent (of `extentNumBytes` bytes, starting
+     * at disk block `startingDiskBlockNum`) of key hash `keyHash`.
+     *
+     * Returns the range of the extent to prefetch, if any.
+     */
+    std::optional<ExtentRange> recordRead(
+        uint32_t keyHash,
+        uint32_t startingDiskBlockNum,
+        ExtentRange range,
+        uint32_t extentNumBytes);
+
+    /**
+     * Stops tracking reads of key hash `keyHash`.
+     */
+    void forget(uint32_t keyHash);
+
+    /**
+     * Returns a snapshot of the tracker's counters.
+     */
+    AccessStats stats();
+
+private:
+    /**
+     * Read state of a single key's extent.
+     */
+    struct Stream
+    {
+        uint32_t startingDiskBlockNum;
+        uint32_t nextOffset;
+        uint32_t window;
+
+        /* range already prefetched, i.e. [prefetchStart, prefetchEnd) */
+        uint32_t prefetchStart;
+        uint32_t prefetchEnd;
+    };
+
+    uint32_t minWindow;
+    uint32_t maxWindow;
+    size_t maxTrackedKeys;
+
+    /* { key hash -> stream } */
+    std::unordered_map<uint32_t, Stream> streams;
+
+    AccessStats accessStats;
+
+    std::mutex mutex;
+};
+
+namespace AccessTrackerTests
+{
+    void testSequentialReadsPrefetch();
+    void testRandomReadsDontPrefetch();
+    void testPrefetchHitRate();
+    void runAll();
+}
@@ -0,0 +1,707 @@
+/**
+ * storage_bench - drives a storage engine directly (no HTTP) through a
+ * configurable workload, reporting throughput and latency percentiles as JSON.
+ *
+ * Usage:
+ *
+ *      storage_bench [--name=value ...]
+ *
+ * See printUsage() for all options. e.g.
+ *
+ *      storage_bench --threads=8 --ops=200000 --read-pct=90 --write-pct=10 \
+ *                    --size-dist=lognormal --size=16384 --fill=0.8 --fragmentation=0.3
+ *
+ * NOTE:
+ *
+ * Each run:
+ *
+ *      1. creates a fresh store in `--dir`
+ *      2. fills `--fill` of its data capacity with keys of the configured size distribution
+ *      3. deletes `--fragmentation` of the filled keys at random (and reclaims their space),
+ *         leaving holes for later writes to allocate around
+ *      4. runs `--ops` operations (or for `--duration-sec`) over `--threads` threads,
+ *         picking reads/writes/deletes by `--read-pct`/`--write-pct`/`--delete-pct`
+ *
+ * The JSON report is written to stdout (or `--out`). Engine logging is suppressed
+ * unless `--verbose` is given, so the report can be piped straight to other tools.
+ */
+
+#include <array>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include <unordered_set>
+
+#include "block.hpp"
+#include "disk_storage.hpp"
+#include "memory_storage.hpp"
+#include "storage_engine.hpp"
+
+namespace fs = std::filesystem;
+
+////////////////////////////////////////////
+// Benchmark config
+////////////////////////////////////////////
+
+/**
+ * Distribution of object sizes written by the benchmark.
+ */
+enum SizeDist : uint32_t
+{
+    /* every object is `size` bytes */
+    SIZE_FIXED = 0,
+
+    /* uniform over [sizeMin, sizeMax] */
+    SIZE_UNIFORM,
+
+    /* log-normal with mean `size`, clamped to [sizeMin, sizeMax] */
+    SIZE_LOGNORMAL
+};
+
+struct BenchConfig
+{
+    std::string engine = "disk";
+    std::string dir = "/tmp/rackkey_bench";
+    std::string out;
+
+    uint32_t threads = 4;
+    uint64_t ops = 100000;
+    double durationSec = 0;
+
+    uint32_t readPct = 70;
+    uint32_t writePct = 25;
+    uint32_t deletePct = 5;
+
+    SizeDist sizeDist = SIZE_FIXED;
+    uint32_t size = 16384;
+    uint32_t sizeMin = 1024;
+    uint32_t sizeMax = 1u << 20;
+    double sizeSigma = 1.0;
+
+    uint32_t keys = 10000;
+    double fill = 0.5;
+    double fragmentation = 0.0;
+
+    uint32_t diskBlockSize = 4096;
+    uint32_t dataBlockSize = 4096;
+    uint32_t maxDataSizePower = 28;
+    uint32_t readaheadMaxBytes = 1u << 20;
+    bool punchHole = false;
+
+    uint64_t seed = 42;
+    bool verbose = false;
+};
+
+static const char *sizeDistName(SizeDist dist)
+{
+    switch (dist)
+    {
+        case SIZE_FIXED: return "fixed";
+        case SIZE_UNIFORM: return "uniform";
+        case SIZE_LOGNORMAL: return "lognormal";
+    }
+    return "unknown";
+}
+
+static void printUsage()
+{
+    std::cerr <<
+        "usage: storage_bench [--name=value ...]\n"
+        "\n"
+        "  --engine=disk|memory        storage engine to drive (disk)\n"
+        "  --dir=PATH                  store directory, recreated on each run (/tmp/rackkey_bench)\n"
+        "  --out=PATH                  write the JSON report to PATH instead of stdout\n"
+        "  --threads=N                 worker threads (4)\n"
+        "  --ops=N                     total operations over all threads (100000)\n"
+        "  --duration-sec=S            run for S seconds instead of --ops\n"
+        "  --read-pct=P                percentage of reads (70)\n"
+        "  --write-pct=P               percentage of (over)writes (25)\n"
+        "  --delete-pct=P              percentage of deletes (5)\n"
+        "  --size-dist=fixed|uniform|lognormal   object size distribution (fixed)\n"
+        "  --size=B                    fixed size / lognormal mean, bytes (16384)\n"
+        "  --size-min=B --size-max=B   size bounds, bytes (1024, 1048576)\n"
+        "  --size-sigma=S              lognormal shape (1.0)\n"
+        "  --keys=N                    key space size (10000)\n"
+        "  --fill=F                    fraction of data capacity filled before the run (0.5)\n"
+        "  --fragmentation=F           fraction of filled keys deleted before the run (0)\n"
+        "  --disk-block-size=B         engine block size (4096)\n"
+        "  --data-block-size=B         data size of each client block (4096)\n"
+        "  --max-data-size-power=N     engine data capacity is 2^N bytes (28)\n"
+        "  --readahead-max-bytes=B     DiskStorage readahead window cap (1048576)\n"
+        "  --punch-hole=0|1            DiskStorage hole punching on reclaim (0)\n"
+        "  --seed=N                    RNG seed (42)\n"
+        "  --verbose=0|1               keep engine logging on stdout (0)\n";
+}
+
+/**
+ * Parses `--name=value` arguments into `config`.
+ *
+ * Throws:
+ *      runtime_error() - on unknown options or invalid values
+ */
+static BenchConfig parseArgs(int argc, char *argv[])
+{
+    BenchConfig config;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            exit(0);
+        }
+
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+            throw std::runtime_error("invalid argument: " + arg);
+
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+
+        if (name == "engine") config.engine = value;
+        else if (name == "dir") config.dir = value;
+        else if (name == "out") config.out = value;
+        else if (name == "threads") config.threads = std::stoul(value);
+        else if (name == "ops") config.ops = std::stoull(value);
+        else if (name == "duration-sec") config.durationSec = std::stod(value);
+        else if (name == "read-pct") config.readPct = std::stoul(value);
+        else if (name == "write-pct") config.writePct = std::stoul(value);
+        else if (name == "delete-pct") config.deletePct = std::stoul(value);
+        else if (name == "size") config.size = std::stoul(value);
+        else if (name == "size-min") config.sizeMin = std::stoul(value);
+        else if (name == "size-max") config.sizeMax = std::stoul(value);
+        else if (name == "size-sigma") config.sizeSigma = std::stod(value);
+        else if (name == "keys") config.keys = std::stoul(value);
+        else if (name == "fill") config.fill = std::stod(value);
+        else if (name == "fragmentation") config.fragmentation = std::stod(value);
+        else if (name == "disk-block-size") config.diskBlockSize = std::stoul(value);
+        else if (name == "data-block-size") config.dataBlockSize = std::stoul(value);
+        else if (name == "max-data-size-power") config.maxDataSizePower = std::stoul(value);
+        else if (name == "readahead-max-bytes") config.readaheadMaxBytes = std::stoul(value);
+        else if (name == "punch-hole") config.punchHole = std::stoul(value) != 0;
+        else if (name == "seed") config.seed = std::stoull(value);
+        else if (name == "verbose") config.verbose = std::stoul(value) != 0;
+        else if (name == "size-dist")
+        {
+            if (value == "fixed") config.sizeDist = SIZE_FIXED;
+            else if (value == "uniform") config.sizeDist = SIZE_UNIFORM;
+            else if (value == "lognormal") config.sizeDist = SIZE_LOGNORMAL;
+            else throw std::runtime_error("invalid --size-dist: " + value);
+        }
+        else
+            throw std::runtime_error("unknown option: --" + name);
+    }
+
+    if (config.engine != "disk" && config.engine != "memory")
+        throw std::runtime_error("invalid --engine: " + config.engine);
+    if (config.readPct + config.writePct + config.deletePct != 100)
+        throw std::runtime_error("--read-pct, --write-pct and --delete-pct must sum to 100");
+    if (config.threads == 0 || config.keys == 0 || config.dataBlockSize == 0)
+        throw std::runtime_error("--threads, --keys and --data-block-size must be non-zero");
+    if (config.sizeMin == 0 || config.sizeMin > config.sizeMax)
+        throw std::runtime_error("need 0 < --size-min <= --size-max");
+    if (config.fill < 0 || config.fill > 1 || config.fragmentation < 0 || config.fragmentation > 1)
+        throw std::runtime_error("--fill and --fragmentation must be within [0, 1]");
+    if (config.maxDataSizePower > 31)
+        throw std::runtime_error("--max-data-size-power must be <= 31");
+
+    return config;
+}
+
+////////////////////////////////////////////
+// Workload
+////////////////////////////////////////////
+
+enum OpType : uint32_t
+{
+    OP_READ = 0,
+    OP_WRITE,
+    OP_DELETE,
+    NUM_OP_TYPES
+};
+
+static const char *opName(uint32_t op)
+{
+    static const char *names[NUM_OP_TYPES] = {"read", "write", "delete"};
+    return names[op];
+}
+
+/**
+ * Measurements of a single op type, collected by one thread (then merged).
+ */
+struct OpStats
+{
+    std::vector<uint64_t> latenciesNs;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+
+    /* reads/deletes that found no stored key to operate on */
+    uint64_t misses = 0;
+
+    void merge(OpStats &other)
+    {
+        latenciesNs.insert(latenciesNs.end(), other.latenciesNs.begin(), other.latenciesNs.end());
+        bytes += other.bytes;
+        errors += other.errors;
+        misses += other.misses;
+    }
+};
+
+/**
+ * State shared by all worker threads.
+ *
+ * NOTE:
+ *
+ * `keySizes[i]` is the object size of key i as last written (0 if absent).
+ * It's only a hint - a racing write/delete of the same key may change the
+ * stored object before a reader uses it, which then surfaces as an error.
+ */
+struct Workload
+{
+    BenchConfig config;
+    StorageEngine *engine;
+    std::unique_ptr<std::atomic<uint32_t>[]> keySizes;
+
+    /* random bytes all written blocks point into */
+    std::vector<unsigned char> payload;
+};
+
+static std::string benchKey(uint32_t i)
+{
+    return "bench_" + std::to_string(i);
+}
+
+/**
+ * Draws an object size from the configured distribution.
+ */
+static uint32_t drawSize(const BenchConfig &config, std::mt19937_64 &rng)
+{
+    switch (config.sizeDist)
+    {
+        case SIZE_FIXED:
+            return config.size;
+
+        case SIZE_UNIFORM:
+            return std::uniform_int_distribution<uint32_t>(config.sizeMin, config.sizeMax)(rng);
+
+        case SIZE_LOGNORMAL:
+        {
+            // mean of a lognormal(m, s) is exp(m + s^2 / 2)
+            double s = config.sizeSigma;
+            double m = std::log(static_cast<double>(config.size)) - s * s / 2;
+            double size = std::lognormal_distribution<double>(m, s)(rng);
+            return static_cast<uint32_t>(std::clamp(size, double(config.sizeMin), double(config.sizeMax)));
+        }
+    }
+    return config.size;
+}
+
+/**
+ * Splits an object of `size` bytes of `workload.payload` into data blocks of key `key`.
+ */
+static std::vector<Block> makeBlocks(Workload &workload, const std::string &key, uint32_t size)
+{
+    uint32_t dataBlockSize = workload.config.dataBlockSize;
+    std::vector<Block> blocks;
+
+    for (uint32_t offset = 0, blockNum = 0; offset < size; offset += dataBlockSize, blockNum++)
+    {
+        uint32_t dataSize = std::min(dataBlockSize, size - offset);
+        auto start = workload.payload.begin() + offset;
+        blocks.emplace_back(key, blockNum, dataSize, start, start + dataSize);
+    }
+    return blocks;
+}
+
+static std::unordered_set<uint32_t> blockNumsOf(const BenchConfig &config, uint32_t size)
+{
+    std::unordered_set<uint32_t> blockNums;
+    uint32_t numBlocks = (size + config.dataBlockSize - 1) / config.dataBlockSize;
+    for (uint32_t i = 0; i < numBlocks; i++)
+        blockNums.insert(i);
+    return blockNums;
+}
+
+/**
+ * Picks a key that's currently stored, or returns false after a few misses.
+ */
+static bool pickStoredKey(Workload &workload, std::mt19937_64 &rng, uint32_t &keyIndex, uint32_t &size)
+{
+    std::uniform_int_distribution<uint32_t> keyDist(0, workload.config.keys - 1);
+    for (int attempt = 0; attempt < 8; attempt++)
+    {
+        keyIndex = keyDist(rng);
+        size = workload.keySizes[keyIndex].load(std::memory_order_relaxed);
+        if (size > 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Runs a single operation of type `op`, returning true if one was attempted.
+ */
+static bool runOp(Workload &workload, uint32_t op, std::mt19937_64 &rng,
+                  std::vector<unsigned char> &readBuffer, OpStats &stats)
+{
+    StorageEngine *engine = workload.engine;
+    uint32_t keyIndex, size;
+
+    if (op == OP_WRITE)
+    {
+        keyIndex = std::uniform_int_distribution<uint32_t>(0, workload.config.keys - 1)(rng);
+        size = drawSize(workload.config, rng);
+    }
+    else if (!pickStoredKey(workload, rng, keyIndex, size))
+    {
+        stats.misses++;
+        return false;
+    }
+
+    std::string key = benchKey(keyIndex);
+    std::vector<Block> blocks;
+    std::unordered_set<uint32_t> blockNums;
+    if (op == OP_WRITE)
+        blocks = makeBlocks(workload, key, size);
+    else if (op == OP_READ)
+        blockNums = blockNumsOf(workload.config, size);
+
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        switch (op)
+        {
+            case OP_READ:
+                engine->readBlocks(key, blockNums, workload.config.dataBlockSize, readBuffer);
+                break;
+            case OP_WRITE:
+                engine->writeBlocks(key, blocks);
+                workload.keySizes[keyIndex].store(size, std::memory_order_relaxed);
+                break;
+            case OP_DELETE:
+                engine->deleteBlocks(key);
+                workload.keySizes[keyIndex].store(0, std::memory_order_relaxed);
+                break;
+        }
+        stats.bytes += (op == OP_DELETE) ? 0 : size;
+    }
+    catch (std::runtime_error &e)
+    {
+        stats.errors++;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    stats.latenciesNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    return true;
+}
+
+/**
+ * Fills the store to `config.fill` of its capacity, then deletes `config.fragmentation`
+ * of the filled keys. Returns {num. keys written, num. keys deleted}.
+ */
+static std::pair<uint32_t, uint32_t> prepareStore(Workload &workload, std::mt19937_64 &rng)
+{
+    BenchConfig &config = workload.config;
+    StorageEngine *engine = workload.engine;
+
+    uint64_t target = static_cast<uint64_t>(config.fill * engine->dataTotalSize());
+    std::vector<uint32_t> filled;
+
+    for (uint32_t i = 0; i < config.keys && engine->dataUsedSize() < target; i++)
+    {
+        uint32_t size = drawSize(config, rng);
+        try
+        {
+            engine->writeBlocks(benchKey(i), makeBlocks(workload, benchKey(i), size));
+        }
+        catch (std::runtime_error &e)
+        {
+            // store full
+            break;
+        }
+        workload.keySizes[i].store(size);
+        filled.push_back(i);
+    }
+
+    // punch holes by deleting a random subset of the filled keys
+    std::shuffle(filled.begin(), filled.end(), rng);
+    uint32_t numDeleted = static_cast<uint32_t>(config.fragmentation * filled.size());
+    for (uint32_t i = 0; i < numDeleted; i++)
+    {
+        engine->deleteBlocks(benchKey(filled[i]));
+        workload.keySizes[filled[i]].store(0);
+    }
+    engine->reclaimSpace();
+
+    return {static_cast<uint32_t>(filled.size()), numDeleted};
+}
+
+/**
+ * Returns {num. free extents, largest free extent (in blocks)} of `fsm`.
+ */
+static std::pair<uint32_t, uint32_t> freeExtents(FreeSpaceMap &fsm)
+{
+    uint32_t numExtents = 0, largest = 0, run = 0;
+    for (uint32_t i = 0; i <= fsm.blockCapacity; i++)
+    {
+        if (i < fsm.blockCapacity && !fsm.isMapped(i))
+        {
+            run++;
+            continue;
+        }
+        if (run > 0)
+        {
+            numExtents++;
+            largest = std::max(largest, run);
+        }
+        run = 0;
+    }
+    return {numExtents, largest};
+}
+
+////////////////////////////////////////////
+// Report
+////////////////////////////////////////////
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double q)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()));
+    return sorted[i];
+}
+
+static std::string latencyJson(std::vector<uint64_t> &latenciesNs)
+{
+    std::sort(latenciesNs.begin(), latenciesNs.end());
+
+    double sum = 0;
+    for (uint64_t ns : latenciesNs)
+        sum += ns;
+    double mean = latenciesNs.empty() ? 0 : sum / latenciesNs.size();
+
+    auto us = [](double ns) { return ns / 1000.0; };
+
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(2)
+       << "{\"minUs\": " << us(latenciesNs.empty() ? 0 : latenciesNs.front())
+       << ", \"meanUs\": " << us(mean)
+       << ", \"p50Us\": " << us(percentile(latenciesNs, 0.50))
+       << ", \"p90Us\": " << us(percentile(latenciesNs, 0.90))
+       << ", \"p99Us\": " << us(percentile(latenciesNs, 0.99))
+       << ", \"p999Us\": " << us(percentile(latenciesNs, 0.999))
+       << ", \"maxUs\": " << us(latenciesNs.empty() ? 0 : latenciesNs.back())
+       << "}";
+    return os.str();
+}
+
+static std::string configJson(const BenchConfig &config)
+{
+    std::ostringstream os;
+    os << "{\"engine\": \"" << config.engine << "\""
+       << ", \"threads\": " << config.threads
+       << ", \"ops\": " << config.ops
+       << ", \"durationSec\": " << config.durationSec
+       << ", \"readPct\": " << config.readPct
+       << ", \"writePct\": " << config.writePct
+       << ", \"deletePct\": " << config.deletePct
+       << ", \"sizeDist\": \"" << sizeDistName(config.sizeDist) << "\""
+       << ", \"size\": " << config.size
+       << ", \"sizeMin\": " << config.sizeMin
+       << ", \"sizeMax\": " << config.sizeMax
+       << ", \"sizeSigma\": " << config.sizeSigma
+       << ", \"keys\": " << config.keys
+       << ", \"fill\": " << config.fill
+       << ", \"fragmentation\": " << config.fragmentation
+       << ", \"diskBlockSize\": " << config.diskBlockSize
+       << ", \"dataBlockSize\": " << config.dataBlockSize
+       << ", \"maxDataSizePower\": " << config.maxDataSizePower
+       << ", \"readaheadMaxBytes\": " << config.readaheadMaxBytes
+       << ", \"punchHole\": " << (config.punchHole ? "true" : "false")
+       << ", \"seed\": " << config.seed
+       << "}";
+    return os.str();
+}
+
+////////////////////////////////////////////
+// Main
+////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    BenchConfig config;
+    try
+    {
+        config = parseArgs(argc, argv);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "storage_bench: " << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    // engines log to stdout, which would interleave with the report
+    std::streambuf *stdoutBuf = std::cout.rdbuf();
+    if (!config.verbose)
+        std::cout.rdbuf(nullptr);
+
+    uint32_t maxDataSize = config.maxDataSizePower == 31 ? (1u << 31) : (1u << config.maxDataSizePower);
+    std::unique_ptr<StorageEngine> engine;
+    FreeSpaceMap *freeSpaceMap;
+
+    if (config.engine == "disk")
+    {
+        fs::remove_all(config.dir);
+        fs::create_directories(config.dir);
+        auto disk = std::make_unique<DiskStorage>(
+            config.dir, "store", config.diskBlockSize, maxDataSize, true,
+            64, config.punchHole, config.readaheadMaxBytes);
+        freeSpaceMap = &disk->freeSpaceMap;
+        engine = std::move(disk);
+    }
+    else
+    {
+        auto memory = std::make_unique<MemoryStorage>(config.diskBlockSize, maxDataSize);
+        freeSpaceMap = &memory->freeSpaceMap;
+        engine = std::move(memory);
+    }
+
+    Workload workload;
+    workload.config = config;
+    workload.engine = engine.get();
+    workload.keySizes.reset(new std::atomic<uint32_t>[config.keys]());
+
+    std::mt19937_64 rng(config.seed);
+    workload.payload.resize(config.sizeDist == SIZE_FIXED ? config.size : config.sizeMax);
+    for (unsigned char &c : workload.payload)
+        c = static_cast<unsigned char>(rng());
+
+    auto [numFilled, numFragmented] = prepareStore(workload, rng);
+    uint32_t usedAfterFill = engine->dataUsedSize();
+    auto [freeExtentsBefore, largestFreeBefore] = freeExtents(*freeSpaceMap);
+
+    // run workload
+    std::vector<std::array<OpStats, NUM_OP_TYPES>> threadStats(config.threads);
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> opsIssued(0);
+
+    auto runStart = std::chrono::steady_clock::now();
+    auto deadline = runStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(config.durationSec));
+
+    for (uint32_t t = 0; t < config.threads; t++)
+    {
+        threads.emplace_back([&, t]() {
+            std::mt19937_64 threadRng(config.seed + 1 + t);
+            std::uniform_int_distribution<uint32_t> pctDist(0, 99);
+            std::vector<unsigned char> readBuffer;
+
+            while (true)
+            {
+                if (config.durationSec > 0)
+                {
+                    if (std::chrono::steady_clock::now() >= deadline)
+                        break;
+                }
+                else if (opsIssued.fetch_add(1, std::memory_order_relaxed) >= config.ops)
+                    break;
+
+                uint32_t pct = pctDist(threadRng);
+                uint32_t op = pct < config.readPct ? OP_READ
+                            : pct < config.readPct + config.writePct ? OP_WRITE
+                            : OP_DELETE;
+                runOp(workload, op, threadRng, readBuffer, threadStats[t][op]);
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+
+    // merge per-thread stats
+    std::array<OpStats, NUM_OP_TYPES> totals;
+    for (auto &stats : threadStats)
+        for (uint32_t op = 0; op < NUM_OP_TYPES; op++)
+            totals[op].merge(stats[op]);
+
+    uint64_t totalOps = 0, totalBytes = 0, totalErrors = 0;
+    std::vector<uint64_t> allLatencies;
+    for (OpStats &stats : totals)
+    {
+        totalOps += stats.latenciesNs.size();
+        totalBytes += stats.bytes;
+        totalErrors += stats.errors;
+        allLatencies.insert(allLatencies.end(), stats.latenciesNs.begin(), stats.latenciesNs.end());
+    }
+
+    auto [freeExtentsAfter, largestFreeAfter] = freeExtents(*freeSpaceMap);
+
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2);
+    report << "{\n"
+           << "  \"config\": " << configJson(config) << ",\n"
+           << "  \"prepare\": {\"keysFilled\": " << numFilled
+           << ", \"keysDeleted\": " << numFragmented
+           << ", \"dataUsedBytes\": " << usedAfterFill
+           << ", \"freeExtents\": " << freeExtentsBefore
+           << ", \"largestFreeExtentBytes\": " << uint64_t(largestFreeBefore) * config.diskBlockSize << "},\n"
+           << "  \"elapsedSec\": " << elapsedSec << ",\n"
+           << "  \"total\": {\"ops\": " << totalOps
+           << ", \"opsPerSec\": " << totalOps / elapsedSec
+           << ", \"mbPerSec\": " << totalBytes / elapsedSec / (1 << 20)
+           << ", \"errors\": " << totalErrors
+           << ", \"latency\": " << latencyJson(allLatencies) << "},\n";
+
+    for (uint32_t op = 0; op < NUM_OP_TYPES; op++)
+    {
+        OpStats &stats = totals[op];
+        report << "  \"" << opName(op) << "\": {\"ops\": " << stats.latenciesNs.size()
+               << ", \"opsPerSec\": " << stats.latenciesNs.size() / elapsedSec
+               << ", \"mbPerSec\": " << stats.bytes / elapsedSec / (1 << 20)
+               << ", \"errors\": " << stats.errors
+               << ", \"misses\": " << stats.misses
+               << ", \"latency\": " << latencyJson(stats.latenciesNs) << "},\n";
+    }
+
+    report << "  \"engine\": {\"dataUsedBytes\": " << engine->dataUsedSize()
+           << ", \"dataTotalBytes\": " << engine->dataTotalSize()
+           << ", \"freeExtents\": " << freeExtentsAfter
+           << ", \"largestFreeExtentBytes\": " << uint64_t(largestFreeAfter) * config.diskBlockSize << "}\n"
+           << "}\n";
+
+    // shut the engine down (and let it finish logging) before writing the report
+    engine.reset();
+    std::cout.rdbuf(stdoutBuf);
+
+    if (config.out.empty())
+    {
+        std::cout << report.str();
+    }
+    else
+    {
+        std::ofstream outFile(config.out);
+        outFile << report.str();
+        if (!outFile)
+        {
+            std::cerr << "storage_bench: failed to write " << config.out << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
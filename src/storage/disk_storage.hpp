@@ -1,12 +1,19 @@
 #pragma once
 
 #include <string>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <unordered_set>
+#include <unordered_map>
 
 #include "utils.hpp"
 #include "block.hpp"
 #include "crypto.hpp"
 #include "free_space.hpp"
+#include "key_arena.hpp"
+#include "access_tracker.hpp"
+#include "storage_engine.hpp"
 #include "storage_config.hpp"
 
 #include "test_utils.hpp"
@@ -15,12 +22,19 @@ namespace fs = std::filesystem;
 
 /**
  * Represents the header of our storage file.
+ * 
+ * NOTE:
+ * 
+ * The file is laid out as: header, BAT, key heap, block store.
+ * The key heap holds the BAT's keys, packed (see KeyArena).
  */
 struct __attribute__((packed)) Header 
 {
     uint32_t magicNumber;   
     uint32_t batOffset;    
     uint32_t batSize;       
+    uint32_t keyHeapOffset;
+    uint32_t keyHeapSize;
     uint32_t diskBlockSize;    
     uint32_t maxDataSize;
     uint32_t blockStoreOffset;
@@ -31,6 +45,8 @@ struct __attribute__((packed)) Header
         uint32_t magicNumber, 
         uint32_t batOffset, 
         uint32_t batSize,
+        uint32_t keyHeapOffset,
+        uint32_t keyHeapSize,
         uint32_t diskBlockSize, 
         uint32_t maxDataSize,
         uint32_t blockStoreOffset
@@ -40,25 +56,45 @@ struct __attribute__((packed)) Header
     std::string toString();
 };
 
+/**
+ * BATEntry flags
+ */
+enum BATEntryFlags : uint32_t
+{
+    /* Key has been deleted, but its blocks are yet to be reclaimed */
+    BAT_ENTRY_TOMBSTONE = 1u << 0
+};
+
 /**
  * Represents an entry in the BAT.
  */
 struct __attribute__((packed)) BATEntry
 {
-    char key[50];
+    /* the entry's key, in the BAT's key arena */
+    KeyRef key;
     uint32_t keyHash;
     uint32_t startingDiskBlockNum;
     uint32_t numBytes;
+    uint32_t flags;
+
+    /* Incremented on every write to the key */
+    uint32_t version;
 
     BATEntry();
 
     BATEntry(
-        std::string &key,
+        KeyRef key,
         uint32_t keyHash, 
         uint32_t startingDiskBlockNum,
         uint32_t numBytes
     );
 
+    /**
+     * Returns true if the entry's key has been deleted (but
+     * its blocks not yet reclaimed).
+     */
+    bool isTombstoned();
+
     bool equals(BATEntry &other);
     std::string toString();
 };
@@ -71,23 +107,93 @@ struct BAT
     uint32_t numEntries;
     std::vector<BATEntry> table;
 
+    /* keys of all entries, mirrored on disk by the key heap */
+    KeyArena keys;
+
     BAT();
 
     BAT(uint32_t numEntries);
 
     /**
      * Finds and returns an iterator to `key`'s corresponding BAT entry.
+     * 
+     * NOTE: 
+     * 
+     * Tombstoned entries are skipped.
      */
     std::optional<std::vector<BATEntry>::iterator> findBATEntry(uint32_t keyHash);
 
+    /**
+     * Returns the key of BAT entry `batEntry`.
+     */
+    std::string keyOf(BATEntry &batEntry);
+
     bool equals(BAT other);
     std::string toString();
 };
 
+/**
+ * A version of a key's extent, pinned by a reader (see DiskStorage::pinVersion()).
+ */
+struct PinnedVersion
+{
+    std::string key;
+    uint32_t keyHash;
+    uint32_t version;
+    uint32_t startingDiskBlockNum;
+    uint32_t numBytes;
+};
+
+/**
+ * A contiguous write of `numBytes` bytes, `dataOffset` bytes into an extent.
+ */
+struct ExtentWrite
+{
+    uint32_t dataOffset;
+    const unsigned char *data;
+    uint32_t numBytes;
+};
+
+/**
+ * Header of the in-place write journal record, which is followed by 
+ * `recordSize` bytes holding its `numWrites` writes (see DiskStorage::writeJournal()).
+ * 
+ * `numBytes` is the extent's size once the writes are applied.
+ * 
+ * A key heap compaction record (see DiskStorage::compactKeyHeap()) has its own
+ * magic number, and its writes are to absolute store file offsets.
+ * 
+ * NOTE: 
+ * 
+ * See DiskStorage::writeInPlace() for the write protocol.
+ */
+struct __attribute__((packed)) JournalHeader
+{
+    uint32_t magicNumber;
+    uint32_t keyHash;
+    uint32_t startingDiskBlockNum;
+    uint32_t numBytes;
+    uint32_t numWrites;
+    uint32_t recordSize;
+    uint32_t dataHash;
+
+    JournalHeader();
+
+    JournalHeader(
+        uint32_t magicNumber,
+        uint32_t keyHash,
+        uint32_t startingDiskBlockNum,
+        uint32_t numBytes,
+        uint32_t numWrites,
+        uint32_t recordSize,
+        uint32_t dataHash
+    );
+};
+
 /**
  * Represents our storage nodes on-disk storage.
  */
-class DiskStorage
+class DiskStorage : public StorageEngine
 {
 public:
 
@@ -107,10 +213,12 @@ public:
         uint32_t diskBlockSize = 4096,
         uint32_t maxDataSize = 1u << 30,
         bool removeExistingStoreFile = false,
-        uint32_t keyLengthMax = 50
+        uint32_t keyLengthMax = 50,
+        bool punchHoleOnReclaim = false,
+        uint32_t readaheadMaxBytes = 1u << 20
     );
 
-    ~DiskStorage();
+    ~DiskStorage() override;
 
     /**
      * Retreive blocks `requestedBlockNums` of key `key`,
@@ -128,8 +236,49 @@ public:
         std::string key, 
         std::unordered_set<uint32_t> blockNums,
         uint32_t dataBlockSize, 
+        std::vector<unsigned char> &readBuffer) override;
+
+    /**
+     * Retreive blocks `requestedBlockNums` of key `key` as part of a bulk
+     * scan, without polluting the page cache (see StorageEngine::scanBlocks()).
+     */
+    std::vector<Block> scanBlocks(
+        std::string key, 
+        std::unordered_set<uint32_t> blockNums,
+        uint32_t dataBlockSize, 
+        std::vector<unsigned char> &readBuffer) override;
+
+    /**
+     * Pins the current version of key `key`, so its extent is neither
+     * overwritten nor freed until unpinned.
+     * 
+     * Throws:
+     *      runtime_error() - if `key` doesn't exist
+     * 
+     * NOTE:
+     * 
+     * Every pin must be matched by an unpinVersion(). Reads of a pinned
+     * version all see the same data, regardless of later writes/deletes.
+     */
+    PinnedVersion pinVersion(std::string key);
+
+    /**
+     * Retreive blocks `requestedBlockNums` of pinned version `pinned` of a key.
+     * 
+     * Throws:
+     *      runtime_error() - on any error during the reading process
+     */
+    std::vector<Block> readVersion(
+        PinnedVersion &pinned,
+        std::unordered_set<uint32_t> requestedBlockNums,
+        uint32_t dataBlockSize,
         std::vector<unsigned char> &readBuffer);
 
+    /**
+     * Unpins version `pinned` of a key (see pinVersion()).
+     */
+    void unpinVersion(PinnedVersion &pinned);
+
     /**
      * Write the given list of blocks `dataBlocks` for the given `key`.
      * 
@@ -141,26 +290,67 @@ public:
      * If `key` already exists, we overwrite its
      * existing blocks and BAT entry.
      */
-    void writeBlocks(std::string key, std::vector<Block> dataBlocks);
+    void writeBlocks(std::string key, std::vector<Block> dataBlocks) override;
 
     /**
-     * Deletes the BAT entry and frees the blocks of the given `key`.
+     * Append the given list of blocks `dataBlocks` to the blocks stored
+     * for the given `key`, growing its extent in place where possible.
+     * 
+     * Throws:
+     *      runtime_error() - on any error during the writing process
+     */
+    void appendBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize) override;
+
+    /**
+     * Replace blocks `dataBlocks` of the given `key`, writing only
+     * their data in place (journaled).
+     * 
+     * Throws:
+     *      runtime_error() - on any error during the writing process
+     */
+    void updateBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize) override;
+
+    /**
+     * Durably tombstones the BAT entry of the given `key`. Its blocks
+     * are freed later by the background reclaimer (see reclaimSpace()).
      * 
      * Throws:
      *      runtime_error - on any error during the deleting process
      */
-    void deleteBlocks(std::string key);
+    void deleteBlocks(std::string key) override;
+
+    /**
+     * Durably tombstones the BAT entries of all given `keys` with a
+     * single sync, skipping keys that don't exist.
+     */
+    void deleteKeys(std::vector<std::string> keys) override;
+
+    /**
+     * Relabels the BAT entry of `fromKey` as `toKey`'s, tombstoning
+     * any entry `toKey` already has. The extent isn't copied.
+     */
+    void renameKey(std::string fromKey, std::string toKey) override;
+
+    /**
+     * Frees the blocks and removes the BAT entries of all tombstoned keys.
+     * 
+     * NOTE:
+     * 
+     * Called by the background reclaimer thread whenever keys are
+     * tombstoned. Only call directly to reclaim synchronously (e.g. tests).
+     */
+    void reclaimSpace() override;
 
     /**
      * Returns list of keys this node stores.
      */
-    std::vector<std::string> getKeys();
+    std::vector<std::string> getKeys() override;
 
     /**
      * Returns block numbers this node stores for the 
      * given key `key`.
      */
-    std::vector<uint32_t> getBlockNums(std::string key, uint32_t dataBlockSize);
+    std::vector<uint32_t> getBlockNums(std::string key, uint32_t dataBlockSize) override;
 
     /**
      * Reads `N` raw disk blocks into a buffer, starting at block `startingBlockNum`.
@@ -182,29 +372,154 @@ public:
      */
     uint32_t getNumDiskBlocks(uint32_t numDataBytes);
 
+    /**
+     * Returns number of disk blocks allocated to the extent of BAT entry
+     * `batEntry`, i.e. those its data takes up plus any reserved for
+     * appends (see extentReserves).
+     */
+    uint32_t getExtentNumDiskBlocks(const BATEntry &batEntry);
+
     /**
      * Returns num. bytes used of data section
      */
-    uint32_t dataUsedSize();
+    uint32_t dataUsedSize() override;
 
     /**
      * Returns total size (in bytes) of the data section
      */
-    uint32_t dataTotalSize();
+    uint32_t dataTotalSize() override;
 
     /**
      * Returns total size (in bytes) of the store file.
      */
     uint32_t totalFileSize();
 
+    /**
+     * Returns read access stats, including the readahead prefetch hit rate.
+     */
+    AccessStats accessStats() override;
+
 private:    
 
-    const uint32_t magicNumber = 0xABABABAB;
+    const uint32_t magicNumber = 0xABABABAD;
+    const uint32_t journalMagicNumber = 0xCDCDCDCD;
+    const uint32_t keyHeapJournalMagicNumber = 0xCECECECE;
 
     fs::path storeFilePath;
+    fs::path journalFilePath;
     std::fstream storeFile;
+
+    /* longest key (in bytes) accepted by writes */
     uint32_t keyLengthMax;
 
+    /**
+     * Guards the header, BAT, free space map and store file stream.
+     */
+    std::mutex storageMutex;
+
+    /**
+     * Background reclamation of tombstoned keys.
+     * 
+     * NOTE:
+     * 
+     * `numTombstones` and `stopReclaimer` are guarded by `storageMutex`.
+     */
+    std::thread reclaimerThread;
+    std::condition_variable reclaimerCv;
+    uint32_t numTombstones;
+    bool stopReclaimer;
+
+    /* If true, reclaimed extents are punched out of the store file */
+    bool punchHoleOnReclaim;
+
+    /**
+     * Reader pins of key versions (see pinVersion()), guarded by `storageMutex`.
+     * 
+     * `extentPins` is of the form: { starting disk block num -> num. readers }.
+     * 
+     * `retiredExtents` holds extents replaced or deleted while pinned, which
+     * stay allocated until unpinned. Of the form: { starting disk block num -> num. disk blocks }.
+     */
+    std::unordered_map<uint32_t, uint32_t> extentPins;
+    std::unordered_map<uint32_t, uint32_t> retiredExtents;
+
+    /**
+     * Disk blocks allocated past the end of an extent's data, so appends
+     * can grow it in place (see appendBlocks()), guarded by `storageMutex`.
+     * Of the form: { starting disk block num -> num. disk blocks }.
+     * 
+     * NOTE: not persisted, so reserves are freed on restart (see
+     *       populateFreeSpaceMapFromFile()).
+     */
+    std::unordered_map<uint32_t, uint32_t> extentReserves;
+
+    /**
+     * Returns true if any reader has the extent starting at 
+     * disk block `startingDiskBlockNum` pinned.
+     */
+    bool isPinned(uint32_t startingDiskBlockNum);
+
+    /**
+     * Tracks reads of each key's extent, deciding what to prefetch.
+     * 
+     * NOTE: a max readahead window of 0 disables prefetching.
+     */
+    AccessTracker accessTracker;
+
+    /**
+     * Pins the current version of key `key`, reads blocks `requestedBlockNums`
+     * of it, then unpins it.
+     */
+    std::vector<Block> readCurrentVersion(
+        std::string &key,
+        std::unordered_set<uint32_t> &requestedBlockNums,
+        uint32_t dataBlockSize,
+        std::vector<unsigned char> &readBuffer,
+        bool isScan);
+
+    /**
+     * Reads blocks `requestedBlockNums` of pinned version `pinned` of a key,
+     * giving the kernel readahead (or, if `isScan`, cache-dropping) hints.
+     */
+    std::vector<Block> readPinnedVersion(
+        PinnedVersion &pinned,
+        std::unordered_set<uint32_t> &requestedBlockNums,
+        uint32_t dataBlockSize,
+        std::vector<unsigned char> &readBuffer,
+        bool isScan);
+
+    /**
+     * Returns the range of pinned version `pinned`'s extent spanning the 
+     * records of the first to the last of `requestedBlockNums`, read through `fd`.
+     */
+    ExtentRange findRecordSpan(
+        int fd,
+        PinnedVersion &pinned,
+        std::unordered_set<uint32_t> &requestedBlockNums,
+        uint32_t dataBlockSize);
+
+    /**
+     * Gives the kernel access advice `advice` (see posix_fadvise()) for
+     * `N` bytes of the store file at `offset`, through open file `fd`.
+     */
+    void adviseRange(int fd, uint32_t offset, uint32_t N, int advice);
+
+    /**
+     * Reclaimer thread function. Waits for tombstones and reclaims them.
+     */
+    void reclaimerLoop();
+
+    /**
+     * Reclaims all tombstoned keys. Expects `lock` to hold `storageMutex`.
+     */
+    void reclaimTombstones(std::unique_lock<std::mutex> &lock);
+
+    /**
+     * Deallocates the given extent in the store file (FALLOC_FL_PUNCH_HOLE),
+     * so the filesystem can reclaim its space.
+     */
+    void punchHole(uint32_t startingDiskBlockNum, uint32_t N);
+
     /**
      * Either creates a new store file, or initialises from an existing one.
      */
@@ -235,7 +550,8 @@ private:
     void writeHeader();
 
     /**
-     * Reads BAT from file and updates local copy (this->BAT).
+     * Reads BAT (and its keys, from the key heap) from file
+     * and updates local copy (this->BAT).
      */
     void readBAT();
 
@@ -244,6 +560,101 @@ private:
      */
     void writeBAT();
 
+    /**
+     * Writes BAT entries `entryIndices` of the local BAT out to disk,
+     * and syncs them.
+     */
+    void writeBATEntries(std::vector<uint32_t> &entryIndices);
+
+    /**
+     * Adds new key `key` to the BAT's key arena and writes it out to the
+     * key heap, compacting the heap first if it's full. Returns its reference.
+     */
+    KeyRef addKey(const std::string &key);
+
+    /**
+     * Writes the BAT's key arena, from `arenaOffset` bytes into it onwards,
+     * out to the key heap, and syncs it.
+     */
+    void writeKeyHeap(uint32_t arenaOffset);
+
+    /**
+     * Drops the keys of removed entries from the key heap, rewriting
+     * the heap and the BAT as one journaled write.
+     */
+    void compactKeyHeap();
+
+    /**
+     * Writes the packed extent `buffer` for the given key, re-using
+     * its existing extent if it fits. Expects `storageMutex` held.
+     * 
+     * NOTE: a moved extent is allocated `reserveN` disk blocks past its
+     *       data if they're free (see extentReserves).
+     */
+    void writeExtent(std::string key, std::vector<unsigned char> &buffer, uint32_t reserveN);
+
+    /**
+     * Overwrites the extent of existing BAT entry `batEntry` in place,
+     * from `dataOffset` bytes into it onwards, with `buffer`.
+     * 
+     * NOTE: the extent's allocated disk blocks must fit the result.
+     *       Those past its end are kept if `keepReserve`, else freed.
+     */
+    void overwriteInPlace(
+        std::vector<BATEntry>::iterator batEntry, 
+        std::vector<unsigned char> &buffer,
+        uint32_t dataOffset,
+        bool keepReserve);
+
+    /**
+     * Returns the block numbers stored in the extent of BAT entry `batEntry`.
+     */
+    std::vector<uint32_t> readBlockNums(std::vector<BATEntry>::iterator batEntry, uint32_t dataBlockSize);
+
+    /**
+     * Applies `writes` to the extent of existing BAT entry `batEntry` in place,
+     * leaving it `numTotalBytes` bytes long.
+     * 
+     * NOTE: the extent's allocated disk blocks must fit the result.
+     *       Those past its end are kept if `keepReserve`, else freed.
+     */
+    void writeInPlace(
+        std::vector<BATEntry>::iterator batEntry,
+        std::vector<ExtentWrite> &writes,
+        uint32_t numTotalBytes,
+        bool keepReserve);
+
+    /**
+     * Durably writes a journal record for in-place `writes`.
+     */
+    void writeJournal(
+        uint32_t magicNumber,
+        uint32_t keyHash,
+        uint32_t startingDiskBlockNum,
+        uint32_t numTotalBytes,
+        std::vector<ExtentWrite> &writes);
+
+    /**
+     * Durably marks the journal as empty.
+     */
+    void clearJournal();
+
+    /**
+     * Re-applies a complete journal record left by an interrupted 
+     * in-place write or key heap compaction, then clears the journal.
+     */
+    void replayJournal();
+
+    /**
+     * Reads `N` bytes of the store file at `offset`.
+     */
+    std::vector<unsigned char> readAt(uint32_t offset, uint32_t N);
+
+    /**
+     * Writes `N` bytes from `data` to the store file at `offset`, and syncs.
+     */
+    void writeAndSync(uint32_t offset, const unsigned char *data, uint32_t N);
+
     /**
      * Builds up the free space map from an existing store file.
      */
@@ -273,6 +684,18 @@ namespace DiskStorageTests
     void testFragmentedWrite();
     void testMaxBlocksReached();
     void testRestoreDiskStateOnFailedWrite();
+    void testDeleteIsTombstonedUntilReclaimed();
+    void testTombstonesReclaimedOnRestart();
+    void testOverwriteReusesExtent();
+    void testJournalReplayedOnRestart();
+    void testPinnedVersionSurvivesWrites();
+    void testSequentialReadsArePrefetched();
+    void testAppendGrowsExtentInPlace();
+    void testAppendsReserveExtents();
+    void testLongKeysPersist();
+    void testKeyHeapCompactedWhenFull();
+    void testKeyHeapCompactionReplayedOnRestart();
+    void testRenameReplacesKey();
 
     void runAll();
 }
\ No newline at end of file
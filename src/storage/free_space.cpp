@@ -168,6 +168,23 @@ void FreeSpaceMap::freeNBlocks(uint32_t startBlockNum, uint32_t N)
     }
 }
 
+/**
+ * Returns true if all `N` blocks starting at block number `startBlockNum`
+ * are free (and within capacity), false otherwise.
+ */
+bool FreeSpaceMap::areNBlocksFree(uint32_t startBlockNum, uint32_t N)
+{
+    if (static_cast<uint64_t>(startBlockNum) + N > blockCapacity)
+        return false;
+
+    for (uint32_t i = startBlockNum; i < startBlockNum + N; i++)
+    {
+        if (isMapped(i))
+            return false;
+    }
+    return true;
+}
+
 /**
  * Returns true if the repective blockCapacity's and bit maps 
  * are equal, false otherwise.
@@ -342,6 +359,22 @@ namespace FreeSpaceMapTests
             ASSERT_THAT(!fsm.isMapped(i));
     }
 
+    void testAreNBlocksFree()
+    {
+        uint32_t blockCapacity = 32;
+        FreeSpaceMap fsm(blockCapacity);
+
+        fsm.allocateNBlocks(4, 6);
+
+        ASSERT_THAT(fsm.areNBlocksFree(0, 4));
+        ASSERT_THAT(!fsm.areNBlocksFree(0, 5));
+        ASSERT_THAT(!fsm.areNBlocksFree(9, 2));
+        ASSERT_THAT(fsm.areNBlocksFree(10, 22));
+
+        // past capacity
+        ASSERT_THAT(!fsm.areNBlocksFree(10, 23));
+    }
+
     void runAll()
     {
         std::cerr << "###################################" << std::endl;
@@ -351,7 +384,8 @@ namespace FreeSpaceMapTests
         std::vector<std::pair<std::string, std::function<void()>>> tests = {
             TEST(testFreeNBlocks),
             TEST(testAllocateNBlocks),
-            TEST(testAllocateThenFree)
+            TEST(testAllocateThenFree),
+            TEST(testAreNBlocksFree)
         };
 
         for (auto &[name, func] : tests)
@@ -65,6 +65,12 @@ public:
      */
     void freeNBlocks(uint32_t startBlockNum, uint32_t N);
 
+    /**
+     * Returns true if all `N` blocks starting at block number `startBlockNum`
+     * are free (and within capacity), false otherwise.
+     */
+    bool areNBlocksFree(uint32_t startBlockNum, uint32_t N);
+
     /**
      * Returns true if the given block is mapped, false if its free
      */
@@ -106,5 +112,6 @@ namespace FreeSpaceMapTests
     void testFreeNBlocks();
     void testAllocateNBlocks();
     void testAllocateThenFree();
+    void testAreNBlocksFree();
     void runAll();
 };
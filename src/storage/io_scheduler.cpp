@@ -0,0 +1,421 @@
+#include <string>
+#include <thread>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include "io_scheduler.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// IoClassStats methods
+////////////////////////////////////////////
+
+std::string IoClassStats::toString() const
+{
+    std::ostringstream oss;
+
+    oss << "queueDepth: " << queueDepth << "\n"
+        << "inFlight: " << inFlight << "\n"
+        << "dispatched: " << dispatched << "\n"
+        << "bytesDispatched: " << bytesDispatched << "\n"
+        << "deadlineMisses: " << deadlineMisses << "\n"
+        << "avgWaitUs: " << (dispatched > 0 ? totalWaitUs / dispatched : 0) << "\n"
+        << "maxWaitUs: " << maxWaitUs << "\n";
+    return oss.str();
+}
+
+////////////////////////////////////////////
+// IoScheduler::Ticket methods
+////////////////////////////////////////////
+
+IoScheduler::Ticket::Ticket(IoScheduler *scheduler, IoClass ioClass)
+    : scheduler(scheduler),
+      ioClass(ioClass)
+{
+}
+
+IoScheduler::Ticket::Ticket(Ticket &&other)
+    : scheduler(other.scheduler),
+      ioClass(other.ioClass)
+{
+    other.scheduler = nullptr;
+}
+
+IoScheduler::Ticket::~Ticket()
+{
+    if (this->scheduler != nullptr)
+        this->scheduler->release(this->ioClass);
+}
+
+////////////////////////////////////////////
+// IoScheduler methods
+////////////////////////////////////////////
+
+/* Param constructor */
+IoScheduler::IoScheduler(
+    uint32_t maxInFlight,
+    std::array<IoClassConfig, NUM_IO_CLASSES> classConfigs
+)
+    : maxInFlight(std::max(1u, maxInFlight)),
+      numInFlight(0)
+{
+    Clock::time_point now = Clock::now();
+    for (uint32_t i = 0; i < NUM_IO_CLASSES; i++)
+    {
+        this->classes[i].config = classConfigs[i];
+        this->classes[i].tokens = classConfigs[i].burstBytes;
+        this->classes[i].lastRefill = now;
+    }
+}
+
+/**
+ * Blocks until a request of class `ioClass`, costing `numBytes`
+ * bytes, may run. The request runs until the ticket is destroyed.
+ */
+IoScheduler::Ticket IoScheduler::acquire(IoClass ioClass, uint64_t numBytes)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    ClassState &state = this->classes[ioClass];
+    Clock::time_point now = Clock::now();
+
+    Waiter waiter = {numBytes, now, now + state.config.deadline, false};
+    state.queue.push_back(&waiter);
+    state.stats.queueDepth++;
+
+    dispatch(now);
+
+    while (!waiter.granted)
+    {
+        // if a class is only waiting on tokens, nothing will notify us once they refill
+        auto timeout = untilTokens();
+        if (timeout != std::nullopt)
+            this->cv.wait_for(lock, *timeout);
+        else
+            this->cv.wait(lock);
+
+        if (!waiter.granted)
+            dispatch(Clock::now());
+    }
+
+    return Ticket(this, ioClass);
+}
+
+/**
+ * Returns the metrics of class `ioClass`.
+ */
+IoClassStats IoScheduler::stats(IoClass ioClass)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->classes[ioClass].stats;
+}
+
+/**
+ * Returns the metrics of every class, as text.
+ */
+std::string IoScheduler::statsString()
+{
+    std::ostringstream oss;
+    for (uint32_t i = 0; i < NUM_IO_CLASSES; i++)
+    {
+        IoClass ioClass = static_cast<IoClass>(i);
+        oss << "[" << className(ioClass) << "]\n" << stats(ioClass).toString();
+    }
+    return oss.str();
+}
+
+/**
+ * Returns the default class parameters.
+ */
+std::array<IoClassConfig, NUM_IO_CLASSES> IoScheduler::defaultClassConfigs()
+{
+    std::array<IoClassConfig, NUM_IO_CLASSES> configs;
+
+    configs[IO_CLASS_INTERACTIVE] = {0, 0, std::chrono::milliseconds(10)};
+    configs[IO_CLASS_SYNC] = {32u << 20, 4u << 20, std::chrono::milliseconds(500)};
+    configs[IO_CLASS_REBALANCE] = {64u << 20, 8u << 20, std::chrono::milliseconds(1000)};
+    configs[IO_CLASS_BACKGROUND] = {16u << 20, 4u << 20, std::chrono::milliseconds(5000)};
+
+    return configs;
+}
+
+/**
+ * Returns the name of class `ioClass`.
+ */
+std::string IoScheduler::className(IoClass ioClass)
+{
+    switch (ioClass)
+    {
+        case IO_CLASS_INTERACTIVE: return "interactive";
+        case IO_CLASS_SYNC: return "sync";
+        case IO_CLASS_REBALANCE: return "rebalance";
+        case IO_CLASS_BACKGROUND: return "background";
+        default: return "unknown";
+    }
+}
+
+/**
+ * Dispatches queued requests while slots are free. Expects `mutex` held.
+ */
+void IoScheduler::dispatch(Clock::time_point now)
+{
+    // refill token buckets
+    for (ClassState &state : this->classes)
+    {
+        if (state.config.bytesPerSec == 0)
+            continue;
+
+        double elapsed = std::chrono::duration<double>(now - state.lastRefill).count();
+        state.tokens = std::min<double>(state.config.burstBytes, state.tokens + elapsed * state.config.bytesPerSec);
+        state.lastRefill = now;
+    }
+
+    bool dispatched = false;
+    while (this->numInFlight < this->maxInFlight)
+    {
+        ClassState *chosen = nullptr;
+
+        // overdue requests first, earliest deadline first
+        for (ClassState &state : this->classes)
+        {
+            if (state.queue.empty() || !hasTokens(state, state.queue.front()->numBytes))
+                continue;
+
+            Clock::time_point deadline = state.queue.front()->deadline;
+            if (deadline <= now && (chosen == nullptr || deadline < chosen->queue.front()->deadline))
+                chosen = &state;
+        }
+
+        // otherwise, highest priority first
+        for (ClassState &state : this->classes)
+        {
+            if (chosen != nullptr)
+                break;
+            if (!state.queue.empty() && hasTokens(state, state.queue.front()->numBytes))
+                chosen = &state;
+        }
+
+        if (chosen == nullptr)
+            break;
+
+        Waiter *waiter = chosen->queue.front();
+        chosen->queue.pop_front();
+        waiter->granted = true;
+
+        this->numInFlight++;
+        if (chosen->config.bytesPerSec > 0)
+            chosen->tokens -= waiter->numBytes;
+
+        uint64_t waitUs = std::chrono::duration_cast<std::chrono::microseconds>(now - waiter->enqueueTime).count();
+        IoClassStats &stats = chosen->stats;
+        stats.queueDepth--;
+        stats.inFlight++;
+        stats.dispatched++;
+        stats.bytesDispatched += waiter->numBytes;
+        stats.totalWaitUs += waitUs;
+        stats.maxWaitUs = std::max(stats.maxWaitUs, waitUs);
+        if (now > waiter->deadline)
+            stats.deadlineMisses++;
+
+        dispatched = true;
+    }
+
+    if (dispatched)
+        this->cv.notify_all();
+}
+
+/**
+ * Returns true if the class's bucket holds enough tokens for a request
+ * of `numBytes` bytes. Expects `mutex` held.
+ *
+ * NOTE:
+ *
+ * Requests larger than the bucket only need a full bucket, and
+ * leave it in debt, so they're never blocked forever.
+ */
+bool IoScheduler::hasTokens(ClassState &state, uint64_t numBytes)
+{
+    if (state.config.bytesPerSec == 0)
+        return true;
+    return state.tokens >= std::min(numBytes, state.config.burstBytes);
+}
+
+/**
+ * Returns how long until a class blocked only by its token bucket
+ * can dispatch, if any are. Expects `mutex` held.
+ */
+std::optional<IoScheduler::Clock::duration> IoScheduler::untilTokens()
+{
+    std::optional<Clock::duration> minWait;
+    for (ClassState &state : this->classes)
+    {
+        if (state.queue.empty() || hasTokens(state, state.queue.front()->numBytes))
+            continue;
+
+        double needed = std::min(state.queue.front()->numBytes, state.config.burstBytes) - state.tokens;
+        auto wait = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(needed / state.config.bytesPerSec)
+        ) + std::chrono::milliseconds(1);
+
+        if (minWait == std::nullopt || wait < *minWait)
+            minWait = wait;
+    }
+    return minWait;
+}
+
+/**
+ * Releases a slot of class `ioClass`, dispatching the next request.
+ */
+void IoScheduler::release(IoClass ioClass)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    this->numInFlight--;
+    this->classes[ioClass].stats.inFlight--;
+
+    dispatch(Clock::now());
+}
+
+////////////////////////////////////////////
+// IoScheduler tests
+////////////////////////////////////////////
+namespace IoSchedulerTests
+{
+    /**
+     * Returns class parameters with no rate limits and long deadlines.
+     */
+    std::array<IoClassConfig, NUM_IO_CLASSES> unlimitedClassConfigs()
+    {
+        std::array<IoClassConfig, NUM_IO_CLASSES> configs;
+        for (IoClassConfig &config : configs)
+            config = {0, 0, std::chrono::milliseconds(10000)};
+        return configs;
+    }
+
+    /**
+     * Waits (up to 1s) for `numQueued` requests of class `ioClass` to be queued.
+     */
+    void waitForQueued(IoScheduler &scheduler, IoClass ioClass, uint64_t numQueued)
+    {
+        for (int i = 0; i < 1000 && scheduler.stats(ioClass).queueDepth < numQueued; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    /**
+     * Queues a background then an interactive request behind a held slot,
+     * and returns the order they were dispatched in.
+     */
+    std::vector<IoClass> dispatchOrder(IoScheduler &scheduler, std::chrono::milliseconds gap)
+    {
+        std::vector<IoClass> order;
+        std::mutex orderMutex;
+
+        auto runRequest = [&](IoClass ioClass) {
+            IoScheduler::Ticket ticket = scheduler.acquire(ioClass, 1);
+            std::lock_guard<std::mutex> lock(orderMutex);
+            order.push_back(ioClass);
+        };
+
+        std::optional<IoScheduler::Ticket> held(scheduler.acquire(IO_CLASS_INTERACTIVE, 1));
+
+        std::thread background(runRequest, IO_CLASS_BACKGROUND);
+        waitForQueued(scheduler, IO_CLASS_BACKGROUND, 1);
+        std::this_thread::sleep_for(gap);
+
+        std::thread interactive(runRequest, IO_CLASS_INTERACTIVE);
+        waitForQueued(scheduler, IO_CLASS_INTERACTIVE, 1);
+
+        held.reset();
+        background.join();
+        interactive.join();
+
+        return order;
+    }
+
+    void testHigherPriorityDispatchedFirst()
+    {
+        IoScheduler scheduler(1, unlimitedClassConfigs());
+
+        std::vector<IoClass> order = dispatchOrder(scheduler, std::chrono::milliseconds(0));
+        ASSERT_THAT(order == std::vector<IoClass>({IO_CLASS_INTERACTIVE, IO_CLASS_BACKGROUND}));
+    }
+
+    void testOverdueRequestDispatchedFirst()
+    {
+        auto configs = unlimitedClassConfigs();
+        configs[IO_CLASS_BACKGROUND].deadline = std::chrono::milliseconds(20);
+        IoScheduler scheduler(1, configs);
+
+        // background request is past its deadline by the time the slot frees
+        std::vector<IoClass> order = dispatchOrder(scheduler, std::chrono::milliseconds(50));
+        ASSERT_THAT(order == std::vector<IoClass>({IO_CLASS_BACKGROUND, IO_CLASS_INTERACTIVE}));
+        ASSERT_THAT(scheduler.stats(IO_CLASS_BACKGROUND).deadlineMisses == 1);
+    }
+
+    void testTokenBucketLimitsBandwidth()
+    {
+        auto configs = unlimitedClassConfigs();
+        configs[IO_CLASS_SYNC] = {10000, 1000, std::chrono::milliseconds(10000)};
+        IoScheduler scheduler(4, configs);
+
+        // first request uses up the (full) bucket
+        scheduler.run(IO_CLASS_SYNC, 1000, []() {});
+
+        // so the next waits ~100ms for it to refill at 10000 bytes/s
+        auto start = std::chrono::steady_clock::now();
+        scheduler.run(IO_CLASS_SYNC, 1000, []() {});
+        auto waited = std::chrono::steady_clock::now() - start;
+
+        ASSERT_THAT(waited >= std::chrono::milliseconds(80));
+        ASSERT_THAT(scheduler.stats(IO_CLASS_SYNC).maxWaitUs >= 80000);
+
+        // other classes aren't held up
+        start = std::chrono::steady_clock::now();
+        scheduler.run(IO_CLASS_INTERACTIVE, 1000, []() {});
+        ASSERT_THAT(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(50));
+    }
+
+    void testStatsTrackQueueing()
+    {
+        IoScheduler scheduler(1, unlimitedClassConfigs());
+
+        int result = scheduler.run(IO_CLASS_REBALANCE, 500, []() { return 7; });
+        ASSERT_THAT(result == 7);
+
+        {
+            IoScheduler::Ticket ticket = scheduler.acquire(IO_CLASS_REBALANCE, 100);
+            IoClassStats stats = scheduler.stats(IO_CLASS_REBALANCE);
+            ASSERT_THAT(stats.inFlight == 1);
+            ASSERT_THAT(stats.dispatched == 2);
+            ASSERT_THAT(stats.bytesDispatched == 600);
+        }
+
+        IoClassStats stats = scheduler.stats(IO_CLASS_REBALANCE);
+        ASSERT_THAT(stats.inFlight == 0);
+        ASSERT_THAT(stats.queueDepth == 0);
+        ASSERT_THAT(scheduler.stats(IO_CLASS_INTERACTIVE).dispatched == 0);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "IoSchedulerTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testHigherPriorityDispatchedFirst),
+            TEST(testOverdueRequestDispatchedFirst),
+            TEST(testTokenBucketLimitsBandwidth),
+            TEST(testStatsTrackQueueing)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <optional>
+#include <condition_variable>
+
+/**
+ * I/O priority classes, highest priority first.
+ */
+enum IoClass : uint32_t
+{
+    /* Foreground GET/PUT/DEL requests */
+    IO_CLASS_INTERACTIVE = 0,
+
+    /* Master's /sync of this node's keys */
+    IO_CLASS_SYNC,
+
+    /* Rebalancing transfers (/range) */
+    IO_CLASS_REBALANCE,
+
+    /* Scrub, compaction and other housekeeping */
+    IO_CLASS_BACKGROUND,
+
+    NUM_IO_CLASSES
+};
+
+/**
+ * Scheduling parameters of a single I/O class.
+ */
+struct IoClassConfig
+{
+    /* Token bucket refill rate. 0 means unlimited. */
+    uint64_t bytesPerSec = 0;
+
+    /* Token bucket capacity, i.e. the largest burst allowed */
+    uint64_t burstBytes = 0;
+
+    /* Max. time a request should wait before it's dispatched ahead of higher priorities */
+    std::chrono::milliseconds deadline = std::chrono::milliseconds(1000);
+};
+
+/**
+ * Per-class scheduler metrics.
+ */
+struct IoClassStats
+{
+    /* num. requests currently waiting / dispatched */
+    uint64_t queueDepth = 0;
+    uint64_t inFlight = 0;
+
+    uint64_t dispatched = 0;
+    uint64_t bytesDispatched = 0;
+
+    /* num. requests dispatched after their deadline */
+    uint64_t deadlineMisses = 0;
+
+    /* time spent queued, in microseconds */
+    uint64_t totalWaitUs = 0;
+    uint64_t maxWaitUs = 0;
+
+    std::string toString() const;
+};
+
+/**
+ * Schedules the storage node's I/O requests by priority class.
+ *
+ * NOTE:
+ *
+ * At most `maxInFlight` requests run at once. Whenever a slot frees up,
+ * the next request dispatched is:
+ *
+ *      1. the queued request with the earliest deadline, if any are past
+ *         their deadline (so lower classes are never starved), otherwise
+ *      2. the oldest request of the highest priority class
+ *
+ * skipping classes whose token bucket doesn't hold enough tokens for their
+ * next request, which caps each class's bandwidth at its `bytesPerSec`.
+ */
+class IoScheduler
+{
+public:
+    /**
+     * RAII handle of a dispatched request. The request's slot
+     * is released when the ticket is destroyed.
+     */
+    class Ticket
+    {
+    public:
+        Ticket(IoScheduler *scheduler, IoClass ioClass);
+        Ticket(Ticket &&other);
+        Ticket(const Ticket &) = delete;
+        Ticket &operator=(const Ticket &) = delete;
+        ~Ticket();
+
+    private:
+        IoScheduler *scheduler;
+        IoClass ioClass;
+    };
+
+    /* Param constructor */
+    IoScheduler(
+        uint32_t maxInFlight = 4,
+        std::array<IoClassConfig, NUM_IO_CLASSES> classConfigs = defaultClassConfigs()
+    );
+
+    /**
+     * Blocks until a request of class `ioClass`, costing `numBytes`
+     * bytes, may run. The request runs until the ticket is destroyed.
+     */
+    Ticket acquire(IoClass ioClass, uint64_t numBytes);
+
+    /**
+     * Runs `fn` as a request of class `ioClass` costing `numBytes` bytes,
+     * returning its result.
+     */
+    template<typename F>
+    auto run(IoClass ioClass, uint64_t numBytes, F fn) -> decltype(fn())
+    {
+        Ticket ticket = acquire(ioClass, numBytes);
+        return fn();
+    }
+
+    /**
+     * Returns the metrics of class `ioClass`.
+     */
+    IoClassStats stats(IoClass ioClass);
+
+    /**
+     * Returns the metrics of every class, as text.
+     */
+    std::string statsString();
+
+    /**
+     * Returns the default class parameters: interactive requests are
+     * unlimited with a tight deadline, background classes are rate limited.
+     */
+    static std::array<IoClassConfig, NUM_IO_CLASSES> defaultClassConfigs();
+
+    /**
+     * Returns the name of class `ioClass`.
+     */
+    static std::string className(IoClass ioClass);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * A queued request.
+     */
+    struct Waiter
+    {
+        uint64_t numBytes;
+        Clock::time_point enqueueTime;
+        Clock::time_point deadline;
+        bool granted;
+    };
+
+    /**
+     * State of a single class.
+     */
+    struct ClassState
+    {
+        IoClassConfig config;
+        std::deque<Waiter*> queue;
+
+        /* token bucket */
+        double tokens;
+        Clock::time_point lastRefill;
+
+        IoClassStats stats;
+    };
+
+    uint32_t maxInFlight;
+    uint32_t numInFlight;
+    std::array<ClassState, NUM_IO_CLASSES> classes;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    /**
+     * Dispatches queued requests while slots are free. Expects `mutex` held.
+     */
+    void dispatch(Clock::time_point now);
+
+    /**
+     * Returns true if class `ioClass`'s bucket holds enough tokens for a
+     * request of `numBytes` bytes. Expects `mutex` held.
+     */
+    bool hasTokens(ClassState &state, uint64_t numBytes);
+
+    /**
+     * Returns how long until a class blocked only by its token bucket
+     * can dispatch, if any are. Expects `mutex` held.
+     */
+    std::optional<Clock::duration> untilTokens();
+
+    /**
+     * Releases a slot of class `ioClass`, dispatching the next request.
+     */
+    void release(IoClass ioClass);
+};
+
+namespace IoSchedulerTests
+{
+    void testHigherPriorityDispatchedFirst();
+    void testOverdueRequestDispatchedFirst();
+    void testTokenBucketLimitsBandwidth();
+    void testStatsTrackQueueing();
+    void runAll();
+}
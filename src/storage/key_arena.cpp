@@ -0,0 +1,166 @@
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "key_arena.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// KeyRef methods
+////////////////////////////////////////////
+
+bool KeyRef::equals(const KeyRef &other) const
+{
+    return offset == other.offset && length == other.length;
+}
+
+////////////////////////////////////////////
+// KeyArena methods
+////////////////////////////////////////////
+
+/* Default constructor */
+KeyArena::KeyArena()
+{
+}
+
+/**
+ * Appends key `key` to the arena, returning its reference.
+ */
+KeyRef KeyArena::add(std::string_view key)
+{
+    KeyRef ref = {static_cast<uint32_t>(this->buffer.size()), static_cast<uint32_t>(key.size())};
+    this->buffer.insert(this->buffer.end(), key.begin(), key.end());
+    return ref;
+}
+
+/**
+ * Returns the key referenced by `ref`.
+ *
+ * Throws:
+ *      runtime_error() - if `ref` lies outside the arena
+ */
+std::string_view KeyArena::get(const KeyRef &ref) const
+{
+    if (static_cast<uint64_t>(ref.offset) + ref.length > this->buffer.size())
+        throw std::runtime_error("KeyArena::get() - key reference out of bounds");
+
+    return std::string_view(this->buffer.data() + ref.offset, ref.length);
+}
+
+/**
+ * Repacks the keys referenced by `refs` to the front of
+ * the arena, dropping all others.
+ */
+void KeyArena::compact(const std::vector<KeyRef*> &refs)
+{
+    std::vector<char> packed;
+    for (KeyRef *ref : refs)
+    {
+        std::string_view key = get(*ref);
+        ref->offset = packed.size();
+        packed.insert(packed.end(), key.begin(), key.end());
+    }
+    this->buffer = std::move(packed);
+}
+
+/**
+ * Replaces the arena's contents with `bytes`.
+ */
+void KeyArena::assign(std::vector<char> bytes)
+{
+    this->buffer = std::move(bytes);
+}
+
+/**
+ * Returns the arena's raw bytes.
+ */
+const char *KeyArena::data() const
+{
+    return this->buffer.data();
+}
+
+/**
+ * Returns num. bytes used by the arena.
+ */
+uint32_t KeyArena::size() const
+{
+    return this->buffer.size();
+}
+
+////////////////////////////////////////////
+// KeyArena tests
+////////////////////////////////////////////
+namespace KeyArenaTests
+{
+    void testAddAndGetKeys()
+    {
+        KeyArena arena;
+
+        KeyRef a = arena.add("archive.zip");
+        KeyRef b = arena.add("");
+        KeyRef c = arena.add(std::string(300, 'k'));
+
+        // keys are packed without padding
+        ASSERT_THAT(arena.size() == 11 + 300);
+        ASSERT_THAT(a.offset == 0 && a.length == 11);
+        ASSERT_THAT(b.offset == 11 && b.length == 0);
+        ASSERT_THAT(c.offset == 11 && c.length == 300);
+
+        ASSERT_THAT(arena.get(a) == "archive.zip");
+        ASSERT_THAT(arena.get(b) == "");
+        ASSERT_THAT(arena.get(c) == std::string(300, 'k'));
+
+        // references outside the arena are rejected
+        try
+        {
+            arena.get({300, 12});
+            FORCE_FAIL("out of bounds reference should throw");
+        }
+        catch (std::runtime_error &e)
+        {
+        }
+    }
+
+    void testCompactKeepsReferencedKeys()
+    {
+        KeyArena arena;
+
+        KeyRef a = arena.add("first");
+        arena.add("second");
+        KeyRef c = arena.add("third");
+
+        // drop "second"
+        arena.compact({&a, &c});
+
+        ASSERT_THAT(arena.size() == 10);
+        ASSERT_THAT(a.offset == 0 && c.offset == 5);
+        ASSERT_THAT(arena.get(a) == "first");
+        ASSERT_THAT(arena.get(c) == "third");
+
+        // persisted bytes restore the same keys
+        KeyArena restored;
+        restored.assign(std::vector<char>(arena.data(), arena.data() + arena.size()));
+        ASSERT_THAT(restored.get(c) == "third");
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "KeyArenaTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testAddAndGetKeys),
+            TEST(testCompactKeepsReferencedKeys)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
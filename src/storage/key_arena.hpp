@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <string_view>
+
+/**
+ * Reference to a key stored in a KeyArena.
+ */
+struct __attribute__((packed)) KeyRef
+{
+    uint32_t offset;
+    uint32_t length;
+
+    bool equals(const KeyRef &other) const;
+};
+
+/**
+ * Append-only buffer of variable-length keys, each referenced
+ * by its offset and length (see KeyRef).
+ *
+ * NOTE:
+ *
+ * Keys are packed back to back with no padding or terminators, so the
+ * arena's bytes can be persisted as-is (see DiskStorage's key heap).
+ * Space of removed keys is only recovered by compact().
+ */
+class KeyArena
+{
+public:
+    /* Default constructor */
+    KeyArena();
+
+    /**
+     * Appends key `key` to the arena, returning its reference.
+     */
+    KeyRef add(std::string_view key);
+
+    /**
+     * Returns the key referenced by `ref`.
+     *
+     * NOTE: the view is invalidated by any later add(), assign() or compact().
+     */
+    std::string_view get(const KeyRef &ref) const;
+
+    /**
+     * Repacks the keys referenced by `refs` to the front of the
+     * arena, in order, dropping all others and updating each reference.
+     */
+    void compact(const std::vector<KeyRef*> &refs);
+
+    /**
+     * Replaces the arena's contents with `bytes` (e.g. read back from disk).
+     */
+    void assign(std::vector<char> bytes);
+
+    /**
+     * Returns the arena's raw bytes.
+     */
+    const char *data() const;
+
+    /**
+     * Returns num. bytes used by the arena.
+     */
+    uint32_t size() const;
+
+private:
+    std::vector<char> buffer;
+};
+
+namespace KeyArenaTests
+{
+    void testAddAndGetKeys();
+    void testCompactKeepsReferencedKeys();
+    void runAll();
+}
@@ -0,0 +1,489 @@
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+
+#include "memory_storage.hpp"
+
+#include "utils.hpp"
+#include "block.hpp"
+#include "free_space.hpp"
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// MemoryStorage - public methods
+////////////////////////////////////////////
+
+/* Param constructor */
+MemoryStorage::MemoryStorage(
+    uint32_t arenaBlockSize,
+    uint32_t maxDataSize
+)
+    : arenaBlockSize(arenaBlockSize),
+      maxDataSize(maxDataSize),
+      arena(new unsigned char[maxDataSize]),
+      usedSize(0)
+{
+    freeSpaceMap.initialise(getNumArenaBlocks(maxDataSize));
+}
+
+/**
+ * Retreive blocks `requestedBlockNums` of key `key`.
+ *
+ * NOTE:
+ *
+ * The key's extent is copied into `readBuffer` under a shared lock,
+ * so a concurrent overwrite can never tear a read.
+ */
+std::vector<Block> MemoryStorage::readBlocks(
+    std::string key,
+    std::unordered_set<uint32_t> requestedBlockNums,
+    uint32_t dataBlockSize,
+    std::vector<unsigned char> &readBuffer)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(this->mutex);
+
+        auto it = this->extents.find(key);
+        if (it == this->extents.end())
+            throw std::runtime_error("readBlocks() - no extent found for given key: " + key);
+
+        MemoryExtent &extent = it->second;
+        unsigned char *start = arenaBlockPtr(extent.startingArenaBlockNum);
+        readBuffer.assign(start, start + extent.numBytes);
+    }
+
+    return unpackBlocks(key, requestedBlockNums, dataBlockSize, readBuffer);
+}
+
+/**
+ * Write the given blocks for the given key.
+ *
+ * NOTE:
+ *
+ * If `key` already exists, we overwrite its existing extent,
+ * in place if the new blocks fit.
+ */
+void MemoryStorage::writeBlocks(std::string key, std::vector<Block> dataBlocks)
+{
+    if (dataBlocks.size() == 0)
+        throw std::runtime_error("writeBlocks() - no data blocks given");
+
+    std::vector<unsigned char> buffer = packBlocks(dataBlocks);
+    if (buffer.size() != packedSize(dataBlocks))
+        throw std::runtime_error("writeBlocks() - bad copy of data blocks to output buffer");
+
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    writeExtent(key, buffer);
+}
+
+/**
+ * Append the given blocks to the given key's blocks.
+ *
+ * NOTE:
+ *
+ * The key's extent is grown in place if the arena blocks directly
+ * after it are free, otherwise it is moved.
+ */
+void MemoryStorage::appendBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize)
+{
+    if (dataBlocks.size() == 0)
+        throw std::runtime_error("appendBlocks() - no data blocks given");
+
+    std::vector<unsigned char> buffer = packBlocks(dataBlocks);
+    if (buffer.size() != packedSize(dataBlocks))
+        throw std::runtime_error("appendBlocks() - bad copy of data blocks to output buffer");
+
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+
+    auto existing = this->extents.find(key);
+    if (existing == this->extents.end())
+    {
+        writeExtent(key, buffer);
+        return;
+    }
+
+    MemoryExtent &extent = existing->second;
+    unsigned char *start = arenaBlockPtr(extent.startingArenaBlockNum);
+
+    uint32_t tailBlockNum;
+    std::memcpy(&tailBlockNum, start + tailBlockOffset(extent.numBytes, dataBlockSize), sizeof(tailBlockNum));
+
+    uint32_t keepBytes = appendOffset(extent.numBytes, tailBlockNum, dataBlocks, dataBlockSize, [&]()
+    {
+        std::vector<unsigned char> stored(start, start + extent.numBytes);
+        return unpackBlockNums(dataBlockSize, stored);
+    });
+    uint32_t numTotalBytes = keepBytes + buffer.size();
+
+    uint32_t oldN = getNumArenaBlocks(extent.numBytes);
+    uint32_t N = getNumArenaBlocks(numTotalBytes);
+
+    // grow in place
+    if (N <= oldN || freeSpaceMap.areNBlocksFree(extent.startingArenaBlockNum + oldN, N - oldN))
+    {
+        if (N > oldN)
+            freeSpaceMap.allocateNBlocks(extent.startingArenaBlockNum + oldN, N - oldN);
+        else if (N < oldN)
+            freeSpaceMap.freeNBlocks(extent.startingArenaBlockNum + N, oldN - N);
+
+        std::memcpy(start + keepBytes, buffer.data(), buffer.size());
+
+        this->usedSize = this->usedSize - extent.numBytes + numTotalBytes;
+        extent.numBytes = numTotalBytes;
+        return;
+    }
+
+    // no room to grow, so move to a new extent
+    std::vector<unsigned char> newExtent(start, start + keepBytes);
+    newExtent.insert(newExtent.end(), buffer.begin(), buffer.end());
+    writeExtent(key, newExtent);
+}
+
+/**
+ * Replace the given blocks of the given key's blocks.
+ *
+ * NOTE:
+ *
+ * Blocks are written over their existing records in place, unless
+ * a grown tail block no longer fits the extent, in which case it is moved.
+ */
+void MemoryStorage::updateBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize)
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+
+    auto existing = this->extents.find(key);
+    if (existing == this->extents.end())
+        throw std::runtime_error("updateBlocks() - no extent found for given key: " + key);
+
+    MemoryExtent &extent = existing->second;
+    unsigned char *start = arenaBlockPtr(extent.startingArenaBlockNum);
+
+    std::vector<unsigned char> extentBuffer(start, start + extent.numBytes);
+    std::vector<uint32_t> storedBlockNums = unpackBlockNums(dataBlockSize, extentBuffer);
+    std::vector<uint32_t> offsets = updateOffsets(storedBlockNums, dataBlocks, dataBlockSize);
+
+    // only an updated tail block changes the extent's size
+    uint32_t numTotalBytes = extent.numBytes;
+    uint32_t tailOffset = tailBlockOffset(extent.numBytes, dataBlockSize);
+    for (size_t i = 0; i < dataBlocks.size(); i++)
+    {
+        if (offsets[i] == tailOffset)
+            numTotalBytes = tailOffset + sizeof(uint32_t) + dataBlocks[i].dataSize;
+    }
+
+    uint32_t oldN = getNumArenaBlocks(extent.numBytes);
+    uint32_t N = getNumArenaBlocks(numTotalBytes);
+
+    // update in place
+    if (N <= oldN)
+    {
+        for (size_t i = 0; i < dataBlocks.size(); i++)
+            std::copy(dataBlocks[i].dataStart, dataBlocks[i].dataEnd, start + offsets[i] + sizeof(uint32_t));
+        if (N < oldN)
+            freeSpaceMap.freeNBlocks(extent.startingArenaBlockNum + N, oldN - N);
+
+        this->usedSize = this->usedSize - extent.numBytes + numTotalBytes;
+        extent.numBytes = numTotalBytes;
+        return;
+    }
+
+    // tail block outgrew the extent, so move to a new extent
+    extentBuffer.resize(numTotalBytes);
+    for (size_t i = 0; i < dataBlocks.size(); i++)
+        std::copy(dataBlocks[i].dataStart, dataBlocks[i].dataEnd, extentBuffer.begin() + offsets[i] + sizeof(uint32_t));
+    writeExtent(key, extentBuffer);
+}
+
+/**
+ * Frees the extent of the given `key`.
+ */
+void MemoryStorage::deleteBlocks(std::string key)
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+
+    auto it = this->extents.find(key);
+    if (it == this->extents.end())
+        throw std::runtime_error("deleteBlocks() - no extent exists for key: " + key);
+
+    MemoryExtent &extent = it->second;
+    freeSpaceMap.freeNBlocks(extent.startingArenaBlockNum, getNumArenaBlocks(extent.numBytes));
+
+    this->usedSize -= extent.numBytes;
+    this->extents.erase(it);
+}
+
+/**
+ * Frees the extents of all given `keys`, skipping keys that don't exist.
+ */
+void MemoryStorage::deleteKeys(std::vector<std::string> keys)
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+
+    for (std::string &key : keys)
+    {
+        auto it = this->extents.find(key);
+        if (it == this->extents.end())
+            continue;
+
+        MemoryExtent &extent = it->second;
+        freeSpaceMap.freeNBlocks(extent.startingArenaBlockNum, getNumArenaBlocks(extent.numBytes));
+
+        this->usedSize -= extent.numBytes;
+        this->extents.erase(it);
+    }
+}
+
+/**
+ * Moves the extent of `fromKey` to `toKey`, freeing any extent `toKey` had.
+ */
+void MemoryStorage::renameKey(std::string fromKey, std::string toKey)
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+
+    auto from = this->extents.find(fromKey);
+    if (from == this->extents.end())
+        throw std::runtime_error("renameKey() - no extent exists for key: " + fromKey);
+
+    MemoryExtent extent = from->second;
+    this->extents.erase(from);
+
+    auto to = this->extents.find(toKey);
+    if (to != this->extents.end())
+    {
+        freeSpaceMap.freeNBlocks(to->second.startingArenaBlockNum, getNumArenaBlocks(to->second.numBytes));
+        this->usedSize -= to->second.numBytes;
+    }
+
+    this->extents[toKey] = extent;
+}
+
+/**
+ * Returns keys this engine stores.
+ */
+std::vector<std::string> MemoryStorage::getKeys()
+{
+    std::shared_lock<std::shared_mutex> lock(this->mutex);
+
+    std::vector<std::string> keys;
+    keys.reserve(this->extents.size());
+    for (auto &p : this->extents)
+        keys.push_back(p.first);
+
+    return keys;
+}
+
+/**
+ * Returns block numbers this engine stores for the
+ * given key `key`.
+ */
+std::vector<uint32_t> MemoryStorage::getBlockNums(std::string key, uint32_t dataBlockSize)
+{
+    std::vector<unsigned char> extentBuffer;
+    {
+        std::shared_lock<std::shared_mutex> lock(this->mutex);
+
+        auto it = this->extents.find(key);
+        if (it == this->extents.end())
+            throw std::runtime_error("getBlockNums() - no extent found for given key: " + key);
+
+        unsigned char *start = arenaBlockPtr(it->second.startingArenaBlockNum);
+        extentBuffer.assign(start, start + it->second.numBytes);
+    }
+
+    return unpackBlockNums(dataBlockSize, extentBuffer);
+}
+
+/**
+ * Returns #bytes used of data section
+ */
+uint32_t MemoryStorage::dataUsedSize()
+{
+    std::shared_lock<std::shared_mutex> lock(this->mutex);
+    return this->usedSize;
+}
+
+uint32_t MemoryStorage::dataTotalSize()
+{
+    return this->maxDataSize;
+}
+
+/**
+ * Returns number of arena blocks `numDataBytes` bytes takes up.
+ */
+uint32_t MemoryStorage::getNumArenaBlocks(uint32_t numDataBytes)
+{
+    return MathUtils::ceilDiv(numDataBytes, this->arenaBlockSize);
+}
+
+////////////////////////////////////////////
+// MemoryStorage - private methods
+////////////////////////////////////////////
+
+/**
+ * Returns pointer to the start of arena block `arenaBlockNum`.
+ */
+unsigned char* MemoryStorage::arenaBlockPtr(uint32_t arenaBlockNum)
+{
+    return this->arena.get() + (static_cast<size_t>(arenaBlockNum) * this->arenaBlockSize);
+}
+
+/**
+ * Writes the packed extent `buffer` for the given key.
+ *
+ * NOTE:
+ *
+ * If `key` already exists, we overwrite its existing extent,
+ * in place if the new blocks fit.
+ */
+void MemoryStorage::writeExtent(std::string key, std::vector<unsigned char> &buffer)
+{
+    uint32_t numTotalBytes = buffer.size();
+    uint32_t N = getNumArenaBlocks(numTotalBytes);
+
+    /**
+     * If the new extent fits in the existing one, re-use it
+     * and free any arena blocks left over at its end.
+     */
+    auto existing = this->extents.find(key);
+    if (existing != this->extents.end())
+    {
+        MemoryExtent &extent = existing->second;
+        uint32_t oldN = getNumArenaBlocks(extent.numBytes);
+        if (N <= oldN)
+        {
+            std::memcpy(arenaBlockPtr(extent.startingArenaBlockNum), buffer.data(), numTotalBytes);
+            if (N < oldN)
+                freeSpaceMap.freeNBlocks(extent.startingArenaBlockNum + N, oldN - N);
+
+            this->usedSize = this->usedSize - extent.numBytes + numTotalBytes;
+            extent.numBytes = numTotalBytes;
+            return;
+        }
+    }
+
+    /**
+     * Free the existing extent first, so its space can be re-used
+     * by the new one. Restored if the new allocation fails.
+     */
+    if (existing != this->extents.end())
+        freeSpaceMap.freeNBlocks(existing->second.startingArenaBlockNum, getNumArenaBlocks(existing->second.numBytes));
+
+    auto alloc = freeSpaceMap.findNFreeBlocks(N);
+    if (alloc == std::nullopt)
+    {
+        if (existing != this->extents.end())
+            freeSpaceMap.allocateNBlocks(existing->second.startingArenaBlockNum, getNumArenaBlocks(existing->second.numBytes));
+        throw std::runtime_error("writeBlocks() - no contiguous section of " + std::to_string(N) + " blocks found");
+    }
+
+    uint32_t startingArenaBlockNum = *alloc;
+    freeSpaceMap.allocateNBlocks(startingArenaBlockNum, N);
+    std::memcpy(arenaBlockPtr(startingArenaBlockNum), buffer.data(), numTotalBytes);
+
+    if (existing != this->extents.end())
+    {
+        this->usedSize -= existing->second.numBytes;
+        existing->second = {startingArenaBlockNum, numTotalBytes};
+    }
+    else
+        this->extents[key] = {startingArenaBlockNum, numTotalBytes};
+
+    this->usedSize += numTotalBytes;
+}
+
+////////////////////////////////////////////
+// MemoryStorage tests
+////////////////////////////////////////////
+namespace MemoryStorageTests
+{
+    /**
+     * Tests that a deleted key's extent is handed out again
+     * to the next write that fits.
+     */
+    void testFreedExtentIsReused()
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t arenaBlockSize = 20;
+        MemoryStorage ms(arenaBlockSize, 1u << 20);
+
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+        auto p1 = Block::generateRandom("archive.zip", dataBlockSize, 3 * dataBlockSize, writeDataBuffers);
+        auto p2 = Block::generateRandom("video.mp4", dataBlockSize, 3 * dataBlockSize, writeDataBuffers);
+        ms.writeBlocks("archive.zip", p1.first);
+        ms.writeBlocks("video.mp4", p2.first);
+
+        uint32_t numArenaBlocks = ms.getNumArenaBlocks(3 * (dataBlockSize + sizeof(uint32_t)));
+        for (uint32_t i = 0; i < 2 * numArenaBlocks; i++)
+            ASSERT_THAT(ms.freeSpaceMap.isMapped(i));
+
+        // free first extent, then write a key of the same size
+        ms.deleteBlocks("archive.zip");
+        for (uint32_t i = 0; i < numArenaBlocks; i++)
+            ASSERT_THAT(!ms.freeSpaceMap.isMapped(i));
+
+        auto p3 = Block::generateRandom("shakespeare.txt", dataBlockSize, 3 * dataBlockSize, writeDataBuffers);
+        ms.writeBlocks("shakespeare.txt", p3.first);
+
+        for (uint32_t i = 0; i < 2 * numArenaBlocks; i++)
+            ASSERT_THAT(ms.freeSpaceMap.isMapped(i));
+        ASSERT_THAT(!ms.freeSpaceMap.isMapped(2 * numArenaBlocks));
+    }
+
+    void testUsedSizeTracksWritesAndDeletes()
+    {
+        uint32_t dataBlockSize = 40;
+        MemoryStorage ms(20, 1u << 20);
+
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+        auto p = Block::generateRandom("archive.zip", dataBlockSize, 2 * dataBlockSize + 10, writeDataBuffers);
+        ms.writeBlocks("archive.zip", p.first);
+
+        uint32_t expectedSize = (2 * dataBlockSize + 10) + (3 * sizeof(uint32_t));
+        ASSERT_THAT(ms.dataUsedSize() == expectedSize);
+
+        ms.deleteBlocks("archive.zip");
+        ASSERT_THAT(ms.dataUsedSize() == 0);
+    }
+
+    void testRenameReplacesKey()
+    {
+        uint32_t dataBlockSize = 40;
+        MemoryStorage ms(20, 1u << 20);
+
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+        auto p = Block::generateRandom("archive.zip", dataBlockSize, 3 * dataBlockSize, writeDataBuffers);
+        auto newP = Block::generateRandom("archive.zip", dataBlockSize, dataBlockSize, writeDataBuffers);
+        ms.writeBlocks("archive.zip", p.first);
+        ms.writeBlocks("archive.zip.~staged", newP.first);
+
+        ms.renameKey("archive.zip.~staged", "archive.zip");
+        ASSERT_THAT(ms.getKeys() == std::vector<std::string>{"archive.zip"});
+        ASSERT_THAT(ms.dataUsedSize() == dataBlockSize + sizeof(uint32_t));
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = ms.readBlocks("archive.zip", {0}, dataBlockSize, readBuffer);
+        ASSERT_THAT(readBlocks.size() == 1 && newP.first[0].equals(readBlocks[0]));
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "MemoryStorageTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testFreedExtentIsReused),
+            TEST(testUsedSizeTracksWritesAndDeletes),
+            TEST(testRenameReplacesKey)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "block.hpp"
+#include "free_space.hpp"
+#include "storage_engine.hpp"
+
+/**
+ * Represents a key's extent within the memory arena.
+ */
+struct MemoryExtent
+{
+    uint32_t startingArenaBlockNum;
+    uint32_t numBytes;
+};
+
+/**
+ * RAM-only storage engine.
+ *
+ * Blocks are stored in a single pre-reserved arena, which is carved up
+ * into `arenaBlockSize` sized blocks and allocated with a FreeSpaceMap,
+ * exactly like DiskStorage's block store. Each key's blocks therefore
+ * occupy one contiguous extent, and reads/writes are a single memcpy.
+ *
+ * NOTE:
+ *
+ * Contents do not survive a restart. Intended for caching tiers
+ * and for benchmarking the network path separately from disk.
+ */
+class MemoryStorage : public StorageEngine
+{
+public:
+
+    /* Free space map for our arena */
+    FreeSpaceMap freeSpaceMap;
+
+    /* Param constructor */
+    MemoryStorage(
+        uint32_t arenaBlockSize = 4096,
+        uint32_t maxDataSize = 1u << 30
+    );
+
+    std::vector<Block> readBlocks(
+        std::string key,
+        std::unordered_set<uint32_t> blockNums,
+        uint32_t dataBlockSize,
+        std::vector<unsigned char> &readBuffer) override;
+
+    void writeBlocks(std::string key, std::vector<Block> dataBlocks) override;
+
+    void appendBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize) override;
+
+    void updateBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize) override;
+
+    void deleteBlocks(std::string key) override;
+
+    void deleteKeys(std::vector<std::string> keys) override;
+
+    void renameKey(std::string fromKey, std::string toKey) override;
+
+    std::vector<std::string> getKeys() override;
+
+    std::vector<uint32_t> getBlockNums(std::string key, uint32_t dataBlockSize) override;
+
+    uint32_t dataUsedSize() override;
+
+    uint32_t dataTotalSize() override;
+
+    /**
+     * Returns number of arena blocks `numDataBytes` bytes takes up.
+     */
+    uint32_t getNumArenaBlocks(uint32_t numDataBytes);
+
+private:
+
+    uint32_t arenaBlockSize;
+    uint32_t maxDataSize;
+
+    /**
+     * Backing memory for all extents.
+     *
+     * NOTE:
+     *
+     * Allocated uninitialised, so pages are only committed
+     * once they are first written to.
+     */
+    std::unique_ptr<unsigned char[]> arena;
+
+    /* { key -> extent } */
+    std::unordered_map<std::string, MemoryExtent> extents;
+
+    /* Running total of extent bytes in use */
+    uint32_t usedSize;
+
+    /* Readers take a shared lock, writers an exclusive one */
+    std::shared_mutex mutex;
+
+    /**
+     * Returns pointer to the start of arena block `arenaBlockNum`.
+     */
+    unsigned char* arenaBlockPtr(uint32_t arenaBlockNum);
+
+    /**
+     * Writes the packed extent `buffer` for the given key, re-using
+     * its existing extent if it fits. Expects `mutex` held exclusively.
+     */
+    void writeExtent(std::string key, std::vector<unsigned char> &buffer);
+};
+
+////////////////////////////////////////////
+// MemoryStorage tests
+////////////////////////////////////////////
+namespace MemoryStorageTests
+{
+    void testFreedExtentIsReused();
+    void testUsedSizeTracksWritesAndDeletes();
+    void testRenameReplacesKey();
+
+    void runAll();
+}
@@ -0,0 +1,303 @@
+#include <string>
+#include <algorithm>
+#include <set>
+
+#include "placement_index.hpp"
+
+#include "utils.hpp"
+#include "crypto.hpp"
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// PlacementIndex methods
+////////////////////////////////////////////
+
+/* Default constructor */
+PlacementIndex::PlacementIndex()
+{
+}
+
+/**
+ * Adds blocks `blockNums` of key `key` to the index.
+ */
+void PlacementIndex::addKey(const std::string &key, const std::vector<uint32_t> &blockNums)
+{
+    // hash outside the lock
+    std::vector<uint32_t> hashes;
+    hashes.reserve(blockNums.size());
+    for (uint32_t bn : blockNums)
+        hashes.push_back(placementHash(key, bn));
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    auto keyIt = this->keyEntries.try_emplace(key).first;
+    std::vector<HashMap::iterator> &entries = keyIt->second;
+    for (auto &it : entries)
+        this->index.erase(it);
+    entries.clear();
+
+    for (size_t i = 0; i < blockNums.size(); i++)
+        entries.push_back(this->index.insert({hashes[i], {&keyIt->first, blockNums[i]}}));
+}
+
+/**
+ * Adds blocks `blockNums` of key `key` (in ascending order) to the index,
+ * dropping any indexed blocks from the first of them on (see addBlocks()
+ * in placement_index.hpp).
+ */
+void PlacementIndex::addBlocks(const std::string &key, const std::vector<uint32_t> &blockNums)
+{
+    if (blockNums.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    auto keyIt = this->keyEntries.try_emplace(key).first;
+    std::vector<HashMap::iterator> &entries = keyIt->second;
+
+    // e.g. a re-sent tail block, or blocks re-sent by a retried append
+    auto replaced = std::remove_if(entries.begin(), entries.end(), [&](HashMap::iterator &it)
+    {
+        if (it->second.second < blockNums.front())
+            return false;
+        this->index.erase(it);
+        return true;
+    });
+    entries.erase(replaced, entries.end());
+
+    for (uint32_t bn : blockNums)
+        entries.push_back(this->index.insert({placementHash(key, bn), {&keyIt->first, bn}}));
+}
+
+/**
+ * Removes all blocks of key `key` from the index.
+ */
+void PlacementIndex::removeKey(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    auto it = this->keyEntries.find(key);
+    if (it == this->keyEntries.end())
+        return;
+
+    for (auto &entry : it->second)
+        this->index.erase(entry);
+    this->keyEntries.erase(it);
+}
+
+/**
+ * Moves the blocks indexed for key `fromKey` to key `toKey`,
+ * replacing any indexed for `toKey`.
+ * 
+ * NOTE: blocks are re-hashed, as a block's placement hash depends on its key.
+ */
+void PlacementIndex::renameKey(const std::string &fromKey, const std::string &toKey)
+{
+    std::vector<uint32_t> blockNums;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        auto it = this->keyEntries.find(fromKey);
+        if (it != this->keyEntries.end())
+        {
+            for (auto &entry : it->second)
+                blockNums.push_back(entry->second.second);
+        }
+    }
+
+    removeKey(fromKey);
+    addKey(toKey, blockNums);
+}
+
+/**
+ * Returns all blocks with placement hash in the ring range [startHash, endHash),
+ * in hash order.
+ */
+std::vector<PlacementEntry> PlacementIndex::findRange(uint32_t startHash, uint32_t endHash)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    std::vector<PlacementEntry> entries;
+
+    if (startHash < endHash)
+    {
+        collect(this->index.lower_bound(startHash), this->index.lower_bound(endHash), entries);
+    }
+
+    // range wraps around the ring
+    else
+    {
+        collect(this->index.lower_bound(startHash), this->index.end(), entries);
+        collect(this->index.begin(), this->index.lower_bound(endHash), entries);
+    }
+
+    return entries;
+}
+
+/**
+ * Returns number of blocks indexed.
+ */
+size_t PlacementIndex::size()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->index.size();
+}
+
+/**
+ * Returns the ring placement hash of block `blockNum` of key `key`.
+ *
+ * NOTE:
+ *
+ * Must match the hash input the master uses in its /store PUT handler.
+ */
+uint32_t PlacementIndex::placementHash(const std::string &key, uint32_t blockNum)
+{
+    return Crypto::sha256_32(key + std::to_string(blockNum));
+}
+
+/**
+ * Appends all entries in [first, last) to `entries`.
+ */
+void PlacementIndex::collect(HashMap::iterator first, HashMap::iterator last, std::vector<PlacementEntry> &entries)
+{
+    for (auto it = first; it != last; ++it)
+        entries.push_back({it->first, *it->second.first, it->second.second});
+}
+
+////////////////////////////////////////////
+// PlacementIndex tests
+////////////////////////////////////////////
+namespace PlacementIndexTests
+{
+    void testFindRange()
+    {
+        PlacementIndex pi;
+        pi.addKey("archive.zip", {0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+        pi.addKey("video.mp4", {0, 1, 2});
+
+        ASSERT_THAT(pi.size() == 13);
+
+        // whole ring
+        std::vector<PlacementEntry> all = pi.findRange(0, 0);
+        ASSERT_THAT(all.size() == 13);
+        for (size_t i = 1; i < all.size(); i++)
+            ASSERT_THAT(all[i - 1].hash <= all[i].hash);
+
+        // range covering exactly the middle entries
+        uint32_t startHash = all[3].hash;
+        uint32_t endHash = all[8].hash;
+        std::vector<PlacementEntry> entries = pi.findRange(startHash, endHash);
+
+        ASSERT_THAT(entries.size() == 5);
+        for (auto &entry : entries)
+        {
+            ASSERT_THAT(entry.hash >= startHash && entry.hash < endHash);
+            ASSERT_THAT(entry.hash == PlacementIndex::placementHash(entry.key, entry.blockNum));
+        }
+    }
+
+    void testFindWrappingRange()
+    {
+        PlacementIndex pi;
+        pi.addKey("archive.zip", {0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+
+        std::vector<PlacementEntry> all = pi.findRange(0, 0);
+
+        // [all[7], all[2]) wraps, so should contain entries 7, 8, 9, 0, 1
+        std::vector<PlacementEntry> entries = pi.findRange(all[7].hash, all[2].hash);
+        ASSERT_THAT(entries.size() == 5);
+        ASSERT_THAT(entries[0].hash == all[7].hash);
+        ASSERT_THAT(entries[4].hash == all[1].hash);
+    }
+
+    void testReplaceAndRemoveKey()
+    {
+        PlacementIndex pi;
+        pi.addKey("archive.zip", {0, 1, 2, 3, 4});
+        pi.addKey("video.mp4", {0, 1});
+
+        // overwrite with fewer blocks
+        pi.addKey("archive.zip", {0, 1});
+        ASSERT_THAT(pi.size() == 4);
+
+        pi.removeKey("archive.zip");
+        ASSERT_THAT(pi.size() == 2);
+
+        for (auto &entry : pi.findRange(0, 0))
+            ASSERT_THAT(entry.key == "video.mp4");
+
+        // removing an unknown key is a no-op
+        pi.removeKey("unknown");
+        ASSERT_THAT(pi.size() == 2);
+    }
+
+    void testAddBlocks()
+    {
+        PlacementIndex pi;
+        pi.addKey("archive.zip", {0, 1, 2});
+
+        // block 2 is re-sent, so replaced rather than indexed twice
+        pi.addBlocks("archive.zip", {2, 3, 4});
+        ASSERT_THAT(pi.size() == 5);
+
+        pi.addBlocks("video.mp4", {0});
+        ASSERT_THAT(pi.size() == 6);
+
+        pi.removeKey("archive.zip");
+        ASSERT_THAT(pi.size() == 1);
+    }
+
+    void testAddBlocksDropsReplacedBlocks()
+    {
+        PlacementIndex pi;
+        pi.addKey("archive.zip", {0, 1, 3, 4, 6});
+
+        // a retried append re-sends blocks from 2 on, replacing 3, 4 and 6
+        pi.addBlocks("archive.zip", {2, 3});
+        ASSERT_THAT(pi.size() == 4);
+
+        std::multiset<uint32_t> blockNums;
+        for (PlacementEntry &entry : pi.findRange(0, 0))
+            blockNums.insert(entry.blockNum);
+        ASSERT_THAT((blockNums == std::multiset<uint32_t>{0, 1, 2, 3}));
+    }
+
+    void testRenameKey()
+    {
+        PlacementIndex pi;
+        pi.addKey("archive.zip", {0, 1, 2, 3});
+        pi.addKey("archive.zip.~staged", {0, 1});
+
+        pi.renameKey("archive.zip.~staged", "archive.zip");
+        ASSERT_THAT(pi.size() == 2);
+
+        for (PlacementEntry &entry : pi.findRange(0, 0))
+        {
+            ASSERT_THAT(entry.key == "archive.zip" && entry.blockNum < 2);
+            ASSERT_THAT(entry.hash == PlacementIndex::placementHash("archive.zip", entry.blockNum));
+        }
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "PlacementIndexTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testFindRange),
+            TEST(testFindWrappingRange),
+            TEST(testReplaceAndRemoveKey),
+            TEST(testAddBlocks),
+            TEST(testAddBlocksDropsReplacedBlocks),
+            TEST(testRenameKey)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * Represents a single stored block, keyed by its placement hash.
+ */
+struct PlacementEntry
+{
+    uint32_t hash;
+    std::string key;
+    uint32_t blockNum;
+};
+
+/**
+ * Index of all blocks stored on this node, ordered by placement hash.
+ *
+ * A block's placement hash is the same hash the master uses to place it
+ * on the hash ring, i.e. sha256_32(key + blockNum). When a node joins or
+ * leaves, the blocks that must move are exactly those whose placement hash
+ * falls in certain ring ranges, which this index can enumerate directly.
+ */
+class PlacementIndex
+{
+public:
+    /* Default constructor */
+    PlacementIndex();
+
+    /**
+     * Adds blocks `blockNums` of key `key` to the index.
+     *
+     * NOTE:
+     *
+     * Any blocks previously indexed for `key` are replaced.
+     */
+    void addKey(const std::string &key, const std::vector<uint32_t> &blockNums);
+
+    /**
+     * Adds blocks `blockNums` of key `key` (in ascending order) to the index,
+     * as appended by StorageEngine::appendBlocks().
+     *
+     * NOTE:
+     *
+     * Blocks already indexed for `key` before the first of `blockNums` are
+     * kept, and the rest are dropped, as the append replaced them.
+     */
+    void addBlocks(const std::string &key, const std::vector<uint32_t> &blockNums);
+
+    /**
+     * Removes all blocks of key `key` from the index.
+     */
+    void removeKey(const std::string &key);
+
+    /**
+     * Moves the blocks indexed for key `fromKey` to key `toKey`,
+     * replacing any indexed for `toKey` (see StorageEngine::renameKey()).
+     */
+    void renameKey(const std::string &fromKey, const std::string &toKey);
+
+    /**
+     * Returns all blocks with placement hash in the ring range [startHash, endHash),
+     * in hash order.
+     *
+     * NOTE:
+     *
+     * If endHash <= startHash, the range wraps around the ring,
+     * i.e. [startHash, UINT32_MAX] + [0, endHash).
+     */
+    std::vector<PlacementEntry> findRange(uint32_t startHash, uint32_t endHash);
+
+    /**
+     * Returns number of blocks indexed.
+     */
+    size_t size();
+
+    /**
+     * Returns the ring placement hash of block `blockNum` of key `key`.
+     */
+    static uint32_t placementHash(const std::string &key, uint32_t blockNum);
+
+private:
+    /**
+     * { placement hash -> (key, block num) }
+     *
+     * NOTE: each entry references its key's (node-stable) copy in
+     *       `keyEntries`, so a key is stored once rather than per block.
+     */
+    using HashMap = std::multimap<uint32_t, std::pair<const std::string*, uint32_t>>;
+    HashMap index;
+
+    /* { key -> index entries of that key }, used for O(blocks) removal */
+    std::unordered_map<std::string, std::vector<HashMap::iterator>> keyEntries;
+
+    std::mutex mutex;
+
+    /**
+     * Appends all entries in [first, last) to `entries`.
+     */
+    void collect(HashMap::iterator first, HashMap::iterator last, std::vector<PlacementEntry> &entries);
+};
+
+namespace PlacementIndexTests
+{
+    void testFindRange();
+    void testFindWrappingRange();
+    void testReplaceAndRemoveKey();
+    void testAddBlocks();
+    void testAddBlocksDropsReplacedBlocks();
+    void testRenameKey();
+    void runAll();
+}
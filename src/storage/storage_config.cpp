@@ -13,11 +13,38 @@ void StorageConfig::loadVariables()
      */
     json::value storageConfig = this->jsonConfig.at(U("storageServer"));
 
+    this->storageEngine = storageConfig.at(U("storageEngine")).as_string();
     this->storeDirPath = storageConfig.at(U("storeDirPath")).as_string();
     this->storeFilePrefix = storageConfig.at(U("storeFilePrefix")).as_string();
     this->diskBlockSize = storageConfig.at(U("diskBlockSize")).as_integer();
     this->maxDataSizePower = storageConfig.at(U("maxDataSizePower")).as_integer();
     this->removeExistingStoreFile = storageConfig.at(U("removeExistingStoreFile")).as_bool();
+    this->punchHoleOnReclaim = storageConfig.at(U("punchHoleOnReclaim")).as_bool();
+    this->readaheadMaxBytes = storageConfig.at(U("readaheadMaxBytes")).as_integer();
+    this->ioThreads = storageConfig.at(U("ioThreads")).as_integer();
+    this->workerThreads = storageConfig.at(U("workerThreads")).as_integer();
+
+    json::value ioConfig = storageConfig.at(U("ioScheduler"));
+    this->ioMaxInFlight = ioConfig.at(U("maxInFlight")).as_integer();
+    for (uint32_t i = 0; i < NUM_IO_CLASSES; i++)
+    {
+        json::value classConfig = ioConfig.at(U("classes")).at(IoScheduler::className(static_cast<IoClass>(i)));
+
+        this->ioClassConfigs[i].bytesPerSec = classConfig.at(U("bytesPerSec")).as_number().to_uint64();
+        this->ioClassConfigs[i].burstBytes = classConfig.at(U("burstBytes")).as_number().to_uint64();
+        this->ioClassConfigs[i].deadline = std::chrono::milliseconds(classConfig.at(U("deadlineMs")).as_integer());
+    }
+
+    json::value tiering = storageConfig.at(U("tiering"));
+    this->tieringEnabled = tiering.at(U("enabled")).as_bool();
+    this->hotStorageEngine = tiering.at(U("hotStorageEngine")).as_string();
+    this->hotStoreDirPath = tiering.at(U("hotStoreDirPath")).as_string();
+    this->hotMaxDataSizePower = tiering.at(U("hotMaxDataSizePower")).as_integer();
+    this->tieringConfig.promoteHeat = tiering.at(U("promoteHeat")).as_double();
+    this->tieringConfig.demoteHeat = tiering.at(U("demoteHeat")).as_double();
+    this->tieringConfig.heatHalfLife = std::chrono::milliseconds(tiering.at(U("heatHalfLifeMs")).as_integer());
+    this->tieringConfig.migrationPeriod = std::chrono::milliseconds(tiering.at(U("migrationPeriodMs")).as_integer());
+    this->tieringConfig.migrationBytesPerSec = tiering.at(U("migrationBytesPerSec")).as_number().to_uint64();
 
     /**
      * shared config
@@ -26,4 +53,11 @@ void StorageConfig::loadVariables()
 
     this->dataBlockSize = shared.at(U("dataBlockSize")).as_integer();
     this->keyLengthMax = shared.at(U("keyLengthMax")).as_integer();
+    this->shutdownDrainMs = shared.at(U("shutdownDrainMs")).as_integer();
+    this->rpcPortOffset = shared.at(U("rpcPortOffset")).as_integer();
+    this->rpcSocketBufferBytes = shared.at(U("rpcSocketBufferBytes")).as_integer();
+    this->rpcLocalDir = shared.at(U("rpcLocalDir")).as_string();
+    this->rpcShmRingBytes = shared.at(U("rpcShmRingBytes")).as_number().to_uint64();
+
+    this->tieringConfig.dataBlockSize = this->dataBlockSize;
 }
\ No newline at end of file
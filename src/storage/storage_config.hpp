@@ -1,6 +1,8 @@
 #pragma once
 #include <string>
 #include "config.hpp"
+#include "io_scheduler.hpp"
+#include "tiered_storage.hpp"
 
 class StorageConfig: public Config 
 {
@@ -11,6 +13,14 @@ public:
     /* store directory ('rackkey/' by default) */
     std::string storeDirPath;
 
+    /**
+     * Storage engine used by the node, one of:
+     * 
+     *      "disk"   - DiskStorage, a single on-disk store file (default)
+     *      "memory" - MemoryStorage, a RAM-only arena
+     */
+    std::string storageEngine;
+
     /* store file prefix ('store' by default) */
     std::string storeFilePrefix;
 
@@ -27,11 +37,92 @@ public:
     /* True if should remove existing store file, false otherwise */
     bool removeExistingStoreFile;
 
+    /**
+     * True if deleted keys' extents should be punched out of the store
+     * file (FALLOC_FL_PUNCH_HOLE) when reclaimed, returning their space
+     * to the filesystem. Only used by the "disk" engine.
+     */
+    bool punchHoleOnReclaim;
+
+    /**
+     * Maximum number of bytes prefetched ahead of a sequential read stream
+     * (the window starts small and doubles up to this). 0 disables readahead.
+     * Only used by the "disk" engine.
+     */
+    uint32_t readaheadMaxBytes;
+
+    /* Maximum number of storage I/O requests run at once (see IoScheduler) */
+    uint32_t ioMaxInFlight;
+
+    /**
+     * Per-class I/O scheduling parameters, indexed by IoClass. Each class
+     * is configured under `ioScheduler.classes.{NAME}` as:
+     * 
+     *      bytesPerSec - token bucket refill rate (0 means unlimited)
+     *      burstBytes  - token bucket capacity
+     *      deadlineMs  - max. queueing time before it's dispatched ahead of higher priorities
+     */
+    std::array<IoClassConfig, NUM_IO_CLASSES> ioClassConfigs;
+
+    /**
+     * True if the storage engine should be fronted by a hot tier
+     * (see TieredStorage), configured under `tiering`.
+     */
+    bool tieringEnabled;
+
+    /* Hot tier's storage engine, "memory" or "disk" (e.g. on a tmpfs) */
+    std::string hotStorageEngine;
+
+    /* Hot tier's store directory, if a "disk" engine */
+    std::string hotStoreDirPath;
+
+    /* log2 of the hot tier's maximum data section size */
+    uint32_t hotMaxDataSizePower;
+
+    /* Heat thresholds, heat half life and migration rate (see TieringConfig) */
+    TieringConfig tieringConfig;
+
+    /**
+     * Num. threads in cpprest's thread pool, which accepts and reads
+     * requests (0 uses cpprest's default).
+     */
+    uint32_t ioThreads;
+
+    /**
+     * Num. threads handlers are run on (see WorkerPool), so blocking storage 
+     * I/O doesn't hold up cpprest's threads. 0 runs handlers on cpprest's threads.
+     */
+    uint32_t workerThreads;
+
     /**
      * Size of data (in bytes) each data block (i.e. Block object) stores.
      */
     uint32_t dataBlockSize;
 
-    /* maximum key length (in bytes/characters) */
+    /* maximum key length (in bytes/characters). Keys are stored unpadded. */
     uint32_t keyLengthMax;
+
+    /**
+     * Max. time (in milliseconds) spent on shutdown waiting for in-flight
+     * requests to finish.
+     */
+    uint32_t shutdownDrainMs;
+
+    /**
+     * The master's RPCs are served on PORT + `rpcPortOffset` (see rpc.hpp).
+     * 0 serves HTTP only.
+     */
+    uint32_t rpcPortOffset;
+
+    /* Send/receive buffer size (in bytes) of RPC sockets (0 keeps the OS default) */
+    uint32_t rpcSocketBufferBytes;
+
+    /**
+     * Directory of our local RPC socket (`node_{NODE_ID}.sock`), for a master
+     * on the same host sharing it. Empty serves RPCs over TCP only.
+     */
+    std::string rpcLocalDir;
+
+    /* Size (in bytes) of each shared memory ring of a local RPC connection */
+    uint64_t rpcShmRingBytes;
 };
\ No newline at end of file
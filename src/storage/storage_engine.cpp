@@ -0,0 +1,810 @@
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <unordered_set>
+
+#include "storage_engine.hpp"
+#include "disk_storage.hpp"
+#include "memory_storage.hpp"
+#include "tiered_storage.hpp"
+
+#include "utils.hpp"
+#include "block.hpp"
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// StorageEngine - protected methods
+////////////////////////////////////////////
+
+/**
+ * Packs `dataBlocks` into a single extent buffer.
+ */
+std::vector<unsigned char> StorageEngine::packBlocks(std::vector<Block> &dataBlocks)
+{
+    std::vector<unsigned char> buffer;
+    buffer.reserve(packedSize(dataBlocks));
+
+    unsigned char blockNum[sizeof(uint32_t)];
+    for (auto &dataBlock : dataBlocks)
+    {
+        // write block number
+        std::memcpy(blockNum, &dataBlock.blockNum, sizeof(dataBlock.blockNum));
+        buffer.insert(buffer.end(), blockNum, blockNum + sizeof(dataBlock.blockNum));
+
+        // write data
+        buffer.insert(buffer.end(), dataBlock.dataStart, dataBlock.dataEnd);
+    }
+
+    return buffer;
+}
+
+/**
+ * Returns the packed size (in bytes) of `dataBlocks`.
+ */
+uint32_t StorageEngine::packedSize(std::vector<Block> &dataBlocks)
+{
+    uint32_t numTotalBytes = 0;
+    for (auto &dataBlock : dataBlocks)
+    {
+        numTotalBytes += sizeof(uint32_t);
+        numTotalBytes += dataBlock.dataSize;
+    }
+    return numTotalBytes;
+}
+
+/**
+ * Builds Block objects for `requestedBlockNums` from the extent buffer
+ * `extent`. Block data pointers point into `extent`.
+ */
+std::vector<Block> StorageEngine::unpackBlocks(
+    std::string &key,
+    std::unordered_set<uint32_t> &requestedBlockNums,
+    uint32_t dataBlockSize,
+    std::vector<unsigned char> &extent)
+{
+    std::vector<Block> blocks;
+
+    auto iter = extent.begin();
+    while (iter < extent.end())
+    {
+        // read block num
+        uint32_t blockNum;
+        std::memcpy(&blockNum, &(*iter), sizeof(blockNum));
+        iter += sizeof(uint32_t);
+
+        // read data
+        uint32_t dataSize = std::min(
+            dataBlockSize,
+            static_cast<uint32_t>(std::distance(iter, extent.end()))
+        );
+
+        // only add if we asked for this block
+        if (requestedBlockNums.find(blockNum) != requestedBlockNums.end())
+            blocks.emplace_back(key, blockNum, dataSize, iter, iter + dataSize);
+
+        iter += dataSize;
+    }
+
+    if (blocks.size() != requestedBlockNums.size())
+        throw std::runtime_error("readBlocks() - num. blocks read != num. blocks requested");
+
+    return blocks;
+}
+
+/**
+ * Returns the offset of the final (tail) block within an extent 
+ * of `extentNumBytes` bytes.
+ * 
+ * NOTE: 
+ * 
+ * Only a key's final block can be smaller than `dataBlockSize`, and 
+ * blocks are stored in ascending order, so every block before the tail 
+ * takes up exactly (sizeof(blockNum) + dataBlockSize) bytes.
+ */
+uint32_t StorageEngine::tailBlockOffset(uint32_t extentNumBytes, uint32_t dataBlockSize)
+{
+    uint32_t recordSize = sizeof(uint32_t) + dataBlockSize;
+    return (MathUtils::ceilDiv(extentNumBytes, recordSize) - 1) * recordSize;
+}
+
+/**
+ * Returns the number of bytes of an existing extent to keep when appending
+ * `dataBlocks` to it, i.e. the offset at which the appended blocks are written.
+ * 
+ * NOTE:
+ * 
+ * Blocks before the tail are only re-sent when an append is retried (after
+ * failing on another node, say, having been stored here), so only then are
+ * the extent's block numbers read to find the first of them.
+ */
+uint32_t StorageEngine::appendOffset(
+    uint32_t extentNumBytes,
+    uint32_t tailBlockNum,
+    std::vector<Block> &dataBlocks,
+    uint32_t dataBlockSize,
+    const std::function<std::vector<uint32_t>()> &readStoredBlockNums)
+{
+    if (dataBlocks.size() == 0)
+        throw std::runtime_error("appendBlocks() - no data blocks given");
+
+    for (size_t i = 1; i < dataBlocks.size(); i++)
+    {
+        if (dataBlocks[i].blockNum <= dataBlocks[i - 1].blockNum)
+            throw std::runtime_error("appendBlocks() - blocks not in ascending order");
+    }
+
+    uint32_t tailOffset = tailBlockOffset(extentNumBytes, dataBlockSize);
+    uint32_t tailDataSize = extentNumBytes - tailOffset - sizeof(uint32_t);
+    uint32_t firstBlockNum = dataBlocks[0].blockNum;
+
+    // replace the tail block
+    if (firstBlockNum == tailBlockNum)
+        return tailOffset;
+
+    // a partial tail block must be filled before anything follows it
+    if (firstBlockNum > tailBlockNum)
+    {
+        if (tailDataSize == dataBlockSize)
+            return extentNumBytes;
+
+        throw std::runtime_error(
+            "appendBlocks() - block " + std::to_string(firstBlockNum) + 
+            " doesn't follow on from tail block " + std::to_string(tailBlockNum)
+        );
+    }
+
+    // replace every stored block from the first re-sent one on (the blocks 
+    // kept are all before the tail, so are all full)
+    std::vector<uint32_t> storedBlockNums = readStoredBlockNums();
+    auto it = std::lower_bound(storedBlockNums.begin(), storedBlockNums.end(), firstBlockNum);
+    return std::distance(storedBlockNums.begin(), it) * (sizeof(uint32_t) + dataBlockSize);
+}
+
+/**
+ * Returns the offset within an existing extent of each of `dataBlocks`, 
+ * which replace blocks already stored in it.
+ * 
+ * `storedBlockNums` are the block numbers stored in the extent, in order.
+ */
+std::vector<uint32_t> StorageEngine::updateOffsets(
+    std::vector<uint32_t> &storedBlockNums,
+    std::vector<Block> &dataBlocks,
+    uint32_t dataBlockSize)
+{
+    if (dataBlocks.size() == 0)
+        throw std::runtime_error("updateBlocks() - no data blocks given");
+
+    uint32_t recordSize = sizeof(uint32_t) + dataBlockSize;
+    std::vector<uint32_t> offsets;
+
+    for (Block &block : dataBlocks)
+    {
+        auto it = std::lower_bound(storedBlockNums.begin(), storedBlockNums.end(), block.blockNum);
+        if (it == storedBlockNums.end() || *it != block.blockNum)
+            throw std::runtime_error("updateBlocks() - block " + std::to_string(block.blockNum) + " not stored");
+
+        // only the tail block may change size
+        bool isTail = (it + 1 == storedBlockNums.end());
+        if (block.dataSize > dataBlockSize || (!isTail && block.dataSize != dataBlockSize))
+            throw std::runtime_error("updateBlocks() - bad data size for block " + std::to_string(block.blockNum));
+
+        offsets.push_back(std::distance(storedBlockNums.begin(), it) * recordSize);
+    }
+
+    return offsets;
+}
+
+/**
+ * Returns all block numbers stored in the extent buffer `extent`.
+ */
+std::vector<uint32_t> StorageEngine::unpackBlockNums(
+    uint32_t dataBlockSize,
+    std::vector<unsigned char> &extent)
+{
+    std::vector<uint32_t> blockNums;
+
+    auto iter = extent.begin();
+    while (iter < extent.end())
+    {
+        // read block num
+        uint32_t blockNum;
+        std::memcpy(&blockNum, &(*iter), sizeof(blockNum));
+        blockNums.push_back(blockNum);
+        iter += sizeof(uint32_t);
+
+        // move pointer to next data block
+        uint32_t dataSize = std::min(
+            dataBlockSize,
+            static_cast<uint32_t>(std::distance(iter, extent.end()))
+        );
+        iter += dataSize;
+    }
+
+    return blockNums;
+}
+
+////////////////////////////////////////////
+// StorageEngine tests
+////////////////////////////////////////////
+namespace StorageEngineTests
+{
+    /**
+     * Tests that we can write a single key's blocks and read them back out.
+     */
+    void testCanWriteAndReadOneKeysBlocks(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::string key = "archive.zip";
+        uint32_t N = 2;
+        uint32_t numDataBytes = N * dataBlockSize + 10;
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        auto p = Block::generateRandom(key, dataBlockSize, numDataBytes, writeDataBuffers);
+        std::vector<Block> writeBlocks = p.first;
+        std::unordered_set<uint32_t> blockNums = p.second;
+        engine->writeBlocks(key, writeBlocks);
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks(key, blockNums, dataBlockSize, readBuffer);
+
+        ASSERT_THAT(writeBlocks.size() == readBlocks.size());
+        for (uint32_t i = 0; i < writeBlocks.size(); i++)
+            ASSERT_THAT(writeBlocks[i].equals(readBlocks[i]));
+    }
+
+    /**
+     * Tests that we can write multiple keys' blocks and read them back out.
+     */
+    void testCanWriteAndReadMultipleKeysBlocks(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        uint32_t M = 5; // num. different keys we write
+
+        std::vector<std::vector<Block>> writeBlocksList;
+        std::vector<std::unordered_set<uint32_t>> writeBlockNumsList;
+        std::vector<std::vector<std::vector<unsigned char>>> writeDataBuffersList(M);
+
+        for (uint32_t i = 0; i < M; i++)
+        {
+            std::string key = "key_" + std::to_string(i);
+            uint32_t numDataBytes = (i + 1) * dataBlockSize + (i % dataBlockSize);
+
+            auto p = Block::generateRandom(key, dataBlockSize, numDataBytes, writeDataBuffersList[i]);
+            engine->writeBlocks(key, p.first);
+
+            writeBlocksList.push_back(p.first);
+            writeBlockNumsList.push_back(p.second);
+        }
+
+        for (uint32_t i = 0; i < M; i++)
+        {
+            std::string key = "key_" + std::to_string(i);
+
+            std::vector<unsigned char> readBuffer;
+            std::vector<Block> readBlocks = engine->readBlocks(key, writeBlockNumsList[i], dataBlockSize, readBuffer);
+
+            ASSERT_THAT(writeBlocksList[i].size() == readBlocks.size());
+            for (uint32_t j = 0; j < readBlocks.size(); j++)
+                ASSERT_THAT(writeBlocksList[i][j].equals(readBlocks[j]));
+        }
+    }
+
+    /**
+     * Tests that we can write N blocks, then later read a chosen subset
+     * of M < N blocks.
+     */
+    void testCanReadSubsetOfBlocks(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::string key = "archive.zip";
+        uint32_t N = 10;
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        auto p = Block::generateRandom(key, dataBlockSize, N * dataBlockSize, writeDataBuffers);
+        std::vector<Block> writeBlocks = p.first;
+        engine->writeBlocks(key, writeBlocks);
+
+        // choose every second block
+        std::unordered_set<uint32_t> subsetBlockNums;
+        for (uint32_t bn = 0; bn < N; bn += 2)
+            subsetBlockNums.insert(bn);
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks(key, subsetBlockNums, dataBlockSize, readBuffer);
+
+        ASSERT_THAT(readBlocks.size() == subsetBlockNums.size());
+        for (auto &readBlock : readBlocks)
+        {
+            ASSERT_THAT(subsetBlockNums.find(readBlock.blockNum) != subsetBlockNums.end());
+            ASSERT_THAT(readBlock.equals(writeBlocks[readBlock.blockNum]));
+        }
+    }
+
+    /**
+     * Tests that we can delete one key's blocks, leaving other keys intact.
+     */
+    void testCanDeleteOneKeysBlocks(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+        auto p1 = Block::generateRandom("archive.zip", dataBlockSize, 3 * dataBlockSize, writeDataBuffers);
+        auto p2 = Block::generateRandom("video.mp4", dataBlockSize, 2 * dataBlockSize, writeDataBuffers);
+        engine->writeBlocks("archive.zip", p1.first);
+        engine->writeBlocks("video.mp4", p2.first);
+
+        uint32_t usedBeforeDelete = engine->dataUsedSize();
+        engine->deleteBlocks("archive.zip");
+        engine->reclaimSpace();
+
+        ASSERT_THAT(engine->getKeys().size() == 1);
+        ASSERT_THAT(engine->dataUsedSize() < usedBeforeDelete);
+
+        // deleted key can no longer be read
+        try
+        {
+            std::vector<unsigned char> readBuffer;
+            engine->readBlocks("archive.zip", p1.second, dataBlockSize, readBuffer);
+            FORCE_FAIL("read of deleted key should have failed");
+        }
+        catch (std::runtime_error &e)
+        {
+        }
+
+        // remaining key is intact
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks("video.mp4", p2.second, dataBlockSize, readBuffer);
+        for (uint32_t i = 0; i < readBlocks.size(); i++)
+            ASSERT_THAT(p2.first[i].equals(readBlocks[i]));
+    }
+
+    void testCanDeleteManyKeys(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::vector<std::string> keys = {"archive.zip", "video.mp4", "shakespeare.txt"};
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+        for (auto &key : keys)
+        {
+            auto p = Block::generateRandom(key, dataBlockSize, 2 * dataBlockSize, writeDataBuffers);
+            engine->writeBlocks(key, p.first);
+        }
+
+        // unknown keys are skipped
+        engine->deleteKeys({"archive.zip", "shakespeare.txt", "unknown"});
+        engine->reclaimSpace();
+
+        std::vector<std::string> remainingKeys = engine->getKeys();
+        ASSERT_THAT(remainingKeys.size() == 1);
+        ASSERT_THAT(remainingKeys[0].find("video.mp4") == 0);
+        ASSERT_THAT(engine->dataUsedSize() == 2 * dataBlockSize + 2 * sizeof(uint32_t));
+    }
+
+    void testCanGetKeys(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::vector<std::string> keys = {"archive.zip", "video.mp4", "shakespeare.txt"};
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+        for (auto &key : keys)
+        {
+            auto p = Block::generateRandom(key, dataBlockSize, dataBlockSize, writeDataBuffers);
+            engine->writeBlocks(key, p.first);
+        }
+
+        std::vector<std::string> readKeys = engine->getKeys();
+        ASSERT_THAT(readKeys.size() == keys.size());
+        for (auto &key : readKeys)
+        {
+            std::string k = StringUtils::removeNullChars(key);
+            ASSERT_THAT(std::find(keys.begin(), keys.end(), k) != keys.end());
+        }
+    }
+
+    void testCanGetKeysBlockNums(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 10);
+
+        std::string key = "archive.zip";
+        uint32_t N = 2;
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        auto p = Block::generateRandom(key, dataBlockSize, N * dataBlockSize, writeDataBuffers);
+        std::unordered_set<uint32_t> blockNumsWritten = p.second;
+        engine->writeBlocks(key, p.first);
+
+        std::vector<uint32_t> blockNumsRead = engine->getBlockNums(key, dataBlockSize);
+
+        ASSERT_THAT(blockNumsRead.size() == blockNumsWritten.size());
+        for (auto &bn : blockNumsRead)
+            ASSERT_THAT(blockNumsWritten.find(bn) != blockNumsWritten.end());
+    }
+
+    void testCanOverwriteExistingKey(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::string key = "archive.zip";
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        // write N blocks
+        uint32_t N = 5;
+        auto p = Block::generateRandom(key, dataBlockSize, N * dataBlockSize, writeDataBuffers);
+        engine->writeBlocks(key, p.first);
+        uint32_t usedSizeN = engine->dataUsedSize();
+
+        // overwrite with M < N blocks
+        uint32_t M = N - 2;
+        p = Block::generateRandom(key, dataBlockSize, M * dataBlockSize, writeDataBuffers);
+        engine->writeBlocks(key, p.first);
+
+        ASSERT_THAT(engine->getKeys().size() == 1);
+        ASSERT_THAT(engine->dataUsedSize() < usedSizeN);
+        ASSERT_THAT(engine->getBlockNums(key, dataBlockSize).size() == M);
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks(key, p.second, dataBlockSize, readBuffer);
+        for (uint32_t i = 0; i < M; i++)
+            ASSERT_THAT(p.first[i].equals(readBlocks[i]));
+    }
+
+    void testCanAppendBlocks(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::string key = "archive.zip";
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        // append to a new key is a write of blocks 0, 1 and partial block 2
+        auto p = Block::generateRandom(key, dataBlockSize, 2 * dataBlockSize + 10, writeDataBuffers);
+        engine->appendBlocks(key, p.first, dataBlockSize);
+
+        // fill block 2, then add 3 and partial block 4
+        auto q = Block::generateRandom(key, dataBlockSize, 2 * dataBlockSize + 5, writeDataBuffers);
+        std::vector<Block> appended = q.first;
+        for (uint32_t i = 0; i < appended.size(); i++)
+            appended[i].blockNum = i + 2;
+        engine->appendBlocks(key, appended, dataBlockSize);
+
+        std::vector<uint32_t> blockNums = engine->getBlockNums(key, dataBlockSize);
+        ASSERT_THAT(blockNums == std::vector<uint32_t>({0, 1, 2, 3, 4}));
+        ASSERT_THAT(engine->dataUsedSize() == 4 * dataBlockSize + 5 + 5 * sizeof(uint32_t));
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks(key, {0, 1, 2, 3, 4}, dataBlockSize, readBuffer);
+        ASSERT_THAT(readBlocks.size() == 5);
+        for (uint32_t i = 0; i < 2; i++)
+            ASSERT_THAT(p.first[i].equals(readBlocks[i]));
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            ASSERT_THAT(readBlocks[i + 2].blockNum == appended[i].blockNum);
+            ASSERT_THAT(std::equal(appended[i].dataStart, appended[i].dataEnd, readBlocks[i + 2].dataStart, readBlocks[i + 2].dataEnd));
+        }
+    }
+
+    void testAppendMustFollowOn(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::string key = "archive.zip";
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        // blocks 0 and partial block 1
+        auto p = Block::generateRandom(key, dataBlockSize, dataBlockSize + 10, writeDataBuffers);
+        engine->writeBlocks(key, p.first);
+        uint32_t usedSize = engine->dataUsedSize();
+
+        // appending block 2 without filling block 1 must fail, and leave the key intact
+        auto q = Block::generateRandom(key, dataBlockSize, dataBlockSize, writeDataBuffers);
+        q.first[0].blockNum = 2;
+        try
+        {
+            engine->appendBlocks(key, q.first, dataBlockSize);
+            FORCE_FAIL("append after partial tail block should have failed");
+        }
+        catch (std::runtime_error &e)
+        {
+        }
+
+        ASSERT_THAT(engine->dataUsedSize() == usedSize);
+        ASSERT_THAT(engine->getBlockNums(key, dataBlockSize).size() == 2);
+    }
+
+    void testAppendReplacesResentBlocks(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::string key = "archive.zip";
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        // this node's share of the key: blocks 0, 3, 5 and partial block 6
+        auto p = Block::generateRandom(key, dataBlockSize, 3 * dataBlockSize + 10, writeDataBuffers);
+        std::vector<uint32_t> storedBlockNums = {0, 3, 5, 6};
+        for (uint32_t i = 0; i < p.first.size(); i++)
+            p.first[i].blockNum = storedBlockNums[i];
+        engine->writeBlocks(key, p.first);
+
+        // a retried append re-sends blocks 4 and 6, then partial block 8
+        auto q = Block::generateRandom(key, dataBlockSize, 2 * dataBlockSize + 20, writeDataBuffers);
+        std::vector<Block> appended = q.first;
+        std::vector<uint32_t> appendedBlockNums = {4, 6, 8};
+        for (uint32_t i = 0; i < appended.size(); i++)
+            appended[i].blockNum = appendedBlockNums[i];
+        engine->appendBlocks(key, appended, dataBlockSize);
+
+        ASSERT_THAT(engine->getBlockNums(key, dataBlockSize) == std::vector<uint32_t>({0, 3, 4, 6, 8}));
+        ASSERT_THAT(engine->dataUsedSize() == 4 * dataBlockSize + 20 + 5 * sizeof(uint32_t));
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks(key, {0, 3, 4, 6, 8}, dataBlockSize, readBuffer);
+        ASSERT_THAT(readBlocks.size() == 5);
+        ASSERT_THAT(p.first[0].equals(readBlocks[0]));
+        ASSERT_THAT(p.first[1].equals(readBlocks[1]));
+        for (uint32_t i = 0; i < appended.size(); i++)
+            ASSERT_THAT(std::equal(appended[i].dataStart, appended[i].dataEnd, readBlocks[i + 2].dataStart, readBlocks[i + 2].dataEnd));
+
+        // re-sending from before every stored block replaces them all
+        auto r = Block::generateRandom(key, dataBlockSize, 10, writeDataBuffers);
+        engine->appendBlocks(key, r.first, dataBlockSize);
+
+        ASSERT_THAT(engine->getBlockNums(key, dataBlockSize) == std::vector<uint32_t>({0}));
+        ASSERT_THAT(engine->dataUsedSize() == 10 + sizeof(uint32_t));
+    }
+
+    void testCanUpdateBlocks(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::string key = "archive.zip";
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        // blocks 0, 1 and partial block 2, followed by another key
+        auto p = Block::generateRandom(key, dataBlockSize, 2 * dataBlockSize + 10, writeDataBuffers);
+        engine->writeBlocks(key, p.first);
+        auto other = Block::generateRandom("video.mp4", dataBlockSize, dataBlockSize, writeDataBuffers);
+        engine->writeBlocks("video.mp4", other.first);
+
+        // replace block 0, and grow the tail block past its extent
+        auto q = Block::generateRandom(key, dataBlockSize, dataBlockSize, writeDataBuffers);
+        auto r = Block::generateRandom(key, dataBlockSize, 30, writeDataBuffers);
+        r.first[0].blockNum = 2;
+        std::vector<Block> updated = {q.first[0], r.first[0]};
+        engine->updateBlocks(key, updated, dataBlockSize);
+
+        ASSERT_THAT(engine->getBlockNums(key, dataBlockSize) == std::vector<uint32_t>({0, 1, 2}));
+        ASSERT_THAT(engine->dataUsedSize() == 3 * dataBlockSize + 30 + 4 * sizeof(uint32_t));
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks(key, {0, 1, 2}, dataBlockSize, readBuffer);
+        ASSERT_THAT(readBlocks.size() == 3);
+        ASSERT_THAT(std::equal(updated[0].dataStart, updated[0].dataEnd, readBlocks[0].dataStart, readBlocks[0].dataEnd));
+        ASSERT_THAT(p.first[1].equals(readBlocks[1]));
+        ASSERT_THAT(std::equal(updated[1].dataStart, updated[1].dataEnd, readBlocks[2].dataStart, readBlocks[2].dataEnd));
+
+        // other key untouched
+        std::vector<unsigned char> otherBuffer;
+        std::vector<Block> otherBlocks = engine->readBlocks("video.mp4", other.second, dataBlockSize, otherBuffer);
+        ASSERT_THAT(other.first[0].equals(otherBlocks[0]));
+    }
+
+    void testUpdateMustTargetStoredBlocks(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::string key = "archive.zip";
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        // blocks 0 and partial block 1
+        auto p = Block::generateRandom(key, dataBlockSize, dataBlockSize + 10, writeDataBuffers);
+        engine->writeBlocks(key, p.first);
+
+        auto full = Block::generateRandom(key, dataBlockSize, dataBlockSize, writeDataBuffers);
+        auto partial = Block::generateRandom(key, dataBlockSize, 10, writeDataBuffers);
+
+        // block not stored
+        full.first[0].blockNum = 2;
+        std::vector<std::vector<Block>> badUpdates = {full.first, partial.first};
+
+        // unknown key
+        try
+        {
+            engine->updateBlocks("video.mp4", p.first, dataBlockSize);
+            FORCE_FAIL("update of unknown key should have failed");
+        }
+        catch (std::runtime_error &e)
+        {
+        }
+
+        // block not stored, and partial non-tail block
+        for (auto &badUpdate : badUpdates)
+        {
+            try
+            {
+                engine->updateBlocks(key, badUpdate, dataBlockSize);
+                FORCE_FAIL("bad update should have failed");
+            }
+            catch (std::runtime_error &e)
+            {
+            }
+        }
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks(key, p.second, dataBlockSize, readBuffer);
+        for (uint32_t i = 0; i < readBlocks.size(); i++)
+            ASSERT_THAT(p.first[i].equals(readBlocks[i]));
+    }
+
+    void testMaxBlocksReached(EngineFactory createEngine)
+    {
+        uint32_t diskBlockSize = 4096;
+        uint32_t dataBlockSize = diskBlockSize - sizeof(uint32_t);
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        // 1MB max data size (2^20), 4KB disk block size (2^12) -> 2^8 raw blocks
+        uint32_t maxNumBlocks = 256;
+
+        // should successfully write N blocks
+        std::string key = "archive.zip";
+        uint32_t N = 230;
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        auto p = Block::generateRandom(key, dataBlockSize, N * dataBlockSize, writeDataBuffers);
+        engine->writeBlocks(key, p.first);
+        uint32_t usedSize = engine->dataUsedSize();
+
+        // should fail to write more blocks than are available
+        std::string newKey = "video.mp4";
+        uint32_t newN = maxNumBlocks - N;
+        std::vector<std::vector<unsigned char>> newDataBuffers;
+        auto newP = Block::generateRandom(newKey, diskBlockSize, newN * diskBlockSize, newDataBuffers);
+        try
+        {
+            engine->writeBlocks(newKey, newP.first);
+            FORCE_FAIL("write should have failed");
+        }
+        catch (std::runtime_error &e)
+        {
+        }
+
+        // ensure existing state has been maintained
+        ASSERT_THAT(engine->dataUsedSize() == usedSize);
+        ASSERT_THAT(engine->getKeys().size() == 1);
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks(key, p.second, dataBlockSize, readBuffer);
+        ASSERT_THAT(readBlocks.size() == N);
+    }
+
+    /**
+     * Testing that, on a failed write, the old key's data is left intact.
+     */
+    void testRestoreStateOnFailedWrite(EngineFactory createEngine)
+    {
+        uint32_t dataBlockSize = 40;
+        uint32_t diskBlockSize = 20;
+        auto engine = createEngine(diskBlockSize, 1u << 20);
+
+        std::string key = "archive.zip";
+        uint32_t N = 10;
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        auto p = Block::generateRandom(key, dataBlockSize, N * dataBlockSize, writeDataBuffers);
+        engine->writeBlocks(key, p.first);
+        uint32_t usedSize = engine->dataUsedSize();
+
+        /**
+         * Setting dataSize to 0 when underlying data is non-zero size
+         * will cause writeBlocks() to cancel the write.
+         */
+        std::vector<std::vector<unsigned char>> brokenDataBuffers;
+        auto broken = Block::generateRandom(key, dataBlockSize, N * dataBlockSize, brokenDataBuffers);
+        broken.first[0].dataSize = 0;
+
+        try
+        {
+            engine->writeBlocks(key, broken.first);
+            FORCE_FAIL("write should have failed");
+        }
+        catch (std::runtime_error &e)
+        {
+        }
+
+        ASSERT_THAT(engine->dataUsedSize() == usedSize);
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> readBlocks = engine->readBlocks(key, p.second, dataBlockSize, readBuffer);
+        for (uint32_t i = 0; i < N; i++)
+            ASSERT_THAT(p.first[i].equals(readBlocks[i]));
+    }
+
+    /**
+     * Runs all tests against the engine created by `createEngine`.
+     */
+    void runAll(std::string engineName, EngineFactory createEngine)
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "StorageEngineTests: " << engineName << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void(EngineFactory)>>> tests = {
+            TEST(testCanWriteAndReadOneKeysBlocks),
+            TEST(testCanWriteAndReadMultipleKeysBlocks),
+            TEST(testCanReadSubsetOfBlocks),
+            TEST(testCanDeleteOneKeysBlocks),
+            TEST(testCanDeleteManyKeys),
+            TEST(testCanGetKeys),
+            TEST(testCanGetKeysBlockNums),
+            TEST(testCanOverwriteExistingKey),
+            TEST(testCanAppendBlocks),
+            TEST(testAppendMustFollowOn),
+            TEST(testAppendReplacesResentBlocks),
+            TEST(testCanUpdateBlocks),
+            TEST(testUpdateMustTargetStoredBlocks),
+            TEST(testMaxBlocksReached),
+            TEST(testRestoreStateOnFailedWrite)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            std::function<void()> test = [&]() { func(createEngine); };
+            TestUtils::runTest(name, test);
+        }
+
+        std::cerr << std::endl;
+    }
+
+    /**
+     * Runs all tests against every engine.
+     */
+    void runAll()
+    {
+        runAll("DiskStorage", [](uint32_t diskBlockSize, uint32_t maxDataSize) {
+            return std::make_unique<DiskStorage>("rackkey", "store", diskBlockSize, maxDataSize, true);
+        });
+        fs::remove(fs::path("rackkey/store"));
+
+        runAll("MemoryStorage", [](uint32_t diskBlockSize, uint32_t maxDataSize) {
+            return std::make_unique<MemoryStorage>(diskBlockSize, maxDataSize);
+        });
+
+        runAll("TieredStorage", [](uint32_t diskBlockSize, uint32_t maxDataSize) {
+            return std::make_unique<TieredStorage>(
+                std::make_unique<MemoryStorage>(diskBlockSize, maxDataSize),
+                std::make_unique<DiskStorage>("rackkey", "store", diskBlockSize, maxDataSize, true),
+                TieringConfig(),
+                nullptr,
+                false
+            );
+        });
+        fs::remove(fs::path("rackkey/store"));
+    }
+}
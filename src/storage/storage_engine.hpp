@@ -0,0 +1,296 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_set>
+
+#include "block.hpp"
+#include "access_tracker.hpp"
+
+/**
+ * Interface implemented by each of a storage node's storage engines.
+ *
+ * A storage engine stores the blocks of each key it is given, and
+ * can read/delete them back out by key.
+ *
+ * NOTE:
+ *
+ * All engines store a key's blocks as one contiguous 'extent' of the form:
+ *
+ *      blockNum - 4 bytes
+ *      data     - dataBlockSize bytes (or less, for the final block)
+ *      blockNum - 4 bytes
+ *      data     - ...
+ *      ...
+ *
+ * packBlocks() and unpackBlocks() convert to/from this format.
+ */
+class StorageEngine
+{
+public:
+    virtual ~StorageEngine() = default;
+
+    /**
+     * Retreive blocks `blockNums` of key `key`,
+     * each of which should have a data size of `dataBlockSize`.
+     *
+     * Throws:
+     *      runtime_error() - on any error during the reading process
+     *
+     * NOTE:
+     *
+     * `readBuffer` is the buffer we read the raw block data into.
+     * i.e. block pointers point to positions in `readBuffer`.
+     */
+    virtual std::vector<Block> readBlocks(
+        std::string key,
+        std::unordered_set<uint32_t> blockNums,
+        uint32_t dataBlockSize,
+        std::vector<unsigned char> &readBuffer) = 0;
+
+    /**
+     * Retreive blocks `blockNums` of key `key`, as part of a bulk scan of
+     * many keys (e.g. rebalancing, sync), which shouldn't displace data 
+     * cached for regular reads.
+     * 
+     * NOTE:
+     * 
+     * Engines without a cache to protect need not override this.
+     */
+    virtual std::vector<Block> scanBlocks(
+        std::string key,
+        std::unordered_set<uint32_t> blockNums,
+        uint32_t dataBlockSize,
+        std::vector<unsigned char> &readBuffer)
+    {
+        return readBlocks(key, blockNums, dataBlockSize, readBuffer);
+    }
+
+    /**
+     * Write the given list of blocks `dataBlocks` for the given `key`.
+     *
+     * Throws:
+     *      runtime_error() - on any error during the writing process
+     *
+     * NOTE:
+     *
+     * If `key` already exists, we overwrite its existing blocks.
+     */
+    virtual void writeBlocks(std::string key, std::vector<Block> dataBlocks) = 0;
+
+    /**
+     * Appends the given list of blocks `dataBlocks` to the blocks already
+     * stored for the given `key`, each of which has a data size of `dataBlockSize`.
+     * 
+     * Throws:
+     *      runtime_error() - on any error during the writing process, or
+     *                        if `dataBlocks` don't follow on from the stored blocks
+     * 
+     * NOTE:
+     * 
+     * `dataBlocks` must be in ascending block number order. The first may 
+     * re-send the key's stored tail block (e.g. once the tail has been filled),
+     * in which case it replaces it. It may also re-send earlier blocks, e.g. 
+     * when an append that failed on another node is retried, in which case
+     * every stored block from it on is replaced. If `key` doesn't exist, 
+     * this is a write.
+     */
+    virtual void appendBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize) = 0;
+
+    /**
+     * Replaces blocks `dataBlocks` of the given `key` with the given
+     * data, leaving its other blocks untouched. Each block has a 
+     * data size of `dataBlockSize`.
+     * 
+     * Throws:
+     *      runtime_error() - on any error during the writing process, or
+     *                        if `key` doesn't already store each block
+     * 
+     * NOTE:
+     * 
+     * Only the key's stored tail block may change size; the rest must be full.
+     */
+    virtual void updateBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize) = 0;
+
+    /**
+     * Deletes all blocks of the given `key`.
+     *
+     * Throws:
+     *      runtime_error - on any error during the deleting process
+     */
+    virtual void deleteBlocks(std::string key) = 0;
+
+    /**
+     * Deletes all blocks of each of the given `keys`, skipping
+     * keys that don't exist.
+     * 
+     * Throws:
+     *      runtime_error - on any error during the deleting process
+     */
+    virtual void deleteKeys(std::vector<std::string> keys) = 0;
+
+    /**
+     * Moves all blocks of `fromKey` to `toKey`, replacing any 
+     * blocks `toKey` already has.
+     * 
+     * Throws:
+     *      runtime_error - if `fromKey` doesn't exist, or on any 
+     *                      error during the move
+     * 
+     * NOTE:
+     * 
+     * Used to commit a streamed PUT's staged blocks (see ApiUtils::stagedKey()),
+     * so the key's old blocks stay readable until then.
+     */
+    virtual void renameKey(std::string fromKey, std::string toKey) = 0;
+
+    /**
+     * Synchronously reclaims the space of any deleted keys
+     * still pending reclamation.
+     * 
+     * NOTE:
+     * 
+     * Engines that reclaim space inline on delete need not override this.
+     */
+    virtual void reclaimSpace() {}
+
+    /**
+     * Returns list of keys this engine stores.
+     */
+    virtual std::vector<std::string> getKeys() = 0;
+
+    /**
+     * Returns block numbers this engine stores for the
+     * given key `key`.
+     */
+    virtual std::vector<uint32_t> getBlockNums(std::string key, uint32_t dataBlockSize) = 0;
+
+    /**
+     * Returns num. bytes used of data section
+     */
+    virtual uint32_t dataUsedSize() = 0;
+
+    /**
+     * Returns total size (in bytes) of the data section
+     */
+    virtual uint32_t dataTotalSize() = 0;
+
+    /**
+     * Returns read access stats (see AccessStats).
+     * 
+     * NOTE: engines that don't track reads return all zeroes.
+     */
+    virtual AccessStats accessStats() { return AccessStats(); }
+
+protected:
+    /**
+     * Packs `dataBlocks` into a single extent buffer (see format above).
+     */
+    static std::vector<unsigned char> packBlocks(std::vector<Block> &dataBlocks);
+
+    /**
+     * Returns the packed size (in bytes) of `dataBlocks`.
+     */
+    static uint32_t packedSize(std::vector<Block> &dataBlocks);
+
+    /**
+     * Builds Block objects for `requestedBlockNums` from the extent buffer
+     * `extent`. Block data pointers point into `extent`.
+     *
+     * Throws:
+     *      runtime_error() - if not all requested blocks are present
+     */
+    static std::vector<Block> unpackBlocks(
+        std::string &key,
+        std::unordered_set<uint32_t> &requestedBlockNums,
+        uint32_t dataBlockSize,
+        std::vector<unsigned char> &extent);
+
+    /**
+     * Returns the offset of the final (tail) block within an extent 
+     * of `extentNumBytes` bytes.
+     */
+    static uint32_t tailBlockOffset(uint32_t extentNumBytes, uint32_t dataBlockSize);
+
+    /**
+     * Returns the number of bytes of an existing extent to keep when appending
+     * `dataBlocks` to it, i.e. the offset at which the appended blocks are written.
+     * 
+     * `tailBlockNum` is the block number of the extent's tail block, and
+     * `readStoredBlockNums` returns all the block numbers stored in the extent,
+     * in order (only called if `dataBlocks` re-send blocks before the tail).
+     * 
+     * Throws:
+     *      runtime_error() - if `dataBlocks` don't follow on from the extent
+     */
+    static uint32_t appendOffset(
+        uint32_t extentNumBytes,
+        uint32_t tailBlockNum,
+        std::vector<Block> &dataBlocks,
+        uint32_t dataBlockSize,
+        const std::function<std::vector<uint32_t>()> &readStoredBlockNums);
+
+    /**
+     * Returns the offset within an existing extent of each of `dataBlocks`, 
+     * which replace blocks already stored in it.
+     * 
+     * `storedBlockNums` are the block numbers stored in the extent, in order.
+     * 
+     * Throws:
+     *      runtime_error() - if any block isn't stored, or a non-tail block isn't full
+     */
+    static std::vector<uint32_t> updateOffsets(
+        std::vector<uint32_t> &storedBlockNums,
+        std::vector<Block> &dataBlocks,
+        uint32_t dataBlockSize);
+
+    /**
+     * Returns all block numbers stored in the extent buffer `extent`.
+     */
+    static std::vector<uint32_t> unpackBlockNums(
+        uint32_t dataBlockSize,
+        std::vector<unsigned char> &extent);
+};
+
+////////////////////////////////////////////
+// StorageEngine tests
+////////////////////////////////////////////
+
+/**
+ * Engine-agnostic test suite, run against every StorageEngine implementation.
+ */
+namespace StorageEngineTests
+{
+    /**
+     * Creates a fresh engine with the given disk block size and max data size.
+     */
+    using EngineFactory = std::function<std::unique_ptr<StorageEngine>(uint32_t, uint32_t)>;
+
+    void testCanWriteAndReadOneKeysBlocks(EngineFactory createEngine);
+    void testCanWriteAndReadMultipleKeysBlocks(EngineFactory createEngine);
+    void testCanReadSubsetOfBlocks(EngineFactory createEngine);
+    void testCanDeleteOneKeysBlocks(EngineFactory createEngine);
+    void testCanDeleteManyKeys(EngineFactory createEngine);
+    void testCanGetKeys(EngineFactory createEngine);
+    void testCanGetKeysBlockNums(EngineFactory createEngine);
+    void testCanOverwriteExistingKey(EngineFactory createEngine);
+    void testCanAppendBlocks(EngineFactory createEngine);
+    void testAppendMustFollowOn(EngineFactory createEngine);
+    void testAppendReplacesResentBlocks(EngineFactory createEngine);
+    void testCanUpdateBlocks(EngineFactory createEngine);
+    void testUpdateMustTargetStoredBlocks(EngineFactory createEngine);
+    void testMaxBlocksReached(EngineFactory createEngine);
+    void testRestoreStateOnFailedWrite(EngineFactory createEngine);
+
+    /**
+     * Runs all tests against the engine created by `createEngine`.
+     */
+    void runAll(std::string engineName, EngineFactory createEngine);
+
+    /**
+     * Runs all tests against every engine.
+     */
+    void runAll();
+}
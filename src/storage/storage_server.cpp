@@ -1,17 +1,35 @@
 #include <cpprest/http_listener.h>
 #include <cpprest/json.h>
 #include <cpprest/http_client.h>
+#include <cpprest/producerconsumerstream.h>
+#include <pplx/threadpool.h>
 
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <cstdlib>
 #include <set>
+#include <map>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
 
 #include "block.hpp"
 #include "utils.hpp"
+#include "storage_engine.hpp"
 #include "disk_storage.hpp"
+#include "memory_storage.hpp"
+#include "tiered_storage.hpp"
+#include "placement_index.hpp"
+#include "io_scheduler.hpp"
 #include "storage_config.hpp"
 #include "payloads.hpp"
+#include "server_lifecycle.hpp"
+#include "worker_pool.hpp"
+#include "rpc.hpp"
 
 using namespace web;
 using namespace web::http;
@@ -23,79 +41,272 @@ class StorageServer
 private:
 
     /**
-     * On-disk storage for this node
+     * Storage engine for this node (see storage_engine.hpp)
      */
-    std::unique_ptr<DiskStorage> diskStorage;
+    std::unique_ptr<StorageEngine> storageEngine;
+
+    /**
+     * Index of stored blocks, ordered by their ring placement hash
+     */
+    PlacementIndex placementIndex;
 
     StorageConfig config;
 
+    /**
+     * Schedules this node's storage I/O by priority class (see io_scheduler.hpp)
+     */
+    IoScheduler ioScheduler;
+
+    /**
+     * `storageEngine`, if tiering is enabled (see tiered_storage.hpp)
+     */
+    TieredStorage *tieredStorage = nullptr;
+
+    /**
+     * Runs handlers off cpprest's threads, if `workerThreads` is set
+     * (see worker_pool.hpp)
+     */
+    std::unique_ptr<WorkerPool> workerPool;
+
+    /* Tracks in-flight requests, so shutdown can drain them (see startServer()) */
+    ServerLifecycle lifecycle;
+
+    /**
+     * Serves the master's RPCs (see rpc.hpp), if `rpcPortOffset` is set
+     */
+    std::unique_ptr<RpcServer> rpcServer;
+
 public:
 
     /**
      * Param constructor
      */
     StorageServer(std::string configFilePath)
-        : config(configFilePath)
+        : config(configFilePath),
+          ioScheduler(config.ioMaxInFlight, config.ioClassConfigs)
     {
-        // initialise on-disk storage
+        // initialise storage engine
         std::string storeDirPath = config.storeDirPath;
         std::string storeFileName = config.storeFilePrefix + std::to_string(getNodeIDFromEnv());
         uint32_t diskBlockSize = config.diskBlockSize;
         uint32_t maxDataSize = 1u << config.maxDataSizePower;
         bool removeExistingStoreFile = config.removeExistingStoreFile;
-        uint32_t keyLengthMax = config.keyLengthMax;
+        uint32_t keyLengthMax = this->maxStoredKeyLength();
         
-        this->diskStorage = std::make_unique<DiskStorage>(
-            storeDirPath,
-            storeFileName,
-            diskBlockSize,
-            maxDataSize,
-            removeExistingStoreFile,
-            keyLengthMax
-        );
+        if (config.storageEngine == "disk")
+        {
+            this->storageEngine = std::make_unique<DiskStorage>(
+                storeDirPath,
+                storeFileName,
+                diskBlockSize,
+                maxDataSize,
+                removeExistingStoreFile,
+                keyLengthMax,
+                config.punchHoleOnReclaim,
+                config.readaheadMaxBytes
+            );
+        }
+        else if (config.storageEngine == "memory")
+        {
+            this->storageEngine = std::make_unique<MemoryStorage>(
+                diskBlockSize,
+                maxDataSize
+            );
+        }
+        else
+            throw std::runtime_error("Unknown storage engine: " + config.storageEngine);
+
+        // front the engine with a hot tier
+        if (config.tieringEnabled)
+        {
+            std::unique_ptr<StorageEngine> hotTier;
+            uint32_t hotMaxDataSize = 1u << config.hotMaxDataSizePower;
+
+            // hot tier contents aren't tracked across restarts, so always start afresh
+            if (config.hotStorageEngine == "disk")
+            {
+                fs::create_directories(config.hotStoreDirPath);
+                hotTier = std::make_unique<DiskStorage>(
+                    config.hotStoreDirPath,
+                    storeFileName,
+                    diskBlockSize,
+                    hotMaxDataSize,
+                    true,
+                    keyLengthMax
+                );
+            }
+            else if (config.hotStorageEngine == "memory")
+                hotTier = std::make_unique<MemoryStorage>(diskBlockSize, hotMaxDataSize);
+            else
+                throw std::runtime_error("Unknown hot tier storage engine: " + config.hotStorageEngine);
+
+            auto tiered = std::make_unique<TieredStorage>(
+                std::move(hotTier),
+                std::move(this->storageEngine),
+                config.tieringConfig,
+                &this->ioScheduler
+            );
+            this->tieredStorage = tiered.get();
+            this->storageEngine = std::move(tiered);
+        }
+
+        // index any blocks already in storage
+        for (std::string &key : this->storageEngine->getKeys())
+            this->placementIndex.addKey(key, this->storageEngine->getBlockNums(key, config.dataBlockSize));
     }
 
+    ////////////////////////////////////////////
+    // Operations (shared by the HTTP and RPC APIs)
+    ////////////////////////////////////////////
+
     /**
-     * Retreives blocks of the given `key` from storage.
+     * Reads the blocks of key `key` listed in `payload` (a list of block
+     * numbers) from storage. Throws if they can't be read.
+     * 
+     * NOTE: 
+     * 
+     * Each block's data pointers point to positions in `readBuffer`.
      */
-    void getHandler(http_request request, std::string key)
+    std::vector<Block> readBlocks(const std::string &key, std::vector<unsigned char> &payload, std::vector<unsigned char> &readBuffer)
     {
-        std::cout << "GET /store req received: " << key << std::endl;
+        std::unordered_set<uint32_t> blockNums;
+        for (size_t i = 0; i + sizeof(uint32_t) <= payload.size(); i += sizeof(uint32_t))
+        {
+            uint32_t blockNum;
+            std::memcpy(&blockNum, payload.data() + i, sizeof(blockNum));
+            blockNums.insert(blockNum);
+        }
 
-        std::vector<unsigned char> readBuffer;
-        std::vector<Block> blocks;
+        IoScheduler::Ticket ticket = ioScheduler.acquire(IO_CLASS_INTERACTIVE, blockNums.size() * config.dataBlockSize);
+        return storageEngine->readBlocks(key, blockNums, config.dataBlockSize, readBuffer);
+    }
 
-        /**
-         * Retreive block numbers from request payload
-         */
-        std::unordered_set<uint32_t> blockNums;
+    /**
+     * Writes the blocks in `payload` (serialized Blocks) to storage for key
+     * `key`, replacing any it already has. Throws if they can't be written.
+     */
+    void storeBlocks(const std::string &key, std::vector<unsigned char> &payload)
+    {
+        std::vector<Block> blocks = Block::deserialize(payload);
 
-        auto task = request.extract_vector()
-        .then([&](std::vector<unsigned char> payload)
+        IoScheduler::Ticket ticket = ioScheduler.acquire(IO_CLASS_INTERACTIVE, payload.size());
+        storageEngine->writeBlocks(key, blocks);
+
+        std::vector<uint32_t> blockNums;
+        for (auto &block : blocks)
+            blockNums.push_back(block.blockNum);
+        placementIndex.addKey(key, blockNums);
+    }
+
+    /**
+     * Appends the blocks in `payload` to key `key`'s extents.
+     * 
+     * NOTE:
+     * 
+     * The first block may be a re-send of the key's tail block
+     * (see StorageEngine::appendBlocks()).
+     */
+    void appendBlocks(const std::string &key, std::vector<unsigned char> &payload)
+    {
+        std::vector<Block> blocks = Block::deserialize(payload);
+
+        IoScheduler::Ticket ticket = ioScheduler.acquire(IO_CLASS_INTERACTIVE, payload.size());
+        storageEngine->appendBlocks(key, blocks, config.dataBlockSize);
+
+        std::vector<uint32_t> blockNums;
+        for (auto &block : blocks)
+            blockNums.push_back(block.blockNum);
+        placementIndex.addBlocks(key, blockNums);
+    }
+
+    /**
+     * Replaces the blocks in `payload`, leaving key `key`'s other blocks
+     * on this node untouched.
+     * 
+     * NOTE:
+     * 
+     * Each block must already be stored for the key
+     * (see StorageEngine::updateBlocks()).
+     */
+    void updateBlocks(const std::string &key, std::vector<unsigned char> &payload)
+    {
+        std::vector<Block> blocks = Block::deserialize(payload);
+
+        IoScheduler::Ticket ticket = ioScheduler.acquire(IO_CLASS_INTERACTIVE, payload.size());
+        storageEngine->updateBlocks(key, blocks, config.dataBlockSize);
+    }
+
+    /**
+     * Deletes all blocks of key `key` from this node.
+     */
+    void deleteKey(const std::string &key)
+    {
+        IoScheduler::Ticket ticket = ioScheduler.acquire(IO_CLASS_INTERACTIVE, config.diskBlockSize);
+        storageEngine->deleteBlocks(key);
+        placementIndex.removeKey(key);
+    }
+
+    /**
+     * Moves the blocks of the key named by `payload` to key `key`, replacing
+     * any it has (see StorageEngine::renameKey()).
+     */
+    void renameKey(const std::string &key, std::vector<unsigned char> &payload)
+    {
+        std::string fromKey(payload.begin(), payload.end());
+        if (fromKey.size() > this->maxStoredKeyLength())
+            throw std::runtime_error("renameKey() - key exceeds max. key length: " + fromKey);
+
+        IoScheduler::Ticket ticket = ioScheduler.acquire(IO_CLASS_INTERACTIVE, config.diskBlockSize);
+        storageEngine->renameKey(fromKey, key);
+        placementIndex.renameKey(fromKey, key);
+    }
+
+    /**
+     * Deletes all blocks of each key listed in `payload`, which is a
+     * newline-separated list of keys.
+     * 
+     * NOTE:
+     * 
+     * Keys this node doesn't store are skipped. Deleted keys' space 
+     * is reclaimed in the background by the storage engine, so the
+     * size response may not yet reflect it.
+     */
+    void deleteKeys(const std::string &payload)
+    {
+        std::vector<std::string> keys;
+        std::istringstream iss(payload);
+        std::string key;
+        while (std::getline(iss, key))
         {
-            auto it = payload.begin();
-            while (it != payload.end())
-            {
-                uint32_t blockNum;
-                std::memcpy(&blockNum, &(*it), sizeof(blockNum));
-                it += sizeof(blockNum);
+            if (key.empty())
+                continue;
+            keys.push_back(key);
+        }
 
-                blockNums.insert(blockNum);
-            }
-        });
+        IoScheduler::Ticket ticket = ioScheduler.acquire(IO_CLASS_INTERACTIVE, keys.size() * config.diskBlockSize);
+        storageEngine->deleteKeys(keys);
+        for (std::string &key : keys)
+            placementIndex.removeKey(key);
+    }
 
-        task.wait();
+    ////////////////////////////////////////////
+    // HTTP handlers
+    ////////////////////////////////////////////
 
-        /**
-         * Retreive requested blocks from disk.
-         * 
-         * NOTE: 
-         * 
-         * Each block's data pointers point to positions in `readBuffer`.
-         */
+    /**
+     * Retreives blocks of the given `key` from storage (see readBlocks()).
+     */
+    void getHandler(http_request request, std::string key)
+    {
+        std::cout << "GET /store req received: " << key << std::endl;
+
+        std::vector<unsigned char> payload = request.extract_vector().get();
+
+        std::vector<unsigned char> readBuffer;
+        std::vector<Block> blocks;
         try 
         {
-            blocks = diskStorage->readBlocks(key, blockNums, config.dataBlockSize, readBuffer);
+            blocks = this->readBlocks(key, payload, readBuffer);
         }
         catch (std::runtime_error &e)
         {
@@ -118,63 +329,87 @@ public:
     }
 
     /**
-     * Writes given blocks to storage for the given key `key`.
+     * Writes given blocks to storage for the given key `key` (see storeBlocks()).
      */
     void putHandler(http_request request, std::string key)
     {
         std::cout << "PUT /store req received: " << key << std::endl;
 
-        auto payloadBuffer = std::make_shared<std::vector<unsigned char>>();
-
-        /**
-         * Extract list of blocks from payload and write
-         * them to disk.
-         */
-        pplx::task<void> task = request.extract_vector()
-        .then([&](std::vector<unsigned char> payload)
-        {
-            *payloadBuffer = std::move(payload);
-            std::vector<Block> blocks = Block::deserialize(*payloadBuffer);
-            
-            try
-            {
-                diskStorage->writeBlocks(key, blocks);
-            }
-            catch (std::runtime_error &e)
-            {
-                std::cout << e.what() << std::endl;
-                request.reply(status_codes::InternalError);
-                return;
-            }
-
-        });
+        std::vector<unsigned char> payload = request.extract_vector().get();
+        this->replyWithSize(request, [&]() { this->storeBlocks(key, payload); });
+    }
+    
+    /**
+     * Appends given blocks to storage for the given key `key` (see appendBlocks()).
+     */
+    void appendHandler(http_request request, std::string key)
+    {
+        std::cout << "PUT /append req received: " << key << std::endl;
 
-        task.wait();
+        std::vector<unsigned char> payload = request.extract_vector().get();
+        this->replyWithSize(request, [&]() { this->appendBlocks(key, payload); });
+    }
 
-        std::vector<unsigned char> responseBuffer = createSizeResponsePayload();
+    /**
+     * Replaces given blocks of the given key `key` (see updateBlocks()).
+     */
+    void updateHandler(http_request request, std::string key)
+    {
+        std::cout << "PUT /update req received: " << key << std::endl;
 
-        // send success response
-        http_response response;
-        response.set_status_code(status_codes::OK);
-        response.set_body(responseBuffer);
-        request.reply(response);
-        return;
+        std::vector<unsigned char> payload = request.extract_vector().get();
+        this->replyWithSize(request, [&]() { this->updateBlocks(key, payload); });
     }
-    
+
     /**
      * Deletes all blocks of the given key `key` from this node.
      */
     void deleteHandler(http_request request, std::string key)
     {
         std::cout << "DEL /store req received: " << key << std::endl;
+
+        this->replyWithSize(request, [&]() { this->deleteKey(key); });
+    }
+
+    /**
+     * Moves the blocks of the key named in the request payload to 
+     * the given key `key` (see renameKey()).
+     */
+    void renameHandler(http_request request, std::string key)
+    {
+        std::cout << "PUT /rename req received: " << key << std::endl;
+
+        std::vector<unsigned char> payload = request.extract_vector().get();
+        this->replyWithSize(request, [&]() { this->renameKey(key, payload); });
+    }
+
+    /**
+     * Deletes all blocks of each key listed in the request payload
+     * (see deleteKeys()).
+     */
+    void deleteKeysHandler(http_request request)
+    {
+        std::cout << "DEL /keys req received" << std::endl;
+
+        std::string payload = request.extract_string().get();
+        this->replyWithSize(request, [&]() { this->deleteKeys(payload); });
+    }
+
+    /**
+     * Runs `operation`, then replies to `request` with a 'size response'
+     * (see createSizeResponsePayload()), or a 500 if it fails.
+     */
+    void replyWithSize(http_request request, std::function<void()> operation)
+    {
         try
         {
-            diskStorage->deleteBlocks(key);
+            operation();
         }
         catch (std::runtime_error &e)
         {
             std::cout << e.what() << std::endl;
             request.reply(status_codes::InternalError);
+            return;
         }
 
         std::vector<unsigned char> responseBuffer = createSizeResponsePayload();
@@ -184,7 +419,194 @@ public:
         response.set_status_code(status_codes::OK);
         response.set_body(responseBuffer);
         request.reply(response);
-        return;
+    }
+
+    // how much of a /range response may wait unread by the caller
+    static constexpr size_t RANGE_WINDOW_BYTES = 8u << 20;
+
+    // how long a /range response waits on a caller that has stopped reading
+    static constexpr std::chrono::seconds RANGE_STALL_TIMEOUT{30};
+
+    // bounds of the interval a /range response polls a slow caller at
+    static constexpr std::chrono::milliseconds RANGE_POLL_MIN{1};
+    static constexpr std::chrono::milliseconds RANGE_POLL_MAX{16};
+
+    /**
+     * Streams all blocks whose ring placement hash falls in the range
+     * given by `range`, of the form "{START}-{END}" (i.e. [START, END)).
+     * 
+     * The response is one large sequential transfer of serialized Block
+     * objects (see Block::serialize()), produced one key extent at a time,
+     * and only while at most RANGE_WINDOW_BYTES of it are unread, so that
+     * memory use is bounded by the window plus the largest extent.
+     * 
+     * NOTE:
+     * 
+     * If END <= START, the range wraps around the ring.
+     * 
+     * A key that fails to scan (e.g. as it was overwritten since we consulted
+     * the index) is rescanned from the index once every other key is sent, and
+     * skipped only if it has been deleted since. If it fails again, or the
+     * caller stops reading, the response is aborted, so the caller sees a
+     * failed transfer rather than a silently incomplete one.
+     */
+    void rangeHandler(http_request request, std::string range)
+    {
+        std::cout << "GET /range req received: " << range << std::endl;
+
+        uint32_t startHash;
+        uint32_t endHash;
+        try
+        {
+            size_t dashPos = range.find('-');
+            if (dashPos == std::string::npos)
+                throw std::invalid_argument("missing '-'");
+
+            startHash = std::stoul(range.substr(0, dashPos));
+            endHash = std::stoul(range.substr(dashPos + 1));
+        }
+        catch (std::exception &e)
+        {
+            std::cout << "Bad range: " << range << std::endl;
+            request.reply(status_codes::BadRequest);
+            return;
+        }
+
+        concurrency::streams::producer_consumer_buffer<uint8_t> responseBuffer;
+
+        http_response response(status_codes::OK);
+        response.set_body(responseBuffer.create_istream());
+        request.reply(response);
+
+        try
+        {
+            std::set<std::string> failedKeys = streamRange(startHash, endHash, {}, responseBuffer);
+
+            // rescan the keys that failed, with their current blocks
+            if (!failedKeys.empty())
+                failedKeys = streamRange(startHash, endHash, failedKeys, responseBuffer);
+
+            if (!failedKeys.empty())
+                throw std::runtime_error("GET /range - " + std::to_string(failedKeys.size()) + " key(s) failed to scan: " + range);
+        }
+        catch (std::runtime_error &e)
+        {
+            std::cout << e.what() << std::endl;
+            responseBuffer.close(std::ios_base::out, std::make_exception_ptr(e)).wait();
+            return;
+        }
+
+        responseBuffer.close(std::ios_base::out).wait();
+    }
+
+    /**
+     * Helper for rangeHandler().
+     * 
+     * Writes the blocks of the index range [startHash, endHash) to `responseBuffer`,
+     * only for keys in `onlyKeys` (if not empty), and returns the keys that failed
+     * to scan.
+     * 
+     * NOTE:
+     * 
+     * Throws if the caller stops reading (see waitForRangeReader()).
+     */
+    std::set<std::string> streamRange(
+        uint32_t startHash,
+        uint32_t endHash,
+        const std::set<std::string> &onlyKeys,
+        concurrency::streams::producer_consumer_buffer<uint8_t> &responseBuffer
+    )
+    {
+        /**
+         * Group the range's blocks by key, so each key's extent
+         * is read exactly once.
+         */
+        std::map<std::string, std::unordered_set<uint32_t>> keyBlockNums;
+        for (PlacementEntry &entry : placementIndex.findRange(startHash, endHash))
+        {
+            if (onlyKeys.empty() || onlyKeys.count(entry.key))
+                keyBlockNums[entry.key].insert(entry.blockNum);
+        }
+
+        std::set<std::string> failedKeys;
+        for (auto &[key, blockNums] : keyBlockNums)
+        {
+            std::vector<unsigned char> readBuffer;
+            std::vector<Block> blocks;
+            try
+            {
+                IoScheduler::Ticket ticket = ioScheduler.acquire(IO_CLASS_REBALANCE, blockNums.size() * config.dataBlockSize);
+                blocks = storageEngine->scanBlocks(key, blockNums, config.dataBlockSize, readBuffer);
+            }
+            catch (std::runtime_error &e)
+            {
+                std::cout << e.what() << std::endl;
+                failedKeys.insert(key);
+                continue;
+            }
+
+            std::vector<unsigned char> payloadBuffer;
+            for (auto &block : blocks)
+                block.serialize(payloadBuffer);
+
+            responseBuffer.putn_nocopy(payloadBuffer.data(), payloadBuffer.size()).wait();
+            waitForRangeReader(responseBuffer);
+        }
+
+        return failedKeys;
+    }
+
+    /**
+     * Helper for streamRange().
+     * 
+     * Returns once at most RANGE_WINDOW_BYTES of `responseBuffer` are waiting
+     * to be read, and throws if the caller makes no progress for RANGE_STALL_TIMEOUT.
+     * 
+     * NOTE:
+     * 
+     * The buffer has no read notification, so this polls, backing off from
+     * RANGE_POLL_MIN to RANGE_POLL_MAX while the caller makes no progress.
+     */
+    void waitForRangeReader(concurrency::streams::producer_consumer_buffer<uint8_t> &responseBuffer)
+    {
+        size_t lastUnread = responseBuffer.in_avail();
+        auto lastProgress = std::chrono::steady_clock::now();
+        auto pollInterval = RANGE_POLL_MIN;
+
+        while (responseBuffer.in_avail() > RANGE_WINDOW_BYTES)
+        {
+            size_t unread = responseBuffer.in_avail();
+            auto now = std::chrono::steady_clock::now();
+
+            if (unread < lastUnread)
+            {
+                lastProgress = now;
+                pollInterval = RANGE_POLL_MIN;
+            }
+            else if (now - lastProgress > RANGE_STALL_TIMEOUT)
+                throw std::runtime_error("GET /range - caller stopped reading");
+
+            lastUnread = unread;
+            std::this_thread::sleep_for(pollInterval);
+            pollInterval = std::min(pollInterval * 2, RANGE_POLL_MAX);
+        }
+    }
+
+    /**
+     * Returns this node's read access stats (see AccessStats), 
+     * including its readahead prefetch hit rate, its I/O scheduler's
+     * per-class stats (see IoClassStats) and, if tiering is enabled,
+     * its migration stats (see TieringStats), as text.
+     */
+    void statsHandler(http_request request)
+    {
+        std::cout << "GET /stats req received" << std::endl;
+
+        std::string stats = storageEngine->accessStats().toString() + ioScheduler.statsString();
+        if (this->tieredStorage != nullptr)
+            stats += "[tiering]\n" + this->tieredStorage->tieringStats().toString();
+
+        request.reply(status_codes::OK, stats);
     }
 
     void syncHandler(http_request request)
@@ -205,12 +627,14 @@ public:
      * which is of the form:
      * 
      *      ----
+     *      keySize
      *      key0
      *      numBlocks      
      *      blockNumA
      *      blockNumB
      *      ...
      *      ----
+     *      keySize
      *      key1
      *      numBlocks
      *      blockNumA
@@ -221,19 +645,21 @@ public:
      * 
      * NOTE:
      * 
-     * 
+     * Each key's block numbers are read as a separate IO_CLASS_SYNC
+     * request, so a large sync never holds up foreground requests.
      */
     std::vector<unsigned char> createSyncResponsePayload()
     {
         std::map<std::string, std::vector<uint32_t>> keyBlockNumMap;
-        std::vector<std::string> keys = this->diskStorage->getKeys();
+        std::vector<std::string> keys = this->storageEngine->getKeys();
         for (std::string &key : keys)
         {
-            std::vector<uint32_t> blockNums = this->diskStorage->getBlockNums(key, this->config.dataBlockSize);
+            IoScheduler::Ticket ticket = this->ioScheduler.acquire(IO_CLASS_SYNC, this->config.diskBlockSize);
+            std::vector<uint32_t> blockNums = this->storageEngine->getBlockNums(key, this->config.dataBlockSize);
             keyBlockNumMap[key] = blockNums;
         }
 
-        Payloads::SizeInfo sizeInfo(this->diskStorage->dataUsedSize(), this->diskStorage->dataTotalSize());
+        Payloads::SizeInfo sizeInfo(this->storageEngine->dataUsedSize(), this->storageEngine->dataTotalSize());
         Payloads::SyncInfo syncInfo(keyBlockNumMap, sizeInfo);
         std::vector<unsigned char> buffer;
         syncInfo.serialize(buffer);
@@ -254,8 +680,8 @@ public:
      */
     std::vector<unsigned char> createSizeResponsePayload()
     {
-        uint32_t dataUsedSize = this->diskStorage->dataUsedSize();
-        uint32_t dataTotalSize = this->diskStorage->dataTotalSize();
+        uint32_t dataUsedSize = this->storageEngine->dataUsedSize();
+        uint32_t dataTotalSize = this->storageEngine->dataTotalSize();
 
         Payloads::SizeInfo sizeInfo(dataUsedSize, dataTotalSize);
         std::vector<unsigned char> buffer; 
@@ -266,6 +692,9 @@ public:
 
     /**
      * Responds to the master server's health check.
+     * 
+     * The response payload is a 'size response' (see createSizeResponsePayload()),
+     * so that space reclaimed in the background reaches the master's stats.
      */
     void healthCheckHandler(http_request request)
     {
@@ -277,7 +706,9 @@ public:
          * NOTE: In future, perhaps also check health of disk
          *       storage.
          */
-        request.reply(status_codes::OK);
+        http_response response(status_codes::OK);
+        response.set_body(createSizeResponsePayload());
+        request.reply(response);
         return;
     }
 
@@ -290,27 +721,241 @@ public:
         return envNodeID ? std::stoi(envNodeID) : 0;
     }
 
+    /**
+     * Retreives the port to listen on via the environment variable `PORT` (8080 by default).
+     */
+    int getPortFromEnv()
+    {
+        const char* envPort = std::getenv("PORT");
+        return envPort ? std::stoi(envPort) : 8080;
+    }
+
+    /**
+     * Returns the max. length of a stored key, which allows for a
+     * client key staged by the master (see ApiUtils::stagedKey()).
+     */
+    uint32_t maxStoredKeyLength()
+    {
+        return this->config.keyLengthMax + ApiUtils::STAGED_KEY_SUFFIX.size();
+    }
+
+    ////////////////////////////////////////////
+    // RPC handlers
+    ////////////////////////////////////////////
+
+    /**
+     * Serves RPC `request` (see rpc.hpp), i.e. runs the same operation as its
+     * HTTP endpoint, replying with the same payload.
+     * 
+     * NOTE:
+     * 
+     * Blocks read for RPC_GET_BLOCKS are sent straight from the read buffer.
+     */
+    void rpcHandler(RpcRequest &request)
+    {
+        if (request.op != RPC_HEALTH)
+            std::cout << "RPC " << rpcOpName(request.op) << " req received: " << request.key << std::endl;
+
+        if (request.key.size() > this->maxStoredKeyLength())
+        {
+            request.reply(RPC_BAD_REQUEST);
+            return;
+        }
+
+        try
+        {
+            switch (request.op)
+            {
+                case RPC_GET_BLOCKS:
+                {
+                    std::vector<unsigned char> readBuffer;
+                    std::vector<Block> blocks = this->readBlocks(request.key, request.payload, readBuffer);
+
+                    RpcMessage response(RPC_OK);
+                    response.appendBlocks(blocks);
+                    request.reply(response);
+                    return;
+                }
+                case RPC_STORE_BLOCKS:
+                    this->storeBlocks(request.key, request.payload);
+                    break;
+                case RPC_APPEND_BLOCKS:
+                    this->appendBlocks(request.key, request.payload);
+                    break;
+                case RPC_UPDATE_BLOCKS:
+                    this->updateBlocks(request.key, request.payload);
+                    break;
+                case RPC_DELETE_KEY:
+                    this->deleteKey(request.key);
+                    break;
+                case RPC_DELETE_KEYS:
+                    this->deleteKeys(std::string(request.payload.begin(), request.payload.end()));
+                    break;
+                case RPC_RENAME_KEY:
+                    this->renameKey(request.key, request.payload);
+                    break;
+                case RPC_HEALTH:
+                    break;
+                case RPC_SYNC:
+                {
+                    RpcMessage response(RPC_OK);
+                    response.append(createSyncResponsePayload());
+                    request.reply(response);
+                    return;
+                }
+                default:
+                    request.reply(RPC_NOT_IMPLEMENTED);
+                    return;
+            }
+        }
+        catch (std::runtime_error &e)
+        {
+            std::cout << e.what() << std::endl;
+            request.reply(RPC_ERROR);
+            return;
+        }
+
+        // all other operations reply with a 'size response'
+        RpcMessage response(RPC_OK);
+        response.append(createSizeResponsePayload());
+        request.reply(response);
+    }
+
+    /**
+     * Hands RPC `request` to rpcHandler(), as dispatch() does HTTP requests.
+     */
+    void rpcDispatch(RpcRequest request)
+    {
+        if (!this->lifecycle.tryBeginRequest())
+        {
+            request.reply(RPC_UNAVAILABLE);
+            return;
+        }
+
+        auto handle = [this, request]() mutable
+        {
+            try
+            {
+                this->rpcHandler(request);
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << "RPC failed: " << e.what() << std::endl;
+                request.reply(RPC_ERROR);
+            }
+            this->lifecycle.endRequest();
+        };
+
+        if (this->workerPool)
+            this->workerPool->submit(handle);
+        else
+            handle();
+    }
+
+    /**
+     * Starts the storage server, then serves requests until SIGINT/SIGTERM.
+     * 
+     * NOTE:
+     * 
+     * The master's RPCs are served on port PORT + `rpcPortOffset` (unless it's 0),
+     * alongside the HTTP API, and on a Unix socket in `rpcLocalDir` (if set)
+     * for a master on the same host.
+     * 
+     * On shutdown, new requests are turned away while those in flight (and
+     * queued for a worker) are given up to `shutdownDrainMs` to finish, before
+     * the listeners are closed.
+     */
     void startServer() 
     {
-        uri_builder uri("http://0.0.0.0:8080");
+        uri_builder uri("http://0.0.0.0:" + std::to_string(getPortFromEnv()));
         auto addr = uri.to_uri().to_string();
         http_listener listener(addr);
 
+        if (config.workerThreads > 0)
+            this->workerPool = std::make_unique<WorkerPool>(config.workerThreads);
+
         listener.support([this](http_request request) {
-            this->router(request);
+            this->dispatch(request);
         });
 
         try 
         {
-            listener
-                .open()
-                .then([&addr](){ std::cout << "Storage server is listening at: " << addr << std::endl; });
-            while (1);
+            listener.open().wait();
+            std::cout << "Storage server is listening at: " << addr << std::endl;
+
+            if (config.rpcPortOffset > 0)
+            {
+                std::string localSocketPath;
+                if (!config.rpcLocalDir.empty())
+                {
+                    // if this fails, so does binding the socket, which RpcServer logs
+                    std::error_code error;
+                    fs::create_directories(config.rpcLocalDir, error);
+                    localSocketPath = config.rpcLocalDir + "/node_" + std::to_string(getNodeIDFromEnv()) + ".sock";
+                }
+
+                uint16_t rpcPort = getPortFromEnv() + config.rpcPortOffset;
+                this->rpcServer = std::make_unique<RpcServer>("0.0.0.0", rpcPort, config.rpcSocketBufferBytes,
+                    [this](RpcRequest request) { this->rpcDispatch(request); }, localSocketPath);
+                this->rpcServer->start();
+                std::cout << "Storage server RPC is listening on port: " << rpcPort << std::endl;
+            }
+
+            int signal = ServerLifecycle::waitForShutdownSignal();
+            std::cout << "Received signal " << signal << ", shutting down" << std::endl;
+
+            if (!this->lifecycle.drain(std::chrono::milliseconds(config.shutdownDrainMs)))
+                std::cout << this->lifecycle.requestsInFlight() << " requests still in flight, closing anyway" << std::endl;
+
+            listener.close().wait();
+            if (this->rpcServer)
+                this->rpcServer->stop();
         } 
         catch (const std::exception& e) 
         {
             std::cout << "An error occurred: " << e.what() << std::endl;
         }
+
+        if (this->workerPool)
+            this->workerPool->stop();
+    }
+
+    /**
+     * Hands `request` to router(), on a worker thread if we have a `workerPool`.
+     * 
+     * NOTE:
+     * 
+     * Requests arriving once shutdown has started get a 503, and the rest
+     * count as in flight until router() returns.
+     */
+    void dispatch(http_request request)
+    {
+        if (!this->lifecycle.tryBeginRequest())
+        {
+            request.reply(status_codes::ServiceUnavailable);
+            return;
+        }
+
+        auto handle = [this, request]()
+        {
+            try
+            {
+                this->router(request);
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << "Request failed: " << e.what() << std::endl;
+
+                // the handler may have replied before failing
+                try { request.reply(status_codes::InternalError); } catch (const std::exception &e) {}
+            }
+            this->lifecycle.endRequest();
+        };
+
+        if (this->workerPool)
+            this->workerPool->submit(handle);
+        else
+            handle();
     }
 
     void router(http_request request) 
@@ -319,8 +964,19 @@ public:
         std::string endpoint = p.first;
         std::string key = p.second;
 
-        // network truncates the key's null bytes. Store as fixed size on disk.
-        key = StringUtils::fixedSize(key, this->config.keyLengthMax);
+        if (endpoint == U("/range"))
+        {
+            if (request.method() == methods::GET)
+                this->rangeHandler(request, key);
+            return;
+        }
+
+        // keys are variable length, up to a configured max.
+        if (key.size() > this->maxStoredKeyLength())
+        {
+            request.reply(status_codes::BadRequest);
+            return;
+        }
 
         if (endpoint == U("/store"))
         {
@@ -332,6 +988,26 @@ public:
             if (request.method() == methods::DEL)
                 this->deleteHandler(request, key);
         }
+        else if (endpoint == U("/append"))
+        {
+            if (request.method() == methods::PUT)
+                this->appendHandler(request, key);
+        }
+        else if (endpoint == U("/update"))
+        {
+            if (request.method() == methods::PUT)
+                this->updateHandler(request, key);
+        }
+        else if (endpoint == U("/rename"))
+        {
+            if (request.method() == methods::PUT)
+                this->renameHandler(request, key);
+        }
+        else if (endpoint == U("/keys"))
+        {
+            if (request.method() == methods::DEL)
+                this->deleteKeysHandler(request);
+        }
         else if (endpoint == U("/health"))
         {
             if (request.method() == methods::GET)
@@ -342,6 +1018,11 @@ public:
             if (request.method() == methods::GET)
                 this->syncHandler(request);
         }
+        else if (endpoint == U("/stats"))
+        {
+            if (request.method() == methods::GET)
+                this->statsHandler(request);
+        }
         else 
         {
             std::cout << "Endpoint not implemented: " << endpoint << std::endl;
@@ -353,11 +1034,24 @@ public:
 
 void run()
 {
-    std::string configFilePath = "/app/config.json";
-    // std::string configFilePath = "../src/config.json";
+    // may be overridden via the environment variable `CONFIG_PATH` (e.g. by bench/cluster.cpp)
+    const char* envConfigPath = std::getenv("CONFIG_PATH");
+    std::string configFilePath = envConfigPath ? envConfigPath : "/app/config.json";
+
+    // before any thread is started, so shutdown signals reach startServer() alone
+    ServerLifecycle::blockShutdownSignals();
+
+    // the thread pool must be sized before cpprest first uses it
+    uint32_t ioThreads = StorageConfig(configFilePath).ioThreads;
+    if (ioThreads > 0)
+        crossplat::threadpool::initialize_with_threads(ioThreads);
+
     StorageServer storageServer = StorageServer(configFilePath);
     storageServer.startServer();
+
+    std::cout << "Storage server stopped" << std::endl;
     // DiskStorageTests::runAll();
+    // StorageEngineTests::runAll();
 }
 
 int main()
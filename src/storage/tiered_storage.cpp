@@ -0,0 +1,700 @@
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <optional>
+#include <algorithm>
+
+#include "tiered_storage.hpp"
+
+#include "block.hpp"
+#include "memory_storage.hpp"
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// TieringStats methods
+////////////////////////////////////////////
+
+std::string TieringStats::toString() const
+{
+    std::ostringstream oss;
+
+    oss << "hotReads: " << hotReads << "\n"
+        << "coldReads: " << coldReads << "\n"
+        << "promotions: " << promotions << "\n"
+        << "demotions: " << demotions << "\n"
+        << "bytesPromoted: " << bytesPromoted << "\n"
+        << "hotKeys: " << hotKeys << "\n";
+    return oss.str();
+}
+
+////////////////////////////////////////////
+// TieredStorage - public methods
+////////////////////////////////////////////
+
+/* Param constructor */
+TieredStorage::TieredStorage(
+    std::unique_ptr<StorageEngine> hotTier,
+    std::unique_ptr<StorageEngine> coldTier,
+    TieringConfig config,
+    IoScheduler *ioScheduler,
+    bool runMigrator
+)
+    : hotTier(std::move(hotTier)),
+      coldTier(std::move(coldTier)),
+      config(config),
+      ioScheduler(ioScheduler),
+      nextVersion(0),
+      lastMigration(std::chrono::steady_clock::now()),
+      stopMigrator(false)
+{
+    if (runMigrator)
+        this->migratorThread = std::thread(&TieredStorage::migratorLoop, this);
+}
+
+TieredStorage::~TieredStorage()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopMigrator = true;
+    }
+    this->migratorCv.notify_one();
+
+    if (this->migratorThread.joinable())
+        this->migratorThread.join();
+}
+
+/**
+ * Retreive blocks `requestedBlockNums` of key `key`, from
+ * the hot tier if it holds the key.
+ */
+std::vector<Block> TieredStorage::readBlocks(
+    std::string key,
+    std::unordered_set<uint32_t> requestedBlockNums,
+    uint32_t dataBlockSize,
+    std::vector<unsigned char> &readBuffer)
+{
+    if (recordRead(key))
+    {
+        try
+        {
+            return this->hotTier->readBlocks(key, requestedBlockNums, dataBlockSize, readBuffer);
+        }
+        catch (std::runtime_error &e)
+        {
+            // hot copy was dropped after we checked, so fall back to the cold tier
+        }
+    }
+
+    return this->coldTier->readBlocks(key, requestedBlockNums, dataBlockSize, readBuffer);
+}
+
+/**
+ * Retreive blocks `requestedBlockNums` of key `key` as part of a bulk scan.
+ */
+std::vector<Block> TieredStorage::scanBlocks(
+    std::string key,
+    std::unordered_set<uint32_t> requestedBlockNums,
+    uint32_t dataBlockSize,
+    std::vector<unsigned char> &readBuffer)
+{
+    return this->coldTier->scanBlocks(key, requestedBlockNums, dataBlockSize, readBuffer);
+}
+
+void TieredStorage::writeBlocks(std::string key, std::vector<Block> dataBlocks)
+{
+    writeCold(key, false, [&]() { this->coldTier->writeBlocks(key, dataBlocks); });
+}
+
+void TieredStorage::appendBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize)
+{
+    writeCold(key, false, [&]() { this->coldTier->appendBlocks(key, dataBlocks, dataBlockSize); });
+}
+
+void TieredStorage::updateBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize)
+{
+    writeCold(key, false, [&]() { this->coldTier->updateBlocks(key, dataBlocks, dataBlockSize); });
+}
+
+void TieredStorage::deleteBlocks(std::string key)
+{
+    writeCold(key, true, [&]() { this->coldTier->deleteBlocks(key); });
+}
+
+void TieredStorage::deleteKeys(std::vector<std::string> keys)
+{
+    try
+    {
+        this->coldTier->deleteKeys(keys);
+    }
+    catch (std::runtime_error &e)
+    {
+        for (std::string &key : keys)
+            invalidate(key, false);
+        throw;
+    }
+
+    for (std::string &key : keys)
+        invalidate(key, true);
+}
+
+/**
+ * Moves `fromKey`'s blocks to `toKey` on the cold tier, dropping
+ * any hot copy of either.
+ */
+void TieredStorage::renameKey(std::string fromKey, std::string toKey)
+{
+    try
+    {
+        this->coldTier->renameKey(fromKey, toKey);
+    }
+    catch (std::runtime_error &e)
+    {
+        invalidate(fromKey, false);
+        invalidate(toKey, false);
+        throw;
+    }
+
+    invalidate(fromKey, true);
+    invalidate(toKey, false);
+}
+
+void TieredStorage::reclaimSpace()
+{
+    this->coldTier->reclaimSpace();
+    this->hotTier->reclaimSpace();
+}
+
+std::vector<std::string> TieredStorage::getKeys()
+{
+    return this->coldTier->getKeys();
+}
+
+std::vector<uint32_t> TieredStorage::getBlockNums(std::string key, uint32_t dataBlockSize)
+{
+    return this->coldTier->getBlockNums(key, dataBlockSize);
+}
+
+/**
+ * Returns num. bytes used of the cold tier, which holds every key.
+ */
+uint32_t TieredStorage::dataUsedSize()
+{
+    return this->coldTier->dataUsedSize();
+}
+
+uint32_t TieredStorage::dataTotalSize()
+{
+    return this->coldTier->dataTotalSize();
+}
+
+AccessStats TieredStorage::accessStats()
+{
+    return this->coldTier->accessStats();
+}
+
+/**
+ * Returns the tier holding key `key`'s extent.
+ */
+StorageTier TieredStorage::tierOf(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    auto it = this->keyStates.find(key);
+    return (it != this->keyStates.end() && it->second.hot) ? TIER_HOT : TIER_COLD;
+}
+
+/**
+ * Returns a snapshot of the migration counters.
+ */
+TieringStats TieredStorage::tieringStats()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->stats;
+}
+
+/**
+ * Runs a single migration pass:
+ *
+ *      1. decays every key's heat by the time since the last pass
+ *      2. demotes hot keys whose heat fell below `demoteHeat`
+ *      3. promotes keys whose heat reached `promoteHeat`, hottest first,
+ *         until this pass's share of `migrationBytesPerSec` is used up
+ */
+void TieredStorage::migrate()
+{
+    std::vector<std::pair<double, std::string>> candidates; // {heat, key}
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+
+        auto now = std::chrono::steady_clock::now();
+        double elapsedMs = std::chrono::duration<double, std::milli>(now - this->lastMigration).count();
+        this->lastMigration = now;
+
+        double decay = 1.0;
+        if (this->config.heatHalfLife.count() > 0)
+            decay = std::pow(0.5, elapsedMs / this->config.heatHalfLife.count());
+
+        std::vector<std::string> cooled;
+        for (auto it = this->keyStates.begin(); it != this->keyStates.end();)
+        {
+            KeyState &state = it->second;
+            state.heat *= decay;
+
+            if (state.hot && state.heat < this->config.demoteHeat)
+                cooled.push_back(it->first);
+            else if (!state.hot && state.heat >= this->config.promoteHeat)
+                candidates.push_back({state.heat, it->first});
+
+            // stop tracking keys that have gone cold
+            if (!state.hot && state.heat < 0.01)
+                it = this->keyStates.erase(it);
+            else
+                ++it;
+        }
+
+        for (std::string &key : cooled)
+            demote(key, lock);
+    }
+
+    if (candidates.empty())
+        return;
+
+    this->hotTier->reclaimSpace();
+
+    std::sort(candidates.begin(), candidates.end(), std::greater<>());
+
+    uint64_t budget = this->config.migrationBytesPerSec * this->config.migrationPeriod.count() / 1000;
+    for (auto &[heat, key] : candidates)
+    {
+        uint64_t version;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            auto it = this->keyStates.find(key);
+            if (it == this->keyStates.end() || it->second.hot)
+                continue;
+            version = it->second.version;
+        }
+
+        budget -= promote(key, version, heat, budget);
+    }
+}
+
+////////////////////////////////////////////
+// TieredStorage - private methods
+////////////////////////////////////////////
+
+/**
+ * Migrator thread function. Runs a migration pass every `migrationPeriod`.
+ */
+void TieredStorage::migratorLoop()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true)
+    {
+        this->migratorCv.wait_for(lock, this->config.migrationPeriod, [this]() {
+            return this->stopMigrator;
+        });
+
+        if (this->stopMigrator)
+            return;
+
+        lock.unlock();
+        try
+        {
+            migrate();
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "migratorLoop() - failed to migrate keys: " << e.what() << std::endl;
+        }
+        lock.lock();
+    }
+}
+
+/**
+ * Records a read of key `key`, returning true if the hot tier holds it.
+ */
+bool TieredStorage::recordRead(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    auto [it, inserted] = this->keyStates.try_emplace(key, KeyState{0.0, false, this->nextVersion});
+    if (inserted)
+        this->nextVersion++;
+
+    KeyState &state = it->second;
+    state.heat += 1.0;
+
+    if (state.hot)
+        this->stats.hotReads++;
+    else
+        this->stats.coldReads++;
+
+    return state.hot;
+}
+
+/**
+ * Runs `write` against the cold tier, then drops any hot copy of key `key`.
+ *
+ * NOTE:
+ *
+ * The hot copy is dropped after the write, so a promotion that read the key
+ * before the write completed always sees the key's version change.
+ */
+void TieredStorage::writeCold(const std::string &key, bool forget, std::function<void()> write)
+{
+    try
+    {
+        write();
+    }
+    catch (std::runtime_error &e)
+    {
+        invalidate(key, false);
+        throw;
+    }
+
+    invalidate(key, forget);
+}
+
+/**
+ * Drops any hot copy of key `key`, and bumps its version.
+ */
+void TieredStorage::invalidate(const std::string &key, bool forget)
+{
+    bool wasHot = false;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        auto it = this->keyStates.find(key);
+        if (it == this->keyStates.end())
+            return;
+
+        wasHot = it->second.hot;
+        if (wasHot)
+            this->stats.hotKeys--;
+
+        it->second.hot = false;
+        it->second.version = this->nextVersion++;
+
+        if (forget)
+            this->keyStates.erase(it);
+    }
+
+    if (!wasHot)
+        return;
+
+    try
+    {
+        this->hotTier->deleteBlocks(key);
+    }
+    catch (std::runtime_error &e)
+    {
+    }
+}
+
+/**
+ * Demotes key `key`, if the hot tier holds it. Expects `lock` to hold `mutex`.
+ *
+ * NOTE:
+ *
+ * The lock is dropped while the hot copy is deleted. Reads that found
+ * the key hot before then fall back to the cold tier if they miss.
+ */
+void TieredStorage::demote(const std::string &key, std::unique_lock<std::mutex> &lock)
+{
+    auto it = this->keyStates.find(key);
+    if (it == this->keyStates.end() || !it->second.hot)
+        return;
+
+    it->second.hot = false;
+    this->stats.demotions++;
+    this->stats.hotKeys--;
+
+    lock.unlock();
+    try
+    {
+        this->hotTier->deleteBlocks(key);
+    }
+    catch (std::runtime_error &e)
+    {
+    }
+    lock.lock();
+}
+
+/**
+ * Copies key `key` (at version `version`) into the hot tier, making room by
+ * demoting hot keys colder than `heat`.
+ *
+ * Returns num. bytes of `budget` used, i.e. 0 if the key wasn't promoted.
+ */
+uint64_t TieredStorage::promote(const std::string &key, uint64_t version, double heat, uint64_t budget)
+{
+    uint32_t dataBlockSize = this->config.dataBlockSize;
+
+    std::vector<uint32_t> blockNums;
+    try
+    {
+        blockNums = this->coldTier->getBlockNums(key, dataBlockSize);
+    }
+    catch (std::runtime_error &e)
+    {
+        // key doesn't exist (or was deleted since it was read)
+        return 0;
+    }
+
+    uint64_t cost = static_cast<uint64_t>(blockNums.size()) * (sizeof(uint32_t) + dataBlockSize);
+    if (cost == 0 || cost > budget || cost > this->hotTier->dataTotalSize())
+        return 0;
+
+    // make room, demoting the coldest hot keys first
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+
+        while (this->hotTier->dataUsedSize() + cost > this->hotTier->dataTotalSize())
+        {
+            auto coldest = this->keyStates.end();
+            for (auto it = this->keyStates.begin(); it != this->keyStates.end(); ++it)
+            {
+                if (it->second.hot && (coldest == this->keyStates.end() || it->second.heat < coldest->second.heat))
+                    coldest = it;
+            }
+
+            if (coldest == this->keyStates.end() || coldest->second.heat >= heat)
+                return 0;
+
+            std::string coldestKey = coldest->first;
+            demote(coldestKey, lock);
+            this->hotTier->reclaimSpace();
+        }
+    }
+
+    std::optional<IoScheduler::Ticket> ticket;
+    if (this->ioScheduler != nullptr)
+        ticket.emplace(this->ioScheduler->acquire(IO_CLASS_BACKGROUND, cost));
+
+    std::vector<unsigned char> readBuffer;
+    try
+    {
+        std::vector<Block> blocks = this->coldTier->scanBlocks(
+            key,
+            std::unordered_set<uint32_t>(blockNums.begin(), blockNums.end()),
+            dataBlockSize,
+            readBuffer
+        );
+        this->hotTier->writeBlocks(key, blocks);
+    }
+    catch (std::runtime_error &e)
+    {
+        // key changed under us, or the hot tier is too fragmented
+        return 0;
+    }
+
+    // only mark the copy hot if the key wasn't written (or deleted) meanwhile
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        auto it = this->keyStates.find(key);
+        if (it != this->keyStates.end() && it->second.version == version)
+        {
+            it->second.hot = true;
+            this->stats.promotions++;
+            this->stats.hotKeys++;
+            this->stats.bytesPromoted += readBuffer.size();
+            return cost;
+        }
+    }
+
+    try
+    {
+        this->hotTier->deleteBlocks(key);
+    }
+    catch (std::runtime_error &e)
+    {
+    }
+    return cost;
+}
+
+////////////////////////////////////////////
+// TieredStorage tests
+////////////////////////////////////////////
+namespace TieredStorageTests
+{
+    const uint32_t dataBlockSize = 40;
+
+    /* packed size of a 2 block key */
+    const uint32_t keySize = 2 * (sizeof(uint32_t) + dataBlockSize);
+
+    /**
+     * Creates a tiered engine over two memory tiers, the hot one of `hotSize` bytes.
+     */
+    std::unique_ptr<TieredStorage> createEngine(uint32_t hotSize, TieringConfig config = TieringConfig())
+    {
+        config.dataBlockSize = dataBlockSize;
+        config.promoteHeat = 2.5;
+        config.demoteHeat = 0.0;
+
+        return std::make_unique<TieredStorage>(
+            std::make_unique<MemoryStorage>(keySize, hotSize),
+            std::make_unique<MemoryStorage>(keySize, 1u << 16),
+            config,
+            nullptr,
+            false
+        );
+    }
+
+    /**
+     * Writes 2 random blocks for key `key`, returning them.
+     */
+    std::pair<std::vector<Block>, std::unordered_set<uint32_t>> writeKey(
+        TieredStorage &engine,
+        std::string key,
+        std::vector<std::vector<unsigned char>> &writeDataBuffers)
+    {
+        auto p = Block::generateRandom(key, dataBlockSize, 2 * dataBlockSize, writeDataBuffers);
+        engine.writeBlocks(key, p.first);
+        return p;
+    }
+
+    /**
+     * Reads all blocks of key `key` `N` times, checking they match `blocks`.
+     */
+    void readKey(TieredStorage &engine, std::string key, std::vector<Block> &blocks, uint32_t N)
+    {
+        std::unordered_set<uint32_t> blockNums;
+        for (Block &block : blocks)
+            blockNums.insert(block.blockNum);
+
+        for (uint32_t i = 0; i < N; i++)
+        {
+            std::vector<unsigned char> readBuffer;
+            std::vector<Block> readBlocks = engine.readBlocks(key, blockNums, dataBlockSize, readBuffer);
+
+            ASSERT_THAT(readBlocks.size() == blocks.size());
+            for (uint32_t j = 0; j < blocks.size(); j++)
+                ASSERT_THAT(readBlocks[j].equals(blocks[j]));
+        }
+    }
+
+    void testHotKeysPromoted()
+    {
+        auto engine = createEngine(1u << 12);
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        auto p = writeKey(*engine, "archive.zip", writeDataBuffers);
+        auto q = writeKey(*engine, "video.mp4", writeDataBuffers);
+
+        readKey(*engine, "archive.zip", p.first, 3);
+        readKey(*engine, "video.mp4", q.first, 1);
+        engine->migrate();
+
+        ASSERT_THAT(engine->tierOf("archive.zip") == TIER_HOT);
+        ASSERT_THAT(engine->tierOf("video.mp4") == TIER_COLD);
+
+        // hot reads return the same data
+        readKey(*engine, "archive.zip", p.first, 1);
+
+        TieringStats stats = engine->tieringStats();
+        ASSERT_THAT(stats.promotions == 1 && stats.hotKeys == 1);
+        ASSERT_THAT(stats.bytesPromoted == keySize);
+        ASSERT_THAT(stats.hotReads == 1 && stats.coldReads == 4);
+    }
+
+    void testWriteDropsHotCopy()
+    {
+        auto engine = createEngine(1u << 12);
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        auto p = writeKey(*engine, "archive.zip", writeDataBuffers);
+        readKey(*engine, "archive.zip", p.first, 3);
+        engine->migrate();
+        ASSERT_THAT(engine->tierOf("archive.zip") == TIER_HOT);
+
+        // new data is never shadowed by a stale hot copy
+        p = writeKey(*engine, "archive.zip", writeDataBuffers);
+        ASSERT_THAT(engine->tierOf("archive.zip") == TIER_COLD);
+        readKey(*engine, "archive.zip", p.first, 1);
+
+        // ...and is promoted again once read enough
+        engine->migrate();
+        ASSERT_THAT(engine->tierOf("archive.zip") == TIER_HOT);
+        readKey(*engine, "archive.zip", p.first, 1);
+
+        engine->deleteBlocks("archive.zip");
+        ASSERT_THAT(engine->tierOf("archive.zip") == TIER_COLD);
+        ASSERT_THAT(engine->tieringStats().hotKeys == 0);
+    }
+
+    void testHotterKeysDisplaceColderKeys()
+    {
+        // hot tier only fits a single key
+        auto engine = createEngine(keySize);
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        auto p = writeKey(*engine, "archive.zip", writeDataBuffers);
+        auto q = writeKey(*engine, "video.mp4", writeDataBuffers);
+
+        readKey(*engine, "archive.zip", p.first, 4);
+        engine->migrate();
+        ASSERT_THAT(engine->tierOf("archive.zip") == TIER_HOT);
+
+        readKey(*engine, "video.mp4", q.first, 8);
+        engine->migrate();
+        ASSERT_THAT(engine->tierOf("video.mp4") == TIER_HOT);
+        ASSERT_THAT(engine->tierOf("archive.zip") == TIER_COLD);
+        ASSERT_THAT(engine->tieringStats().demotions == 1);
+
+        // a colder key can't displace a hotter one
+        readKey(*engine, "archive.zip", p.first, 1);
+        engine->migrate();
+        ASSERT_THAT(engine->tierOf("video.mp4") == TIER_HOT);
+        readKey(*engine, "archive.zip", p.first, 1);
+    }
+
+    void testMigrationRateLimited()
+    {
+        // budget of just over 1 key per pass
+        TieringConfig config;
+        config.migrationBytesPerSec = keySize + 10;
+        config.migrationPeriod = std::chrono::milliseconds(1000);
+
+        auto engine = createEngine(1u << 12, config);
+        std::vector<std::vector<unsigned char>> writeDataBuffers;
+
+        auto p = writeKey(*engine, "archive.zip", writeDataBuffers);
+        auto q = writeKey(*engine, "video.mp4", writeDataBuffers);
+        readKey(*engine, "archive.zip", p.first, 4);
+        readKey(*engine, "video.mp4", q.first, 3);
+
+        // hottest key goes first
+        engine->migrate();
+        ASSERT_THAT(engine->tierOf("archive.zip") == TIER_HOT);
+        ASSERT_THAT(engine->tierOf("video.mp4") == TIER_COLD);
+
+        engine->migrate();
+        ASSERT_THAT(engine->tierOf("video.mp4") == TIER_HOT);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "TieredStorageTests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = {
+            TEST(testHotKeysPromoted),
+            TEST(testWriteDropsHotCopy),
+            TEST(testHotterKeysDisplaceColderKeys),
+            TEST(testMigrationRateLimited)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+
+        std::cerr << std::endl;
+    }
+}
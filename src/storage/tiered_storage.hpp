@@ -0,0 +1,246 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "block.hpp"
+#include "io_scheduler.hpp"
+#include "storage_engine.hpp"
+
+/**
+ * Tier holding a key's extent.
+ */
+enum StorageTier : uint32_t
+{
+    /* Only the cold tier (main store file) holds the extent */
+    TIER_COLD = 0,
+
+    /* The hot tier also holds a copy of the extent */
+    TIER_HOT
+};
+
+/**
+ * Parameters of a TieredStorage's heat tracking and migration.
+ */
+struct TieringConfig
+{
+    /* Data size (in bytes) of each stored block */
+    uint32_t dataBlockSize = 4096;
+
+    /* Heat (decayed read count) at which a key is promoted */
+    double promoteHeat = 4.0;
+
+    /* Heat below which a hot key is demoted, even if the hot tier has space */
+    double demoteHeat = 1.0;
+
+    /* Time for a key's heat to halve */
+    std::chrono::milliseconds heatHalfLife = std::chrono::milliseconds(60000);
+
+    /* Time between migration passes */
+    std::chrono::milliseconds migrationPeriod = std::chrono::milliseconds(1000);
+
+    /* Max. num. bytes promoted per second */
+    uint64_t migrationBytesPerSec = 16u << 20;
+};
+
+/**
+ * Counters describing a TieredStorage's migrations.
+ */
+struct TieringStats
+{
+    uint64_t hotReads = 0;
+    uint64_t coldReads = 0;
+
+    uint64_t promotions = 0;
+    uint64_t demotions = 0;
+    uint64_t bytesPromoted = 0;
+
+    /* num. keys the hot tier currently holds */
+    uint64_t hotKeys = 0;
+
+    std::string toString() const;
+};
+
+/**
+ * Storage engine made up of a small, fast hot tier (e.g. MemoryStorage, or a
+ * DiskStorage on tmpfs) in front of the main, cold tier.
+ *
+ * NOTE:
+ *
+ * The cold tier always holds every key, so all writes go to it and the hot
+ * tier only ever holds copies of frequently read keys:
+ *
+ *      - reads record the key's heat, and are served by the hot tier if it
+ *        holds the key
+ *      - writes drop the key's hot copy, so it's never stale
+ *      - a background pass (see migrate()) decays all keys' heat, promotes
+ *        the hottest keys, and demotes hot keys that cooled down (or that
+ *        make room for hotter keys)
+ *
+ * Demotion is just dropping the hot copy, so the hot tier can be volatile.
+ * Promotions are capped at `migrationBytesPerSec`, and are scheduled as
+ * IO_CLASS_BACKGROUND requests when given an IoScheduler.
+ */
+class TieredStorage : public StorageEngine
+{
+public:
+
+    /* Param constructor */
+    TieredStorage(
+        std::unique_ptr<StorageEngine> hotTier,
+        std::unique_ptr<StorageEngine> coldTier,
+        TieringConfig config = TieringConfig(),
+        IoScheduler *ioScheduler = nullptr,
+        bool runMigrator = true
+    );
+
+    ~TieredStorage() override;
+
+    std::vector<Block> readBlocks(
+        std::string key,
+        std::unordered_set<uint32_t> blockNums,
+        uint32_t dataBlockSize,
+        std::vector<unsigned char> &readBuffer) override;
+
+    /**
+     * Bulk scans are always served by the cold tier, and don't heat keys.
+     */
+    std::vector<Block> scanBlocks(
+        std::string key,
+        std::unordered_set<uint32_t> blockNums,
+        uint32_t dataBlockSize,
+        std::vector<unsigned char> &readBuffer) override;
+
+    void writeBlocks(std::string key, std::vector<Block> dataBlocks) override;
+
+    void appendBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize) override;
+
+    void updateBlocks(std::string key, std::vector<Block> dataBlocks, uint32_t dataBlockSize) override;
+
+    void deleteBlocks(std::string key) override;
+
+    void deleteKeys(std::vector<std::string> keys) override;
+
+    void renameKey(std::string fromKey, std::string toKey) override;
+
+    void reclaimSpace() override;
+
+    std::vector<std::string> getKeys() override;
+
+    std::vector<uint32_t> getBlockNums(std::string key, uint32_t dataBlockSize) override;
+
+    uint32_t dataUsedSize() override;
+
+    uint32_t dataTotalSize() override;
+
+    AccessStats accessStats() override;
+
+    /**
+     * Returns the tier holding key `key`'s extent.
+     */
+    StorageTier tierOf(const std::string &key);
+
+    /**
+     * Returns a snapshot of the migration counters.
+     */
+    TieringStats tieringStats();
+
+    /**
+     * Runs a single migration pass.
+     *
+     * NOTE:
+     *
+     * Called periodically by the migrator thread. Only call
+     * directly to migrate synchronously (e.g. tests).
+     */
+    void migrate();
+
+private:
+
+    /**
+     * Tiering state of a single key.
+     */
+    struct KeyState
+    {
+        /* decayed read count */
+        double heat;
+
+        /* true if the hot tier holds a copy of the key */
+        bool hot;
+
+        /* changed by every write, so promotions can detect racing writes */
+        uint64_t version;
+    };
+
+    std::unique_ptr<StorageEngine> hotTier;
+    std::unique_ptr<StorageEngine> coldTier;
+    TieringConfig config;
+    IoScheduler *ioScheduler;
+
+    /**
+     * { key -> tiering state }, for keys read recently or held by the hot tier.
+     *
+     * NOTE: guarded by `mutex`, as are `nextVersion`, `stats` and `lastMigration`.
+     */
+    std::unordered_map<std::string, KeyState> keyStates;
+    uint64_t nextVersion;
+    TieringStats stats;
+    std::chrono::steady_clock::time_point lastMigration;
+
+    std::mutex mutex;
+
+    /**
+     * Background migration (see migrate()).
+     */
+    std::thread migratorThread;
+    std::condition_variable migratorCv;
+    bool stopMigrator;
+
+    /**
+     * Migrator thread function. Runs a migration pass every `migrationPeriod`.
+     */
+    void migratorLoop();
+
+    /**
+     * Records a read of key `key`, returning true if the hot tier holds it.
+     */
+    bool recordRead(const std::string &key);
+
+    /**
+     * Runs `write` against the cold tier, then drops any hot copy of key `key`
+     * (and, if `forget`, its tiering state).
+     */
+    void writeCold(const std::string &key, bool forget, std::function<void()> write);
+
+    /**
+     * Drops any hot copy of key `key`, and bumps its version.
+     */
+    void invalidate(const std::string &key, bool forget);
+
+    /**
+     * Demotes key `key`, if the hot tier holds it. Expects `lock` to hold `mutex`.
+     */
+    void demote(const std::string &key, std::unique_lock<std::mutex> &lock);
+
+    /**
+     * Copies key `key` (read at version `version`) into the hot tier, making room
+     * by demoting hot keys colder than `heat`. Returns num. bytes promoted.
+     */
+    uint64_t promote(const std::string &key, uint64_t version, double heat, uint64_t budget);
+};
+
+namespace TieredStorageTests
+{
+    void testHotKeysPromoted();
+    void testWriteDropsHotCopy();
+    void testHotterKeysDisplaceColderKeys();
+    void testMigrationRateLimited();
+    void runAll();
+}